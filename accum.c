@@ -0,0 +1,518 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <math.h>
+#include "accum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ACCUM_X86
+#endif
+
+typedef void (*sum_fn)(long long *sum, long long *sum2, const void *raw, size_t n);
+typedef void (*hits_fn)(unsigned int *count, const void *raw, size_t n);
+
+static int impl = -1;
+static sum_fn sums[2]; /* by width - 1 */
+static hits_fn hits[2];
+
+/* scalar kernels, also used for the tails of the vector ones */
+
+static void sum_i8_scalar(long long *sum, long long *sum2, const void *raw, size_t n)
+{
+    const int8_t *x = (const int8_t*)raw;
+    size_t i;
+
+    for(i=0; i<n; i++) {
+        sum[i] += x[i];
+        sum2[i] += x[i] * x[i];
+    }
+}
+
+static void sum_i16_scalar(long long *sum, long long *sum2, const void *raw, size_t n)
+{
+    const int16_t *x = (const int16_t*)raw;
+    size_t i;
+
+    for(i=0; i<n; i++) {
+        sum[i] += x[i];
+        sum2[i] += x[i] * x[i];
+    }
+}
+
+/* the tails start at sample i0 of the bin, which keeps their place in
+ * the ACCUM_NSUB interleave */
+static void hits_i8_tail(unsigned int *count, const int8_t *x, size_t i0, size_t n)
+{
+    size_t i;
+
+    for(i=i0; i<n; i++)
+        count[(i % ACCUM_NSUB) * ACCUM_NCODES + (uint8_t)(x[i] + 128)]++;
+}
+
+static void hits_i16_tail(unsigned int *count, const int16_t *x, size_t i0, size_t n)
+{
+    size_t i;
+
+    for(i=i0; i<n; i++)
+        count[(i % ACCUM_NSUB) * ACCUM_NCODES + ((x[i] >> 8) + 128)]++;
+}
+
+static void hits_i8_scalar(unsigned int *count, const void *raw, size_t n)
+{
+    hits_i8_tail(count, (const int8_t*)raw, 0, n);
+}
+
+static void hits_i16_scalar(unsigned int *count, const void *raw, size_t n)
+{
+    hits_i16_tail(count, (const int16_t*)raw, 0, n);
+}
+
+#ifdef ACCUM_X86
+
+/* The vector kernels widen the samples to 64 bits for the sums, and
+ * compute the counter index of several samples at once for the hits;
+ * the increments themselves stay scalar, as there is no scatter. */
+
+/* acc[0..3] += the 4 int32 of v, sign-extended (sign = v >> 31) or
+ * zero-extended (sign = 0) */
+static inline void add4_sse2(long long *acc, __m128i v, __m128i sign)
+{
+    __m128i *p = (__m128i*)acc;
+
+    _mm_storeu_si128(p, _mm_add_epi64(_mm_loadu_si128(p), _mm_unpacklo_epi32(v, sign)));
+    _mm_storeu_si128(p + 1, _mm_add_epi64(_mm_loadu_si128(p + 1), _mm_unpackhi_epi32(v, sign)));
+}
+
+/* 8 int16 samples into sum and sum2; the squares, at most 2^30, are
+ * put together from the low and high halves of the 16-bit products */
+static inline void add8_sse2(long long *sum, long long *sum2, __m128i x)
+{
+    __m128i zero = _mm_setzero_si128(), lo, hi, x32;
+
+    x32 = _mm_unpacklo_epi16(x, _mm_srai_epi16(x, 15));
+    add4_sse2(sum, x32, _mm_srai_epi32(x32, 31));
+    x32 = _mm_unpackhi_epi16(x, _mm_srai_epi16(x, 15));
+    add4_sse2(sum + 4, x32, _mm_srai_epi32(x32, 31));
+    lo = _mm_mullo_epi16(x, x);
+    hi = _mm_mulhi_epi16(x, x);
+    add4_sse2(sum2, _mm_unpacklo_epi16(lo, hi), zero);
+    add4_sse2(sum2 + 4, _mm_unpackhi_epi16(lo, hi), zero);
+}
+
+static void sum_i8_sse2(long long *sum, long long *sum2, const void *raw, size_t n)
+{
+    const int8_t *x = (const int8_t*)raw;
+    __m128i v;
+    size_t i;
+
+    for(i=0; i+16<=n; i+=16) {
+        v = _mm_loadu_si128((const __m128i*)(x + i));
+        add8_sse2(sum + i, sum2 + i, _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8));
+        add8_sse2(sum + i + 8, sum2 + i + 8, _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8));
+    }
+    sum_i8_scalar(sum + i, sum2 + i, x + i, n - i);
+}
+
+static void sum_i16_sse2(long long *sum, long long *sum2, const void *raw, size_t n)
+{
+    const int16_t *x = (const int16_t*)raw;
+    size_t i;
+
+    for(i=0; i+8<=n; i+=8)
+        add8_sse2(sum + i, sum2 + i, _mm_loadu_si128((const __m128i*)(x + i)));
+    sum_i16_scalar(sum + i, sum2 + i, x + i, n - i);
+}
+
+/* code + 128 plus the offset of the sample's counter copy, for 4
+ * consecutive samples starting at a multiple of ACCUM_NSUB */
+static inline void count4_sse2(unsigned int *count, __m128i code32, __m128i off)
+{
+    uint32_t idx[4];
+
+    _mm_storeu_si128((__m128i*)idx, _mm_add_epi32(code32, off));
+    count[idx[0]]++;
+    count[idx[1]]++;
+    count[idx[2]]++;
+    count[idx[3]]++;
+}
+
+static void hits_i8_sse2(unsigned int *count, const void *raw, size_t n)
+{
+    const int8_t *x = (const int8_t*)raw;
+    const __m128i off = _mm_setr_epi32(128, ACCUM_NCODES + 128, 2 * ACCUM_NCODES + 128,
+                                       3 * ACCUM_NCODES + 128);
+    __m128i v, x16;
+    size_t i;
+
+    for(i=0; i+16<=n; i+=16) {
+        v = _mm_loadu_si128((const __m128i*)(x + i));
+        x16 = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+        count4_sse2(count, _mm_srai_epi32(_mm_unpacklo_epi16(x16, x16), 16), off);
+        count4_sse2(count, _mm_srai_epi32(_mm_unpackhi_epi16(x16, x16), 16), off);
+        x16 = _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+        count4_sse2(count, _mm_srai_epi32(_mm_unpacklo_epi16(x16, x16), 16), off);
+        count4_sse2(count, _mm_srai_epi32(_mm_unpackhi_epi16(x16, x16), 16), off);
+    }
+    hits_i8_tail(count, x, i, n);
+}
+
+static void hits_i16_sse2(unsigned int *count, const void *raw, size_t n)
+{
+    const int16_t *x = (const int16_t*)raw;
+    const __m128i off = _mm_setr_epi32(128, ACCUM_NCODES + 128, 2 * ACCUM_NCODES + 128,
+                                       3 * ACCUM_NCODES + 128);
+    __m128i hi;
+    size_t i;
+
+    for(i=0; i+8<=n; i+=8) {
+        hi = _mm_srai_epi16(_mm_loadu_si128((const __m128i*)(x + i)), 8);
+        count4_sse2(count, _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16), off);
+        count4_sse2(count, _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16), off);
+    }
+    hits_i16_tail(count, x, i, n);
+}
+
+/* acc[0..3] += the 4 int32 of v */
+__attribute__((target("avx2")))
+static inline void add4_avx2(long long *acc, __m128i v)
+{
+    __m256i *p = (__m256i*)acc;
+
+    _mm256_storeu_si256(p, _mm256_add_epi64(_mm256_loadu_si256(p), _mm256_cvtepi32_epi64(v)));
+}
+
+/* 8 samples as int32 into sum and sum2 */
+__attribute__((target("avx2")))
+static inline void add8_avx2(long long *sum, long long *sum2, __m256i x32)
+{
+    __m256i sq = _mm256_mullo_epi32(x32, x32);
+
+    add4_avx2(sum, _mm256_castsi256_si128(x32));
+    add4_avx2(sum + 4, _mm256_extracti128_si256(x32, 1));
+    add4_avx2(sum2, _mm256_castsi256_si128(sq));
+    add4_avx2(sum2 + 4, _mm256_extracti128_si256(sq, 1));
+}
+
+__attribute__((target("avx2")))
+static void sum_i8_avx2(long long *sum, long long *sum2, const void *raw, size_t n)
+{
+    const int8_t *x = (const int8_t*)raw;
+    size_t i;
+
+    for(i=0; i+8<=n; i+=8)
+        add8_avx2(sum + i, sum2 + i,
+                  _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(x + i))));
+    sum_i8_scalar(sum + i, sum2 + i, x + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void sum_i16_avx2(long long *sum, long long *sum2, const void *raw, size_t n)
+{
+    const int16_t *x = (const int16_t*)raw;
+    size_t i;
+
+    for(i=0; i+8<=n; i+=8)
+        add8_avx2(sum + i, sum2 + i,
+                  _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(x + i))));
+    sum_i16_scalar(sum + i, sum2 + i, x + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline void count8_avx2(unsigned int *count, __m256i code32)
+{
+    const __m256i off = _mm256_setr_epi32(128, ACCUM_NCODES + 128, 2 * ACCUM_NCODES + 128,
+                                          3 * ACCUM_NCODES + 128, 128, ACCUM_NCODES + 128,
+                                          2 * ACCUM_NCODES + 128, 3 * ACCUM_NCODES + 128);
+    uint32_t idx[8];
+
+    _mm256_storeu_si256((__m256i*)idx, _mm256_add_epi32(code32, off));
+    count[idx[0]]++;
+    count[idx[1]]++;
+    count[idx[2]]++;
+    count[idx[3]]++;
+    count[idx[4]]++;
+    count[idx[5]]++;
+    count[idx[6]]++;
+    count[idx[7]]++;
+}
+
+__attribute__((target("avx2")))
+static void hits_i8_avx2(unsigned int *count, const void *raw, size_t n)
+{
+    const int8_t *x = (const int8_t*)raw;
+    size_t i;
+
+    for(i=0; i+8<=n; i+=8)
+        count8_avx2(count, _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(x + i))));
+    hits_i8_tail(count, x, i, n);
+}
+
+__attribute__((target("avx2")))
+static void hits_i16_avx2(unsigned int *count, const void *raw, size_t n)
+{
+    const int16_t *x = (const int16_t*)raw;
+    size_t i;
+
+    for(i=0; i+8<=n; i+=8)
+        count8_avx2(count, _mm256_srai_epi32(_mm256_cvtepi16_epi32(
+                                                 _mm_loadu_si128((const __m128i*)(x + i))), 8));
+    hits_i16_tail(count, x, i, n);
+}
+
+#endif /* ACCUM_X86 */
+
+static int use_impl(int newImpl)
+{
+    switch(newImpl) {
+    case ACCUM_SCALAR:
+        sums[0] = sum_i8_scalar;
+        sums[1] = sum_i16_scalar;
+        hits[0] = hits_i8_scalar;
+        hits[1] = hits_i16_scalar;
+        break;
+#ifdef ACCUM_X86
+    case ACCUM_SSE2:
+        sums[0] = sum_i8_sse2;
+        sums[1] = sum_i16_sse2;
+        hits[0] = hits_i8_sse2;
+        hits[1] = hits_i16_sse2;
+        break;
+    case ACCUM_AVX2:
+        if(!__builtin_cpu_supports("avx2")) return -1;
+        sums[0] = sum_i8_avx2;
+        sums[1] = sum_i16_avx2;
+        hits[0] = hits_i8_avx2;
+        hits[1] = hits_i16_avx2;
+        break;
+#endif
+    default:
+        return -1;
+    }
+    impl = newImpl;
+    return 0;
+}
+
+static void pick_impl(void)
+{
+    int i;
+
+    for(i=ACCUM_NIMPL-1; i>=0; i--)
+        if(use_impl(i) == 0) break;
+}
+
+/* the default is picked once, by whichever thread asks first */
+static pthread_once_t implOnce = PTHREAD_ONCE_INIT;
+
+int accum_set_impl(int newImpl)
+{
+    pthread_once(&implOnce, pick_impl);
+    return use_impl(newImpl);
+}
+
+int accum_get_impl(void)
+{
+    pthread_once(&implOnce, pick_impl);
+    return impl;
+}
+
+const char *accum_impl_name(int i)
+{
+    static const char *names[ACCUM_NIMPL] = {"scalar", "sse2", "avx2"};
+
+    if(i < 0 || i >= ACCUM_NIMPL) return NULL;
+    return names[i];
+}
+
+void accum_sum(long long *sum, long long *sum2, const char *raw, size_t width, size_t n)
+{
+    accum_get_impl();
+    sums[width == 2](sum, sum2, raw, n);
+}
+
+void accum_hits(unsigned int *count, const char *raw, size_t width, size_t n)
+{
+    accum_get_impl();
+    hits[width == 2](count, raw, n);
+}
+
+int accum_init(struct accum *a, size_t nCh, size_t nPt, size_t width, int average,
+               size_t nTimeBins)
+{
+    memset(a, 0, sizeof(*a));
+    a->nCh = nCh;
+    a->nPt = nPt;
+    a->width = width == 2 ? 2 : 1;
+    if(average) {
+        a->sum = (long long*)calloc(nCh * nPt, sizeof(long long));
+        a->sum2 = (long long*)calloc(nCh * nPt, sizeof(long long));
+        if(a->sum == NULL || a->sum2 == NULL) goto fail;
+    }
+    if(nTimeBins > 0 && nPt > 0) {
+        a->binWidth = (nPt + nTimeBins - 1) / nTimeBins;
+        a->nTimeBins = (nPt + a->binWidth - 1) / a->binWidth;
+        /* a counter gets at most this many hits per trigger */
+        a->mergeEvery = UINT32_MAX / ((a->binWidth + ACCUM_NSUB - 1) / ACCUM_NSUB);
+        a->hits = (unsigned int*)calloc(nCh * a->nTimeBins * ACCUM_NSUB * ACCUM_NCODES,
+                                        sizeof(unsigned int));
+        a->total = (unsigned long long*)calloc(nCh * a->nTimeBins * ACCUM_NCODES,
+                                               sizeof(unsigned long long));
+        if(a->hits == NULL || a->total == NULL) goto fail;
+    }
+    accum_get_impl();
+    return 0;
+fail:
+    accum_free(a);
+    return -1;
+}
+
+void accum_free(struct accum *a)
+{
+    free(a->sum);
+    free(a->sum2);
+    free(a->hits);
+    free(a->total);
+    a->sum = a->sum2 = NULL;
+    a->hits = NULL;
+    a->total = NULL;
+}
+
+/* folds the 32-bit counters into the totals */
+static void accum_merge(struct accum *a)
+{
+    size_t b, s, c;
+    unsigned int *h;
+    unsigned long long *t;
+
+    for(b=0; b<a->nCh*a->nTimeBins; b++) {
+        h = a->hits + b * ACCUM_NSUB * ACCUM_NCODES;
+        t = a->total + b * ACCUM_NCODES;
+        for(s=0; s<ACCUM_NSUB; s++)
+            for(c=0; c<ACCUM_NCODES; c++) t[c] += h[s * ACCUM_NCODES + c];
+    }
+    memset(a->hits, 0, a->nCh * a->nTimeBins * ACCUM_NSUB * ACCUM_NCODES * sizeof(*a->hits));
+    a->nSinceMerge = 0;
+}
+
+void accum_add(struct accum *a, const char *buf, size_t stride)
+{
+    size_t j, b, n;
+    const char *x;
+
+    for(j=0; j<a->nCh; j++) {
+        x = buf + j * stride * a->width;
+        if(a->sum)
+            sums[a->width - 1](a->sum + j * a->nPt, a->sum2 + j * a->nPt, x, a->nPt);
+        if(a->hits == NULL) continue;
+        for(b=0; b<a->nTimeBins; b++) {
+            n = a->nPt - b * a->binWidth < a->binWidth ? a->nPt - b * a->binWidth : a->binWidth;
+            hits[a->width - 1](a->hits + (j * a->nTimeBins + b) * ACCUM_NSUB * ACCUM_NCODES,
+                               x + b * a->binWidth * a->width, n);
+        }
+    }
+    a->nTriggers++;
+    if(a->hits && ++(a->nSinceMerge) >= a->mergeEvery)
+        accum_merge(a);
+}
+
+/* the dataset, created if it is not there yet */
+static hid_t open_dataset(hid_t fid, const char *name, hid_t tid, int rank, const hsize_t *dims)
+{
+    hid_t did, sid;
+
+    if(H5Lexists(fid, name, H5P_DEFAULT) > 0)
+        return H5Dopen(fid, name, H5P_DEFAULT);
+    sid = H5Screate_simple(rank, dims, NULL);
+    did = H5Dcreate(fid, name, tid, sid, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    H5Sclose(sid);
+    return did;
+}
+
+static void write_attr(hid_t did, const char *name, hid_t tid, const void *v)
+{
+    hid_t sid, aid;
+
+    if(H5Aexists(did, name) > 0) {
+        aid = H5Aopen(did, name, H5P_DEFAULT);
+    } else {
+        sid = H5Screate(H5S_SCALAR);
+        aid = H5Acreate(did, name, tid, sid, H5P_DEFAULT, H5P_DEFAULT);
+        H5Sclose(sid);
+    }
+    H5Awrite(aid, tid, v);
+    H5Aclose(aid);
+}
+
+/* the average and rms of stored channel j, scope channel iCh, in volts */
+static void average_row(const struct accum *a, size_t j, size_t iCh,
+                        const struct waveform_attribute *wavAttr, double *mean, double *rms)
+{
+    const long long *s = a->sum + j * a->nPt, *s2 = a->sum2 + j * a->nPt;
+    double m, n = (double)a->nTriggers;
+    size_t i;
+
+    for(i=0; i<a->nPt; i++) {
+        m = s[i] / n;
+        mean[i] = (m - wavAttr->yoff[iCh]) * wavAttr->ymult[iCh] + wavAttr->yzero[iCh];
+        rms[i] = sqrt(fmax(s2[i] / n - m * m, 0)) * fabs(wavAttr->ymult[iCh]);
+    }
+}
+
+int accum_write(struct accum *a, hid_t fid, const struct waveform_attribute *wavAttr)
+{
+    hsize_t dims[3], off[2], slab[2];
+    hid_t did, rmsDid, sid, mSid;
+    unsigned long long nTriggers = a->nTriggers, binWidth = a->binWidth;
+    int codeShift = a->width == 2 ? 8 : 0;
+    double *mean, *rms;
+    size_t j, iCh;
+    herr_t ret = 0;
+
+    if(a->nTriggers == 0) return 0;
+    if(a->sum) {
+        dims[0] = a->nCh;
+        dims[1] = a->nPt;
+        did = open_dataset(fid, ACCUM_AVERAGE_DATASET, H5T_NATIVE_DOUBLE, 2, dims);
+        rmsDid = open_dataset(fid, ACCUM_RMS_DATASET, H5T_NATIVE_DOUBLE, 2, dims);
+        if(did < 0 || rmsDid < 0) return -1;
+        mean = (double*)malloc(2 * a->nPt * sizeof(double));
+        rms = mean + a->nPt;
+        /* a row at a time, records can be 12.5M samples long */
+        sid = H5Dget_space(did);
+        slab[0] = 1;
+        slab[1] = a->nPt;
+        mSid = H5Screate_simple(2, slab, NULL);
+        for(j=0, iCh=0; iCh<SCOPE_NCH && j<a->nCh; iCh++) {
+            if(!((1u << iCh) & wavAttr->chMask)) continue;
+            average_row(a, j, iCh, wavAttr, mean, rms);
+            off[0] = j;
+            off[1] = 0;
+            H5Sselect_hyperslab(sid, H5S_SELECT_SET, off, NULL, slab, NULL);
+            ret |= H5Dwrite(did, H5T_NATIVE_DOUBLE, mSid, sid, H5P_DEFAULT, mean);
+            ret |= H5Dwrite(rmsDid, H5T_NATIVE_DOUBLE, mSid, sid, H5P_DEFAULT, rms);
+            j++;
+        }
+        H5Sclose(mSid);
+        H5Sclose(sid);
+        free(mean);
+        write_attr(did, "nTriggers", H5T_NATIVE_ULLONG, &nTriggers);
+        write_attr(rmsDid, "nTriggers", H5T_NATIVE_ULLONG, &nTriggers);
+        H5Dclose(rmsDid);
+        H5Dclose(did);
+    }
+    if(a->hits) {
+        accum_merge(a);
+        dims[0] = a->nCh;
+        dims[1] = a->nTimeBins;
+        dims[2] = ACCUM_NCODES;
+        did = open_dataset(fid, ACCUM_PERSISTENCE_DATASET, H5T_NATIVE_ULLONG, 3, dims);
+        if(did < 0) return -1;
+        ret |= H5Dwrite(did, H5T_NATIVE_ULLONG, H5S_ALL, H5S_ALL, H5P_DEFAULT, a->total);
+        write_attr(did, "nTriggers", H5T_NATIVE_ULLONG, &nTriggers);
+        write_attr(did, "binWidth", H5T_NATIVE_ULLONG, &binWidth);
+        write_attr(did, "codeShift", H5T_NATIVE_INT, &codeShift);
+        H5Dclose(did);
+    }
+    return ret < 0 ? -1 : 0;
+}
@@ -0,0 +1,69 @@
+#ifndef __ACCUM_H__
+#define __ACCUM_H__
+
+#include <stddef.h>
+#include <hdf5.h>
+#include "common.h"
+
+/* Online reduction of the events for dpo5054 -A and -P: per channel,
+ * the sum and sum of squares of every sample over the triggers (the
+ * average waveform and its rms), and a persistence map, hits per (time
+ * bin, ADC code) as a scope shows them.  A FastFrame frame counts as a
+ * trigger.  SSE2 and AVX2 kernels with a scalar fallback, chosen as in
+ * deltacodec; all give the same results. */
+
+enum {
+    ACCUM_SCALAR = 0,
+    ACCUM_SSE2,
+    ACCUM_AVX2,
+    ACCUM_NIMPL
+};
+
+#define ACCUM_NCODES 256 /* code bins: the sample, or the high byte of 2-byte ones */
+#define ACCUM_NSUB 4     /* interleaved counters per time bin and code, see accum_hits */
+#define ACCUM_AVERAGE_DATASET "Average"       /* [nCh, nPt] volts */
+#define ACCUM_RMS_DATASET "AverageRms"        /* [nCh, nPt] volts */
+#define ACCUM_PERSISTENCE_DATASET "Persistence" /* [nCh, nTimeBins, ACCUM_NCODES] hits */
+
+struct accum
+{
+    size_t nCh, nPt, width; /* a trigger is nCh rows of nPt samples of width bytes */
+    size_t nTriggers;
+    long long *sum, *sum2; /* [nCh][nPt], NULL without the average */
+    /* persistence, NULL hits without it: nTimeBins bins of binWidth
+     * samples (the last one may be shorter).  hits are 32-bit,
+     * [nCh][nTimeBins][ACCUM_NSUB][ACCUM_NCODES], and are moved to
+     * total, [nCh][nTimeBins][ACCUM_NCODES], every mergeEvery triggers,
+     * before any of them can wrap. */
+    size_t nTimeBins, binWidth, mergeEvery, nSinceMerge;
+    unsigned int *hits;
+    unsigned long long *total;
+};
+
+/* picks the kernels, returns -1 when the cpu can not run them.  The
+ * default is the best one available.  Call it before any thread uses
+ * the kernels. */
+int accum_set_impl(int impl);
+int accum_get_impl(void);
+const char *accum_impl_name(int impl);
+
+/* sum[i] += x[i] and sum2[i] += x[i] * x[i] for n samples */
+void accum_sum(long long *sum, long long *sum2, const char *raw, size_t width, size_t n);
+/* hits of n samples that fall in one time bin: sample i counts in
+ * count[(i % ACCUM_NSUB) * ACCUM_NCODES + code], so that a run of equal
+ * codes, the usual case on a baseline, does not wait on one counter */
+void accum_hits(unsigned int *count, const char *raw, size_t width, size_t n);
+
+/* average != 0 keeps the sums, nTimeBins > 0 the persistence map.
+ * Returns -1 if the memory can not be had. */
+int accum_init(struct accum *a, size_t nCh, size_t nPt, size_t width, int average,
+               size_t nTimeBins);
+void accum_free(struct accum *a);
+/* adds one trigger, whose row j starts stride samples after row j-1 */
+void accum_add(struct accum *a, const char *buf, size_t stride);
+/* writes the average and rms in volts (calibrated with wavAttr) and the
+ * persistence map to fid, overwriting what an earlier call wrote, with
+ * the number of triggers as attribute nTriggers of each dataset */
+int accum_write(struct accum *a, hid_t fid, const struct waveform_attribute *wavAttr);
+
+#endif /* __ACCUM_H__ */
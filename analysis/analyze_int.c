@@ -0,0 +1,171 @@
+/*
+ * analyze_int: baseline-subtracted charge in a fixed window of every
+ * waveform (of every frame in FastFrame runs), histogrammed per
+ * channel.  The baseline is the mean of a window before the pulse.
+ * Pulses are taken as negative, so a pulse gives positive charge,
+ * -sum(v - baseline) * dt / R.  Events run in parallel (evloop.c), the
+ * sums are done on the raw samples (wavstat.c), and the histograms are
+ * written to an HDF5 file as datasets charge_ch<N> (see hist.c).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "hdf5io.h"
+#include "wavstat.h"
+#include "hist.h"
+#include "evloop.h"
+#include "timing.h"
+
+/* what the workers need to know, set once in main */
+static struct waveform_attribute wavAttr;
+static size_t nCh, frameSize, nFrames, width;
+static size_t iBase = 0, nBase = 0, iInt = 0, nInt = 0;
+static double qScale[SCOPE_NCH]; /* pC per raw count, per stored channel */
+static int chOf[SCOPE_NCH];     /* scope channel of each stored one */
+
+/* a hist per stored channel */
+static void analyze_event(void *state, size_t eventId, const char *wavBuf)
+{
+    struct hist *h = (struct hist*)state;
+    const char *x;
+    size_t j, f;
+    double base;
+
+    for(j=0; j<nCh; j++) {
+        for(f=0; f<nFrames; f++) {
+            x = wavBuf + (j * wavAttr.nPt + f * frameSize) * width;
+            base = (double)wavstat_sum(x + iBase * width, width, nBase) / nBase;
+            hist_fill(h + j, (nInt * base - wavstat_sum(x + iInt * width, width, nInt))
+                      * qScale[j]);
+        }
+    }
+}
+
+/* "i:n" */
+static int parse_window(const char *s, size_t *i, size_t *n)
+{
+    return sscanf(s, "%zu:%zu", i, n) == 2 ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    size_t i, j, iCh, iEvent = 0, nEvents = 0, nEventsInFile, nThreads = 0, nSlots, nRun;
+    size_t nBins = 1000;
+    double lo = -5, hi = 95, R = 50, t0, t1;
+    char *progName = argv[0], name[64];
+    int opt, badOpt = 0;
+    struct hdf5io_waveform_file *wavFile;
+    struct hist **states;
+    hid_t fid;
+
+    while((opt = getopt(argc, argv, "b:H:j:R:w:")) != -1) {
+        switch(opt) {
+        case 'b':
+            badOpt |= parse_window(optarg, &iBase, &nBase);
+            break;
+        case 'H':
+            badOpt |= hist_parse(optarg, &nBins, &lo, &hi);
+            break;
+        case 'j':
+            nThreads = atol(optarg);
+            break;
+        case 'R':
+            R = atof(optarg);
+            break;
+        case 'w':
+            badOpt |= parse_window(optarg, &iInt, &nInt);
+            break;
+        default:
+            badOpt = 1;
+        }
+    }
+    argv += optind - 1;
+    argc -= optind - 1;
+
+    if(argc < 3 || badOpt) {
+        fprintf(stderr, "%s [-b iPt:n] [-w iPt:n] [-H nBins:lo:hi] [-R ohms] [-j nThreads]"
+                " inFile.h5 outFile.h5 [iEvent] [nEvents]\n", progName);
+        fprintf(stderr, "-b baseline window, default the first 10%% of the frame.\n");
+        fprintf(stderr, "-w integration window, default the rest of the frame.\n");
+        fprintf(stderr, "-H charge histogram in pC, default %zd:%g:%g; -R termination,"
+                " default %g ohms.\n", nBins, lo, hi, R);
+        fprintf(stderr, "-j threads, default one per cpu.\n");
+        return EXIT_FAILURE;
+    }
+    if(argc > 3) iEvent = atol(argv[3]);
+    if(argc > 4) nEvents = atol(argv[4]);
+
+    wavFile = hdf5io_open_file_for_read(argv[1]);
+    hdf5io_read_waveform_attribute_in_file_header(wavFile, &wavAttr);
+    nEventsInFile = hdf5io_get_number_of_events(wavFile);
+    if(iEvent >= nEventsInFile) nEvents = 0;
+    else if(nEvents == 0 || iEvent + nEvents > nEventsInFile) nEvents = nEventsInFile - iEvent;
+    nCh = wavFile->nCh;
+    width = wavAttr.sampleWidth == 2 ? 2 : 1;
+    nFrames = wavAttr.nFrames > 0 ? wavAttr.nFrames : 1;
+    frameSize = wavAttr.nPt / nFrames;
+    if(nBase == 0) nBase = frameSize / 10 > 0 ? frameSize / 10 : 1;
+    if(nInt == 0) {
+        iInt = iBase + nBase;
+        nInt = iInt < frameSize ? frameSize - iInt : 0;
+    }
+    if(iBase + nBase > frameSize || nInt == 0 || iInt + nInt > frameSize) {
+        fprintf(stderr, "Windows %zd:%zd and %zd:%zd do not fit frames of %zd samples\n",
+                iBase, nBase, iInt, nInt, frameSize);
+        hdf5io_close_file(wavFile);
+        return EXIT_FAILURE;
+    }
+    for(j=0, iCh=0; iCh<SCOPE_NCH; iCh++) {
+        if(!((1u << iCh) & wavAttr.chMask)) continue;
+        chOf[j] = iCh;
+        qScale[j] = wavAttr.ymult[iCh] * wavAttr.dt / R * 1e12;
+        j++;
+    }
+    fprintf(stderr, "%zd events from %zd, %zd channels, %zd frames of %zd samples;"
+            " baseline %zd:%zd, integral %zd:%zd; %s kernels\n", nEvents, iEvent, nCh,
+            nFrames, frameSize, iBase, nBase, iInt, nInt,
+            wavstat_impl_name(wavstat_get_impl()));
+
+    if(nThreads == 0) nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    nSlots = evloop_nslots(nThreads);
+    states = (struct hist**)calloc(nSlots, sizeof(*states));
+    for(i=0; i<nSlots; i++) {
+        states[i] = (struct hist*)calloc(nCh, sizeof(struct hist));
+        for(j=0; j<nCh; j++) hist_init(states[i] + j, nBins, lo, hi);
+    }
+    t0 = now();
+    nRun = evloop_run(wavFile, iEvent, nEvents, nThreads, analyze_event, (void**)states);
+    t1 = now();
+    hdf5io_close_file(wavFile);
+    fprintf(stderr, "%zd events in %.2f s on %zd threads: %.1f events/s, %.1f MB/s\n",
+            nRun, t1 - t0, nThreads, nRun / (t1 - t0),
+            nRun * nCh * wavAttr.nPt * width / (t1 - t0) / 1e6);
+    if(nRun < nEvents)
+        fprintf(stderr, "Could only read %zd of %zd events\n", nRun, nEvents);
+
+    for(i=1; i<nSlots; i++)
+        for(j=0; j<nCh; j++) hist_add(states[0] + j, states[i] + j);
+    fid = H5Fcreate(argv[2], H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if(fid < 0) {
+        fprintf(stderr, "Can not create %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    for(j=0; j<nCh; j++) {
+        snprintf(name, sizeof(name), "charge_ch%d", chOf[j] + 1);
+        hist_write(fid, name, states[0] + j, "pC");
+        fprintf(stderr, "%s: %llu entries, mean %g pC, rms %g pC\n", name,
+                states[0][j].nEntries, hist_mean(states[0] + j), hist_rms(states[0] + j));
+    }
+    H5Fclose(fid);
+
+    for(i=0; i<nSlots; i++) {
+        for(j=0; j<nCh; j++) hist_free(states[i] + j);
+        free(states[i]);
+    }
+    free(states);
+    return EXIT_SUCCESS;
+}
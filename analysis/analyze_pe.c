@@ -0,0 +1,232 @@
+/*
+ * analyze_pe: finds the pulses in every waveform (every frame in
+ * FastFrame runs) and histograms, per channel, their charge (the
+ * photoelectron spectrum), their amplitude and the number of pulses
+ * per frame.  The baseline is the mean of the first samples of the
+ * frame; a pulse starts at the first sample more than the threshold
+ * below it and ends where the waveform comes back, and its charge is
+ * -sum(v - baseline) * dt / R over the pulse plus some samples before
+ * and after.  Pulses are taken as negative.  Events run in parallel
+ * (evloop.c), the quiet parts of the waveforms are skipped with the
+ * wavstat.c scans, and the histograms are written to an HDF5 file as
+ * datasets charge_ch<N>, amplitude_ch<N> and npulse_ch<N> (hist.c).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "hdf5io.h"
+#include "wavstat.h"
+#include "hist.h"
+#include "evloop.h"
+#include "timing.h"
+
+#define NPULSE_MAX 64 /* bins of the pulses per frame histogram */
+
+enum {
+    H_CHARGE = 0,
+    H_AMPLITUDE,
+    H_NPULSE,
+    H_N
+};
+static const char *histName[H_N] = {"charge", "amplitude", "npulse"};
+static const char *histUnit[H_N] = {"pC", "mV", "pulses"};
+
+/* what the workers need to know, set once in main */
+static struct waveform_attribute wavAttr;
+static size_t nCh, frameSize, nFrames, width;
+static size_t nBase = 0, nPre = 5, nPost = 10;
+static double thrCounts[SCOPE_NCH]; /* threshold in raw counts, per stored channel */
+static double qScale[SCOPE_NCH];    /* pC per raw count */
+static double aScale[SCOPE_NCH];    /* mV per raw count */
+static int chOf[SCOPE_NCH];         /* scope channel of each stored one */
+
+static int sample_min(const char *x, size_t w, size_t n)
+{
+    int m = INT32_MAX, v;
+    size_t i;
+
+    for(i=0; i<n; i++) {
+        v = w == 2 ? ((const int16_t*)x)[i] : x[i];
+        if(v < m) m = v;
+    }
+    return m;
+}
+
+/* pulses of one frame x of stored channel j into h[H_*] */
+static void find_pulses(struct hist *h, size_t j, const char *x)
+{
+    size_t i = nBase, start, end, a, b, nPulse = 0;
+    double base;
+    int level;
+
+    base = (double)wavstat_sum(x, width, nBase) / nBase;
+    /* a pulse is below level, and over when a sample is back at level */
+    level = (int)ceil(base - thrCounts[j]);
+    while(i < frameSize) {
+        start = i + wavstat_find_below(x + i * width, width, frameSize - i, level);
+        if(start >= frameSize) break;
+        end = start + wavstat_find_above(x + start * width, width, frameSize - start,
+                                         level - 1);
+        a = start > nPre ? start - nPre : 0;
+        b = end + nPost < frameSize ? end + nPost : frameSize;
+        hist_fill(h + H_CHARGE,
+                  ((b - a) * base - wavstat_sum(x + a * width, width, b - a)) * qScale[j]);
+        hist_fill(h + H_AMPLITUDE,
+                  (base - sample_min(x + start * width, width, end - start)) * aScale[j]);
+        nPulse++;
+        i = b;
+    }
+    hist_fill(h + H_NPULSE, nPulse);
+}
+
+/* H_N hists per stored channel */
+static void analyze_event(void *state, size_t eventId, const char *wavBuf)
+{
+    struct hist *h = (struct hist*)state;
+    size_t j, f;
+
+    for(j=0; j<nCh; j++)
+        for(f=0; f<nFrames; f++)
+            find_pulses(h + j * H_N, j, wavBuf + (j * wavAttr.nPt + f * frameSize) * width);
+}
+
+int main(int argc, char **argv)
+{
+    size_t i, j, k, iCh, iEvent = 0, nEvents = 0, nEventsInFile, nThreads = 0, nSlots, nRun;
+    size_t nBins[H_N] = {1000, 500, NPULSE_MAX};
+    double lo[H_N] = {-1, 0, 0}, hi[H_N] = {9, 500, NPULSE_MAX};
+    double R = 50, thr = 10, t0, t1;
+    char *progName = argv[0], name[64];
+    int opt, badOpt = 0;
+    struct hdf5io_waveform_file *wavFile;
+    struct hist **states, *h;
+    hid_t fid;
+
+    while((opt = getopt(argc, argv, "A:b:H:j:p:R:t:")) != -1) {
+        switch(opt) {
+        case 'A':
+            badOpt |= hist_parse(optarg, nBins + H_AMPLITUDE, lo + H_AMPLITUDE,
+                                 hi + H_AMPLITUDE);
+            break;
+        case 'b':
+            nBase = atol(optarg);
+            break;
+        case 'H':
+            badOpt |= hist_parse(optarg, nBins + H_CHARGE, lo + H_CHARGE, hi + H_CHARGE);
+            break;
+        case 'j':
+            nThreads = atol(optarg);
+            break;
+        case 'p': /* nPre:nPost */
+            if(sscanf(optarg, "%zu:%zu", &nPre, &nPost) != 2) badOpt = 1;
+            break;
+        case 'R':
+            R = atof(optarg);
+            break;
+        case 't':
+            thr = atof(optarg);
+            break;
+        default:
+            badOpt = 1;
+        }
+    }
+    argv += optind - 1;
+    argc -= optind - 1;
+
+    if(argc < 3 || badOpt) {
+        fprintf(stderr, "%s [-t mV] [-b nBase] [-p nPre:nPost] [-H nBins:lo:hi]"
+                " [-A nBins:lo:hi] [-R ohms] [-j nThreads]"
+                " inFile.h5 outFile.h5 [iEvent] [nEvents]\n", progName);
+        fprintf(stderr, "-t threshold below the baseline, default %g mV.\n", thr);
+        fprintf(stderr, "-b baseline samples at the start of the frame, default 10%%.\n");
+        fprintf(stderr, "-p samples before and after a pulse added to its charge, default"
+                " %zd:%zd.\n", nPre, nPost);
+        fprintf(stderr, "-H charge histogram in pC, default %zd:%g:%g; -A amplitude"
+                " histogram in mV, default %zd:%g:%g.\n", nBins[H_CHARGE], lo[H_CHARGE],
+                hi[H_CHARGE], nBins[H_AMPLITUDE], lo[H_AMPLITUDE], hi[H_AMPLITUDE]);
+        fprintf(stderr, "-R termination, default %g ohms; -j threads, default one per"
+                " cpu.\n", R);
+        return EXIT_FAILURE;
+    }
+    if(argc > 3) iEvent = atol(argv[3]);
+    if(argc > 4) nEvents = atol(argv[4]);
+
+    wavFile = hdf5io_open_file_for_read(argv[1]);
+    hdf5io_read_waveform_attribute_in_file_header(wavFile, &wavAttr);
+    nEventsInFile = hdf5io_get_number_of_events(wavFile);
+    if(iEvent >= nEventsInFile) nEvents = 0;
+    else if(nEvents == 0 || iEvent + nEvents > nEventsInFile) nEvents = nEventsInFile - iEvent;
+    nCh = wavFile->nCh;
+    width = wavAttr.sampleWidth == 2 ? 2 : 1;
+    nFrames = wavAttr.nFrames > 0 ? wavAttr.nFrames : 1;
+    frameSize = wavAttr.nPt / nFrames;
+    if(nBase == 0) nBase = frameSize / 10 > 0 ? frameSize / 10 : 1;
+    if(nBase > frameSize) {
+        fprintf(stderr, "%zd baseline samples do not fit frames of %zd samples\n",
+                nBase, frameSize);
+        hdf5io_close_file(wavFile);
+        return EXIT_FAILURE;
+    }
+    for(j=0, iCh=0; iCh<SCOPE_NCH; iCh++) {
+        if(!((1u << iCh) & wavAttr.chMask)) continue;
+        chOf[j] = iCh;
+        thrCounts[j] = thr * 1e-3 / wavAttr.ymult[iCh];
+        qScale[j] = wavAttr.ymult[iCh] * wavAttr.dt / R * 1e12;
+        aScale[j] = wavAttr.ymult[iCh] * 1e3;
+        j++;
+    }
+    fprintf(stderr, "%zd events from %zd, %zd channels, %zd frames of %zd samples;"
+            " threshold %g mV, baseline %zd samples; %s kernels\n", nEvents, iEvent, nCh,
+            nFrames, frameSize, thr, nBase, wavstat_impl_name(wavstat_get_impl()));
+
+    if(nThreads == 0) nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    nSlots = evloop_nslots(nThreads);
+    states = (struct hist**)calloc(nSlots, sizeof(*states));
+    for(i=0; i<nSlots; i++) {
+        states[i] = (struct hist*)calloc(nCh * H_N, sizeof(struct hist));
+        for(j=0; j<nCh; j++)
+            for(k=0; k<H_N; k++) hist_init(states[i] + j * H_N + k, nBins[k], lo[k], hi[k]);
+    }
+    t0 = now();
+    nRun = evloop_run(wavFile, iEvent, nEvents, nThreads, analyze_event, (void**)states);
+    t1 = now();
+    hdf5io_close_file(wavFile);
+    fprintf(stderr, "%zd events in %.2f s on %zd threads: %.1f events/s, %.1f MB/s\n",
+            nRun, t1 - t0, nThreads, nRun / (t1 - t0),
+            nRun * nCh * wavAttr.nPt * width / (t1 - t0) / 1e6);
+    if(nRun < nEvents)
+        fprintf(stderr, "Could only read %zd of %zd events\n", nRun, nEvents);
+
+    for(i=1; i<nSlots; i++)
+        for(k=0; k<nCh*H_N; k++) hist_add(states[0] + k, states[i] + k);
+    fid = H5Fcreate(argv[2], H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if(fid < 0) {
+        fprintf(stderr, "Can not create %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    for(j=0; j<nCh; j++) {
+        for(k=0; k<H_N; k++) {
+            h = states[0] + j * H_N + k;
+            snprintf(name, sizeof(name), "%s_ch%d", histName[k], chOf[j] + 1);
+            hist_write(fid, name, h, histUnit[k]);
+        }
+        h = states[0] + j * H_N;
+        fprintf(stderr, "ch%d: %llu pulses, charge mean %g pC, amplitude mean %g mV,"
+                " %g pulses per frame\n", chOf[j] + 1, h[H_CHARGE].nEntries,
+                hist_mean(h + H_CHARGE), hist_mean(h + H_AMPLITUDE), hist_mean(h + H_NPULSE));
+    }
+    H5Fclose(fid);
+
+    for(i=0; i<nSlots; i++) {
+        for(k=0; k<nCh*H_N; k++) hist_free(states[i] + k);
+        free(states[i]);
+    }
+    free(states);
+    return EXIT_SUCCESS;
+}
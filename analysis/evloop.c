@@ -0,0 +1,66 @@
+#include <stdlib.h>
+
+#include "evloop.h"
+#include "tpool.h"
+
+struct evslot {
+    struct tpool_job job;
+    evloop_fn fn;
+    void *state;
+    struct hdf5io_waveform_event *evt;
+};
+
+static void run_slot(void *arg)
+{
+    struct evslot *s = (struct evslot*)arg;
+
+    s->fn(s->state, s->evt->eventId, s->evt->wavBuf);
+}
+
+size_t evloop_nslots(size_t nThreads)
+{
+    return 2 * (nThreads ? nThreads : 1);
+}
+
+size_t evloop_run(struct hdf5io_waveform_file *wavFile, size_t firstEvent, size_t nEvents,
+                  size_t nThreads, evloop_fn fn, void **states)
+{
+    struct hdf5io_waveform_event *evt;
+    struct hdf5io_reader *reader;
+    struct tpool_t *pool;
+    struct evslot *slots, *s;
+    size_t i, k, nSlots;
+
+    if(nThreads == 0) nThreads = 1;
+    nSlots = evloop_nslots(nThreads);
+    pool = tpool_init(nThreads);
+    slots = (struct evslot*)calloc(nSlots, sizeof(*slots));
+    for(i=0; i<nSlots; i++) {
+        slots[i].job.fn = run_slot;
+        slots[i].job.arg = slots + i;
+        slots[i].fn = fn;
+        slots[i].state = states[i];
+    }
+    /* the slots hold up to nSlots events, and reader_next hands out one
+     * more before the oldest is released: the reader needs two more
+     * buffers than slots to keep reading meanwhile */
+    hdf5io_set_decompress_threads(wavFile, nThreads);
+    reader = hdf5io_open_reader(wavFile, firstEvent, nEvents, nSlots + 2);
+    for(k=0; (evt = hdf5io_reader_next(reader)) != NULL; k++) {
+        s = slots + k % nSlots;
+        if(k >= nSlots) { /* the oldest event, release it in order */
+            tpool_wait(pool, &(s->job));
+            hdf5io_reader_release(reader);
+        }
+        s->evt = evt;
+        tpool_submit(pool, &(s->job));
+    }
+    for(i=(k > nSlots ? k - nSlots : 0); i<k; i++) {
+        tpool_wait(pool, &(slots[i % nSlots].job));
+        hdf5io_reader_release(reader);
+    }
+    hdf5io_close_reader(reader);
+    tpool_close(pool);
+    free(slots);
+    return k;
+}
@@ -0,0 +1,28 @@
+#ifndef __EVLOOP_H__
+#define __EVLOOP_H__
+
+#include <stddef.h>
+#include "common.h"
+#include "hdf5io.h"
+
+/* Parallel event loop of the analysis programs.  Events are read and
+ * decompressed ahead by an hdf5io reader and handed to a pool of
+ * workers, one event per job.  The jobs run in nSlots slots, a slot
+ * never runs two events at once, and each slot has its own state, so
+ * per-slot accumulators (histograms, sums) need no locking and are
+ * merged by the caller after evloop_run. */
+
+/* fn(state, eventId, wavBuf): wavBuf as read_event fills it */
+typedef void (*evloop_fn)(void *state, size_t eventId, const char *wavBuf);
+
+/* slots, and states to allocate, for nThreads workers */
+size_t evloop_nslots(size_t nThreads);
+/* runs fn on events firstEvent..firstEvent+nEvents-1 on nThreads
+ * workers, slot k with states[k].  The file also decompresses on
+ * nThreads threads (set_decompress_threads), and its waveform
+ * attribute has to be read before.  Returns the number of events run,
+ * fewer than nEvents if one could not be read. */
+size_t evloop_run(struct hdf5io_waveform_file *wavFile, size_t firstEvent, size_t nEvents,
+                  size_t nThreads, evloop_fn fn, void **states);
+
+#endif /* __EVLOOP_H__ */
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "evselect.h"
+
+#define BLOCK 4096 /* rows of the tables read at a time */
+
+static const struct {
+    const char *name;
+    int var;
+    size_t off;
+} vars[] = {
+    {"baseline", EVSELECT_FEATURE, offsetof(struct hdf5io_features, baseline)},
+    {"rms", EVSELECT_FEATURE, offsetof(struct hdf5io_features, rms)},
+    {"amplitude", EVSELECT_FEATURE, offsetof(struct hdf5io_features, amplitude)},
+    {"peakTime", EVSELECT_FEATURE, offsetof(struct hdf5io_features, peakTime)},
+    {"integral", EVSELECT_FEATURE, offsetof(struct hdf5io_features, integral)},
+    {"time", EVSELECT_TIME, 0},
+    {"event", EVSELECT_EVENT, 0}
+};
+
+/* longest first, so that "<=" is not taken for "<" */
+static const struct {
+    const char *s;
+    int op;
+} ops[] = {
+    {"<=", EVSELECT_LE}, {">=", EVSELECT_GE}, {"==", EVSELECT_EQ}, {"!=", EVSELECT_NE},
+    {"<", EVSELECT_LT}, {">", EVSELECT_GT}
+};
+
+static const char *skip_space(const char *p)
+{
+    while(isspace((unsigned char)*p)) p++;
+    return p;
+}
+
+int evselect_parse(struct evselect *sel, const char *expr)
+{
+    struct evselect_cut *cut;
+    const char *p = expr, *q;
+    char *end;
+    size_t i, len;
+
+    memset(sel, 0, sizeof(*sel));
+    for(;;) {
+        p = skip_space(p);
+        for(q=p; isalpha((unsigned char)*q); q++) ;
+        len = q - p;
+        if(len == 7 && strncmp(p, "trigger", len) == 0) {
+            fprintf(stderr, "selection: trigger times are not recorded, all are 0\n");
+            return -1;
+        }
+        for(i=0; i<sizeof(vars)/sizeof(vars[0]); i++)
+            if(strlen(vars[i].name) == len && strncmp(p, vars[i].name, len) == 0) break;
+        if(len == 0 || i == sizeof(vars)/sizeof(vars[0])) {
+            fprintf(stderr, "selection: no variable at `%s'\n", p);
+            return -1;
+        }
+        if(sel->nCuts == EVSELECT_MAXCUTS) {
+            fprintf(stderr, "selection: more than %d cuts\n", EVSELECT_MAXCUTS);
+            return -1;
+        }
+        cut = &(sel->cuts[sel->nCuts++]);
+        cut->var = vars[i].var;
+        cut->off = vars[i].off;
+        p = q;
+        if(cut->var == EVSELECT_FEATURE) {
+            if(*p < '1' || *p >= '1' + SCOPE_NCH) {
+                fprintf(stderr, "selection: %s needs a channel 1..%d\n", vars[i].name,
+                        SCOPE_NCH);
+                return -1;
+            }
+            cut->ch = *p++ - '1';
+        }
+        p = skip_space(p);
+        for(i=0; i<sizeof(ops)/sizeof(ops[0]); i++)
+            if(strncmp(p, ops[i].s, strlen(ops[i].s)) == 0) break;
+        if(i == sizeof(ops)/sizeof(ops[0])) {
+            fprintf(stderr, "selection: no comparison at `%s'\n", p);
+            return -1;
+        }
+        cut->op = ops[i].op;
+        p += strlen(ops[i].s);
+        cut->value = strtod(p, &end);
+        if(end == p) {
+            fprintf(stderr, "selection: no number at `%s'\n", p);
+            return -1;
+        }
+        p = skip_space(end);
+        if(*p == '\0') return 0;
+        if(*p == ',') p++;
+        else if(p[0] == '&' && p[1] == '&') p += 2;
+        else {
+            fprintf(stderr, "selection: `%s' after a cut\n", p);
+            return -1;
+        }
+    }
+}
+
+static inline int cut_pass(int op, double x, double v)
+{
+    switch(op) {
+    case EVSELECT_LT: return x < v;
+    case EVSELECT_LE: return x <= v;
+    case EVSELECT_GT: return x > v;
+    case EVSELECT_GE: return x >= v;
+    case EVSELECT_EQ: return x == v;
+    default: return x != v;
+    }
+}
+
+/* Event i has row i in the index and the feature table, as dpo5054
+ * writes them. */
+long evselect_run(struct hdf5io_waveform_file *wavFile, const struct evselect *sel,
+                  size_t firstEvent, size_t nEvents, size_t **eventIds)
+{
+    struct waveform_attribute wavAttr;
+    struct hdf5io_event_index *index = NULL, row;
+    struct hdf5io_features *feat = NULL;
+    const struct evselect_cut *cut;
+    int chIdx[SCOPE_NCH], needIndex = 0, needFeatures = 0, any;
+    size_t a, b, i, j, k, n, iRow, nRows, cap = 0;
+    double v[EVSELECT_MAXCUTS], tLo = -HUGE_VAL, tHi = HUGE_VAL, bound, x;
+    unsigned char pass[BLOCK];
+    long nSel = 0;
+
+    *eventIds = NULL;
+    a = firstEvent;
+    b = hdf5io_get_number_of_events(wavFile);
+    if(nEvents < b - a && a < b) b = a + nEvents;
+
+    hdf5io_read_waveform_attribute_in_file_header(wavFile, &wavAttr);
+    for(i=0, j=0; i<SCOPE_NCH; i++)
+        chIdx[i] = (wavAttr.chMask & (1u << i)) ? (int)j++ : -1;
+    for(k=0; k<sel->nCuts; k++) {
+        cut = &(sel->cuts[k]);
+        v[k] = cut->value;
+        switch(cut->var) {
+        case EVSELECT_FEATURE:
+            if(chIdx[cut->ch] < 0) {
+                fprintf(stderr, "selection: channel %d is not in the file\n", cut->ch + 1);
+                return -1;
+            }
+            needFeatures = 1;
+            break;
+        case EVSELECT_TIME:
+            if(cut->op == EVSELECT_GE || cut->op == EVSELECT_GT || cut->op == EVSELECT_EQ)
+                tLo = fmax(tLo, cut->value);
+            if(cut->op == EVSELECT_LE || cut->op == EVSELECT_LT || cut->op == EVSELECT_EQ)
+                tHi = fmin(tHi, cut->value);
+            needIndex = 1;
+            break;
+        case EVSELECT_EVENT: /* the range it allows, the row test does the rest */
+            if(cut->op == EVSELECT_GE || cut->op == EVSELECT_GT || cut->op == EVSELECT_EQ) {
+                bound = cut->op == EVSELECT_GT ? floor(cut->value) + 1 : ceil(cut->value);
+                if(bound > (double)a) a = bound < (double)b ? (size_t)bound : b;
+            }
+            if(cut->op == EVSELECT_LE || cut->op == EVSELECT_LT || cut->op == EVSELECT_EQ) {
+                bound = cut->op == EVSELECT_LT ? ceil(cut->value) : floor(cut->value) + 1;
+                if(bound < (double)b) b = bound > (double)a ? (size_t)bound : a;
+            }
+            break;
+        }
+    }
+
+    if(needIndex) {
+        if(hdf5io_read_event_index(wavFile, 0, 1, &row) < 0) {
+            fprintf(stderr, "selection: the file has no event index\n");
+            return -1;
+        }
+        /* time is from the first event: compare hostTime with
+         * hostTime[0] + value, and only look at the rows that can pass */
+        for(k=0; k<sel->nCuts; k++)
+            if(sel->cuts[k].var == EVSELECT_TIME) v[k] += row.hostTime;
+        if(tLo > -HUGE_VAL || tHi < HUGE_VAL) {
+            nRows = hdf5io_find_time_range(wavFile, row.hostTime + tLo,
+                                           nextafter(row.hostTime + tHi, HUGE_VAL), &iRow);
+            if(iRow > a) a = iRow;
+            if(iRow + nRows < b) b = iRow + nRows;
+        }
+        if(wavFile->nIndexRows + wavFile->nIndexBuf < b)
+            b = wavFile->nIndexRows + wavFile->nIndexBuf;
+        index = (struct hdf5io_event_index*)malloc(BLOCK * sizeof(*index));
+    }
+    if(needFeatures) {
+        if(hdf5io_get_number_of_features(wavFile) == 0) {
+            fprintf(stderr, "selection: the file has no %s table (dpo5054 -F)\n",
+                    HDF5IO_FEATURE_DATASET);
+            free(index);
+            return -1;
+        }
+        if(hdf5io_get_number_of_features(wavFile) < b)
+            b = hdf5io_get_number_of_features(wavFile);
+        feat = (struct hdf5io_features*)malloc(BLOCK * sizeof(*feat));
+    }
+
+    for(; a<b; a+=n) {
+        n = b - a < BLOCK ? b - a : BLOCK;
+        memset(pass, 1, n);
+        if(needIndex && hdf5io_read_event_index(wavFile, a, n, index) < 0) {
+            nSel = -1;
+            break;
+        }
+        /* the cheap cuts first, the features only if a row is left */
+        for(k=0; k<sel->nCuts; k++) {
+            cut = &(sel->cuts[k]);
+            if(cut->var == EVSELECT_TIME)
+                for(i=0; i<n; i++) pass[i] &= cut_pass(cut->op, index[i].hostTime, v[k]);
+            else if(cut->var == EVSELECT_EVENT)
+                for(i=0; i<n; i++) pass[i] &= cut_pass(cut->op, (double)(a + i), v[k]);
+        }
+        for(i=0, any=0; i<n; i++) any |= pass[i];
+        if(!any) continue;
+        if(needFeatures) {
+            if(hdf5io_read_features(wavFile, a, n, feat) < 0) {
+                nSel = -1;
+                break;
+            }
+            for(k=0; k<sel->nCuts; k++) {
+                cut = &(sel->cuts[k]);
+                if(cut->var != EVSELECT_FEATURE) continue;
+                for(i=0; i<n; i++) {
+                    x = ((const float*)((const char*)(feat + i) + cut->off))[chIdx[cut->ch]];
+                    pass[i] &= cut_pass(cut->op, x, v[k]);
+                }
+            }
+        }
+        for(i=0; i<n; i++) {
+            if(!pass[i]) continue;
+            if((size_t)nSel == cap) {
+                cap = cap ? 2 * cap : BLOCK;
+                *eventIds = (size_t*)realloc(*eventIds, cap * sizeof(size_t));
+            }
+            (*eventIds)[nSel++] = a + i;
+        }
+    }
+    if(nSel < 0) {
+        fprintf(stderr, "selection: could not read the tables\n");
+        free(*eventIds);
+        *eventIds = NULL;
+    }
+    free(feat);
+    free(index);
+    return nSel;
+}
+
+static void write_string_attr(hid_t did, const char *name, const char *s)
+{
+    hid_t sid, aid, tid;
+
+    tid = H5Tcopy(H5T_C_S1);
+    H5Tset_size(tid, strlen(s) + 1);
+    sid = H5Screate(H5S_SCALAR);
+    aid = H5Acreate(did, name, tid, sid, H5P_DEFAULT, H5P_DEFAULT);
+    H5Awrite(aid, tid, s);
+    H5Aclose(aid);
+    H5Sclose(sid);
+    H5Tclose(tid);
+}
+
+int evselect_write_source(hid_t fid, const size_t *ids, size_t n, const char *expr,
+                          const char *srcName)
+{
+    hsize_t dims[1];
+    hid_t sid, did;
+    herr_t ret = 0;
+
+    dims[0] = n;
+    sid = H5Screate_simple(1, dims, NULL);
+    did = H5Dcreate(fid, EVSELECT_SOURCE_DATASET, H5T_NATIVE_HSIZE, sid, H5P_DEFAULT,
+                    H5P_DEFAULT, H5P_DEFAULT);
+    if(did < 0) {
+        H5Sclose(sid);
+        return -1;
+    }
+    if(n > 0)
+        ret = H5Dwrite(did, H5T_NATIVE_HSIZE, H5S_ALL, H5S_ALL, H5P_DEFAULT, ids);
+    write_string_attr(did, "selection", expr);
+    write_string_attr(did, "sourceFile", srcName);
+    H5Dclose(did);
+    H5Sclose(sid);
+    return ret < 0 ? -1 : 0;
+}
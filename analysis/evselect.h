@@ -0,0 +1,72 @@
+#ifndef __EVSELECT_H__
+#define __EVSELECT_H__
+
+#include <stddef.h>
+#include <hdf5.h>
+#include "common.h"
+#include "hdf5io.h"
+
+/* Event selection from the per-event tables of a file, the event index
+ * and the EventFeatures table (dpo5054 -F), without reading any
+ * waveform.  A selection is cuts that all have to pass, written
+ * "cut,cut,..." (or with &&), a cut "var op value" with op one of <,
+ * <=, >, >=, ==, != and var
+ *     baseline<ch>, rms<ch>, amplitude<ch>, peakTime<ch>, integral<ch>
+ *              the feature of scope channel ch (1..4), volts and seconds
+ *     time     hostTime of the event index, s from the first event
+ *     event    the eventId
+ * e.g. "amplitude2<-0.05,time>=60,time<120".  The index has room for the
+ * scope's trigger time stamp, but dpo5054 does not query it and writes
+ * 0, so a cut on it is refused until it does. */
+
+#define EVSELECT_MAXCUTS 16
+
+enum {
+    EVSELECT_FEATURE = 0,
+    EVSELECT_TIME,
+    EVSELECT_EVENT
+};
+
+enum {
+    EVSELECT_LT = 0,
+    EVSELECT_LE,
+    EVSELECT_GT,
+    EVSELECT_GE,
+    EVSELECT_EQ,
+    EVSELECT_NE
+};
+
+struct evselect_cut
+{
+    int var;    /* EVSELECT_FEATURE..EVSELECT_EVENT */
+    size_t off; /* EVSELECT_FEATURE: of the float[SCOPE_NCH] in struct hdf5io_features */
+    int ch;     /* EVSELECT_FEATURE: the scope channel, 0..SCOPE_NCH-1 */
+    int op;     /* EVSELECT_LT.. */
+    double value;
+};
+
+struct evselect
+{
+    size_t nCuts;
+    struct evselect_cut cuts[EVSELECT_MAXCUTS];
+};
+
+/* returns -1 if expr does not parse, with what did not on stderr */
+int evselect_parse(struct evselect *sel, const char *expr);
+/* Finds the events firstEvent..firstEvent+nEvents-1 of wavFile that
+ * pass, in increasing order, into *eventIds (malloc'ed, NULL if there
+ * are none), and returns how many, or -1 (with a message) if a cut
+ * needs a table the file does not have.  Time cuts first narrow the
+ * events to a range with binary searches of the index; the tables are
+ * then read over that range only, a block of rows at a time, and the
+ * features only for blocks that still have candidates. */
+long evselect_run(struct hdf5io_waveform_file *wavFile, const struct evselect *sel,
+                  size_t firstEvent, size_t nEvents, size_t **eventIds);
+/* writes ids as dataset EVSELECT_SOURCE_DATASET of fid, with the
+ * selection and the file they came from as attributes, so that the
+ * events of an exported file can be traced back */
+#define EVSELECT_SOURCE_DATASET "SourceEvents"
+int evselect_write_source(hid_t fid, const size_t *ids, size_t n, const char *expr,
+                          const char *srcName);
+
+#endif /* __EVSELECT_H__ */
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "hist.h"
+
+int hist_init(struct hist *h, size_t nBins, double lo, double hi)
+{
+    memset(h, 0, sizeof(*h));
+    if(nBins == 0 || !(hi > lo)) return -1;
+    h->nBins = nBins;
+    h->lo = lo;
+    h->hi = hi;
+    h->scale = nBins / (hi - lo);
+    h->count = (unsigned long long*)calloc(nBins, sizeof(*h->count));
+    return h->count ? 0 : -1;
+}
+
+void hist_free(struct hist *h)
+{
+    free(h->count);
+    h->count = NULL;
+}
+
+int hist_parse(const char *s, size_t *nBins, double *lo, double *hi)
+{
+    return sscanf(s, "%zu:%lf:%lf", nBins, lo, hi) == 3 && *nBins > 0 && *hi > *lo ? 0 : -1;
+}
+
+double hist_mean(const struct hist *h)
+{
+    return h->nEntries > 0 ? h->sum / h->nEntries : 0;
+}
+
+double hist_rms(const struct hist *h)
+{
+    double mean = hist_mean(h);
+
+    return h->nEntries > 0 ? sqrt(fmax(h->sum2 / h->nEntries - mean * mean, 0)) : 0;
+}
+
+void hist_add(struct hist *h, const struct hist *o)
+{
+    size_t i;
+
+    for(i=0; i<h->nBins; i++) h->count[i] += o->count[i];
+    h->underflow += o->underflow;
+    h->overflow += o->overflow;
+    h->nEntries += o->nEntries;
+    h->sum += o->sum;
+    h->sum2 += o->sum2;
+}
+
+static void write_attr(hid_t did, const char *name, hid_t type, const void *v)
+{
+    hid_t sid, aid;
+
+    sid = H5Screate(H5S_SCALAR);
+    aid = H5Acreate(did, name, type, sid, H5P_DEFAULT, H5P_DEFAULT);
+    H5Awrite(aid, type, v);
+    H5Aclose(aid);
+    H5Sclose(sid);
+}
+
+int hist_write(hid_t fid, const char *name, const struct hist *h, const char *unit)
+{
+    hsize_t dims[1];
+    hid_t sid, did, tid;
+    double mean = hist_mean(h), rms = hist_rms(h);
+    herr_t ret;
+
+    dims[0] = h->nBins;
+    sid = H5Screate_simple(1, dims, NULL);
+    did = H5Dcreate(fid, name, H5T_NATIVE_ULLONG, sid, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if(did < 0) {
+        H5Sclose(sid);
+        return -1;
+    }
+    ret = H5Dwrite(did, H5T_NATIVE_ULLONG, H5S_ALL, H5S_ALL, H5P_DEFAULT, h->count);
+    write_attr(did, "lo", H5T_NATIVE_DOUBLE, &h->lo);
+    write_attr(did, "hi", H5T_NATIVE_DOUBLE, &h->hi);
+    write_attr(did, "underflow", H5T_NATIVE_ULLONG, &h->underflow);
+    write_attr(did, "overflow", H5T_NATIVE_ULLONG, &h->overflow);
+    write_attr(did, "entries", H5T_NATIVE_ULLONG, &h->nEntries);
+    write_attr(did, "mean", H5T_NATIVE_DOUBLE, &mean);
+    write_attr(did, "rms", H5T_NATIVE_DOUBLE, &rms);
+    tid = H5Tcopy(H5T_C_S1);
+    H5Tset_size(tid, strlen(unit) + 1);
+    write_attr(did, "unit", tid, unit);
+    H5Tclose(tid);
+    H5Dclose(did);
+    H5Sclose(sid);
+    return ret < 0 ? -1 : 0;
+}
@@ -0,0 +1,47 @@
+#ifndef __HIST_H__
+#define __HIST_H__
+
+#include <stddef.h>
+#include <hdf5.h>
+
+/* Fixed-bin 1D histogram for the analysis programs.  Each worker fills
+ * its own and they are summed with hist_add at the end, so filling
+ * takes no lock. */
+struct hist
+{
+    size_t nBins;
+    double lo, hi;
+    double scale; /* nBins / (hi - lo) */
+    unsigned long long *count, underflow, overflow;
+    unsigned long long nEntries;
+    double sum, sum2; /* of all entries, for the mean and rms */
+};
+
+int hist_init(struct hist *h, size_t nBins, double lo, double hi);
+void hist_free(struct hist *h);
+/* "nBins:lo:hi", returns -1 if it does not parse */
+int hist_parse(const char *s, size_t *nBins, double *lo, double *hi);
+double hist_mean(const struct hist *h);
+double hist_rms(const struct hist *h);
+/* adds the entries of o, which has the same bins, to h */
+void hist_add(struct hist *h, const struct hist *o);
+/* writes the counts as dataset name in fid (a file or group), with the
+ * binning, under/overflow, entries, mean, rms and unit as attributes */
+int hist_write(hid_t fid, const char *name, const struct hist *h, const char *unit);
+
+static inline void hist_fill(struct hist *h, double x)
+{
+    double b = (x - h->lo) * h->scale;
+
+    h->nEntries++;
+    h->sum += x;
+    h->sum2 += x * x;
+    if(b < 0)
+        h->underflow++;
+    else if(b >= h->nBins)
+        h->overflow++;
+    else
+        h->count[(size_t)b]++;
+}
+
+#endif /* __HIST_H__ */
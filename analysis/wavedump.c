@@ -5,26 +5,343 @@
 #include <time.h>
 #include <errno.h>
 #include <math.h>
+#include <unistd.h>
 
 #include "common.h"
 #include "hdf5io.h"
+#include "calib.h"
+#include "tpool.h"
+#include "evselect.h"
 
-char *waveformBuf;
+#define READ_AHEAD 4 /* event buffers of the read-ahead thread */
+#define ROWS_PER_JOB 16384 /* output rows formatted by one job */
+#define VALUES_PER_JOB 4096 /* numbers formatted by one job of the fast text tables */
+#define TIME_TABLE_MAX (1 << 20) /* longest frame whose times fast text formats once */
+#define SLOT 32 /* bytes per number in the fast text tables, the last one holds the length */
+
+enum {
+    OUT_TEXT = 0, /* %24.16e columns */
+    OUT_FAST,     /* the same columns with the shortest numbers that read back exactly */
+    OUT_BIN,      /* float32 records of time and channels, for gnuplot's binary */
+    OUT_NPY,      /* one NumPy float32 array [nEvents, nCh, nPt] */
+    OUT_N
+};
+static const char *outName[OUT_N] = {"text", "fast", "bin", "npy"};
+
+/* an event as the format jobs see it */
+struct dump {
+    int mode;
+    size_t nSel, nPt, iPt, frameSize, width, nCodes;
+    double dt;
+    const char *raw;      /* OUT_FAST: the samples */
+    const double *volt;   /* OUT_TEXT */
+    const float *voltF;   /* OUT_BIN */
+    const char *valTab;   /* OUT_FAST: a slot per channel and sample code */
+    const char *timeTab;  /* OUT_FAST: a slot per sample of a frame, or NULL */
+};
+
+/* formats rows i0..i1-1 of an event into buf */
+struct fmtjob {
+    struct tpool_job job;
+    const struct dump *d;
+    size_t i0, i1, len;
+    char *buf;
+};
+
+/* formats n numbers of v into slots */
+struct tabjob {
+    struct tpool_job job;
+    const double *v;
+    size_t n;
+    char *slots;
+};
+
+/* The shortest of %.15g, %.16g, %.17g that reads back as v.  Any
+ * decimal of up to 15 digits survives the trip through a double, so
+ * if a shorter one read back as v, %.15g (which drops trailing zeros)
+ * prints it. */
+static int format_shortest(double v, char *s)
+{
+    int p, n = 0;
+
+    for(p=15; p<=17; p++) {
+        n = sprintf(s, "%.*g", p, v);
+        if(strtod(s, NULL) == v) break;
+    }
+    return n;
+}
+
+static void format_slots(void *arg)
+{
+    struct tabjob *tj = (struct tabjob*)arg;
+    size_t i;
+
+    for(i=0; i<tj->n; i++)
+        tj->slots[i * SLOT + SLOT - 1] = (char)format_shortest(tj->v[i], tj->slots + i * SLOT);
+}
+
+/* v[0..n-1] into n slots, on the pool */
+static char *format_table(struct tpool_t *pool, const double *v, size_t n)
+{
+    size_t i, nJobs = (n + VALUES_PER_JOB - 1) / VALUES_PER_JOB;
+    struct tabjob *jobs;
+    char *slots;
+
+    slots = (char*)malloc(n * SLOT);
+    jobs = (struct tabjob*)calloc(nJobs, sizeof(*jobs));
+    for(i=0; i<nJobs; i++) {
+        jobs[i].job.fn = format_slots;
+        jobs[i].job.arg = jobs + i;
+        jobs[i].v = v + i * VALUES_PER_JOB;
+        jobs[i].n = i + 1 < nJobs ? VALUES_PER_JOB : n - i * VALUES_PER_JOB;
+        jobs[i].slots = slots + i * VALUES_PER_JOB * SLOT;
+        tpool_submit(pool, &(jobs[i].job));
+    }
+    for(i=0; i<nJobs; i++) tpool_wait(pool, &(jobs[i].job));
+    free(jobs);
+    return slots;
+}
+
+/* copies a slot, may write up to SLOT bytes */
+static inline char *put_slot(char *p, const char *slot)
+{
+    memcpy(p, slot, SLOT);
+    return p + (unsigned char)slot[SLOT - 1];
+}
+
+/* the table index of sample k, its bits as an unsigned number */
+static inline size_t sample_code(const struct dump *d, size_t k)
+{
+    return d->width == 2 ? ((const uint16_t*)d->raw)[k] : ((const uint8_t*)d->raw)[k];
+}
+
+static void format_rows(void *arg)
+{
+    struct fmtjob *fj = (struct fmtjob*)arg;
+    const struct dump *d = fj->d;
+    char *p = fj->buf;
+    size_t i, j, k;
+    float f;
+
+    for(i=fj->i0; i<fj->i1; i++) {
+        k = (d->iPt + i) % d->frameSize;
+        switch(d->mode) {
+        case OUT_TEXT:
+            p += sprintf(p, "%24.16e ", d->dt * k);
+            for(j=0; j<d->nSel; j++)
+                p += sprintf(p, "%24.16e ", d->volt[j * d->nPt + i]);
+            break;
+        case OUT_FAST:
+            if(d->timeTab)
+                p = put_slot(p, d->timeTab + k * SLOT);
+            else
+                p += format_shortest(d->dt * k, p);
+            for(j=0; j<d->nSel; j++) {
+                *p++ = ' ';
+                p = put_slot(p, d->valTab
+                             + (j * d->nCodes + sample_code(d, j * d->nPt + i)) * SLOT);
+            }
+            break;
+        case OUT_BIN:
+            f = (float)(d->dt * k);
+            memcpy(p, &f, sizeof(f));
+            p += sizeof(f);
+            for(j=0; j<d->nSel; j++) {
+                memcpy(p, d->voltF + j * d->nPt + i, sizeof(f));
+                p += sizeof(f);
+            }
+            continue; /* records, no lines */
+        }
+        *p++ = '\n';
+        if(k + 1 == d->frameSize)
+            *p++ = '\n';
+    }
+    fj->len = p - fj->buf;
+}
+
+/* Formats the rows of an event on the pool, in blocks of ROWS_PER_JOB
+ * rows over a ring of nJobs job buffers, and writes the blocks out in
+ * order as they finish. */
+static void dump_rows(struct tpool_t *pool, struct fmtjob *jobs, size_t nJobs,
+                      const struct dump *d)
+{
+    size_t b, nBlocks = (d->nPt + ROWS_PER_JOB - 1) / ROWS_PER_JOB;
+    struct fmtjob *fj;
+
+    for(b=0; b<nBlocks+nJobs; b++) {
+        fj = jobs + b % nJobs;
+        if(b >= nJobs && b - nJobs < nBlocks) {
+            tpool_wait(pool, &(fj->job));
+            fwrite(fj->buf, 1, fj->len, stdout);
+        }
+        if(b < nBlocks) {
+            fj->d = d;
+            fj->i0 = b * ROWS_PER_JOB;
+            fj->i1 = fj->i0 + ROWS_PER_JOB < d->nPt ? fj->i0 + ROWS_PER_JOB : d->nPt;
+            tpool_submit(pool, &(fj->job));
+        }
+    }
+}
+
+/* the header of a NumPy .npy file of float32 [nEvents, nSel, nPt] */
+static void write_npy_header(size_t nEvents, size_t nSel, size_t nPt)
+{
+    char hdr[256];
+    uint16_t one = 1;
+    size_t n;
+
+    n = sprintf(hdr, "{'descr': '%cf4', 'fortran_order': False, 'shape': (%zd, %zd, %zd), }",
+                *(char*)&one ? '<' : '>', nEvents, nSel, nPt);
+    /* magic, version 1.0, the length, then the dict padded with
+     * spaces and a newline to a multiple of 64 bytes */
+    while((10 + n + 1) % 64) hdr[n++] = ' ';
+    hdr[n++] = '\n';
+    fwrite("\x93NUMPY\x01\x00", 1, 8, stdout);
+    fputc(n & 0xff, stdout);
+    fputc(n >> 8, stdout);
+    fwrite(hdr, 1, n, stdout);
+}
+
+/* Copies events ids[0..nEvents-1] of inFile, as they are, with their
+ * index and feature rows, to a new file outName, numbered from 0 on,
+ * and the ids as EVSELECT_SOURCE_DATASET.  The rows are looked up
+ * before the reader starts, as it then owns inFile. */
+static int export_events(struct hdf5io_waveform_file *inFile, const char *inName,
+                         struct waveform_attribute *wavAttr, const size_t *ids,
+                         size_t nEvents, const char *outName, const char *expr)
+{
+    struct hdf5io_waveform_file *outFile;
+    struct hdf5io_event_index *index;
+    struct hdf5io_features *feat = NULL;
+    struct hdf5io_waveform_event *evt, outEvent;
+    struct hdf5io_reader *reader;
+    size_t k, nFeat = hdf5io_get_number_of_features(inFile);
+
+    index = (struct hdf5io_event_index*)calloc(nEvents + 1, sizeof(*index));
+    if(nFeat > 0)
+        feat = (struct hdf5io_features*)calloc(nEvents + 1, sizeof(*feat));
+    for(k=0; k<nEvents; k++) {
+        /* row i is event i, unless events were written out of order */
+        if(hdf5io_read_event_index(inFile, ids[k], 1, index + k) < 0
+           || index[k].eventId != ids[k])
+            if(hdf5io_find_event(inFile, ids[k], index + k) < 0)
+                memset(index + k, 0, sizeof(*index));
+        if(feat && ids[k] < nFeat)
+            hdf5io_read_features(inFile, ids[k], 1, feat + k);
+    }
+
+    outFile = hdf5io_open_file(outName, 100, inFile->nCh);
+    if(outFile->waveFid < 0) {
+        fprintf(stderr, "Can not create %s\n", outName);
+        free(outFile);
+        free(feat);
+        free(index);
+        return -1;
+    }
+    hdf5io_write_waveform_attribute_in_file_header(outFile, wavAttr);
+    reader = hdf5io_open_reader_list(inFile, ids, nEvents, READ_AHEAD);
+    for(k=0; k<nEvents; k++) {
+        if((evt = hdf5io_reader_next(reader)) == NULL) break;
+        outEvent.eventId = k;
+        outEvent.wavBuf = evt->wavBuf;
+        outEvent.hostTime = index[k].hostTime;
+        outEvent.triggerTime = index[k].triggerTime;
+        hdf5io_write_event(outFile, &outEvent);
+        if(feat) {
+            feat[k].eventId = k;
+            hdf5io_write_features(outFile, feat + k);
+        }
+        hdf5io_reader_release(reader);
+    }
+    hdf5io_close_reader(reader);
+    if(k < nEvents)
+        fprintf(stderr, "Could only read %zd of %zd events\n", k, nEvents);
+    evselect_write_source(outFile->waveFid, ids, k, expr ? expr : "", inName);
+    hdf5io_flush_file(outFile);
+    hdf5io_close_file(outFile);
+    fprintf(stderr, "%zd events written to %s\n", k, outName);
+    free(feat);
+    free(index);
+    return k < nEvents ? -1 : 0;
+}
 
 int main(int argc, char **argv)
 {
-    size_t i, j, iCh, iEvent=0, nEvents=0, frameSize, nEventsInFile;
-    char *inFileName;
-    
+    size_t i, j, k, iCh, iEvent=0, nEvents=0, frameSize, nEventsInFile;
+    size_t iPt = 0, nPt = 0, nSel, nThreads = 0, nJobs, width, cap;
+    unsigned int selMask = 0, chSel = 0;
+    int opt, badOpt = 0, mode = OUT_TEXT, ret;
+    char *inFileName, *p, *progName = argv[0], *codes, *valTab = NULL, *timeTab = NULL;
+    char *selExpr = NULL, *outFileName = NULL;
+    size_t *ids = NULL;
+    long nIds;
+    struct evselect sel;
+    double *volt = NULL, *vals;
+    float *voltF = NULL;
+
     struct hdf5io_waveform_file *waveformFile;
-    struct waveform_attribute waveformAttr;
-    struct hdf5io_waveform_event waveformEvent;
+    struct waveform_attribute waveformAttr, selAttr, codeAttr;
+    struct hdf5io_waveform_event *waveformEvent, windowEvent;
+    struct hdf5io_reader *reader = NULL;
+    struct tpool_t *pool;
+    struct fmtjob *jobs;
+    struct dump d;
+
+    while((opt = getopt(argc, argv, "c:j:o:r:s:O:")) != -1) {
+        switch(opt) {
+        case 'c':
+            selMask = strtoul(optarg, NULL, 0);
+            break;
+        case 'j':
+            nThreads = atol(optarg);
+            break;
+        case 'o':
+            for(mode=0; mode<OUT_N; mode++)
+                if(strcmp(optarg, outName[mode]) == 0) break;
+            if(mode == OUT_N) badOpt = 1;
+            break;
+        case 'r': /* iPt[:nPt] */
+            iPt = strtoul(optarg, &p, 10);
+            if(*p == ':') nPt = strtoul(p + 1, NULL, 10);
+            break;
+        case 's':
+            selExpr = optarg;
+            if(evselect_parse(&sel, selExpr) < 0) badOpt = 1;
+            break;
+        case 'O':
+            outFileName = optarg;
+            break;
+        default:
+            badOpt = 1;
+        }
+    }
+    /* the positional arguments keep their old places in argv[] */
+    argv += optind - 1;
+    argc -= optind - 1;
 
-    if(argc<2) {
-        fprintf(stderr, "%s inFileName [iEvent] [nEvents]\n", argv[0]);
+    /* an export copies whole events */
+    if(outFileName && (selMask || iPt || nPt)) badOpt = 1;
+    if(argc<2 || badOpt) {
+        fprintf(stderr, "%s [-o text|fast|bin|npy] [-c chMask(0x..)] [-r iPt[:nPt]]"
+                " [-j nThreads] [-s selection] [-O outFileName] inFileName [iEvent]"
+                " [nEvents]\n", progName);
+        fprintf(stderr, "-o text (default) prints %%24.16e columns of time and volts, fast"
+                " the same columns with the shortest exact numbers,\n"
+                "   bin float32 records of time and volts (gnuplot binary"
+                " format=\"%%<1+nCh>float\"),\n"
+                "   npy a NumPy float32 array [nEvents, nCh, nPt].\n");
+        fprintf(stderr, "-c dumps only the scope channels in chMask, -r only samples"
+                " iPt..iPt+nPt-1 of each event.\n");
+        fprintf(stderr, "-j formats text on n threads, default one per cpu.\n");
+        fprintf(stderr, "-s dumps only the events that pass the selection, cuts on the"
+                " event index and EventFeatures tables\n"
+                "   such as \"amplitude2<-0.05,time>=60,time<120\" (see"
+                " analysis/evselect.h).\n");
+        fprintf(stderr, "-O copies the events to a new HDF5 file instead of dumping them"
+                " (not with -c, -r).\n");
         return EXIT_FAILURE;
     }
-    
+
     inFileName = argv[1];
     waveformFile = hdf5io_open_file_for_read(inFileName);
     if(argc>2)
@@ -37,13 +354,15 @@ int main(int argc, char **argv)
             "     chMask  = 0x%02x\n"
             "     nPt     = %zd\n"
             "     nFrames = %zd\n"
+            "     width   = %zd\n"
             "     dt      = %g\n"
             "     t0      = %g\n"
             "     ymult   = %g %g %g %g\n"
             "     yoff    = %g %g %g %g\n"
             "     yzero   = %g %g %g %g\n",
-            waveformAttr.chMask, waveformAttr.nPt, waveformAttr.nFrames, waveformAttr.dt,
-            waveformAttr.t0, waveformAttr.ymult[0], waveformAttr.ymult[1], waveformAttr.ymult[2],
+            waveformAttr.chMask, waveformAttr.nPt, waveformAttr.nFrames,
+            waveformAttr.sampleWidth, waveformAttr.dt, waveformAttr.t0,
+            waveformAttr.ymult[0], waveformAttr.ymult[1], waveformAttr.ymult[2],
             waveformAttr.ymult[3], waveformAttr.yoff[0], waveformAttr.yoff[1],
             waveformAttr.yoff[2], waveformAttr.yoff[3], waveformAttr.yzero[0],
             waveformAttr.yzero[1], waveformAttr.yzero[2], waveformAttr.yzero[3]);
@@ -51,6 +370,29 @@ int main(int argc, char **argv)
     nEventsInFile = hdf5io_get_number_of_events(waveformFile);
     fprintf(stderr, "Number of events in file: %zd\n", nEventsInFile);
     if(nEvents <= 0 || nEvents > nEventsInFile) nEvents = nEventsInFile;
+    if(iEvent >= nEventsInFile) nEvents = 0;
+    else if(iEvent + nEvents > nEventsInFile) nEvents = nEventsInFile - iEvent;
+    /* the events to read by id: those the selection picks among
+     * iEvent..iEvent+nEvents-1, or all of them for an export */
+    if(selExpr) {
+        nIds = evselect_run(waveformFile, &sel, iEvent, nEvents, &ids);
+        if(nIds < 0) {
+            hdf5io_close_file(waveformFile);
+            return EXIT_FAILURE;
+        }
+        fprintf(stderr, "Selected events: %ld of %zd\n", nIds, nEvents);
+        nEvents = nIds;
+    } else if(outFileName) {
+        ids = (size_t*)malloc((nEvents + 1) * sizeof(size_t));
+        for(k=0; k<nEvents; k++) ids[k] = iEvent + k;
+    }
+    if(outFileName) {
+        ret = export_events(waveformFile, inFileName, &waveformAttr, ids, nEvents,
+                            outFileName, selExpr);
+        hdf5io_close_file(waveformFile);
+        free(ids);
+        return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
     if(waveformAttr.nFrames > 0) {
         frameSize = waveformAttr.nPt / waveformAttr.nFrames;
         fprintf(stderr, "Frame size: %zd\n", frameSize);
@@ -58,34 +400,152 @@ int main(int argc, char **argv)
         frameSize = waveformAttr.nPt;
     }
 
-    waveformBuf = (char*)malloc(waveformFile->nPt * waveformFile->nCh * sizeof(char));
-    waveformEvent.wavBuf = waveformBuf;
-
-    for(waveformEvent.eventId = iEvent; waveformEvent.eventId < iEvent + nEvents;
-        waveformEvent.eventId++) {
-        hdf5io_read_event(waveformFile, &waveformEvent);
-
-        for(i = 0; i < waveformFile->nPt; i++) {
-            printf("%24.16e ", waveformAttr.dt*(i%frameSize));
-            j = 0;
-            for(iCh=0; iCh<SCOPE_NCH; iCh++) {
-                if((1<<iCh) & waveformAttr.chMask) {
-                    printf("%24.16e ", (waveformBuf[j * waveformFile->nPt + i]
-                                        - waveformAttr.yoff[iCh])
-                           * waveformAttr.ymult[iCh]
-                           + waveformAttr.yzero[iCh]);
-                    j++;
-                }
+    /* selected scope channels, and their bits among the stored ones */
+    if(selMask == 0) selMask = waveformAttr.chMask;
+    selMask &= waveformAttr.chMask;
+    for(nSel=0, j=0, iCh=0; iCh<SCOPE_NCH; iCh++) {
+        if(!((1u << iCh) & waveformAttr.chMask)) continue;
+        if((1u << iCh) & selMask) {
+            chSel |= 1u << j;
+            nSel++;
+        }
+        j++;
+    }
+    if(nPt == 0 && iPt < waveformAttr.nPt) nPt = waveformAttr.nPt - iPt;
+    if(nSel == 0 || nPt == 0 || iPt + nPt > waveformAttr.nPt) {
+        fprintf(stderr, "Nothing to dump: channels 0x%02x, samples %zd..%zd of %zd\n",
+                selMask, iPt, iPt + nPt - 1, waveformAttr.nPt);
+        hdf5io_close_file(waveformFile);
+        return EXIT_FAILURE;
+    }
+    width = waveformAttr.sampleWidth == 2 ? 2 : 1;
+    selAttr = waveformAttr;
+    selAttr.chMask = selMask;
+    selAttr.nPt = nPt;
+    selAttr.nFrames = 0;
+
+    if(nThreads == 0) nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    pool = tpool_init(nThreads);
+    memset(&d, 0, sizeof(d));
+    d.mode = mode;
+    d.nSel = nSel;
+    d.nPt = nPt;
+    d.iPt = iPt;
+    d.frameSize = frameSize;
+    d.width = width;
+    d.dt = waveformAttr.dt;
+    setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+
+    switch(mode) {
+    case OUT_TEXT:
+        volt = (double*)malloc(nSel * nPt * sizeof(double));
+        break;
+    case OUT_FAST:
+        /* a sample takes one of 2^(8*width) values: each is calibrated
+         * and formatted once, as is the time of each sample of a frame */
+        d.nCodes = (size_t)1 << (8 * width);
+        codes = (char*)malloc(nSel * d.nCodes * width);
+        for(j=0; j<nSel; j++)
+            for(k=0; k<d.nCodes; k++) {
+                if(width == 2) ((uint16_t*)codes)[j * d.nCodes + k] = (uint16_t)k;
+                else ((uint8_t*)codes)[j * d.nCodes + k] = (uint8_t)k;
             }
-            printf("\n");
-            if((i+1) % frameSize == 0)
-                printf("\n");
+        codeAttr = selAttr;
+        codeAttr.nPt = d.nCodes;
+        vals = (double*)malloc(nSel * d.nCodes * sizeof(double));
+        calib_event_double(&codeAttr, codes, vals, NULL);
+        d.valTab = valTab = format_table(pool, vals, nSel * d.nCodes);
+        free(vals);
+        free(codes);
+        if(frameSize <= TIME_TABLE_MAX) {
+            memset(&codeAttr, 0, sizeof(codeAttr));
+            codeAttr.nPt = frameSize;
+            codeAttr.dt = waveformAttr.dt;
+            vals = (double*)malloc(frameSize * sizeof(double));
+            calib_event_double(&codeAttr, NULL, NULL, vals);
+            d.timeTab = timeTab = format_table(pool, vals, frameSize);
+            free(vals);
         }
-        printf("\n");
+        break;
+    case OUT_BIN:
+    case OUT_NPY:
+        voltF = (float*)malloc(nSel * nPt * sizeof(float));
+        d.voltF = voltF;
+        break;
     }
+    d.volt = volt;
+    if(mode == OUT_NPY)
+        write_npy_header(nEvents, nSel, nPt);
 
-    free(waveformBuf);
+    /* a row takes at most SLOT bytes per number and two newlines */
+    nJobs = 2 * nThreads;
+    cap = ROWS_PER_JOB * ((nSel + 1) * SLOT + 2) + SLOT;
+    jobs = (struct fmtjob*)calloc(nJobs, sizeof(*jobs));
+    for(i=0; i<nJobs; i++) {
+        jobs[i].job.fn = format_rows;
+        jobs[i].job.arg = jobs + i;
+        jobs[i].buf = (char*)malloc(cap);
+    }
+
+    /* whole events are read and inflated on another thread while the
+     * previous ones are printed, parts of events with read_event_window */
+    if(nSel == waveformFile->nCh && nPt == waveformAttr.nPt) {
+        if(ids)
+            reader = hdf5io_open_reader_list(waveformFile, ids, nEvents, READ_AHEAD);
+        else
+            reader = hdf5io_open_reader(waveformFile, iEvent, nEvents, READ_AHEAD);
+    } else {
+        memset(&windowEvent, 0, sizeof(windowEvent));
+        windowEvent.wavBuf = (char*)malloc(nSel * nPt * width);
+    }
+    for(k=0; k<nEvents; k++) {
+        if(reader) {
+            if((waveformEvent = hdf5io_reader_next(reader)) == NULL) break;
+        } else {
+            windowEvent.eventId = ids ? ids[k] : iEvent + k;
+            if(hdf5io_read_event_window(waveformFile, &windowEvent, chSel, iPt, nPt) < 0) break;
+            waveformEvent = &windowEvent;
+        }
+        d.raw = waveformEvent->wavBuf;
+        switch(mode) {
+        case OUT_TEXT:
+            calib_event_double(&selAttr, d.raw, volt, NULL);
+            break;
+        case OUT_BIN:
+        case OUT_NPY:
+            calib_event_float(&selAttr, d.raw, voltF, NULL);
+            break;
+        }
+        if(mode == OUT_NPY) {
+            fwrite(voltF, sizeof(float), nSel * nPt, stdout);
+        } else {
+            dump_rows(pool, jobs, nJobs, &d);
+            if(mode != OUT_BIN) fputc('\n', stdout);
+        }
+        if(reader) hdf5io_reader_release(reader);
+    }
+    if(k < nEvents) {
+        fprintf(stderr, "Could only read %zd of %zd events\n", k, nEvents);
+        if(mode == OUT_NPY) { /* the array keeps its shape */
+            memset(voltF, 0, nSel * nPt * sizeof(float));
+            for(; k<nEvents; k++) fwrite(voltF, sizeof(float), nSel * nPt, stdout);
+        }
+    }
+    fflush(stdout);
+
+    if(reader)
+        hdf5io_close_reader(reader);
+    else
+        free(windowEvent.wavBuf);
     hdf5io_close_file(waveformFile);
-    
+    tpool_close(pool);
+    for(i=0; i<nJobs; i++) free(jobs[i].buf);
+    free(jobs);
+    free(timeTab);
+    free(valTab);
+    free(voltF);
+    free(volt);
+    free(ids);
+
     return EXIT_SUCCESS;
 }
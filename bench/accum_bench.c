@@ -0,0 +1,96 @@
+/*
+ * accum_bench [nPt] [nCh] [totalSamples] [nTimeBins]
+ *
+ * Adds simulated triggers of nCh channels of nPt samples to the running
+ * average and to a persistence map of nTimeBins time bins with each
+ * accum kernel the cpu runs, for 1- and 2-byte samples, and reports
+ * GSamples/s.  Every kernel must give the same sums and hits as the
+ * scalar one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "accum.h"
+#include "simwave.h"
+#include "timing.h"
+
+int main(int argc, char **argv)
+{
+    size_t nPt = 100000, nCh = 4, totalSamples = (size_t)1 << 28, nTimeBins = 1000;
+    size_t i, k, n, nRep, width, nHits;
+    struct accum avg, pers;
+    char *raw;
+    long long *refSum, *refSum2;
+    unsigned long long *refTotal;
+    double t0, t1, t2;
+    int impl, bad;
+
+    if(argc > 1) nPt = strtoul(argv[1], NULL, 10);
+    if(argc > 2) nCh = strtoul(argv[2], NULL, 10);
+    if(argc > 3) totalSamples = strtoul(argv[3], NULL, 10);
+    if(argc > 4) nTimeBins = strtoul(argv[4], NULL, 10);
+    n = nCh * nPt;
+    nRep = totalSamples / n + 1;
+
+    raw = (char*)malloc(2 * n + 16);
+    refSum = (long long*)malloc(n * sizeof(long long));
+    refSum2 = (long long*)malloc(n * sizeof(long long));
+    printf("nPt = %zd, nCh = %zd, %zd triggers per run, GSamples/s\n"
+           "                   average   persistence\n", nPt, nCh, nRep);
+
+    for(width=1; width<=2; width++) {
+        simwave_fill(raw, n, 1);
+        if(width == 2) /* 8-bit traces spread over the 16-bit range */
+            for(i=n; i-->0;) ((int16_t*)raw)[i] = (int16_t)(raw[i] * 200 + (int)(i % 199));
+        refTotal = NULL;
+
+        for(impl=0; impl<ACCUM_NIMPL; impl++) {
+            if(accum_set_impl(impl) < 0) {
+                printf("int%-2zd %-8s: not supported by this cpu\n", 8 * width,
+                       accum_impl_name(impl));
+                continue;
+            }
+            if(accum_init(&avg, nCh, nPt, width, 1, 0) < 0
+               || accum_init(&pers, nCh, nPt, width, 0, nTimeBins) < 0) {
+                fprintf(stderr, "out of memory\n");
+                return EXIT_FAILURE;
+            }
+            /* a different trigger every time, the same ones for every kernel */
+            t0 = now();
+            for(k=0; k<nRep; k++) accum_add(&avg, raw + (k % 7) * width, nPt);
+            t1 = now();
+            for(k=0; k<nRep; k++) accum_add(&pers, raw + (k % 7) * width, nPt);
+            t2 = now();
+            /* accum_write merges the hits into the totals */
+            for(i=0, nHits=0; i<nCh*pers.nTimeBins*ACCUM_NSUB*ACCUM_NCODES; i++)
+                pers.total[i / (ACCUM_NSUB * ACCUM_NCODES) * ACCUM_NCODES + i % ACCUM_NCODES]
+                    += pers.hits[i];
+            for(i=0; i<nCh*pers.nTimeBins*ACCUM_NCODES; i++) nHits += pers.total[i];
+            if(refTotal == NULL) {
+                memcpy(refSum, avg.sum, n * sizeof(long long));
+                memcpy(refSum2, avg.sum2, n * sizeof(long long));
+                refTotal = pers.total;
+                pers.total = NULL;
+            }
+            bad = memcmp(refSum, avg.sum, n * sizeof(long long)) != 0
+                || memcmp(refSum2, avg.sum2, n * sizeof(long long)) != 0
+                || (pers.total && memcmp(refTotal, pers.total,
+                                         nCh * pers.nTimeBins * ACCUM_NCODES
+                                         * sizeof(unsigned long long)) != 0)
+                || nHits != nRep * n;
+            printf("int%-2zd %-8s: %12.3f %13.3f%s\n", 8 * width, accum_impl_name(impl),
+                   nRep * n / (t1 - t0) / 1e9, nRep * n / (t2 - t1) / 1e9,
+                   bad ? ", MISMATCH" : "");
+            accum_free(&avg);
+            accum_free(&pers);
+        }
+        free(refTotal);
+    }
+    free(refSum2);
+    free(refSum);
+    free(raw);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# acq_bench.sh [nEvents] [recordLength] [chMask] [nFrames] [triggerRate] [-- dpo5054 options]
+#
+# Runs dpo5054 against a local scopesim and reports the end-to-end
+# throughput together with the per-event dead time seen by the
+# (simulated) scope.  Run from the top of the source tree after
+# `make dpo5054 scopesim'.  LATENCY (microseconds, default 0) is passed
+# to scopesim -d to model the request round trip of a real network and
+# scope.  HANG=n makes scopesim's curvestream? stop after n events, to
+# exercise the fallback of dpo5054 -s.  SIMOPTS are further scopesim
+# options.
+
+NEVENTS=${1:-200}
+RECLEN=${2:-100000}
+CHMASK=${3:-0x0f}
+NFRAMES=${4:-0}
+RATE=${5:-0}
+[ $# -gt 5 ] && shift 5 || shift $#
+[ "$1" = "--" ] && shift
+
+PORT=${PORT:-14000}
+LATENCY=${LATENCY:-0}
+HANG=${HANG:-0}
+OUTFILE=${OUTFILE:-/tmp/acq_bench.h5}
+SIMLOG=$(mktemp)
+RUNLOG=$(mktemp)
+
+./scopesim -1 -p $PORT -l $RECLEN -f $NFRAMES -r $RATE -d $LATENCY -H $HANG $SIMOPTS >$SIMLOG 2>&1 &
+SIMPID=$!
+sleep 0.2
+
+./dpo5054 "$@" 127.0.0.1 $PORT $OUTFILE $CHMASK $NEVENTS >$RUNLOG
+RET=$?
+wait $SIMPID
+
+grep "^scopesim:" $SIMLOG
+grep "^run summary:\|^setup:" $RUNLOG | sed "s/^run summary:/dpo5054:/;s/^setup:/dpo5054: setup:/"
+echo "dpo5054: exit $RET, $(stat -c %s $OUTFILE) bytes written to $OUTFILE"
+rm -f $SIMLOG $RUNLOG
+exit $RET
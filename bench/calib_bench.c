@@ -0,0 +1,124 @@
+/*
+ * calib_bench [nPt] [nCh] [totalSamples] [nFrames]
+ *
+ * Converts simulated events of nCh channels of nPt samples to volts
+ * with each calib kernel the cpu runs, for 1- and 2-byte samples and
+ * float and double output, and reports GSamples/s.  The per-sample
+ * expression wavedump used before is the reference speed, and every
+ * kernel must give bit for bit the same volts as the scalar one.  The
+ * last column also fills the time axis of nFrames FastFrame frames.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+#include "calib.h"
+#include "simwave.h"
+#include "timing.h"
+
+/* the conversion as wavedump wrote it, one sample at a time */
+static void naive_event(const struct waveform_attribute *wavAttr, const char *buf, double *out)
+{
+    size_t i, j = 0, iCh;
+
+    for(iCh=0; iCh<SCOPE_NCH; iCh++) {
+        if(!((1u << iCh) & wavAttr->chMask)) continue;
+        for(i=0; i<wavAttr->nPt; i++)
+            out[j * wavAttr->nPt + i] =
+                ((wavAttr->sampleWidth == 2 ? ((const int16_t*)buf)[j * wavAttr->nPt + i]
+                  : buf[j * wavAttr->nPt + i]) - wavAttr->yoff[iCh])
+                * wavAttr->ymult[iCh] + wavAttr->yzero[iCh];
+        j++;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t nPt = 100000, nCh = 4, totalSamples = (size_t)1 << 30, nFrames = 100;
+    size_t i, k, n, nRep, width;
+    struct waveform_attribute wavAttr;
+    char *raw;
+    float *outF, *refF;
+    double *outD, *refD, *t;
+    double t0, t1, t2, t3;
+    int impl, bad;
+
+    if(argc > 1) nPt = strtoul(argv[1], NULL, 10);
+    if(argc > 2) nCh = strtoul(argv[2], NULL, 10);
+    if(argc > 3) totalSamples = strtoul(argv[3], NULL, 10);
+    if(argc > 4) nFrames = strtoul(argv[4], NULL, 10);
+    n = nCh * nPt;
+    nRep = totalSamples / n + 1;
+
+    raw = (char*)malloc(2 * n);
+    outF = (float*)malloc(n * sizeof(float));
+    refF = (float*)malloc(n * sizeof(float));
+    outD = (double*)malloc(n * sizeof(double));
+    refD = (double*)malloc(n * sizeof(double));
+    t = (double*)malloc(nPt * sizeof(double));
+
+    memset(&wavAttr, 0, sizeof(wavAttr));
+    wavAttr.chMask = (1 << nCh) - 1;
+    wavAttr.nPt = nPt;
+    wavAttr.dt = 4e-10;
+    for(i=0; i<SCOPE_NCH; i++) {
+        wavAttr.ymult[i] = 4e-3 / (i + 1);
+        wavAttr.yoff[i] = 0.5 * i - 3.0;
+        wavAttr.yzero[i] = 1e-3 * i;
+    }
+    printf("nPt = %zd, nCh = %zd, %zd events per run, GSamples/s\n"
+           "                   float out    double out\n", nPt, nCh, nRep);
+
+    for(width=1; width<=2; width++) {
+        wavAttr.sampleWidth = width;
+        simwave_fill(raw, n, 1);
+        if(width == 2) /* 8-bit traces spread over the 16-bit range */
+            for(i=n; i-->0;) ((int16_t*)raw)[i] = (int16_t)(raw[i] * 200 + (int)(i % 199));
+
+        t0 = now();
+        for(k=0; k<nRep; k++) naive_event(&wavAttr, raw, outD);
+        t1 = now();
+        printf("int%-2zd naive   : %14s %13.3f\n", 8 * width, "-",
+               nRep * n / (t1 - t0) / 1e9);
+
+        for(impl=0; impl<CALIB_NIMPL; impl++) {
+            if(calib_set_impl(impl) < 0) {
+                printf("int%-2zd %-8s: not supported by this cpu\n", 8 * width,
+                       calib_impl_name(impl));
+                continue;
+            }
+            wavAttr.nFrames = 0;
+            t0 = now();
+            for(k=0; k<nRep; k++) calib_event_float(&wavAttr, raw, outF, NULL);
+            t1 = now();
+            for(k=0; k<nRep; k++) calib_event_double(&wavAttr, raw, outD, NULL);
+            t2 = now();
+            wavAttr.nFrames = nFrames;
+            for(k=0; k<nRep; k++) calib_event_double(&wavAttr, raw, outD, t);
+            t3 = now();
+            if(impl == CALIB_SCALAR) {
+                memcpy(refF, outF, n * sizeof(float));
+                memcpy(refD, outD, n * sizeof(double));
+            }
+            bad = memcmp(refF, outF, n * sizeof(float)) != 0
+                || memcmp(refD, outD, n * sizeof(double)) != 0;
+            printf("int%-2zd %-8s: %14.3f %13.3f, with time axis %8.3f%s\n", 8 * width,
+                   calib_impl_name(impl), nRep * n / (t1 - t0) / 1e9,
+                   nRep * n / (t2 - t1) / 1e9, nRep * n / (t3 - t2) / 1e9,
+                   bad ? ", MISMATCH" : "");
+        }
+        naive_event(&wavAttr, raw, outD);
+        if(memcmp(refD, outD, n * sizeof(double)) != 0)
+            printf("int%-2zd: kernels do not match the naive conversion\n", 8 * width);
+    }
+    free(t);
+    free(refD);
+    free(outD);
+    free(refF);
+    free(outF);
+    free(raw);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,145 @@
+/*
+ * codec_bench [nPt] [nCh] [nEvents] [recorded.h5]
+ *
+ * Writes nEvents events through hdf5io with each filter hdf5io_set_filter
+ * offers and reports the compression ratio together with the write and
+ * read MB/s.  The events are simulated, or taken (cyclically) from the
+ * first events of a file recorded by dpo5054, in which case nPt and nCh
+ * come from that file.  lz4 and zstd need the HDF5 filter plugins on
+ * HDF5_PLUGIN_PATH and are reported as unavailable otherwise.
+ */
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "hdf5io.h"
+#include "simwave.h"
+#include "timing.h"
+
+#define NPOOL 16
+#define OUTFILE "/tmp/codec_bench.h5"
+
+static struct {
+    int filter, level;
+} codecs[] = {
+    {HDF5IO_FILTER_NONE, 0},
+    {HDF5IO_FILTER_DEFLATE, 1},
+    {HDF5IO_FILTER_DEFLATE, 6},
+    {HDF5IO_FILTER_DEFLATE, 9},
+    {HDF5IO_FILTER_LZ4, 0},
+    {HDF5IO_FILTER_ZSTD, 1},
+    {HDF5IO_FILTER_ZSTD, 3},
+    {HDF5IO_FILTER_ZSTD, 9},
+    {HDF5IO_FILTER_DELTA, 0},
+};
+
+/* fills pool with up to NPOOL events of a recorded file, returns how many */
+static size_t load_recorded(const char *fname, struct waveform_attribute *wavAttr,
+                            size_t *nCh, char **pool)
+{
+    struct hdf5io_waveform_file *wavFile;
+    struct hdf5io_waveform_event evt;
+    size_t i, n, evtSize;
+
+    wavFile = hdf5io_open_file_for_read(fname);
+    hdf5io_read_waveform_attribute_in_file_header(wavFile, wavAttr);
+    *nCh = wavFile->nCh;
+    n = hdf5io_get_number_of_events(wavFile);
+    if(n > NPOOL) n = NPOOL;
+    evtSize = wavFile->nCh * wavFile->nPt * wavFile->sampleWidth;
+    *pool = (char*)malloc(NPOOL * evtSize);
+    for(i=0; i<n; i++) {
+        evt.eventId = i;
+        evt.wavBuf = *pool + i * evtSize;
+        hdf5io_read_event(wavFile, &evt);
+    }
+    hdf5io_close_file(wavFile);
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    size_t nPt = 10000, nCh = 4, nEvents = 2000, nPool = NPOOL;
+    size_t i, k, evtSize;
+    char *pool, *rbuf;
+    struct waveform_attribute wavAttr;
+    struct hdf5io_waveform_file *wavFile;
+    struct hdf5io_waveform_event evt;
+    struct stat st;
+    double t0, t1, t2;
+    int bad;
+
+    if(argc > 1) nPt = strtoul(argv[1], NULL, 10);
+    if(argc > 2) nCh = strtoul(argv[2], NULL, 10);
+    if(argc > 3) nEvents = strtoul(argv[3], NULL, 10);
+
+    memset(&wavAttr, 0, sizeof(wavAttr));
+    memset(&evt, 0, sizeof(evt));
+    if(argc > 4) {
+        nPool = load_recorded(argv[4], &wavAttr, &nCh, &pool);
+        if(nPool == 0) {
+            fprintf(stderr, "%s has no events\n", argv[4]);
+            return EXIT_FAILURE;
+        }
+        nPt = wavAttr.nPt;
+        printf("recorded waveforms from %s\n", argv[4]);
+    } else {
+        pool = (char*)malloc(NPOOL * nCh * nPt);
+        simwave_fill(pool, NPOOL * nCh * nPt, 1);
+        wavAttr.chMask = (1 << nCh) - 1;
+        wavAttr.nPt = nPt;
+        wavAttr.sampleWidth = 1;
+        wavAttr.dt = 4e-10;
+        for(i=0; i<SCOPE_NCH; i++) wavAttr.ymult[i] = 4e-3;
+        printf("simulated waveforms\n");
+    }
+    evtSize = nCh * nPt * wavAttr.sampleWidth;
+    rbuf = (char*)malloc(evtSize);
+    printf("nPt = %zd, nCh = %zd, width = %zd, nEvents = %zd\n", nPt, nCh,
+           wavAttr.sampleWidth, nEvents);
+
+    for(k=0; k<sizeof(codecs)/sizeof(codecs[0]); k++) {
+        wavFile = hdf5io_open_file(OUTFILE, 100, nCh);
+        hdf5io_write_waveform_attribute_in_file_header(wavFile, &wavAttr);
+        if(hdf5io_set_filter(wavFile, codecs[k].filter, codecs[k].level) < 0) {
+            printf("%-8s %2d: not available (HDF5_PLUGIN_PATH)\n",
+                   hdf5io_filter_name(codecs[k].filter), codecs[k].level);
+            hdf5io_close_file(wavFile);
+            continue;
+        }
+        t0 = now();
+        for(i=0; i<nEvents; i++) {
+            evt.eventId = i;
+            evt.wavBuf = pool + (i % nPool) * evtSize;
+            hdf5io_write_event(wavFile, &evt);
+        }
+        hdf5io_flush_file(wavFile);
+        hdf5io_close_file(wavFile);
+        t1 = now();
+
+        bad = 0;
+        wavFile = hdf5io_open_file_for_read(OUTFILE);
+        hdf5io_read_waveform_attribute_in_file_header(wavFile, &wavAttr);
+        evt.wavBuf = rbuf;
+        for(i=0; i<nEvents; i++) {
+            evt.eventId = i;
+            hdf5io_read_event(wavFile, &evt);
+            bad |= memcmp(rbuf, pool + (i % nPool) * evtSize, evtSize) != 0;
+        }
+        hdf5io_close_file(wavFile);
+        t2 = now();
+
+        stat(OUTFILE, &st);
+        printf("%-8s %2d: ratio %6.3f, write %8.2f MB/s, read %8.2f MB/s%s\n",
+               hdf5io_filter_name(codecs[k].filter), codecs[k].level,
+               (double)nEvents * evtSize / st.st_size,
+               nEvents * evtSize / (t1 - t0) / 1e6, nEvents * evtSize / (t2 - t1) / 1e6,
+               bad ? ", READBACK MISMATCH" : "");
+    }
+    free(rbuf);
+    free(pool);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,100 @@
+/*
+ * delta_bench [chunkSize] [totalBytes]
+ *
+ * Encodes and decodes simulated waveforms in chunks of chunkSize
+ * samples with each deltacodec kernel the cpu runs, reports ratio and
+ * GB/s, and checks that the kernels round-trip and agree on the
+ * stream.  memcpy of the same data is the reference speed.  Truncated
+ * and damaged streams must be rejected or decode without overrunning.
+ * Compare against deflate in HDF5 files with codec_bench.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "deltacodec.h"
+#include "simwave.h"
+#include "timing.h"
+
+int main(int argc, char **argv)
+{
+    size_t chunkSize = 10000, totalBytes = (size_t)1 << 30, srcSize = 16 << 20;
+    size_t i, k, nChunks, nRep, encLen = 0, refLen = 0, *off;
+    char *src, *enc, *ref, *dec;
+    double t0, t1, t2;
+    int impl, bad = 0, nRejected;
+
+    if(argc > 1) chunkSize = strtoul(argv[1], NULL, 10);
+    if(argc > 2) totalBytes = strtoul(argv[2], NULL, 10);
+    nChunks = srcSize / chunkSize;
+    srcSize = nChunks * chunkSize;
+    nRep = totalBytes / srcSize + 1;
+
+    src = (char*)malloc(srcSize);
+    dec = (char*)malloc(srcSize + chunkSize);
+    enc = (char*)malloc(nChunks * deltacodec_bound(chunkSize));
+    ref = (char*)malloc(nChunks * deltacodec_bound(chunkSize));
+    off = (size_t*)malloc((nChunks + 1) * sizeof(size_t));
+    simwave_fill(src, srcSize, 1);
+
+    t0 = now();
+    for(k=0; k<nRep; k++)
+        for(i=0; i<nChunks; i++)
+            memcpy(dec + i * chunkSize, src + i * chunkSize, chunkSize);
+    t1 = now();
+    printf("chunk %zd samples, memcpy %.2f GB/s\n", chunkSize,
+           nRep * srcSize / (t1 - t0) / 1e9);
+
+    for(impl=0; impl<DELTACODEC_NIMPL; impl++) {
+        if(deltacodec_set_impl(impl) < 0) {
+            printf("%-6s: not supported by this cpu\n", deltacodec_impl_name(impl));
+            continue;
+        }
+        t0 = now();
+        for(k=0; k<nRep; k++) {
+            off[0] = 0;
+            for(i=0; i<nChunks; i++)
+                off[i+1] = off[i] + deltacodec_encode(src + i * chunkSize, chunkSize,
+                                                      enc + off[i]);
+        }
+        t1 = now();
+        encLen = off[nChunks];
+        memset(dec, 0, srcSize);
+        for(k=0; k<nRep; k++)
+            for(i=0; i<nChunks; i++)
+                bad |= deltacodec_decode(enc + off[i], off[i+1] - off[i],
+                                         dec + i * chunkSize) < 0;
+        t2 = now();
+        bad |= memcmp(src, dec, srcSize) != 0;
+        if(refLen == 0) {
+            memcpy(ref, enc, encLen);
+            refLen = encLen;
+        } else { /* every kernel writes the same stream */
+            bad |= refLen != encLen || memcmp(ref, enc, encLen) != 0;
+        }
+        printf("%-6s: ratio %.3f, encode %.2f GB/s, decode %.2f GB/s%s\n",
+               deltacodec_impl_name(impl), (double)srcSize / encLen,
+               nRep * srcSize / (t1 - t0) / 1e9, nRep * srcSize / (t2 - t1) / 1e9,
+               bad ? ", MISMATCH" : "");
+    }
+
+    /* damaged first chunk: truncated at every length, and with each
+     * block width byte set out of range */
+    nRejected = 0;
+    for(k=0; k<off[1]; k++)
+        nRejected += deltacodec_decode(enc, k, dec) < 0;
+    for(k=4; k<off[1]; k+=1+16*(unsigned char)enc[k]) {
+        memcpy(ref, enc, off[1]);
+        ref[k] = 9;
+        nRejected += deltacodec_decode(ref, off[1], dec) < 0;
+    }
+    printf("damaged streams rejected: %d\n", nRejected);
+
+    free(off);
+    free(src);
+    free(dec);
+    free(enc);
+    free(ref);
+    return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
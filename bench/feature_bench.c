@@ -0,0 +1,122 @@
+/*
+ * feature_bench [nPt] [nCh] [nRows]
+ *
+ * Computes the features of simulated events of nCh channels of nPt
+ * samples with each wavstat kernel the cpu runs, for 1- and 2-byte
+ * samples, and reports GSamples/s; every kernel must give the same
+ * rows as the scalar one.  Then writes a feature table of nRows rows
+ * and reports the rows per second a scan of it reads, whole rows
+ * (hdf5io_read_features) and one column (hdf5io_read_feature_column).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+#include "hdf5io.h"
+#include "wavstat.h"
+#include "evfeatures.h"
+#include "simwave.h"
+#include "timing.h"
+
+#define NPOOL 16
+#define BLOCK 65536 /* rows read at a time by the scans */
+#define OUTFILE "/tmp/feature_bench.h5"
+
+int main(int argc, char **argv)
+{
+    size_t nPt = 100000, nCh = 4, nRows = 10000000;
+    size_t i, k, n, nRep, width, nSel;
+    struct waveform_attribute wavAttr;
+    struct hdf5io_waveform_file *wavFile;
+    struct hdf5io_features *rows, ref[NPOOL], out[NPOOL];
+    char *pool;
+    float *col;
+    double t0, t1, sum;
+    int impl;
+
+    if(argc > 1) nPt = strtoul(argv[1], NULL, 10);
+    if(argc > 2) nCh = strtoul(argv[2], NULL, 10);
+    if(argc > 3) nRows = strtoul(argv[3], NULL, 10);
+    n = nCh * nPt;
+    nRep = ((size_t)1 << 28) / (NPOOL * n) + 1;
+
+    pool = (char*)malloc(2 * NPOOL * n);
+    memset(out, 0, sizeof(out));
+    memset(&wavAttr, 0, sizeof(wavAttr));
+    wavAttr.chMask = (1 << nCh) - 1;
+    wavAttr.nPt = nPt;
+    wavAttr.dt = 4e-10;
+    for(i=0; i<SCOPE_NCH; i++) wavAttr.ymult[i] = 4e-3;
+    printf("nPt = %zd, nCh = %zd, %zd events per run, GSamples/s\n", nPt, nCh, nRep * NPOOL);
+
+    for(width=1; width<=2; width++) {
+        wavAttr.sampleWidth = width;
+        simwave_fill(pool, NPOOL * n, 1);
+        if(width == 2) /* 8-bit traces spread over the 16-bit range */
+            for(i=NPOOL*n; i-->0;)
+                ((int16_t*)pool)[i] = (int16_t)(pool[i] * 200 + (int)(i % 199));
+        for(impl=0; impl<WAVSTAT_NIMPL; impl++) {
+            if(wavstat_set_impl(impl) < 0) {
+                printf("int%-2zd %-8s: not supported by this cpu\n", 8 * width,
+                       wavstat_impl_name(impl));
+                continue;
+            }
+            t0 = now();
+            for(k=0; k<nRep; k++)
+                for(i=0; i<NPOOL; i++)
+                    evfeatures_event(&wavAttr, nCh, nPt / 10, pool + i * n * width,
+                                     out + i);
+            t1 = now();
+            if(impl == WAVSTAT_SCALAR) memcpy(ref, out, sizeof(ref));
+            printf("int%-2zd %-8s: %8.3f%s\n", 8 * width, wavstat_impl_name(impl),
+                   nRep * NPOOL * n / (t1 - t0) / 1e9,
+                   memcmp(ref, out, sizeof(ref)) != 0 ? ", MISMATCH" : "");
+        }
+    }
+
+    /* the table, NPOOL different rows over and over */
+    wavFile = hdf5io_open_file(OUTFILE, 100, nCh);
+    hdf5io_write_waveform_attribute_in_file_header(wavFile, &wavAttr);
+    t0 = now();
+    for(i=0; i<nRows; i++) {
+        ref[i % NPOOL].eventId = i;
+        hdf5io_write_features(wavFile, &ref[i % NPOOL]);
+    }
+    hdf5io_close_file(wavFile);
+    t1 = now();
+    printf("%zd rows written in %.3f s\n", nRows, t1 - t0);
+
+    wavFile = hdf5io_open_file_for_read(OUTFILE);
+    rows = (struct hdf5io_features*)malloc(BLOCK * sizeof(*rows));
+    col = (float*)malloc(BLOCK * SCOPE_NCH * sizeof(float));
+    t0 = now();
+    for(i=0, sum=0; i<nRows; i+=k) {
+        k = nRows - i < BLOCK ? nRows - i : BLOCK;
+        hdf5io_read_features(wavFile, i, k, rows);
+        for(n=0; n<k; n++) sum += rows[n].amplitude[0];
+    }
+    t1 = now();
+    printf("scan of whole rows:        %8.2f Mrows/s\n", nRows / (t1 - t0) / 1e6);
+    t0 = now();
+    for(i=0, nSel=0; i<nRows; i+=k) {
+        k = nRows - i < BLOCK ? nRows - i : BLOCK;
+        hdf5io_read_feature_column(wavFile, "amplitude", i, k, col);
+        for(n=0; n<k; n++) {
+            sum -= col[n * SCOPE_NCH];
+            nSel += col[n * SCOPE_NCH] < -0.1;
+        }
+    }
+    t1 = now();
+    printf("scan of the amplitudes:    %8.2f Mrows/s, %zd rows < -100 mV on ch 0%s\n",
+           nRows / (t1 - t0) / 1e6, nSel, sum != 0 ? ", MISMATCH" : "");
+    hdf5io_close_file(wavFile);
+    remove(OUTFILE);
+
+    free(col);
+    free(rows);
+    free(pool);
+    return EXIT_SUCCESS;
+}
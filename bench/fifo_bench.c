@@ -0,0 +1,115 @@
+/*
+ * fifo_bench [fifoSize] [totalBytes]
+ *
+ * One thread pushes, another pops, as receive_and_push and
+ * pop_and_save do.  Reports throughput for several push sizes along
+ * two paths: the copying one (read() into a stack buffer, fifo_push,
+ * fifo_pop into a buffer, copy into wavBuf) and the zero-copy one
+ * (readv() into fifo_reserve'd space, fifo_peek, copy into wavBuf).
+ * A memcpy from a source buffer stands in for read()/readv().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "fifo.h"
+#include "timing.h"
+
+#define POP_SIZE (4*BUFSIZ)
+#define WAVBUF_SIZE (1024*1024)
+
+static struct fifo_t *fifo;
+static size_t totalBytes;
+static int zeroCopy;
+
+static void *pop_all(void *arg)
+{
+    char *buf = (char*)malloc(POP_SIZE), *wavBuf = (char*)malloc(WAVBUF_SIZE);
+    size_t nPopped = 0, nCalls = 0, wavOff = 0;
+    unsigned char expect = 0, bad = 0;
+    size_t i, nr;
+    struct iovec iov[2];
+    unsigned char *p;
+
+    while(nPopped < totalBytes) {
+        if(zeroCopy) {
+            fifo_peek(fifo, iov);
+            p = (unsigned char*)iov[0].iov_base;
+            nr = iov[0].iov_len < POP_SIZE ? iov[0].iov_len : POP_SIZE;
+        } else {
+            nr = fifo_pop(fifo, buf, POP_SIZE);
+            p = (unsigned char*)buf;
+        }
+        if(wavOff + nr > WAVBUF_SIZE) wavOff = 0;
+        memcpy(wavBuf + wavOff, p, nr);
+        wavOff += nr;
+        for(i=0; i<nr; i+=509) /* spot check the byte sequence */
+            bad |= p[i] != (unsigned char)(expect + i);
+        if(zeroCopy)
+            fifo_release(fifo, nr);
+        expect += nr;
+        nPopped += nr;
+        nCalls++;
+    }
+    free(wavBuf);
+    free(buf);
+    *(size_t*)arg = bad ? 0 : nCalls;
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    size_t fifoSize = 64*1024*1024, pushSizes[] = {64, 1024, BUFSIZ, 65536};
+    size_t i, k, nPushed, nPops, pushSize, n0;
+    struct iovec iov[2];
+    unsigned char *buf, *ibuf;
+    pthread_t tid;
+    double t0, t1;
+
+    totalBytes = (size_t)4 << 30;
+    if(argc > 1) fifoSize = strtoul(argv[1], NULL, 10);
+    if(argc > 2) totalBytes = strtoul(argv[2], NULL, 10);
+
+    for(k=0; k<2*sizeof(pushSizes)/sizeof(pushSizes[0]); k++) {
+        zeroCopy = k >= sizeof(pushSizes)/sizeof(pushSizes[0]);
+        pushSize = pushSizes[k % (sizeof(pushSizes)/sizeof(pushSizes[0]))];
+        buf = (unsigned char*)malloc(pushSize + 256);
+        ibuf = (unsigned char*)malloc(pushSize);
+        for(i=0; i<pushSize+256; i++) buf[i] = (unsigned char)i;
+
+        fifo = fifo_init(fifoSize);
+        /* fewer bytes for tiny pushes so each run takes similar time */
+        totalBytes = (argc > 2) ? totalBytes : ((size_t)4 << 30) / (pushSize < 1024 ? 16 : 1);
+        totalBytes -= totalBytes % pushSize;
+        pthread_create(&tid, NULL, pop_all, &nPops);
+        t0 = now();
+        for(nPushed=0; nPushed<totalBytes; nPushed+=pushSize) {
+            if(zeroCopy) { /* memcpy stands in for readv() here */
+                fifo_reserve(fifo, iov, pushSize);
+                n0 = pushSize < iov[0].iov_len ? pushSize : iov[0].iov_len;
+                memcpy(iov[0].iov_base, buf + (nPushed & 0xff), n0);
+                if(n0 < pushSize)
+                    memcpy(iov[1].iov_base, buf + (nPushed & 0xff) + n0, pushSize - n0);
+                fifo_commit(fifo, pushSize);
+            } else {
+                memcpy(ibuf, buf + (nPushed & 0xff), pushSize);
+                fifo_push(fifo, (char*)ibuf, pushSize);
+            }
+        }
+        pthread_join(tid, NULL);
+        t1 = now();
+        if(nPops == 0) {
+            fprintf(stderr, "push size %zd: data corrupted\n", pushSize);
+            return EXIT_FAILURE;
+        }
+        printf("%s %6zd: %8.3f GB/s, %10.0f pushes/s, %zd pops\n",
+               zeroCopy ? "zero-copy" : "copying  ", pushSize,
+               totalBytes / (t1 - t0) / 1e9, totalBytes / pushSize / (t1 - t0), nPops);
+        fifo_close(fifo);
+        free(ibuf);
+        free(buf);
+    }
+    return EXIT_SUCCESS;
+}
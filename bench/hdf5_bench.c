@@ -0,0 +1,262 @@
+/*
+ * hdf5_bench [nPt] [nCh] [nEvents] [outFile] [maxThreads]
+ *
+ * Writes nEvents simulated events through hdf5io_write_event for a
+ * range of nWfmPerChunk values, then for 0..maxThreads compression
+ * threads, and reports events/s and MB/s.  Every file is read back
+ * and checked.  Last, both layouts are written with 10 events per
+ * chunk group and read back in random order, which shows the cost of
+ * many C<n> datasets.  The event index of the last file is searched
+ * for random events and time ranges, and the file is scanned with
+ * some work per event, reading with read_event in the same thread and
+ * with the read-ahead reader.
+ */
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "hdf5io.h"
+#include "simwave.h"
+#include "timing.h"
+
+#define NPOOL 16
+
+static size_t nCh_of(struct waveform_attribute *wavAttr)
+{
+    unsigned int v;
+    size_t c;
+
+    for(c=0, v=wavAttr->chMask; v; c++) v &= v - 1;
+    return c;
+}
+
+/* returns events/s */
+static double write_file(const char *outFile, size_t nWfmPerChunk, size_t nThreads,
+                         int layout, struct waveform_attribute *wavAttr, char *pool,
+                         size_t nEvents)
+{
+    struct hdf5io_waveform_file *wavFile;
+    struct hdf5io_waveform_event evt;
+    size_t i, nCh = nCh_of(wavAttr);
+    double t0, t1;
+
+    memset(&evt, 0, sizeof(evt));
+    t0 = now();
+    wavFile = hdf5io_open_file(outFile, nWfmPerChunk, nCh);
+    hdf5io_write_waveform_attribute_in_file_header(wavFile, wavAttr);
+    hdf5io_set_layout(wavFile, layout);
+    hdf5io_set_compress_threads(wavFile, nThreads);
+    for(i=0; i<nEvents; i++) {
+        evt.eventId = i;
+        evt.wavBuf = pool + (i % NPOOL) * nCh * wavAttr->nPt;
+        evt.hostTime = now();
+        hdf5io_write_event(wavFile, &evt);
+    }
+    hdf5io_flush_file(wavFile);
+    hdf5io_close_file(wavFile);
+    t1 = now();
+    return nEvents / (t1 - t0);
+}
+
+/* returns the number of events that do not read back as written */
+static size_t check_file(const char *outFile, char *pool, size_t nEvents)
+{
+    struct hdf5io_waveform_file *wavFile;
+    struct hdf5io_waveform_event evt;
+    struct waveform_attribute wavAttr;
+    size_t i, nBad = 0, n;
+
+    wavFile = hdf5io_open_file_for_read(outFile);
+    hdf5io_read_waveform_attribute_in_file_header(wavFile, &wavAttr);
+    n = wavFile->nCh * wavFile->nPt;
+    evt.wavBuf = (char*)malloc(n);
+    if(hdf5io_get_number_of_events(wavFile) != nEvents) nBad++;
+    for(i=0; i<nEvents; i+=(nEvents/37 + 1)) {
+        evt.eventId = i;
+        hdf5io_read_event(wavFile, &evt);
+        nBad += memcmp(evt.wavBuf, pool + (i % NPOOL) * n, n) != 0;
+    }
+    free(evt.wavBuf);
+    hdf5io_close_file(wavFile);
+    return nBad;
+}
+
+/* returns events/s of open_file_for_read and nRead random read_event */
+static double read_random(const char *outFile, size_t nRead)
+{
+    struct hdf5io_waveform_file *wavFile;
+    struct hdf5io_waveform_event evt;
+    struct waveform_attribute wavAttr;
+    size_t i, nEvents;
+    double t0, t1;
+
+    srand(1);
+    t0 = now();
+    wavFile = hdf5io_open_file_for_read(outFile);
+    hdf5io_read_waveform_attribute_in_file_header(wavFile, &wavAttr);
+    nEvents = hdf5io_get_number_of_events(wavFile);
+    evt.wavBuf = (char*)malloc(wavFile->nCh * wavFile->nPt);
+    for(i=0; i<nRead; i++) {
+        evt.eventId = rand() % nEvents;
+        hdf5io_read_event(wavFile, &evt);
+    }
+    free(evt.wavBuf);
+    hdf5io_close_file(wavFile);
+    t1 = now();
+    return nRead / (t1 - t0);
+}
+
+/* stands in for the analysis of an event: nPass sweeps over its samples */
+static long process_event(const char *buf, size_t n, size_t nPass)
+{
+    size_t i, k;
+    long s = 0;
+
+    for(k=0; k<nPass; k++)
+        for(i=0; i<n; i++) s += buf[i] * (long)(k + 1);
+    return s;
+}
+
+/* returns events/s of a sequential scan of the whole file with nPass
+ * sweeps of work per event, through a reader with nBufs buffers or
+ * with read_event when nBufs is 0 */
+static double scan_file(const char *outFile, size_t nBufs, size_t nPass, long *sum)
+{
+    struct hdf5io_waveform_file *wavFile;
+    struct hdf5io_waveform_event evt, *pEvt;
+    struct hdf5io_reader *reader;
+    struct waveform_attribute wavAttr;
+    size_t i, n, nEvents;
+    double t0, t1;
+
+    t0 = now();
+    wavFile = hdf5io_open_file_for_read(outFile);
+    hdf5io_read_waveform_attribute_in_file_header(wavFile, &wavAttr);
+    nEvents = hdf5io_get_number_of_events(wavFile);
+    n = wavFile->nCh * wavFile->nPt;
+    *sum = 0;
+    if(nBufs == 0) {
+        evt.wavBuf = (char*)malloc(n);
+        for(i=0; i<nEvents; i++) {
+            evt.eventId = i;
+            hdf5io_read_event(wavFile, &evt);
+            *sum += process_event(evt.wavBuf, n, nPass);
+        }
+        free(evt.wavBuf);
+    } else {
+        reader = hdf5io_open_reader(wavFile, 0, nEvents, nBufs);
+        while((pEvt = hdf5io_reader_next(reader)) != NULL) {
+            *sum += process_event(pEvt->wavBuf, n, nPass);
+            hdf5io_reader_release(reader);
+        }
+        hdf5io_close_reader(reader);
+    }
+    hdf5io_close_file(wavFile);
+    t1 = now();
+    return nEvents / (t1 - t0);
+}
+
+/* checks the event index of a file in the extensible layout, returns
+ * us per lookup of a random event plus a random time range */
+static double search_index(const char *outFile, size_t nLookup, size_t *nBad)
+{
+    struct hdf5io_waveform_file *wavFile;
+    struct hdf5io_event_index row, first, last;
+    size_t i, nEvents, eventId, iRow, n;
+    double t0, t1, tMin, tMax, ta, tb;
+
+    wavFile = hdf5io_open_file_for_read(outFile);
+    nEvents = hdf5io_get_number_of_events(wavFile);
+    hdf5io_read_event_index(wavFile, 0, 1, &first);
+    hdf5io_read_event_index(wavFile, nEvents - 1, 1, &last);
+    tMin = first.hostTime;
+    tMax = last.hostTime;
+    srand(2);
+    t0 = now();
+    for(i=0; i<nLookup; i++) {
+        eventId = rand() % nEvents;
+        if(hdf5io_find_event(wavFile, eventId, &row) < 0 || row.eventId != eventId
+           || row.inChunkId != eventId)
+            (*nBad)++;
+        ta = tMin + (tMax - tMin) * rand() / RAND_MAX;
+        tb = ta + (tMax - tMin) * 0.01;
+        n = hdf5io_find_time_range(wavFile, ta, tb, &iRow);
+        if(n > 0) {
+            hdf5io_read_event_index(wavFile, iRow, 1, &first);
+            hdf5io_read_event_index(wavFile, iRow + n - 1, 1, &last);
+            if(first.hostTime < ta || last.hostTime >= tb) (*nBad)++;
+        }
+    }
+    t1 = now();
+    hdf5io_close_file(wavFile);
+    return (t1 - t0) / nLookup * 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    size_t nPt = 1000, nCh = 4, nEvents = 20000, maxThreads = 4;
+    size_t nWfmPerChunkList[] = {1, 10, 100, 1000};
+    size_t i, k, nBad = 0;
+    char *outFile = "/tmp/hdf5_bench.h5", *pool;
+    struct waveform_attribute wavAttr;
+    struct stat st;
+    double rate;
+    long sum0, sum1;
+
+    if(argc > 1) nPt = strtoul(argv[1], NULL, 10);
+    if(argc > 2) nCh = strtoul(argv[2], NULL, 10);
+    if(argc > 3) nEvents = strtoul(argv[3], NULL, 10);
+    if(argc > 4) outFile = argv[4];
+    if(argc > 5) maxThreads = strtoul(argv[5], NULL, 10);
+
+    pool = (char*)malloc(NPOOL * nCh * nPt);
+    simwave_fill(pool, NPOOL * nCh * nPt, 1);
+
+    memset(&wavAttr, 0, sizeof(wavAttr));
+    wavAttr.chMask = (1 << nCh) - 1;
+    wavAttr.nPt = nPt;
+    wavAttr.dt = 4e-10;
+    for(i=0; i<SCOPE_NCH; i++) wavAttr.ymult[i] = 4e-3;
+
+    printf("nPt = %zd, nCh = %zd, nEvents = %zd\n", nPt, nCh, nEvents);
+    for(k=0; k<sizeof(nWfmPerChunkList)/sizeof(nWfmPerChunkList[0]); k++) {
+        rate = write_file(outFile, nWfmPerChunkList[k], 0, HDF5IO_LAYOUT_CHUNKGROUPS,
+                          &wavAttr, pool, nEvents);
+        stat(outFile, &st);
+        printf("nWfmPerChunk %5zd: %10.1f events/s, %8.2f MB/s in, file %.1f MB%s\n",
+               nWfmPerChunkList[k], rate, rate * nCh * nPt / 1e6, st.st_size / 1e6,
+               check_file(outFile, pool, nEvents) ? ", READBACK MISMATCH" : "");
+    }
+    for(k=0; k<=maxThreads; k = k ? 2*k : 1) {
+        rate = write_file(outFile, 100, k, HDF5IO_LAYOUT_CHUNKGROUPS,
+                          &wavAttr, pool, nEvents);
+        stat(outFile, &st);
+        printf("%2zd compression threads: %10.1f events/s, %8.2f MB/s in, file %.1f MB%s\n",
+               k, rate, rate * nCh * nPt / 1e6, st.st_size / 1e6,
+               check_file(outFile, pool, nEvents) ? ", READBACK MISMATCH" : "");
+    }
+    for(k=HDF5IO_LAYOUT_CHUNKGROUPS; k<=HDF5IO_LAYOUT_EXTENSIBLE; k++) {
+        rate = write_file(outFile, 10, 0, k, &wavAttr, pool, nEvents);
+        stat(outFile, &st);
+        printf("%-11s layout: write %10.1f events/s, random read %10.1f events/s,"
+               " file %.1f MB%s\n",
+               k == HDF5IO_LAYOUT_EXTENSIBLE ? "extensible" : "chunkgroups", rate,
+               read_random(outFile, 2000), st.st_size / 1e6,
+               check_file(outFile, pool, nEvents) ? ", READBACK MISMATCH" : "");
+    }
+    /* the extensible layout was written last */
+    rate = search_index(outFile, 1000, &nBad);
+    printf("event index: %.1f us per event + time range lookup%s\n", rate,
+           nBad ? ", WRONG ROWS" : "");
+    for(k=0; k<=4; k+=4) {
+        rate = scan_file(outFile, 0, k, &sum0);
+        printf("scan, %zd sweeps per event: read_event %10.1f events/s,", k, rate);
+        rate = scan_file(outFile, 4, k, &sum1);
+        printf(" reader %10.1f events/s%s\n", rate, sum0 != sum1 ? ", MISMATCH" : "");
+    }
+    free(pool);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,134 @@
+/*
+ * parse_bench [nPt] [nCh] [feedSize]
+ *
+ * Feeds a synthetic CURVENext? byte stream to blockparser in pieces of
+ * feedSize bytes (the size pop_and_save pops) and reports the parse
+ * rate, next to a one-byte-at-a-time loop like the one blockparser
+ * replaced.  The decoded waveforms are checked against the source.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blockparser.h"
+#include "timing.h"
+
+#define NEVENTS_STREAM 8
+
+#ifndef min
+#define min(a, b) ((a) <= (b) ? (a) : (b))
+#endif
+
+static char *make_stream(size_t nPt, size_t nCh, size_t nEvents, char *wav, size_t *n)
+{
+    char hdr[64], digits[32];
+    size_t i, iCh, hn, len;
+    char *stream, *p;
+
+    snprintf(digits, sizeof(digits), "%zd", nPt);
+    hn = snprintf(hdr, sizeof(hdr), "#%zd%s", strlen(digits), digits);
+    len = nEvents * (nCh * (hn + nPt) + 1);
+    stream = p = (char*)malloc(len);
+    for(i=0; i<nEvents; i++) {
+        for(iCh=0; iCh<nCh; iCh++) {
+            memcpy(p, hdr, hn); p += hn;
+            memcpy(p, wav + iCh * nPt, nPt); p += nPt;
+        }
+        *p++ = '\n';
+    }
+    *n = len;
+    return stream;
+}
+
+/* the flag-driven per-byte loop, kept for reference */
+static size_t bytewise_parse(const char *buf, size_t n, size_t nPt, size_t nCh, char *wavBuf,
+                             size_t *state)
+{
+    /* state: 0 start, 1 nDig, 2 len digits left, 3 payload, 4 end of event */
+    static size_t nDig, j;
+    size_t i, nEv = 0;
+
+    for(i=0; i<n; i++) {
+        switch(*state) {
+        case 0: if(buf[i] == '#') *state = 1; break;
+        case 1: nDig = buf[i] - '0'; *state = 2; break;
+        case 2: if(--nDig == 0) *state = 3; break;
+        case 3:
+            wavBuf[j++] = buf[i];
+            if(j % nPt == 0) *state = (j >= nPt * nCh) ? 4 : 0;
+            break;
+        case 4:
+            if(buf[i] == '\n') { nEv++; j = 0; *state = 0; }
+            break;
+        }
+    }
+    return nEv;
+}
+
+int main(int argc, char **argv)
+{
+    size_t nPt = 1000000, nCh = 4, feedSize = 32768;
+    size_t i, n, off, nc, nEv, nRep, iRep, state;
+    char *wav, *wavBuf, *stream;
+    struct blockparser_t *parser;
+    int evtDone, ok;
+    double t0, t1;
+
+    if(argc > 1) nPt = strtoul(argv[1], NULL, 10);
+    if(argc > 2) nCh = strtoul(argv[2], NULL, 10);
+    if(argc > 3) feedSize = strtoul(argv[3], NULL, 10);
+
+    wav = (char*)malloc(nPt * nCh);
+    wavBuf = (char*)malloc(nPt * nCh);
+    srand(1);
+    for(i=0; i<nPt*nCh; i++) wav[i] = (char)rand();
+    stream = make_stream(nPt, nCh, NEVENTS_STREAM, wav, &n);
+    nRep = 1 + (size_t)2e9 / n;
+
+    parser = blockparser_init(nPt, nCh, wavBuf);
+    nEv = 0;
+    t0 = now();
+    for(iRep=0; iRep<nRep; iRep++) {
+        for(off=0; off<n; off+=nc) {
+            nc = blockparser_feed(parser, stream + off, min(feedSize, n - off), &evtDone);
+            nEv += evtDone;
+        }
+    }
+    t1 = now();
+    if(nEv != nRep * NEVENTS_STREAM || memcmp(wav, wavBuf, nPt * nCh) != 0) {
+        fprintf(stderr, "blockparser: decoded %zd of %zd events, mismatch\n",
+                nEv, nRep * NEVENTS_STREAM);
+        return EXIT_FAILURE;
+    }
+    printf("blockparser: %zd events, %.3f GB/s\n", nEv, nRep * n / (t1 - t0) / 1e9);
+
+    nRep = 1 + nRep / 8;
+    nEv = 0; state = 0;
+    memset(wavBuf, 0, nPt * nCh);
+    t0 = now();
+    for(iRep=0; iRep<nRep; iRep++)
+        for(off=0; off<n; off+=feedSize)
+            nEv += bytewise_parse(stream + off, min(feedSize, n - off), nPt, nCh,
+                                  wavBuf, &state);
+    t1 = now();
+    printf("bytewise:    %zd events, %.3f GB/s\n", nEv, nRep * n / (t1 - t0) / 1e9);
+
+    /* corrupt one length field; that event is lost, the rest decode */
+    stream[2] = 'x';
+    blockparser_reset(parser);
+    nEv = 0;
+    for(off=0; off<n; off+=nc) {
+        nc = blockparser_feed(parser, stream + off, min(feedSize, n - off), &evtDone);
+        nEv += evtDone;
+    }
+    printf("corrupt input: %zd of %d events decoded, %zd resyncs, %zd dropped\n",
+           nEv, NEVENTS_STREAM, parser->nResync, parser->nDropped);
+    ok = nEv == NEVENTS_STREAM - 1 && parser->nDropped == 1;
+
+    blockparser_close(parser);
+    free(stream);
+    free(wavBuf);
+    free(wav);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
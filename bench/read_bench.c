@@ -0,0 +1,118 @@
+/*
+ * read_bench [nPt] [nCh] [nEvents] [maxThreads] [file.h5]
+ *
+ * Scans a file from start to end with the read-ahead reader, first
+ * with the HDF5 filters running inside H5Dread on the reader thread,
+ * then with chunks read by H5Dread_chunk and decompressed on 1, 2, 4,
+ * ... maxThreads workers (hdf5io_set_decompress_threads), and reports
+ * MB/s of samples delivered.  Every scan must see the same samples.
+ * Without file.h5 one is written first: nEvents simulated events,
+ * deflated on as many threads as the machine has; give a file that
+ * exists to scan it instead (nPt, nCh and nEvents are then ignored).
+ */
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "hdf5io.h"
+#include "simwave.h"
+#include "timing.h"
+
+#define NPOOL 16
+#define OUTFILE "/tmp/read_bench.h5"
+
+static void write_file(const char *fname, size_t nPt, size_t nCh, size_t nEvents)
+{
+    struct hdf5io_waveform_file *wavFile;
+    struct hdf5io_waveform_event evt;
+    struct waveform_attribute wavAttr;
+    size_t i;
+    char *pool;
+
+    pool = (char*)malloc(NPOOL * nCh * nPt);
+    simwave_fill(pool, NPOOL * nCh * nPt, 1);
+    memset(&wavAttr, 0, sizeof(wavAttr));
+    memset(&evt, 0, sizeof(evt));
+    wavAttr.chMask = (1 << nCh) - 1;
+    wavAttr.nPt = nPt;
+    wavAttr.dt = 4e-10;
+    for(i=0; i<SCOPE_NCH; i++) wavAttr.ymult[i] = 4e-3;
+
+    wavFile = hdf5io_open_file(fname, 100, nCh);
+    hdf5io_write_waveform_attribute_in_file_header(wavFile, &wavAttr);
+    hdf5io_set_compress_threads(wavFile, sysconf(_SC_NPROCESSORS_ONLN));
+    for(i=0; i<nEvents; i++) {
+        evt.eventId = i;
+        evt.wavBuf = pool + (i % NPOOL) * nCh * nPt;
+        hdf5io_write_event(wavFile, &evt);
+    }
+    hdf5io_flush_file(wavFile);
+    hdf5io_close_file(wavFile);
+    free(pool);
+}
+
+/* returns MB/s, the sum of all samples in *sum */
+static double scan_file(const char *fname, size_t nThreads, long *sum, size_t *nEvents)
+{
+    struct hdf5io_waveform_file *wavFile;
+    struct hdf5io_waveform_event *evt;
+    struct hdf5io_reader *reader;
+    struct waveform_attribute wavAttr;
+    size_t i, n;
+    double t0, t1;
+
+    t0 = now();
+    wavFile = hdf5io_open_file_for_read(fname);
+    hdf5io_read_waveform_attribute_in_file_header(wavFile, &wavAttr);
+    hdf5io_set_decompress_threads(wavFile, nThreads);
+    n = wavFile->nCh * wavFile->nPt * wavFile->sampleWidth;
+    *nEvents = 0;
+    *sum = 0;
+    reader = hdf5io_open_reader(wavFile, 0, hdf5io_get_number_of_events(wavFile), 4);
+    while((evt = hdf5io_reader_next(reader)) != NULL) {
+        for(i=0; i<n; i++) *sum += evt->wavBuf[i];
+        hdf5io_reader_release(reader);
+        (*nEvents)++;
+    }
+    hdf5io_close_reader(reader);
+    hdf5io_close_file(wavFile);
+    t1 = now();
+    return *nEvents * n / (t1 - t0) / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    size_t nPt = 100000, nCh = 4, nEvents = 10000, maxThreads = 0, k, nRead, nRead0;
+    const char *fname = OUTFILE;
+    struct stat st;
+    long sum, sum0;
+    double rate;
+
+    if(argc > 1) nPt = strtoul(argv[1], NULL, 10);
+    if(argc > 2) nCh = strtoul(argv[2], NULL, 10);
+    if(argc > 3) nEvents = strtoul(argv[3], NULL, 10);
+    if(argc > 4) maxThreads = strtoul(argv[4], NULL, 10);
+    if(argc > 5) fname = argv[5];
+    if(maxThreads == 0) maxThreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(argc <= 5 || stat(fname, &st) != 0) {
+        printf("writing %zd events of %zd x %zd samples to %s\n", nEvents, nCh, nPt, fname);
+        write_file(fname, nPt, nCh, nEvents);
+    }
+    stat(fname, &st);
+    printf("%s: %.1f MB, %zd cpus\n", fname, st.st_size / 1e6,
+           (size_t)sysconf(_SC_NPROCESSORS_ONLN));
+
+    rate = scan_file(fname, 0, &sum0, &nRead0);
+    printf("H5Dread on the reader thread: %8.1f MB/s, %zd events\n", rate, nRead0);
+    for(k=1; k<=maxThreads; k*=2) {
+        rate = scan_file(fname, k, &sum, &nRead);
+        printf("%3zd decompression threads:    %8.1f MB/s%s\n", k, rate,
+               sum != sum0 || nRead != nRead0 ? ", MISMATCH" : "");
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,524 @@
+/*
+ * scopesim [-p port] [-l recordLength] [-f nFrames] [-c chMask] [-r rate]
+ *          [-d latency] [-H nStreamed] [-m] [-1]
+ *
+ * A minimal stand-in for the DPO5054 `socket server'.  It answers the
+ * queries prepare_scope() sends and serves CURVe?/CURVENext? with
+ * #<nDig><len><payload> blocks, so the acquisition path can be
+ * exercised and timed without a real scope.  -c sets the channels
+ * that are on until SELect:CH<n> turns them on or off; like the scope,
+ * a curve leaves out the data sources that are off.  -d delays every
+ * message by latency microseconds after it arrives, standing in for the
+ * network and the scope's command processing.  CURVEStream? sends
+ * events, each ending in ";\n", until the next message comes in; -H
+ * makes the stream stop after nStreamed events, the way the real
+ * socket server hangs, until a message (a device clear "!d") arrives.
+ * 2-byte samples (WFMOutpre:BYT_Nr 2) come in the byte order
+ * DATa:ENCdg or WFMOutpre:BYT_Or asks for, or always MSB first with -m.
+ */
+
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "simwave.h"
+#include "timing.h"
+
+#define CMDBUF_SIZE 65536
+#define RESPBUF_SIZE 65536
+/* each served waveform starts at a random offset into a pre-generated
+ * buffer this much longer than the record, so consecutive events differ
+ * without generating new data on the fly */
+#define WAV_JITTER 4096
+
+struct sim_config
+{
+    unsigned short port;
+    size_t recordLength;
+    size_t nFrames;     /* 0 means FastFrame off */
+    unsigned int chMask;
+    double rate;        /* triggers per second, 0 = as fast as possible */
+    double latency;     /* seconds from a message's arrival to its handling */
+    size_t hangAfter;   /* streamed events before the stream hangs, 0 = never */
+    int msbOnly;        /* ignore requests for LSB first */
+    int once;
+};
+
+struct sim_state
+{
+    unsigned int chSelected;
+    unsigned int chSource[SCOPE_NCH];
+    size_t nSource;
+    size_t dataStart, dataStop;
+    size_t bytNr;
+    int lsbFirst; /* byte order of 2-byte samples */
+    char *wav[SCOPE_NCH];
+    char *wav16[2][SCOPE_NCH]; /* 2-byte samples, [lsbFirst], made when first needed */
+    size_t wavLen;
+    double lastTrigger;
+    int streaming;
+    size_t nStreamed;
+};
+
+struct sim_stats
+{
+    size_t nCurves;
+    size_t nBytes;
+    double tFirstRequest, tLastSent;
+    double deadSum, deadMin, deadMax;
+    size_t nDead;
+};
+
+static struct sim_config cfg = {
+    .port = 4000,
+    .recordLength = 10000,
+    .nFrames = 0,
+    .chMask = 0x0f,
+    .rate = 0.0,
+    .latency = 0.0,
+    .hangAfter = 0,
+    .msbOnly = 0,
+    .once = 0,
+};
+
+/* Compare one SCPI header against a pattern such as
+ * "HORizontal:ACQLENGTH".  Upper case letters of each pattern node are
+ * the mandatory short form, the full node name is also accepted. */
+static int scpi_match(const char *hdr, const char *pat)
+{
+    const char *h, *p;
+    size_t hn, pn, nShort, i;
+
+    if(*hdr == ':') hdr++;
+    for(;;) {
+        for(hn=0; hdr[hn] && hdr[hn] != ':'; hn++) ;
+        for(pn=0; pat[pn] && pat[pn] != ':'; pn++) ;
+        for(nShort=0; nShort<pn && !islower((unsigned char)pat[nShort]); nShort++) ;
+        if(hn != nShort && hn != pn) return 0;
+        for(i=0, h=hdr, p=pat; i<hn; i++)
+            if(toupper((unsigned char)h[i]) != toupper((unsigned char)p[i])) return 0;
+        hdr += hn; pat += pn;
+        if(*hdr == '\0' && *pat == '\0') return 1;
+        if(*hdr != ':' || *pat != ':') return 0;
+        hdr++; pat++;
+    }
+}
+
+static void generate_waveforms(struct sim_state *st)
+{
+    size_t ich, nPt;
+
+    nPt = cfg.recordLength * (cfg.nFrames ? cfg.nFrames : 1);
+    st->wavLen = nPt + WAV_JITTER;
+    for(ich=0; ich<SCOPE_NCH; ich++) {
+        st->wav[ich] = (char*)malloc(st->wavLen);
+        simwave_fill(st->wav[ich], st->wavLen, 12345 + ich);
+    }
+}
+
+/* 2-byte samples: the 8-bit waveform with 8 more bits of resolution */
+static void generate_waveforms16(struct sim_state *st, int lsbFirst)
+{
+    size_t ich, i;
+    unsigned int seed;
+    int16_t v;
+    unsigned char *p;
+
+    for(ich=0; ich<SCOPE_NCH; ich++) {
+        st->wav16[lsbFirst][ich] = (char*)malloc(2 * st->wavLen);
+        p = (unsigned char*)st->wav16[lsbFirst][ich];
+        seed = 777 + ich;
+        for(i=0; i<st->wavLen; i++) {
+            seed = seed * 1103515245 + 12345;
+            v = (int16_t)(st->wav[ich][i] * 256 + (int)((seed >> 16) & 0xff) - 128);
+            p[2*i + !lsbFirst] = (unsigned char)(v & 0xff);
+            p[2*i + lsbFirst] = (unsigned char)((uint16_t)v >> 8);
+        }
+    }
+}
+
+static ssize_t write_all(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t nw, total = 0;
+
+    while(iovcnt > 0) {
+        nw = writev(fd, iov, iovcnt);
+        if(nw < 0) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        total += nw;
+        while(iovcnt > 0 && (size_t)nw >= iov->iov_len) {
+            nw -= iov->iov_len;
+            iov++; iovcnt--;
+        }
+        if(iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + nw;
+            iov->iov_len -= nw;
+        }
+    }
+    return total;
+}
+
+/* waits for the next trigger when next is set, then sends one event:
+ * a definite length block per data source that is on, followed by term */
+static int send_curve(int fd, struct sim_state *st, struct sim_stats *stats, int next,
+                      const char *term)
+{
+    struct iovec iov[2*SCOPE_NCH+1];
+    char hdr[SCOPE_NCH][48], digits[32];
+    size_t i, nPt, len, off;
+    int iovcnt = 0;
+    double t, wait;
+    ssize_t nw;
+
+    nPt = cfg.recordLength * (cfg.nFrames ? cfg.nFrames : 1);
+    if(st->dataStop > nPt) st->dataStop = nPt;
+    len = (st->dataStop - st->dataStart + 1) * st->bytNr;
+
+    t = now();
+    if(next && cfg.rate > 0) {
+        wait = st->lastTrigger + 1.0/cfg.rate - t;
+        if(wait > 0) {
+            usleep((useconds_t)(wait * 1e6));
+            t += wait;
+        }
+        st->lastTrigger = t;
+    }
+    if(stats->tLastSent > 0) {
+        wait = t - stats->tLastSent;
+        stats->deadSum += wait;
+        if(stats->nDead == 0 || wait < stats->deadMin) stats->deadMin = wait;
+        if(wait > stats->deadMax) stats->deadMax = wait;
+        stats->nDead++;
+    }
+
+    off = (size_t)rand() % WAV_JITTER;
+    if(st->bytNr == 2 && st->wav16[st->lsbFirst][0] == NULL)
+        generate_waveforms16(st, st->lsbFirst);
+    for(i=0; i<st->nSource; i++) {
+        if(!(st->chSelected & (1u << st->chSource[i]))) continue;
+        snprintf(digits, sizeof(digits), "%zd", len);
+        snprintf(hdr[i], sizeof(hdr[i]), "#%zd%s", strlen(digits), digits);
+        iov[iovcnt].iov_base = hdr[i];
+        iov[iovcnt].iov_len = strlen(hdr[i]);
+        iovcnt++;
+        if(st->bytNr == 2)
+            iov[iovcnt].iov_base = st->wav16[st->lsbFirst][st->chSource[i]]
+                + 2 * (off + st->dataStart - 1);
+        else
+            iov[iovcnt].iov_base = st->wav[st->chSource[i]] + off + st->dataStart - 1;
+        iov[iovcnt].iov_len = len;
+        iovcnt++;
+    }
+    iov[iovcnt].iov_base = (char*)term;
+    iov[iovcnt].iov_len = strlen(term);
+    iovcnt++;
+
+    nw = write_all(fd, iov, iovcnt);
+    if(nw < 0) return -1;
+    stats->nCurves++;
+    stats->nBytes += nw;
+    stats->tLastSent = now();
+    return 0;
+}
+
+static void respond(char *resp, size_t *nResp, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+static void respond(char *resp, size_t *nResp, const char *fmt, ...)
+{
+    va_list ap;
+
+    if(*nResp > 0 && *nResp < RESPBUF_SIZE-1)
+        resp[(*nResp)++] = ';';
+    va_start(ap, fmt);
+    *nResp += vsnprintf(resp + *nResp, RESPBUF_SIZE - *nResp, fmt, ap);
+    va_end(ap);
+    if(*nResp >= RESPBUF_SIZE) *nResp = RESPBUF_SIZE-1;
+}
+
+static void set_data_source(struct sim_state *st, char *arg)
+{
+    char *tok, *save;
+    int ich;
+
+    st->nSource = 0;
+    for(tok = strtok_r(arg, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        while(isspace((unsigned char)*tok)) tok++;
+        if(strncasecmp(tok, "ch", 2) == 0) {
+            ich = atoi(tok+2) - 1;
+            if(ich >= 0 && ich < SCOPE_NCH && st->nSource < SCOPE_NCH)
+                st->chSource[st->nSource++] = ich;
+        }
+    }
+}
+
+/* handles one `;'-separated message unit; returns -1 if the client went away */
+static int handle_unit(int fd, struct sim_state *st, struct sim_stats *stats,
+                       char *unit, char *resp, size_t *nResp)
+{
+    char *arg, *hdr;
+    size_t n, ich;
+    int query;
+
+    while(isspace((unsigned char)*unit)) unit++;
+    if(*unit == '\0') return 0;
+    hdr = unit;
+    for(arg=unit; *arg && !isspace((unsigned char)*arg); arg++) ;
+    if(*arg) *arg++ = '\0';
+    while(isspace((unsigned char)*arg)) arg++;
+    n = strlen(hdr);
+    query = (n > 0 && hdr[n-1] == '?');
+    if(query) hdr[n-1] = '\0';
+    if(*hdr == ':') hdr++;
+
+    if(query) {
+        if(strcasecmp(hdr, "*IDN") == 0)
+            respond(resp, nResp, "TEKTRONIX,DPO5054,SIM%04d,CF:91.1CT FV:scopesim", cfg.port);
+        else if(strcasecmp(hdr, "*OPC") == 0) /* commands run synchronously here */
+            respond(resp, nResp, "1");
+        else if(scpi_match(hdr, "HORizontal:ACQLENGTH"))
+            respond(resp, nResp, "%zd", cfg.recordLength);
+        else if(scpi_match(hdr, "WFMOutpre:XINcr"))
+            respond(resp, nResp, "%.4e", 4.0e-10);
+        else if(scpi_match(hdr, "WFMOutpre:PT_Off"))
+            respond(resp, nResp, "%zd", cfg.recordLength / 10);
+        else if(scpi_match(hdr, "HORizontal:FASTframe:STATE"))
+            respond(resp, nResp, "%d", cfg.nFrames > 0);
+        else if(scpi_match(hdr, "HORizontal:FASTframe:COUNt"))
+            respond(resp, nResp, "%zd", cfg.nFrames ? cfg.nFrames : 1);
+        else if(scpi_match(hdr, "WFMOutpre:BYT_Nr"))
+            respond(resp, nResp, "%zd", st->bytNr);
+        else if(scpi_match(hdr, "WFMOutpre:BYT_Or"))
+            respond(resp, nResp, "%s", st->lsbFirst ? "LSB" : "MSB");
+        else if(scpi_match(hdr, "WFMOutpre:YMUlt")) {
+            ich = st->nSource ? st->chSource[0] : 0;
+            respond(resp, nResp, "%.4e", 4.0e-3 * (ich + 1) / (st->bytNr == 2 ? 256 : 1));
+        } else if(scpi_match(hdr, "WFMOutpre:YOFf"))
+            respond(resp, nResp, "%.4e", 0.0);
+        else if(scpi_match(hdr, "WFMOutpre:YZEro"))
+            respond(resp, nResp, "%.4e", 0.0);
+        else if(scpi_match(hdr, "CURVe") || scpi_match(hdr, "CURVENext") ||
+                scpi_match(hdr, "CURVEStream")) {
+            if(*nResp > 0) { /* flush what precedes the curve */
+                resp[(*nResp)++] = '\n';
+                if(write(fd, resp, *nResp) < 0) return -1;
+                *nResp = 0;
+            }
+            if(stats->nCurves == 0) stats->tFirstRequest = now();
+            if(scpi_match(hdr, "CURVEStream")) { /* serve_client sends the events */
+                st->streaming = 1;
+                st->nStreamed = 0;
+                return 0;
+            }
+            return send_curve(fd, st, stats, scpi_match(hdr, "CURVENext"), "\n");
+        } else
+            fprintf(stderr, "scopesim: unhandled query `%s?'\n", hdr);
+        return 0;
+    }
+
+    if(scpi_match(hdr, "DATa:SOUrce"))
+        set_data_source(st, arg);
+    else if(scpi_match(hdr, "DATa:STARt"))
+        st->dataStart = strtoul(arg, NULL, 10) > 0 ? strtoul(arg, NULL, 10) : 1;
+    else if(scpi_match(hdr, "DATa:STOP"))
+        st->dataStop = strtoul(arg, NULL, 10);
+    else if(scpi_match(hdr, "WFMOutpre:BYT_Nr"))
+        st->bytNr = (atoi(arg) == 2) ? 2 : 1;
+    else if(scpi_match(hdr, "WFMOutpre:BYT_Or"))
+        st->lsbFirst = !cfg.msbOnly && (strncasecmp(arg, "LSB", 3) == 0);
+    else if(scpi_match(hdr, "DATa:ENCdg")) /* SRIbinary and SRPbinary are LSB first */
+        st->lsbFirst = !cfg.msbOnly && (toupper((unsigned char)*arg) == 'S');
+    else if(strncasecmp(hdr, "SELect:CH", 9) == 0) {
+        ich = atoi(hdr+9) - 1;
+        if(ich < SCOPE_NCH) {
+            if(atoi(arg) || strcasecmp(arg, "ON") == 0) st->chSelected |= 1<<ich;
+            else st->chSelected &= ~(1<<ich);
+        }
+    }
+    /* everything else (!d, ...) is accepted silently */
+    return 0;
+}
+
+static void print_stats(struct sim_stats *stats)
+{
+    double elapsed = stats->tLastSent - stats->tFirstRequest;
+
+    if(stats->nCurves == 0 || elapsed <= 0) {
+        printf("scopesim: no curves served\n");
+    } else {
+        printf("scopesim: %zd events, %zd bytes in %.3f s\n"
+               "scopesim: %.2f MB/s, %.1f events/s\n"
+               "scopesim: dead time per event: mean %.1f us, min %.1f us, max %.1f us\n",
+               stats->nCurves, stats->nBytes, elapsed,
+               stats->nBytes / elapsed / 1e6, stats->nCurves / elapsed,
+               stats->nDead ? stats->deadSum / stats->nDead * 1e6 : 0.0,
+               stats->deadMin * 1e6, stats->deadMax * 1e6);
+    }
+    fflush(stdout);
+}
+
+static void sleep_until(double t)
+{
+    struct timespec ts;
+    double dt = t - now();
+
+    if(dt <= 0) return;
+    ts.tv_sec = (time_t)dt;
+    ts.tv_nsec = (long)((dt - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+}
+
+/* returns 1 when fd has input, waiting at most timeout seconds (or
+ * forever if timeout < 0) */
+static int wait_input(int fd, double timeout)
+{
+    struct timeval tv;
+    fd_set rfd;
+
+    tv.tv_sec = (time_t)timeout;
+    tv.tv_usec = (timeout - tv.tv_sec) * 1e6;
+    FD_ZERO(&rfd);
+    FD_SET(fd, &rfd);
+    return select(fd+1, &rfd, NULL, NULL, timeout < 0 ? NULL : &tv) > 0;
+}
+
+static void serve_client(int fd, struct sim_state *st)
+{
+    char *cmd, *line, *nl, *unit, *save;
+    char resp[RESPBUF_SIZE];
+    size_t nCmd = 0, nResp;
+    ssize_t nr;
+    struct sim_stats stats;
+    double tArrival;
+
+    memset(&stats, 0, sizeof(stats));
+    st->chSelected = cfg.chMask;
+    st->nSource = 1; st->chSource[0] = 0;
+    st->dataStart = 1;
+    st->dataStop = cfg.recordLength * (cfg.nFrames ? cfg.nFrames : 1);
+    st->bytNr = 1;
+    st->lsbFirst = 0;
+    st->lastTrigger = now();
+    st->streaming = 0;
+
+    cmd = (char*)malloc(CMDBUF_SIZE);
+    for(;;) {
+        /* stream until the client says something, or hang like the
+         * real socket server */
+        while(st->streaming && !wait_input(fd, 0)) {
+            if(cfg.hangAfter && st->nStreamed >= cfg.hangAfter) {
+                wait_input(fd, -1);
+                break;
+            }
+            if(send_curve(fd, st, &stats, 1, ";\n") < 0) goto end;
+            st->nStreamed++;
+        }
+        st->streaming = 0;
+        nr = read(fd, cmd + nCmd, CMDBUF_SIZE - 1 - nCmd);
+        if(nr <= 0) break;
+        tArrival = now();
+        nCmd += nr;
+        cmd[nCmd] = '\0';
+        line = cmd;
+        while((nl = memchr(line, '\n', nCmd - (line - cmd))) != NULL) {
+            *nl = '\0';
+            if(cfg.latency > 0) sleep_until(tArrival + cfg.latency);
+            nResp = 0;
+            for(unit = strtok_r(line, ";", &save); unit; unit = strtok_r(NULL, ";", &save))
+                if(handle_unit(fd, st, &stats, unit, resp, &nResp) < 0)
+                    goto end;
+            if(nResp > 0) {
+                resp[nResp++] = '\n';
+                if(write(fd, resp, nResp) < 0) goto end;
+            }
+            line = nl + 1;
+        }
+        nCmd -= line - cmd;
+        memmove(cmd, line, nCmd);
+        if(nCmd >= CMDBUF_SIZE - 1) nCmd = 0; /* discard an overlong line */
+    }
+end:
+    free(cmd);
+    print_stats(&stats);
+}
+
+int main(int argc, char **argv)
+{
+    int opt, lfd, fd, sockopt;
+    struct sockaddr_in addr;
+    struct sim_state st;
+
+    while((opt = getopt(argc, argv, "p:l:f:c:r:d:H:m1h")) != -1) {
+        switch(opt) {
+        case 'p': cfg.port = atoi(optarg); break;
+        case 'l': cfg.recordLength = strtoul(optarg, NULL, 10); break;
+        case 'f': cfg.nFrames = strtoul(optarg, NULL, 10); break;
+        case 'c': cfg.chMask = strtoul(optarg, NULL, 16); break;
+        case 'r': cfg.rate = atof(optarg); break;
+        case 'd': cfg.latency = atof(optarg) * 1e-6; break;
+        case 'H': cfg.hangAfter = strtoul(optarg, NULL, 10); break;
+        case 'm': cfg.msbOnly = 1; break;
+        case '1': cfg.once = 1; break;
+        default:
+            fprintf(stderr, "%s [-p port] [-l recordLength] [-f nFrames] [-c chMask(0x..)]"
+                    " [-r triggerRate] [-d latency(us)] [-H nStreamed] [-m] [-1]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if(cfg.recordLength == 0 ||
+       cfg.recordLength * (cfg.nFrames ? cfg.nFrames : 1) > SCOPE_MEM_LENGTH_MAX) {
+        fprintf(stderr, "record length out of range\n");
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    memset(&st, 0, sizeof(st));
+    generate_waveforms(&st);
+
+    if((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        err(EXIT_FAILURE, "socket");
+    sockopt = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &sockopt, sizeof(sockopt));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(cfg.port);
+    if(bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        err(EXIT_FAILURE, "bind");
+    if(listen(lfd, 1) < 0)
+        err(EXIT_FAILURE, "listen");
+    fprintf(stderr, "scopesim: listening on port %d, record length %zd, %zd frames\n",
+            cfg.port, cfg.recordLength, cfg.nFrames);
+
+    do {
+        if((fd = accept(lfd, NULL, NULL)) < 0) {
+            if(errno == EINTR) continue;
+            err(EXIT_FAILURE, "accept");
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &sockopt, sizeof(sockopt));
+        serve_client(fd, &st);
+        close(fd);
+    } while(!cfg.once);
+
+    close(lfd);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+/*
+ * select_bench [nPt] [nCh] [nEvents] [every]
+ *
+ * Writes nEvents simulated events with their index and feature rows,
+ * every every-th of them tagged with an amplitude of -1 V on channel 1,
+ * then times a rare-event search both ways: evselect on the tables and
+ * a read of only the events it picks (hdf5io_open_reader_list), against
+ * reading every event.  The events read must be the ones written.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "hdf5io.h"
+#include "evfeatures.h"
+#include "evselect.h"
+#include "simwave.h"
+#include "timing.h"
+
+#define NPOOL 16
+#define READ_AHEAD 4
+#define OUTFILE "/tmp/select_bench.h5"
+
+int main(int argc, char **argv)
+{
+    size_t nPt = 10000, nCh = 4, nEvents = 100000, every = 1000;
+    size_t i, n, k, nBad = 0, *ids;
+    struct waveform_attribute wavAttr;
+    struct hdf5io_waveform_file *wavFile;
+    struct hdf5io_waveform_event evt, *e;
+    struct hdf5io_features rows[NPOOL], row;
+    struct hdf5io_reader *reader;
+    struct evselect sel;
+    char *pool;
+    double t0, t1, t2, t3, mb;
+    long nSel;
+
+    if(argc > 1) nPt = strtoul(argv[1], NULL, 10);
+    if(argc > 2) nCh = strtoul(argv[2], NULL, 10);
+    if(argc > 3) nEvents = strtoul(argv[3], NULL, 10);
+    if(argc > 4) every = strtoul(argv[4], NULL, 10);
+    if(every == 0) every = 1;
+    n = nCh * nPt;
+
+    pool = (char*)malloc(NPOOL * n);
+    simwave_fill(pool, NPOOL * n, 1);
+    memset(&wavAttr, 0, sizeof(wavAttr));
+    memset(&evt, 0, sizeof(evt));
+    wavAttr.chMask = (1 << nCh) - 1;
+    wavAttr.nPt = nPt;
+    wavAttr.sampleWidth = 1;
+    wavAttr.dt = 4e-10;
+    for(i=0; i<SCOPE_NCH; i++) wavAttr.ymult[i] = 4e-3;
+    for(i=0; i<NPOOL; i++)
+        evfeatures_event(&wavAttr, nCh, nPt / 10, pool + i * n, rows + i);
+
+    wavFile = hdf5io_open_file(OUTFILE, 100, nCh);
+    hdf5io_write_waveform_attribute_in_file_header(wavFile, &wavAttr);
+    for(i=0; i<nEvents; i++) {
+        evt.eventId = i;
+        evt.wavBuf = pool + (i % NPOOL) * n;
+        evt.hostTime = i * 1e-3;
+        hdf5io_write_event(wavFile, &evt);
+        row = rows[i % NPOOL];
+        row.eventId = i;
+        if(i % every == every / 2) row.amplitude[0] = -1.0f;
+        hdf5io_write_features(wavFile, &row);
+    }
+    hdf5io_flush_file(wavFile);
+    hdf5io_close_file(wavFile);
+    mb = nEvents * n / 1e6;
+    printf("%zd events of %zd x %zd samples, %.1f MB, 1 in %zd tagged\n",
+           nEvents, nCh, nPt, mb, every);
+
+    wavFile = hdf5io_open_file_for_read(OUTFILE);
+    hdf5io_read_waveform_attribute_in_file_header(wavFile, &wavAttr);
+    evselect_parse(&sel, "amplitude1<-0.5");
+    t0 = now();
+    nSel = evselect_run(wavFile, &sel, 0, nEvents, &ids);
+    t1 = now();
+    reader = hdf5io_open_reader_list(wavFile, ids, nSel, READ_AHEAD);
+    for(k=0; (e = hdf5io_reader_next(reader)) != NULL; k++) {
+        nBad += e->eventId % every != every / 2
+            || memcmp(e->wavBuf, pool + (e->eventId % NPOOL) * n, n) != 0;
+        hdf5io_reader_release(reader);
+    }
+    hdf5io_close_reader(reader);
+    t2 = now();
+    nBad += k != (size_t)nSel || (size_t)nSel != (nEvents + every - 1 - every / 2) / every;
+    reader = hdf5io_open_reader(wavFile, 0, nEvents, READ_AHEAD);
+    for(k=0; (e = hdf5io_reader_next(reader)) != NULL; k++) {
+        nBad += memcmp(e->wavBuf, pool + (e->eventId % NPOOL) * n, n) != 0;
+        hdf5io_reader_release(reader);
+    }
+    hdf5io_close_reader(reader);
+    t3 = now();
+    hdf5io_close_file(wavFile);
+    remove(OUTFILE);
+
+    printf("selection on the tables:  %8.3f s, %ld events, %.1f Mrows/s\n",
+           t1 - t0, nSel, nEvents / (t1 - t0) / 1e6);
+    printf("read of those events:     %8.3f s\n", t2 - t1);
+    printf("read of every event:      %8.3f s, %.1f MB/s\n", t3 - t2, mb / (t3 - t2));
+    printf("search %.1f times faster than a full scan%s\n", (t3 - t2) / (t2 - t0),
+           nBad ? ", MISMATCH" : "");
+    free(ids);
+    free(pool);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,24 @@
+#include <stdlib.h>
+#include <math.h>
+#include "simwave.h"
+
+void simwave_fill(char *buf, size_t n, unsigned int seed)
+{
+    size_t i, j;
+    double y, amp;
+
+    /* gaussian-ish baseline noise of a couple of codes */
+    for(i=0; i<n; i++) {
+        y = ((rand_r(&seed) & 0xff) + (rand_r(&seed) & 0xff)
+             + (rand_r(&seed) & 0xff) - 382.5) / 64.0;
+        buf[i] = (char)lrint(y);
+    }
+    /* sparse negative pulses */
+    for(i=0; i<n; i+=500 + rand_r(&seed) % 1500) {
+        amp = 10 + rand_r(&seed) % 90;
+        for(j=0; j<40 && i+j<n; j++) {
+            y = buf[i+j] - amp * (1.0 - exp(-(double)j/2.0)) * exp(-(double)j/8.0);
+            buf[i+j] = (char)(y < -128 ? -128 : lrint(y));
+        }
+    }
+}
@@ -0,0 +1,9 @@
+#ifndef __SIMWAVE_H__
+#define __SIMWAVE_H__
+
+/* Synthetic 8-bit PMT-like waveform: a couple of codes of baseline
+ * noise with sparse negative pulses.  Shared by scopesim and the
+ * benchmarks so they all see data that compresses like real traces. */
+void simwave_fill(char *buf, size_t n, unsigned int seed);
+
+#endif /* __SIMWAVE_H__ */
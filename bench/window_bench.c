@@ -0,0 +1,205 @@
+/*
+ * window_bench [nPt] [nCh] [nEvents] [nWindow] [outFile] [frameSize]
+ *
+ * Writes nEvents simulated events of long records with each waveform
+ * split into HDF5 chunks of a range of lengths (see
+ * hdf5io_set_chunk_samples), then reads every event back three ways:
+ * in full with hdf5io_read_event, one channel in full, and nWindow
+ * samples of one channel around the middle of the record with
+ * hdf5io_read_event_window.  Reports ms per read and the MB HDF5 has
+ * to decompress for it (chunks touched times chunk size), and checks
+ * the partial reads against the full one.  Last, the events are
+ * taken as FastFrame events of nPt/frameSize frames and written in the
+ * default and in the frames layout, and single frames of all channels
+ * are read at random with hdf5io_read_frames.
+ */
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "hdf5io.h"
+#include "simwave.h"
+#include "timing.h"
+
+#define NPOOL 4
+
+/* samples per HDF5 chunk of the dataset open in wavFile */
+static size_t stored_chunk_length(struct hdf5io_waveform_file *wavFile)
+{
+    hsize_t dims[3];
+    hid_t dcpl;
+    int rank;
+
+    dcpl = H5Dget_create_plist(wavFile->chDid);
+    rank = H5Pget_chunk(dcpl, 3, dims);
+    H5Pclose(dcpl);
+    return rank > 0 ? dims[rank - 1] : wavFile->nPt;
+}
+
+/* writes nEvents events of pool to outFile in layout */
+static void write_file(const char *outFile, int layout, struct waveform_attribute *wavAttr,
+                       size_t nCh, size_t nEvents, char *pool)
+{
+    struct hdf5io_waveform_file *wavFile;
+    struct hdf5io_waveform_event evt;
+    size_t i;
+
+    memset(&evt, 0, sizeof(evt));
+    wavFile = hdf5io_open_file(outFile, 10, nCh);
+    hdf5io_write_waveform_attribute_in_file_header(wavFile, wavAttr);
+    hdf5io_set_layout(wavFile, layout);
+    for(i=0; i<nEvents; i++) {
+        evt.eventId = i;
+        evt.wavBuf = pool + (i % NPOOL) * nCh * wavAttr->nPt;
+        hdf5io_write_event(wavFile, &evt);
+    }
+    hdf5io_flush_file(wavFile);
+    hdf5io_close_file(wavFile);
+}
+
+/* returns ms per read_frames of one random frame of every channel,
+ * counts the frames that do not match pool in *nBad */
+static double read_random_frames(const char *outFile, size_t nRead, char *pool,
+                                 size_t *nBad)
+{
+    struct hdf5io_waveform_file *wavFile;
+    struct waveform_attribute wavAttr;
+    size_t i, iCh, iFrame, frameSize, nFramesInFile;
+    char *buf, *ref;
+    double t0, t1;
+
+    wavFile = hdf5io_open_file_for_read(outFile);
+    hdf5io_read_waveform_attribute_in_file_header(wavFile, &wavAttr);
+    frameSize = wavFile->nPt / wavFile->nFrames;
+    nFramesInFile = hdf5io_get_number_of_events(wavFile) * wavFile->nFrames;
+    buf = (char*)malloc(wavFile->nCh * frameSize);
+    srand(3);
+    t0 = now();
+    for(i=0; i<nRead; i++) {
+        iFrame = rand() % nFramesInFile;
+        hdf5io_read_frames(wavFile, iFrame, 1, (1u << wavFile->nCh) - 1, buf);
+        ref = pool + (iFrame / wavFile->nFrames % NPOOL) * wavFile->nCh * wavFile->nPt
+            + (iFrame % wavFile->nFrames) * frameSize;
+        for(iCh=0; iCh<wavFile->nCh; iCh++)
+            *nBad += memcmp(buf + iCh * frameSize, ref + iCh * wavFile->nPt, frameSize) != 0;
+    }
+    t1 = now();
+    free(buf);
+    hdf5io_close_file(wavFile);
+    return (t1 - t0) / nRead * 1e3;
+}
+
+/* chunks of one waveform that samples iPt..iPt+n-1 overlap */
+static size_t chunks_touched(size_t chunkLen, size_t iPt, size_t n)
+{
+    return (iPt + n - 1) / chunkLen - iPt / chunkLen + 1;
+}
+
+int main(int argc, char **argv)
+{
+    size_t nPt = 1000000, nCh = 4, nEvents = 40, nWindow = 2000, frameSize = 1000;
+    size_t chunkList[] = {0, 100000, 10000, 1000};
+    size_t i, k, iWin, chunkLen, evtSize, nBad;
+    char *outFile = "/tmp/window_bench.h5", *pool, *full, *part;
+    struct waveform_attribute wavAttr;
+    struct hdf5io_waveform_file *wavFile;
+    struct hdf5io_waveform_event evt;
+    struct stat st;
+    double t0, t1, t2, t3;
+
+    if(argc > 1) nPt = strtoul(argv[1], NULL, 10);
+    if(argc > 2) nCh = strtoul(argv[2], NULL, 10);
+    if(argc > 3) nEvents = strtoul(argv[3], NULL, 10);
+    if(argc > 4) nWindow = strtoul(argv[4], NULL, 10);
+    if(argc > 5) outFile = argv[5];
+    if(argc > 6) frameSize = strtoul(argv[6], NULL, 10);
+    if(nWindow > nPt) nWindow = nPt;
+    iWin = (nPt - nWindow) / 2;
+
+    evtSize = nCh * nPt;
+    pool = (char*)malloc(NPOOL * evtSize);
+    full = (char*)malloc(evtSize);
+    part = (char*)malloc(nPt);
+    simwave_fill(pool, NPOOL * evtSize, 1);
+
+    memset(&wavAttr, 0, sizeof(wavAttr));
+    memset(&evt, 0, sizeof(evt));
+    wavAttr.chMask = (1 << nCh) - 1;
+    wavAttr.nPt = nPt;
+    wavAttr.dt = 4e-10;
+    for(i=0; i<SCOPE_NCH; i++) wavAttr.ymult[i] = 4e-3;
+
+    printf("nPt = %zd, nCh = %zd, nEvents = %zd, window %zd samples at %zd\n",
+           nPt, nCh, nEvents, nWindow, iWin);
+    for(k=0; k<sizeof(chunkList)/sizeof(chunkList[0]); k++) {
+        wavFile = hdf5io_open_file(outFile, 10, nCh);
+        hdf5io_write_waveform_attribute_in_file_header(wavFile, &wavAttr);
+        hdf5io_set_chunk_samples(wavFile, chunkList[k]);
+        for(i=0; i<nEvents; i++) {
+            evt.eventId = i;
+            evt.wavBuf = pool + (i % NPOOL) * evtSize;
+            hdf5io_write_event(wavFile, &evt);
+        }
+        hdf5io_flush_file(wavFile);
+        hdf5io_close_file(wavFile);
+        stat(outFile, &st);
+
+        nBad = 0;
+        wavFile = hdf5io_open_file_for_read(outFile);
+        hdf5io_read_waveform_attribute_in_file_header(wavFile, &wavAttr);
+        t0 = now();
+        for(i=0; i<nEvents; i++) {
+            evt.eventId = i;
+            evt.wavBuf = full;
+            hdf5io_read_event(wavFile, &evt);
+            nBad += memcmp(full, pool + (i % NPOOL) * evtSize, evtSize) != 0;
+        }
+        t1 = now();
+        for(i=0; i<nEvents; i++) {
+            evt.eventId = i;
+            evt.wavBuf = part;
+            hdf5io_read_event_window(wavFile, &evt, 1u << (nCh - 1), 0, nPt);
+            nBad += memcmp(part, pool + (i % NPOOL) * evtSize + (nCh - 1) * nPt, nPt) != 0;
+        }
+        t2 = now();
+        for(i=0; i<nEvents; i++) {
+            evt.eventId = i;
+            evt.wavBuf = part;
+            hdf5io_read_event_window(wavFile, &evt, 1u << (nCh - 1), iWin, nWindow);
+            nBad += memcmp(part, pool + (i % NPOOL) * evtSize + (nCh - 1) * nPt + iWin,
+                           nWindow) != 0;
+        }
+        t3 = now();
+        chunkLen = stored_chunk_length(wavFile);
+        hdf5io_close_file(wavFile);
+
+        printf("chunk %7zd samples, file %6.1f MB: event %7.3f ms %6.2f MB,"
+               " channel %7.3f ms %6.2f MB, window %7.3f ms %6.3f MB%s\n",
+               chunkLen, st.st_size / 1e6,
+               (t1 - t0) / nEvents * 1e3, evtSize / 1e6,
+               (t2 - t1) / nEvents * 1e3, nPt / 1e6,
+               (t3 - t2) / nEvents * 1e3,
+               chunks_touched(chunkLen, iWin, nWindow) * chunkLen / 1e6,
+               nBad ? ", READBACK MISMATCH" : "");
+    }
+
+    wavAttr.nFrames = nPt / frameSize;
+    wavAttr.nPt = wavAttr.nFrames * frameSize;
+    for(k=HDF5IO_LAYOUT_CHUNKGROUPS; k<=HDF5IO_LAYOUT_FRAMES; k+=HDF5IO_LAYOUT_FRAMES) {
+        write_file(outFile, k, &wavAttr, nCh, nEvents, pool);
+        stat(outFile, &st);
+        nBad = 0;
+        printf("%zd frames of %zd samples, %-11s layout: file %6.1f MB,"
+               " random frame %7.3f ms%s\n", wavAttr.nFrames, frameSize,
+               k == HDF5IO_LAYOUT_FRAMES ? "frames" : "chunkgroups", st.st_size / 1e6,
+               read_random_frames(outFile, 200, pool, &nBad),
+               nBad ? ", READBACK MISMATCH" : "");
+    }
+    free(part);
+    free(full);
+    free(pool);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "blockparser.h"
+
+#ifndef min
+#define min(a, b) ((a) <= (b) ? (a) : (b))
+#endif
+
+enum {
+    BP_START = 0, /* expecting '#', or the terminator of the previous event */
+    BP_NDIG,      /* the digit after '#' */
+    BP_LEN,       /* nDig digits of block length */
+    BP_PAYLOAD,
+    BP_RESYNC     /* dropping input until a '#' right after a '\n' */
+};
+
+/* nCh blocks of #<nDig><blockSize><payload> and the '\n' */
+static size_t event_size(struct blockparser_t *parser)
+{
+    char digits[32];
+
+    return (2 + snprintf(digits, sizeof(digits), "%zd", parser->blockSize)
+            + parser->blockSize) * parser->nCh + 1;
+}
+
+struct blockparser_t *blockparser_init(size_t nPt, size_t nCh, char *wavBuf)
+{
+    struct blockparser_t *parser;
+    parser = (struct blockparser_t*)calloc(1, sizeof(struct blockparser_t));
+    parser->nPt = nPt;
+    parser->nCh = nCh;
+    parser->wavBuf = wavBuf;
+    parser->sampleWidth = 1;
+    parser->blockSize = nPt;
+    parser->evtSize = event_size(parser);
+    blockparser_reset(parser);
+    return parser;
+}
+
+int blockparser_close(struct blockparser_t *parser)
+{
+    if(parser) {
+        free(parser);
+        return 0;
+    }
+    return -1;
+}
+
+int blockparser_set_sample_width(struct blockparser_t *parser, size_t sampleWidth,
+                                 int swap)
+{
+    if(sampleWidth != 1 && sampleWidth != 2) return -1;
+    parser->sampleWidth = sampleWidth;
+    parser->swap = swap && sampleWidth > 1;
+    parser->blockSize = parser->nPt * sampleWidth;
+    parser->evtSize = event_size(parser);
+    blockparser_reset(parser);
+    return 0;
+}
+
+static void swap16(char *p, size_t n)
+{
+    uint16_t *s = (uint16_t*)p;
+    size_t i;
+
+    /* compilers turn this into vector byte shuffles */
+    for(i=0; i<n; i++) s[i] = (uint16_t)(s[i] << 8 | s[i] >> 8);
+}
+
+void blockparser_reset(struct blockparser_t *parser)
+{
+    parser->state = BP_START;
+    parser->iCh = 0;
+    parser->remain = 0;
+    parser->lastByte = '\n';
+    parser->inResync = 0;
+    parser->lastEnd = parser->nBytes;
+}
+
+static void resync(struct blockparser_t *parser)
+{
+    /* false '#' hits in the payload while resynchronising are not
+     * counted again */
+    if(!parser->inResync) parser->nResync++;
+    parser->inResync = 1;
+    parser->state = BP_RESYNC;
+    parser->iCh = 0;
+}
+
+size_t blockparser_feed(struct blockparser_t *parser, const char *buf, size_t n,
+                        int *evtDone)
+{
+    const char *s = buf, *end = buf + n, *h;
+    char prev;
+    size_t k, start;
+
+    *evtDone = 0;
+    while(s < end) {
+        switch(parser->state) {
+        case BP_START:
+            if(*s == '#') {
+                parser->state = BP_NDIG;
+                s++;
+            } else if(parser->iCh == 0 && (*s == '\n' || *s == ';' || *s == '\r')) {
+                s++;
+            } else {
+                resync(parser);
+            }
+            break;
+        case BP_NDIG:
+            if(*s >= '1' && *s <= '9') {
+                parser->nDig = *s - '0';
+                parser->iDig = 0;
+                parser->blockLen = 0;
+                parser->state = BP_LEN;
+                s++;
+            } else {
+                resync(parser);
+            }
+            break;
+        case BP_LEN:
+            if(*s < '0' || *s > '9') {
+                resync(parser);
+                break;
+            }
+            parser->blockLen = parser->blockLen * 10 + (*s - '0');
+            s++;
+            if(++(parser->iDig) == parser->nDig) {
+                if(parser->blockLen != parser->blockSize) {
+                    resync(parser);
+                    break;
+                }
+                parser->remain = parser->blockSize;
+                parser->dst = parser->wavBuf + parser->iCh * parser->blockSize;
+                parser->state = BP_PAYLOAD;
+                if(parser->inResync) {
+                    /* events are lost from the last one up to this header */
+                    start = parser->nBytes + (s - buf) - 2 - parser->nDig;
+                    k = (start - parser->lastEnd + parser->evtSize / 2) / parser->evtSize;
+                    parser->nDropped += k > 0 ? k : 1;
+                    parser->lastEnd = start;
+                    parser->inResync = 0;
+                }
+            }
+            break;
+        case BP_PAYLOAD:
+            k = min(parser->remain, (size_t)(end - s));
+            memcpy(parser->dst, s, k);
+            parser->dst += k;
+            parser->remain -= k;
+            s += k;
+            if(parser->remain == 0) {
+                if(parser->swap)
+                    swap16(parser->dst - parser->blockSize, parser->nPt);
+                parser->state = BP_START;
+                if(++(parser->iCh) >= parser->nCh) {
+                    parser->iCh = 0;
+                    parser->lastEnd = parser->nBytes + (s - buf);
+                    *evtDone = 1;
+                    goto out;
+                }
+            }
+            break;
+        case BP_RESYNC:
+            /* memchr is the vectorised scan here */
+            while((h = memchr(s, '#', end - s)) != NULL) {
+                prev = (h > buf) ? h[-1] : parser->lastByte;
+                s = h + 1;
+                if(prev == '\n') {
+                    parser->state = BP_NDIG;
+                    break;
+                }
+            }
+            if(h == NULL) s = end;
+            break;
+        }
+    }
+out:
+    if(s > buf) parser->lastByte = s[-1];
+    parser->nBytes += s - buf;
+    return s - buf;
+}
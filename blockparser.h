@@ -0,0 +1,57 @@
+#ifndef __BLOCKPARSER_H__
+#define __BLOCKPARSER_H__
+
+/* Decoder for the IEEE 488.2 definite length blocks returned by
+ * CURVe?/CURVENext?.  One event is nCh blocks, each
+ * #<nDig><len><len bytes of payload>, followed by '\n' (and possibly
+ * ';' in curvestream? mode).  Only the header bytes are inspected, the
+ * payload is moved into wavBuf with one memcpy per input span.  2-byte
+ * samples in the host's byte order take the same path; only samples in
+ * the other order are swapped, once per block. */
+struct blockparser_t
+{
+    size_t nPt;  /* samples per channel */
+    size_t nCh;
+    char *wavBuf; /* nCh x nPt destination, row-major */
+    size_t sampleWidth; /* bytes per sample, 1 or 2 */
+    int swap; /* 2-byte samples arrive in the other byte order */
+    size_t blockSize; /* nPt * sampleWidth, the expected block length */
+
+    int state;
+    size_t iCh;
+    size_t nDig, iDig, blockLen;
+    size_t remain; /* payload bytes still to come in the current block */
+    char *dst;
+    char lastByte;
+    int inResync;
+    size_t evtSize; /* bytes of one event in the stream */
+    size_t nBytes; /* bytes consumed so far */
+    size_t lastEnd; /* nBytes at the end of the last event */
+
+    size_t nResync; /* number of corrupt spots the parser recovered from */
+    size_t nDropped; /* events lost at those spots */
+};
+
+/* wavBuf must hold nCh * nPt bytes and stay valid while parsing */
+struct blockparser_t *blockparser_init(size_t nPt, size_t nCh, char *wavBuf);
+int blockparser_close(struct blockparser_t *parser);
+/* 1 (the default) or 2 bytes per sample, which wavBuf must then have
+ * room for; swap if the samples are not in the host's byte order */
+int blockparser_set_sample_width(struct blockparser_t *parser, size_t sampleWidth,
+                                 int swap);
+/* forget any partially decoded event, without counting it as dropped */
+void blockparser_reset(struct blockparser_t *parser);
+/* Consumes up to n bytes of buf and returns the number of bytes used.
+ * Parsing stops right after the last payload byte of an event, with
+ * *evtDone set to 1; the caller then deals with wavBuf and feeds the
+ * rest.  Otherwise all n bytes are consumed and *evtDone is 0.
+ * Blocks whose length does not match blockSize are treated as corrupt input:
+ * the partial event is dropped and the parser scans for the next '#'
+ * that follows a '\n'.  When it finds a good block header there, the
+ * bytes skipped since the last event, in events of evtSize bytes and
+ * at least one, are added to nDropped, so that the caller can account
+ * for every event in the stream. */
+size_t blockparser_feed(struct blockparser_t *parser, const char *buf, size_t n,
+                        int *evtDone);
+
+#endif /* __BLOCKPARSER_H__ */
@@ -0,0 +1,357 @@
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "calib.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CALIB_X86
+#endif
+
+/* a row of n samples to volts, (raw - off) * mult + zero */
+typedef void (*row_float_fn)(const void *src, size_t n, float off, float mult, float zero,
+                             float *dst);
+typedef void (*row_double_fn)(const void *src, size_t n, double off, double mult,
+                              double zero, double *dst);
+
+static int impl = -1;
+static row_float_fn row_float[2];   /* by sampleWidth - 1 */
+static row_double_fn row_double[2];
+
+/* scalar kernels, also used for the tails of the vector ones */
+
+static void row_float_i8_scalar(const void *src, size_t n, float off, float mult, float zero,
+                                float *dst)
+{
+    const int8_t *x = (const int8_t*)src;
+    size_t i;
+
+    for(i=0; i<n; i++) dst[i] = ((float)x[i] - off) * mult + zero;
+}
+
+static void row_float_i16_scalar(const void *src, size_t n, float off, float mult,
+                                 float zero, float *dst)
+{
+    const int16_t *x = (const int16_t*)src;
+    size_t i;
+
+    for(i=0; i<n; i++) dst[i] = ((float)x[i] - off) * mult + zero;
+}
+
+static void row_double_i8_scalar(const void *src, size_t n, double off, double mult,
+                                 double zero, double *dst)
+{
+    const int8_t *x = (const int8_t*)src;
+    size_t i;
+
+    for(i=0; i<n; i++) dst[i] = ((double)x[i] - off) * mult + zero;
+}
+
+static void row_double_i16_scalar(const void *src, size_t n, double off, double mult,
+                                  double zero, double *dst)
+{
+    const int16_t *x = (const int16_t*)src;
+    size_t i;
+
+    for(i=0; i<n; i++) dst[i] = ((double)x[i] - off) * mult + zero;
+}
+
+#ifdef CALIB_X86
+
+/* int16 to int32 in two halves, by interleaving with the sign */
+#define WIDEN16_LO(v) _mm_unpacklo_epi16(v, _mm_srai_epi16(v, 15))
+#define WIDEN16_HI(v) _mm_unpackhi_epi16(v, _mm_srai_epi16(v, 15))
+
+static inline __m128 scale_ps(__m128i v, __m128 off, __m128 mult, __m128 zero)
+{
+    return _mm_add_ps(_mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(v), off), mult), zero);
+}
+
+/* the low two int32 of v */
+static inline __m128d scale_pd(__m128i v, __m128d off, __m128d mult, __m128d zero)
+{
+    return _mm_add_pd(_mm_mul_pd(_mm_sub_pd(_mm_cvtepi32_pd(v), off), mult), zero);
+}
+
+static void row_float_i8_sse2(const void *src, size_t n, float off, float mult, float zero,
+                              float *dst)
+{
+    const int8_t *x = (const int8_t*)src;
+    __m128 o = _mm_set1_ps(off), m = _mm_set1_ps(mult), z = _mm_set1_ps(zero);
+    __m128i v, lo, hi;
+    size_t i;
+
+    for(i=0; i+16<=n; i+=16) {
+        v = _mm_loadu_si128((const __m128i*)(x + i));
+        /* int8 to int16 by putting the bytes in the high halves */
+        lo = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+        hi = _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+        _mm_storeu_ps(dst + i,      scale_ps(WIDEN16_LO(lo), o, m, z));
+        _mm_storeu_ps(dst + i + 4,  scale_ps(WIDEN16_HI(lo), o, m, z));
+        _mm_storeu_ps(dst + i + 8,  scale_ps(WIDEN16_LO(hi), o, m, z));
+        _mm_storeu_ps(dst + i + 12, scale_ps(WIDEN16_HI(hi), o, m, z));
+    }
+    row_float_i8_scalar(x + i, n - i, off, mult, zero, dst + i);
+}
+
+static void row_float_i16_sse2(const void *src, size_t n, float off, float mult,
+                               float zero, float *dst)
+{
+    const int16_t *x = (const int16_t*)src;
+    __m128 o = _mm_set1_ps(off), m = _mm_set1_ps(mult), z = _mm_set1_ps(zero);
+    __m128i v;
+    size_t i;
+
+    for(i=0; i+8<=n; i+=8) {
+        v = _mm_loadu_si128((const __m128i*)(x + i));
+        _mm_storeu_ps(dst + i,     scale_ps(WIDEN16_LO(v), o, m, z));
+        _mm_storeu_ps(dst + i + 4, scale_ps(WIDEN16_HI(v), o, m, z));
+    }
+    row_float_i16_scalar(x + i, n - i, off, mult, zero, dst + i);
+}
+
+static void row_double_i8_sse2(const void *src, size_t n, double off, double mult,
+                               double zero, double *dst)
+{
+    const int8_t *x = (const int8_t*)src;
+    __m128d o = _mm_set1_pd(off), m = _mm_set1_pd(mult), z = _mm_set1_pd(zero);
+    __m128i v, w;
+    size_t i;
+    int k;
+
+    for(i=0; i+8<=n; i+=8) {
+        v = _mm_loadl_epi64((const __m128i*)(x + i));
+        v = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+        w = WIDEN16_LO(v);
+        for(k=0; k<2; k++) {
+            _mm_storeu_pd(dst + i + 4*k,     scale_pd(w, o, m, z));
+            _mm_storeu_pd(dst + i + 4*k + 2, scale_pd(_mm_srli_si128(w, 8), o, m, z));
+            w = WIDEN16_HI(v);
+        }
+    }
+    row_double_i8_scalar(x + i, n - i, off, mult, zero, dst + i);
+}
+
+static void row_double_i16_sse2(const void *src, size_t n, double off, double mult,
+                                double zero, double *dst)
+{
+    const int16_t *x = (const int16_t*)src;
+    __m128d o = _mm_set1_pd(off), m = _mm_set1_pd(mult), z = _mm_set1_pd(zero);
+    __m128i v, w;
+    size_t i;
+    int k;
+
+    for(i=0; i+8<=n; i+=8) {
+        v = _mm_loadu_si128((const __m128i*)(x + i));
+        w = WIDEN16_LO(v);
+        for(k=0; k<2; k++) {
+            _mm_storeu_pd(dst + i + 4*k,     scale_pd(w, o, m, z));
+            _mm_storeu_pd(dst + i + 4*k + 2, scale_pd(_mm_srli_si128(w, 8), o, m, z));
+            w = WIDEN16_HI(v);
+        }
+    }
+    row_double_i16_scalar(x + i, n - i, off, mult, zero, dst + i);
+}
+
+/* plain avx2, no fma: the results must not depend on the kernel */
+
+__attribute__((target("avx2")))
+static inline __m256 scale256_ps(__m256i v, __m256 off, __m256 mult, __m256 zero)
+{
+    return _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(v), off), mult),
+                         zero);
+}
+
+__attribute__((target("avx2")))
+static inline __m256d scale256_pd(__m128i v, __m256d off, __m256d mult, __m256d zero)
+{
+    return _mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_cvtepi32_pd(v), off), mult),
+                         zero);
+}
+
+__attribute__((target("avx2")))
+static void row_float_i8_avx2(const void *src, size_t n, float off, float mult, float zero,
+                              float *dst)
+{
+    const int8_t *x = (const int8_t*)src;
+    __m256 o = _mm256_set1_ps(off), m = _mm256_set1_ps(mult), z = _mm256_set1_ps(zero);
+    __m128i v;
+    size_t i;
+    int k;
+
+    for(i=0; i+32<=n; i+=32) {
+        for(k=0; k<2; k++) {
+            v = _mm_loadu_si128((const __m128i*)(x + i + 16*k));
+            _mm256_storeu_ps(dst + i + 16*k, scale256_ps(_mm256_cvtepi8_epi32(v), o, m, z));
+            _mm256_storeu_ps(dst + i + 16*k + 8,
+                             scale256_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(v, 8)), o, m, z));
+        }
+    }
+    row_float_i8_scalar(x + i, n - i, off, mult, zero, dst + i);
+}
+
+__attribute__((target("avx2")))
+static void row_float_i16_avx2(const void *src, size_t n, float off, float mult,
+                               float zero, float *dst)
+{
+    const int16_t *x = (const int16_t*)src;
+    __m256 o = _mm256_set1_ps(off), m = _mm256_set1_ps(mult), z = _mm256_set1_ps(zero);
+    __m256i v;
+    size_t i;
+
+    for(i=0; i+16<=n; i+=16) {
+        v = _mm256_loadu_si256((const __m256i*)(x + i));
+        _mm256_storeu_ps(dst + i,
+                         scale256_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(v)), o, m, z));
+        _mm256_storeu_ps(dst + i + 8,
+                         scale256_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1)),
+                                     o, m, z));
+    }
+    row_float_i16_scalar(x + i, n - i, off, mult, zero, dst + i);
+}
+
+__attribute__((target("avx2")))
+static void row_double_i8_avx2(const void *src, size_t n, double off, double mult,
+                               double zero, double *dst)
+{
+    const int8_t *x = (const int8_t*)src;
+    __m256d o = _mm256_set1_pd(off), m = _mm256_set1_pd(mult), z = _mm256_set1_pd(zero);
+    __m256i w;
+    size_t i;
+
+    for(i=0; i+8<=n; i+=8) {
+        w = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(x + i)));
+        _mm256_storeu_pd(dst + i,     scale256_pd(_mm256_castsi256_si128(w), o, m, z));
+        _mm256_storeu_pd(dst + i + 4, scale256_pd(_mm256_extracti128_si256(w, 1), o, m, z));
+    }
+    row_double_i8_scalar(x + i, n - i, off, mult, zero, dst + i);
+}
+
+__attribute__((target("avx2")))
+static void row_double_i16_avx2(const void *src, size_t n, double off, double mult,
+                                double zero, double *dst)
+{
+    const int16_t *x = (const int16_t*)src;
+    __m256d o = _mm256_set1_pd(off), m = _mm256_set1_pd(mult), z = _mm256_set1_pd(zero);
+    __m256i w;
+    size_t i;
+
+    for(i=0; i+8<=n; i+=8) {
+        w = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(x + i)));
+        _mm256_storeu_pd(dst + i,     scale256_pd(_mm256_castsi256_si128(w), o, m, z));
+        _mm256_storeu_pd(dst + i + 4, scale256_pd(_mm256_extracti128_si256(w, 1), o, m, z));
+    }
+    row_double_i16_scalar(x + i, n - i, off, mult, zero, dst + i);
+}
+
+#endif /* CALIB_X86 */
+
+static int use_impl(int newImpl)
+{
+    switch(newImpl) {
+    case CALIB_SCALAR:
+        row_float[0] = row_float_i8_scalar;
+        row_float[1] = row_float_i16_scalar;
+        row_double[0] = row_double_i8_scalar;
+        row_double[1] = row_double_i16_scalar;
+        break;
+#ifdef CALIB_X86
+    case CALIB_SSE2:
+        row_float[0] = row_float_i8_sse2;
+        row_float[1] = row_float_i16_sse2;
+        row_double[0] = row_double_i8_sse2;
+        row_double[1] = row_double_i16_sse2;
+        break;
+    case CALIB_AVX2:
+        if(!__builtin_cpu_supports("avx2")) return -1;
+        row_float[0] = row_float_i8_avx2;
+        row_float[1] = row_float_i16_avx2;
+        row_double[0] = row_double_i8_avx2;
+        row_double[1] = row_double_i16_avx2;
+        break;
+#endif
+    default:
+        return -1;
+    }
+    impl = newImpl;
+    return 0;
+}
+
+static void pick_impl(void)
+{
+    int i;
+
+    for(i=CALIB_NIMPL-1; i>=0; i--)
+        if(use_impl(i) == 0) break;
+}
+
+/* the default is picked once, by whichever thread asks first */
+static pthread_once_t implOnce = PTHREAD_ONCE_INIT;
+
+int calib_set_impl(int newImpl)
+{
+    pthread_once(&implOnce, pick_impl);
+    return use_impl(newImpl);
+}
+
+int calib_get_impl(void)
+{
+    pthread_once(&implOnce, pick_impl);
+    return impl;
+}
+
+const char *calib_impl_name(int i)
+{
+    static const char *names[CALIB_NIMPL] = {"scalar", "sse2", "avx2"};
+
+    if(i < 0 || i >= CALIB_NIMPL) return NULL;
+    return names[i];
+}
+
+static size_t frame_size(const struct waveform_attribute *wavAttr)
+{
+    return wavAttr->nFrames > 0 ? wavAttr->nPt / wavAttr->nFrames : wavAttr->nPt;
+}
+
+/* the time axis is the same for every frame: the first frame is
+ * computed and copied to the others */
+void calib_event_float(const struct waveform_attribute *wavAttr, const char *wavBuf,
+                       float *out, float *t)
+{
+    size_t i, j, iCh, nPt = wavAttr->nPt, width = wavAttr->sampleWidth == 2 ? 2 : 1;
+    size_t frameSize = frame_size(wavAttr);
+
+    calib_get_impl();
+    j = 0;
+    for(iCh=0; iCh<SCOPE_NCH; iCh++) {
+        if(!((1u << iCh) & wavAttr->chMask)) continue;
+        row_float[width - 1](wavBuf + j * nPt * width, nPt, (float)wavAttr->yoff[iCh],
+                             (float)wavAttr->ymult[iCh], (float)wavAttr->yzero[iCh],
+                             out + j * nPt);
+        j++;
+    }
+    if(t == NULL || frameSize == 0) return;
+    for(i=0; i<frameSize; i++) t[i] = (float)(wavAttr->dt * i);
+    for(i=frameSize; i+frameSize<=nPt; i+=frameSize) memcpy(t + i, t, frameSize * sizeof(*t));
+    for(; i<nPt; i++) t[i] = t[i % frameSize];
+}
+
+void calib_event_double(const struct waveform_attribute *wavAttr, const char *wavBuf,
+                        double *out, double *t)
+{
+    size_t i, j, iCh, nPt = wavAttr->nPt, width = wavAttr->sampleWidth == 2 ? 2 : 1;
+    size_t frameSize = frame_size(wavAttr);
+
+    calib_get_impl();
+    j = 0;
+    for(iCh=0; iCh<SCOPE_NCH; iCh++) {
+        if(!((1u << iCh) & wavAttr->chMask)) continue;
+        row_double[width - 1](wavBuf + j * nPt * width, nPt, wavAttr->yoff[iCh],
+                              wavAttr->ymult[iCh], wavAttr->yzero[iCh], out + j * nPt);
+        j++;
+    }
+    if(t == NULL || frameSize == 0) return;
+    for(i=0; i<frameSize; i++) t[i] = wavAttr->dt * i;
+    for(i=frameSize; i+frameSize<=nPt; i+=frameSize) memcpy(t + i, t, frameSize * sizeof(*t));
+    for(; i<nPt; i++) t[i] = t[i % frameSize];
+}
@@ -0,0 +1,39 @@
+#ifndef __CALIB_H__
+#define __CALIB_H__
+
+#include <stddef.h>
+#include "common.h"
+
+/* Conversion of the raw samples of an event to volts,
+ * (raw - yoff[ch]) * ymult[ch] + yzero[ch] with the calibration in the
+ * waveform attribute.  The kernels are SSE2 and AVX2 with a scalar
+ * fallback; they do the same operations in the same order (no fused
+ * multiply-add), so all give bit for bit the same results.  float
+ * output is computed in float, double output in double. */
+
+enum {
+    CALIB_SCALAR = 0,
+    CALIB_SSE2,
+    CALIB_AVX2,
+    CALIB_NIMPL
+};
+
+/* picks the kernels, returns -1 when the cpu can not run them.  The
+ * default is the best one available.  Call it before any thread uses
+ * the kernels. */
+int calib_set_impl(int impl);
+int calib_get_impl(void);
+const char *calib_impl_name(int impl);
+
+/* wavBuf is an event as hdf5io reads it: a row of wavAttr->nPt samples
+ * of wavAttr->sampleWidth bytes for each channel in wavAttr->chMask,
+ * lowest channel first.  out gets the same rows in volts.  If t is not
+ * NULL it also gets the time axis of a row, nPt values of (i % frameSize)
+ * * dt, i.e. the time from the start of the FastFrame frame (of the
+ * event when nFrames is 0). */
+void calib_event_float(const struct waveform_attribute *wavAttr, const char *wavBuf,
+                       float *out, float *t);
+void calib_event_double(const struct waveform_attribute *wavAttr, const char *wavBuf,
+                        double *out, double *t);
+
+#endif /* __CALIB_H__ */
@@ -11,6 +11,7 @@ struct waveform_attribute
     unsigned int chMask;
     size_t nPt; /* number of points in each event */
     size_t nFrames; /* number of Fast Frames in each event, 0 means off */
+    size_t sampleWidth; /* bytes per sample, 1 or 2 (WFMOutpre:BYT_Nr) */
     double dt;
     double t0;
     double ymult[SCOPE_NCH];
@@ -0,0 +1,343 @@
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "deltacodec.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DELTACODEC_X86
+#endif
+
+#define PLANE_BYTES (DELTACODEC_BLOCK / 8)
+#define HEADER_BYTES 4
+
+/* expandLut[v] has bit j of v in the lowest bit of byte j */
+#define X1(v) ((((uint64_t)(v) >> 0) & 1)       | ((((uint64_t)(v) >> 1) & 1) << 8)  \
+               | ((((uint64_t)(v) >> 2) & 1) << 16) | ((((uint64_t)(v) >> 3) & 1) << 24) \
+               | ((((uint64_t)(v) >> 4) & 1) << 32) | ((((uint64_t)(v) >> 5) & 1) << 40) \
+               | ((((uint64_t)(v) >> 6) & 1) << 48) | ((((uint64_t)(v) >> 7) & 1) << 56))
+#define X4(v) X1(v), X1(v + 1), X1(v + 2), X1(v + 3)
+#define X16(v) X4(v), X4(v + 4), X4(v + 8), X4(v + 12)
+#define X64(v) X16(v), X16(v + 16), X16(v + 32), X16(v + 48)
+static const uint64_t expandLut[256] = {X64(0), X64(64), X64(128), X64(192)};
+
+typedef size_t (*encode_block_fn)(const uint8_t *x, uint8_t prev, uint8_t *out);
+typedef void (*decode_block_fn)(const uint8_t *in, unsigned w, uint8_t prev, uint8_t *x);
+
+static int impl = -1;
+static encode_block_fn encode_block;
+static decode_block_fn decode_block;
+
+static unsigned bit_width(unsigned v)
+{
+    return v ? 32 - __builtin_clz(v) : 0;
+}
+
+/* scalar kernels, 8 samples at a time in a uint64_t */
+
+static size_t encode_block_scalar(const uint8_t *x, uint8_t prev, uint8_t *out)
+{
+    uint8_t z[DELTACODEC_BLOCK];
+    uint64_t v;
+    unsigned i, b, w, all = 0;
+    int8_t d;
+
+    for(i=0; i<DELTACODEC_BLOCK; i++) {
+        d = (int8_t)(x[i] - prev);
+        prev = x[i];
+        z[i] = (uint8_t)((d << 1) ^ (d >> 7)); /* zigzag */
+        all |= z[i];
+    }
+    w = bit_width(all);
+    out[0] = w;
+    for(b=0; b<w; b++) {
+        for(i=0; i<PLANE_BYTES; i++) {
+            memcpy(&v, z + 8*i, 8);
+            /* gathers the lowest bit of each byte into the top byte */
+            out[1 + b * PLANE_BYTES + i] =
+                (uint8_t)((((v >> b) & 0x0101010101010101ULL) * 0x0102040810204080ULL) >> 56);
+        }
+    }
+    return 1 + w * PLANE_BYTES;
+}
+
+static void decode_block_scalar(const uint8_t *in, unsigned w, uint8_t prev, uint8_t *x)
+{
+    uint64_t v;
+    unsigned i, b;
+    uint8_t z;
+
+    for(i=0; i<PLANE_BYTES; i++) {
+        v = 0;
+        for(b=0; b<w; b++)
+            v |= expandLut[in[b * PLANE_BYTES + i]] << b;
+        memcpy(x + 8*i, &v, 8);
+    }
+    for(i=0; i<DELTACODEC_BLOCK; i++) {
+        z = x[i];
+        prev += (uint8_t)((z >> 1) ^ -(z & 1));
+        x[i] = prev;
+    }
+}
+
+#ifdef DELTACODEC_X86
+
+/* zigzag of the byte differences of x, prev is the sample before x[0] */
+static inline __m128i delta_sse2(__m128i x, uint8_t prev)
+{
+    __m128i d, sign;
+
+    d = _mm_sub_epi8(x, _mm_or_si128(_mm_slli_si128(x, 1), _mm_cvtsi32_si128(prev)));
+    sign = _mm_cmpgt_epi8(_mm_setzero_si128(), d);
+    return _mm_xor_si128(_mm_add_epi8(d, d), sign);
+}
+
+/* inverse zigzag, then running sum starting from *carry, which is
+ * updated to the broadcast last sample */
+static inline __m128i undelta_sse2(__m128i z, __m128i *carry)
+{
+    __m128i d, t;
+
+    d = _mm_xor_si128(_mm_and_si128(_mm_srli_epi16(z, 1), _mm_set1_epi8(0x7f)),
+                      _mm_sub_epi8(_mm_setzero_si128(), _mm_and_si128(z, _mm_set1_epi8(1))));
+    d = _mm_add_epi8(d, _mm_slli_si128(d, 1));
+    d = _mm_add_epi8(d, _mm_slli_si128(d, 2));
+    d = _mm_add_epi8(d, _mm_slli_si128(d, 4));
+    d = _mm_add_epi8(d, _mm_slli_si128(d, 8));
+    d = _mm_add_epi8(d, *carry);
+    t = _mm_srli_si128(d, 15);
+    t = _mm_unpacklo_epi8(t, t);
+    t = _mm_unpacklo_epi16(t, t);
+    *carry = _mm_shuffle_epi32(t, 0);
+    return d;
+}
+
+static size_t encode_block_sse2(const uint8_t *x, uint8_t prev, uint8_t *out)
+{
+    __m128i z[DELTACODEC_BLOCK / 16], all;
+    unsigned i, b, w;
+    uint16_t m;
+
+    all = _mm_setzero_si128();
+    for(i=0; i<DELTACODEC_BLOCK/16; i++) {
+        z[i] = delta_sse2(_mm_loadu_si128((const __m128i*)(x + 16*i)), prev);
+        prev = x[16*i + 15];
+        all = _mm_or_si128(all, z[i]);
+    }
+    /* or of all 16 bytes */
+    all = _mm_or_si128(all, _mm_srli_si128(all, 8));
+    all = _mm_or_si128(all, _mm_srli_si128(all, 4));
+    all = _mm_or_si128(all, _mm_srli_si128(all, 2));
+    all = _mm_or_si128(all, _mm_srli_si128(all, 1));
+    w = bit_width(_mm_cvtsi128_si32(all) & 0xff);
+    out[0] = w;
+    for(b=0; b<w; b++) {
+        for(i=0; i<DELTACODEC_BLOCK/16; i++) {
+            /* bit b to the top of each byte; what the 16 bit shift
+             * carries over from the neighbouring byte stays below */
+            m = (uint16_t)_mm_movemask_epi8(_mm_slli_epi16(z[i], 7 - b));
+            memcpy(out + 1 + b * PLANE_BYTES + 2*i, &m, 2);
+        }
+    }
+    return 1 + w * PLANE_BYTES;
+}
+
+static void decode_block_sse2(const uint8_t *in, unsigned w, uint8_t prev, uint8_t *x)
+{
+    __m128i z, carry;
+    unsigned i, b;
+
+    carry = _mm_set1_epi8(prev);
+    for(i=0; i<DELTACODEC_BLOCK/16; i++) {
+        z = _mm_setzero_si128();
+        for(b=0; b<w; b++)
+            z = _mm_or_si128(z, _mm_slli_epi16(
+                                 _mm_set_epi64x(expandLut[in[b * PLANE_BYTES + 2*i + 1]],
+                                                expandLut[in[b * PLANE_BYTES + 2*i]]), b));
+        _mm_storeu_si128((__m128i*)(x + 16*i), undelta_sse2(z, &carry));
+    }
+}
+
+__attribute__((target("avx2")))
+static size_t encode_block_avx2(const uint8_t *x, uint8_t prev, uint8_t *out)
+{
+    __m256i z[DELTACODEC_BLOCK / 32], v, d, sign, all;
+    __m128i a;
+    unsigned i, b, w;
+    uint32_t m;
+
+    all = _mm256_setzero_si256();
+    for(i=0; i<DELTACODEC_BLOCK/32; i++) {
+        v = _mm256_loadu_si256((const __m256i*)(x + 32*i));
+        /* v moved up by one byte across the lanes, prev in byte 0 */
+        d = _mm256_alignr_epi8(v, _mm256_permute2x128_si256(v, v, 0x08), 15);
+        d = _mm256_sub_epi8(v, _mm256_insert_epi8(d, (char)prev, 0));
+        prev = x[32*i + 31];
+        sign = _mm256_cmpgt_epi8(_mm256_setzero_si256(), d);
+        z[i] = _mm256_xor_si256(_mm256_add_epi8(d, d), sign);
+        all = _mm256_or_si256(all, z[i]);
+    }
+    a = _mm_or_si128(_mm256_castsi256_si128(all), _mm256_extracti128_si256(all, 1));
+    a = _mm_or_si128(a, _mm_srli_si128(a, 8));
+    a = _mm_or_si128(a, _mm_srli_si128(a, 4));
+    a = _mm_or_si128(a, _mm_srli_si128(a, 2));
+    a = _mm_or_si128(a, _mm_srli_si128(a, 1));
+    w = bit_width(_mm_cvtsi128_si32(a) & 0xff);
+    out[0] = w;
+    for(b=0; b<w; b++) {
+        for(i=0; i<DELTACODEC_BLOCK/32; i++) {
+            m = (uint32_t)_mm256_movemask_epi8(_mm256_slli_epi16(z[i], 7 - b));
+            memcpy(out + 1 + b * PLANE_BYTES + 4*i, &m, 4);
+        }
+    }
+    return 1 + w * PLANE_BYTES;
+}
+
+__attribute__((target("avx2")))
+static void decode_block_avx2(const uint8_t *in, unsigned w, uint8_t prev, uint8_t *x)
+{
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bits = _mm256_set1_epi64x(0x8040201008040201LL);
+    __m256i z, t;
+    __m128i carry;
+    unsigned i, b;
+    uint32_t m;
+
+    carry = _mm_set1_epi8(prev);
+    for(i=0; i<DELTACODEC_BLOCK/32; i++) {
+        z = _mm256_setzero_si256();
+        for(b=0; b<w; b++) {
+            memcpy(&m, in + b * PLANE_BYTES + 4*i, 4);
+            /* byte j of the 32 gets bit j of m */
+            t = _mm256_shuffle_epi8(_mm256_set1_epi32(m), spread);
+            t = _mm256_cmpeq_epi8(_mm256_and_si256(t, bits), bits);
+            z = _mm256_or_si256(z, _mm256_and_si256(t, _mm256_set1_epi8(1 << b)));
+        }
+        _mm_storeu_si128((__m128i*)(x + 32*i),
+                         undelta_sse2(_mm256_castsi256_si128(z), &carry));
+        _mm_storeu_si128((__m128i*)(x + 32*i + 16),
+                         undelta_sse2(_mm256_extracti128_si256(z, 1), &carry));
+    }
+}
+
+#endif /* DELTACODEC_X86 */
+
+static int use_impl(int newImpl)
+{
+    switch(newImpl) {
+    case DELTACODEC_SCALAR:
+        encode_block = encode_block_scalar;
+        decode_block = decode_block_scalar;
+        break;
+#ifdef DELTACODEC_X86
+    case DELTACODEC_SSE2:
+        encode_block = encode_block_sse2;
+        decode_block = decode_block_sse2;
+        break;
+    case DELTACODEC_AVX2:
+        if(!__builtin_cpu_supports("avx2")) return -1;
+        encode_block = encode_block_avx2;
+        decode_block = decode_block_avx2;
+        break;
+#endif
+    default:
+        return -1;
+    }
+    impl = newImpl;
+    return 0;
+}
+
+static void pick_impl(void)
+{
+    int i;
+
+    for(i=DELTACODEC_NIMPL-1; i>=0; i--)
+        if(use_impl(i) == 0) break;
+}
+
+/* the default is picked once, by whichever thread asks first */
+static pthread_once_t implOnce = PTHREAD_ONCE_INIT;
+
+int deltacodec_set_impl(int newImpl)
+{
+    pthread_once(&implOnce, pick_impl);
+    return use_impl(newImpl);
+}
+
+int deltacodec_get_impl(void)
+{
+    pthread_once(&implOnce, pick_impl);
+    return impl;
+}
+
+const char *deltacodec_impl_name(int i)
+{
+    static const char *names[DELTACODEC_NIMPL] = {"scalar", "sse2", "avx2"};
+
+    if(i < 0 || i >= DELTACODEC_NIMPL) return NULL;
+    return names[i];
+}
+
+size_t deltacodec_bound(size_t n)
+{
+    return HEADER_BYTES + (n + DELTACODEC_BLOCK - 1) / DELTACODEC_BLOCK
+        * (1 + 8 * PLANE_BYTES);
+}
+
+size_t deltacodec_encode(const char *src, size_t n, char *dst)
+{
+    const uint8_t *x = (const uint8_t*)src;
+    uint8_t *out = (uint8_t*)dst, tail[DELTACODEC_BLOCK], prev = 0;
+    size_t i, k;
+
+    deltacodec_get_impl();
+    for(k=0; k<HEADER_BYTES; k++) out[k] = (uint8_t)(n >> (8*k));
+    out += HEADER_BYTES;
+    for(i=0; i+DELTACODEC_BLOCK<=n; i+=DELTACODEC_BLOCK) {
+        out += encode_block(x + i, prev, out);
+        prev = x[i + DELTACODEC_BLOCK - 1];
+    }
+    if(i < n) { /* padded with the last sample, i.e. zero residuals */
+        memcpy(tail, x + i, n - i);
+        memset(tail + (n - i), x[n-1], DELTACODEC_BLOCK - (n - i));
+        out += encode_block(tail, prev, out);
+    }
+    return out - (uint8_t*)dst;
+}
+
+size_t deltacodec_decoded_size(const char *src, size_t srcLen)
+{
+    const uint8_t *in = (const uint8_t*)src;
+    size_t n = 0, k;
+
+    if(srcLen < HEADER_BYTES) return 0;
+    for(k=0; k<HEADER_BYTES; k++) n |= (size_t)in[k] << (8*k);
+    return n;
+}
+
+int deltacodec_decode(const char *src, size_t srcLen, char *dst)
+{
+    const uint8_t *in = (const uint8_t*)src + HEADER_BYTES, *end = (const uint8_t*)src + srcLen;
+    uint8_t *x = (uint8_t*)dst, tail[DELTACODEC_BLOCK], prev = 0;
+    size_t i, n;
+    unsigned w;
+
+    deltacodec_get_impl();
+    n = deltacodec_decoded_size(src, srcLen);
+    if(srcLen < HEADER_BYTES) return -1;
+    for(i=0; i<n; i+=DELTACODEC_BLOCK) {
+        if(in >= end) return -1;
+        w = in[0];
+        if(w > 8 || (size_t)(end - in) < 1 + w * PLANE_BYTES) return -1;
+        if(i + DELTACODEC_BLOCK <= n) {
+            decode_block(in + 1, w, prev, x + i);
+        } else {
+            decode_block(in + 1, w, prev, tail);
+            memcpy(x + i, tail, n - i);
+        }
+        prev = x[i + DELTACODEC_BLOCK - 1 < n ? i + DELTACODEC_BLOCK - 1 : n - 1];
+        in += 1 + w * PLANE_BYTES;
+    }
+    return 0;
+}
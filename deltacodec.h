@@ -0,0 +1,43 @@
+#ifndef __DELTACODEC_H__
+#define __DELTACODEC_H__
+
+#include <stddef.h>
+
+/* Lossless codec for 8-bit waveforms.  Each sample is replaced by its
+ * difference to the previous one, zigzag mapped so that small negative
+ * and positive steps are both small numbers, and the residuals are
+ * bit-packed in blocks of DELTACODEC_BLOCK samples: one byte holding
+ * the bit width w of the largest residual in the block, then w
+ * bit-planes of DELTACODEC_BLOCK/8 bytes (plane b has bit b of every
+ * residual, sample i at bit i%8 of byte i/8).  The stream starts with
+ * the sample count as 4 bytes little endian.  The kernels are SSE2 and
+ * AVX2 with a scalar fallback; all produce the same stream. */
+
+#define DELTACODEC_BLOCK 128
+
+enum {
+    DELTACODEC_SCALAR = 0,
+    DELTACODEC_SSE2,
+    DELTACODEC_AVX2,
+    DELTACODEC_NIMPL
+};
+
+/* picks the kernels, returns -1 when the cpu can not run them.  The
+ * default is the best one available.  Call it before any thread uses
+ * the kernels. */
+int deltacodec_set_impl(int impl);
+int deltacodec_get_impl(void);
+const char *deltacodec_impl_name(int impl);
+
+/* largest stream n samples may need */
+size_t deltacodec_bound(size_t n);
+/* encodes n samples of src into dst, which must hold
+ * deltacodec_bound(n) bytes; returns the stream length */
+size_t deltacodec_encode(const char *src, size_t n, char *dst);
+/* number of samples a stream decodes to, 0 if srcLen is too short */
+size_t deltacodec_decoded_size(const char *src, size_t srcLen);
+/* decodes a stream into dst, which must hold deltacodec_decoded_size()
+ * bytes; returns 0, or -1 if the stream is corrupt or truncated */
+int deltacodec_decode(const char *src, size_t srcLen, char *dst);
+
+#endif /* __DELTACODEC_H__ */
@@ -0,0 +1,44 @@
+#include <string.h>
+#include <math.h>
+#include "evfeatures.h"
+#include "wavstat.h"
+
+void evfeatures_event(const struct waveform_attribute *wavAttr, size_t nCh, size_t nBase,
+                      const char *wavBuf, struct hdf5io_features *row)
+{
+    size_t j, iCh, iPeak, nPt = wavAttr->nPt, w = wavAttr->sampleWidth == 2 ? 2 : 1;
+    size_t frameSize = wavAttr->nFrames > 0 ? nPt / wavAttr->nFrames : nPt;
+    const char *x;
+    double base, var, ymult;
+    int min, max, peak;
+
+    if(nBase > nPt) nBase = nPt;
+    if(nBase == 0) nBase = 1;
+    memset(row->baseline, 0, sizeof(row->baseline));
+    memset(row->rms, 0, sizeof(row->rms));
+    memset(row->amplitude, 0, sizeof(row->amplitude));
+    memset(row->peakTime, 0, sizeof(row->peakTime));
+    memset(row->integral, 0, sizeof(row->integral));
+    for(j=0, iCh=0; iCh<SCOPE_NCH && j<nCh; iCh++) {
+        if(!((1u << iCh) & wavAttr->chMask)) continue;
+        x = wavBuf + j * nPt * w;
+        ymult = wavAttr->ymult[iCh];
+        base = (double)wavstat_sum(x, w, nBase) / nBase;
+        var = (double)wavstat_sum_squares(x, w, nBase) / nBase - base * base;
+        wavstat_min_max(x, w, nPt, &min, &max);
+        /* the first sample at the extreme is the first one past it by 1 */
+        if(base - min > max - base) {
+            peak = min;
+            iPeak = wavstat_find_below(x, w, nPt, min + 1);
+        } else {
+            peak = max;
+            iPeak = wavstat_find_above(x, w, nPt, max - 1);
+        }
+        row->baseline[j] = (base - wavAttr->yoff[iCh]) * ymult + wavAttr->yzero[iCh];
+        row->rms[j] = sqrt(var > 0 ? var : 0) * fabs(ymult);
+        row->amplitude[j] = (peak - base) * ymult;
+        row->peakTime[j] = (iPeak % frameSize) * wavAttr->dt;
+        row->integral[j] = (wavstat_sum(x, w, nPt) - base * nPt) * ymult * wavAttr->dt;
+        j++;
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef __EVFEATURES_H__
+#define __EVFEATURES_H__
+
+#include <stddef.h>
+#include "common.h"
+#include "hdf5io.h"
+
+/* The per-event features of the HDF5IO_FEATURE_DATASET table, from the
+ * raw samples with the wavstat.c kernels.  Per stored channel:
+ * the baseline is the mean of the first nBase samples of the event
+ * and rms their spread about it; amplitude is the sample furthest from
+ * the baseline (the first one of them) minus the baseline, < 0 for
+ * negative pulses, and peakTime its time from the start of its
+ * FastFrame frame, as wavedump's time axis has it; integral is
+ * sum(v - baseline) * dt over all samples of the event. */
+
+/* wavBuf is an event as hdf5io reads it, nCh rows of wavAttr->nPt
+ * samples; row gets everything but eventId */
+void evfeatures_event(const struct waveform_attribute *wavAttr, size_t nCh, size_t nBase,
+                      const char *wavBuf, struct hdf5io_features *row);
+
+#endif /* __EVFEATURES_H__ */
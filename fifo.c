@@ -2,6 +2,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#ifdef __linux
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 #include "fifo.h"
 
 #ifndef min
@@ -12,52 +17,103 @@
 #define max(a, b) ((a) >= (b) ? (a) : (b))
 #endif
 
-/* The number of spins to do before performing an expensive
- kernel-mode context switch. This is a nice easy value to tweak for
- your application's needs.  Set it to 0 if you want the implementation
- to decide, a low number if you are copying many objects into pipes at
- once (or a few large objects), and a high number if you are coping
- small or few objects into pipes at once.*/
-#define MUTEX_SPINS 8192
-static void mutex_lock(pthread_mutex_t* m)
+/* The number of times to re-check the other side before going to
+ * sleep in the kernel.  Data usually arrives in bursts, so a short
+ * spin saves most of the futex round trips without burning a core
+ * while the ring stays empty (or full). */
+#define FIFO_SPINS 256
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() ((void)0)
+#endif
+
+#define load_acquire(p)     atomic_load_explicit(p, memory_order_acquire)
+#define load_relaxed(p)     atomic_load_explicit(p, memory_order_relaxed)
+#define store_release(p, v) atomic_store_explicit(p, v, memory_order_release)
+
+#ifdef __linux
+static void seq_wait(struct fifo_t *fifo, _Atomic uint32_t *seq, uint32_t val)
 {
-    size_t i;
-    
-    for(i = 0; i < MUTEX_SPINS; i++)
-        if(pthread_mutex_trylock(m) == 0)
-            return;
+    syscall(SYS_futex, (uint32_t*)seq, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void seq_wake(struct fifo_t *fifo, _Atomic uint32_t *seq)
+{
+    atomic_fetch_add(seq, 1);
+    syscall(SYS_futex, (uint32_t*)seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+#else
+static void seq_wait(struct fifo_t *fifo, _Atomic uint32_t *seq, uint32_t val)
+{
+    pthread_mutex_lock(&(fifo->lock));
+    while(atomic_load(seq) == val)
+        pthread_cond_wait(&(fifo->wake), &(fifo->lock));
+    pthread_mutex_unlock(&(fifo->lock));
+}
 
-    pthread_mutex_lock(m);
+static void seq_wake(struct fifo_t *fifo, _Atomic uint32_t *seq)
+{
+    pthread_mutex_lock(&(fifo->lock));
+    atomic_fetch_add(seq, 1);
+    pthread_cond_broadcast(&(fifo->wake));
+    pthread_mutex_unlock(&(fifo->lock));
 }
-#define mutex_unlock pthread_mutex_unlock
+#endif
 
-/* runs some code while automatically locking and unlocking the
-   pipe. If `break' is used, the pipe will be unlocked before control
-   returns from the macro. */
-#define WHILE_LOCKED(body) do {                 \
-        mutex_lock(&(fifo->lock));              \
-        do { body; } while(0);                  \
-        mutex_unlock(&(fifo->lock));            \
+/* Blocks until cond holds.  Raising the waiting flag, a full fence and
+ * re-checking cond pairs with the publish, fence, check-flag sequence
+ * in the other side's wake_other(), so a wake-up cannot be lost between
+ * the check and the sleep. */
+#define WAIT_UNTIL(cond, seq, waiting) do {                             \
+        size_t spin_;                                                   \
+        uint32_t seqVal_;                                               \
+        for(spin_ = 0; !(cond) && spin_ < FIFO_SPINS; spin_++)          \
+            cpu_relax();                                                \
+        while(!(cond)) {                                                \
+            seqVal_ = atomic_load(&(fifo->seq));                        \
+            atomic_store(&(fifo->waiting), 1);                          \
+            atomic_thread_fence(memory_order_seq_cst);                  \
+            if(!(cond))                                                 \
+                seq_wait(fifo, &(fifo->seq), seqVal_);                  \
+            atomic_store(&(fifo->waiting), 0);                          \
+        }                                                               \
     } while(0)
 
-#define cond_signal    pthread_cond_signal
-#define cond_broadcast pthread_cond_broadcast
-#define cond_wait      pthread_cond_wait
+/* Taking the flag down here means a sleeper is woken once, not on
+ * every push/pop that happens before it gets scheduled again. */
+static void wake_other(struct fifo_t *fifo, _Atomic int *waiting, _Atomic uint32_t *seq)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(waiting, memory_order_relaxed) &&
+       atomic_exchange(waiting, 0))
+        seq_wake(fifo, seq);
+}
 
 struct fifo_t *fifo_init(size_t n)
 {
     struct fifo_t *fifo;
-    fifo = (struct fifo_t*)malloc(sizeof(struct fifo_t));
-    fifo->buf = (char*)malloc(sizeof(char)*n);
-    fifo->n = n;
-    fifo->bufend = fifo->buf + n;
-    fifo->head = fifo->buf;
-    fifo->tail = fifo->buf;
+    size_t cap;
 
+    for(cap = 1; cap < n; cap <<= 1) ;
+    if(posix_memalign((void**)&fifo, FIFO_CACHE_LINE, sizeof(struct fifo_t)) != 0)
+        return NULL;
+    memset(fifo, 0, sizeof(struct fifo_t));
+    fifo->buf = (char*)malloc(sizeof(char)*cap);
+    fifo->n = cap;
+    fifo->mask = cap - 1;
+    atomic_init(&(fifo->head), 0);
+    atomic_init(&(fifo->tail), 0);
+    atomic_init(&(fifo->pushSeq), 0);
+    atomic_init(&(fifo->popSeq), 0);
+    atomic_init(&(fifo->pushWaiting), 0);
+    atomic_init(&(fifo->popWaiting), 0);
+    atomic_init(&(fifo->eof), 0);
+#ifndef __linux
     pthread_mutex_init(&(fifo->lock), NULL);
-    pthread_cond_init(&(fifo->push), NULL);
-    pthread_cond_init(&(fifo->pop), NULL);
-    
+    pthread_cond_init(&(fifo->wake), NULL);
+#endif
     return fifo;
 }
 
@@ -65,111 +121,118 @@ int fifo_close(struct fifo_t *fifo)
 {
     if(fifo) {
         if(fifo->buf) free(fifo->buf);
-
+#ifndef __linux
         pthread_mutex_destroy(&(fifo->lock));
-        pthread_cond_destroy(&(fifo->push));
-        pthread_cond_destroy(&(fifo->pop));
-        
+        pthread_cond_destroy(&(fifo->wake));
+#endif
         free(fifo);
         return 0;
     }
     return -1;
 }
 
+/* fills iov with the (up to two) spans of len bytes starting at
+ * counter position pos */
+static int ring_spans(struct fifo_t *fifo, size_t pos, size_t len, struct iovec *iov)
+{
+    size_t off, first;
+
+    off = pos & fifo->mask;
+    first = min(len, fifo->n - off);
+    iov[0].iov_base = fifo->buf + off;
+    iov[0].iov_len = first;
+    if(first == len)
+        return 1;
+    iov[1].iov_base = fifo->buf;
+    iov[1].iov_len = len - first;
+    return 2;
+}
+
+int fifo_reserve(struct fifo_t *fifo, struct iovec *iov, size_t nMin)
+{
+    size_t tail;
+
+    tail = load_relaxed(&(fifo->tail));
+    if(fifo->n - (tail - fifo->headCache) < nMin) {
+        WAIT_UNTIL(fifo->n - (tail - (fifo->headCache = load_acquire(&(fifo->head)))) >= nMin,
+                   popSeq, pushWaiting);
+    }
+    return ring_spans(fifo, tail, fifo->n - (tail - fifo->headCache), iov);
+}
+
+void fifo_commit(struct fifo_t *fifo, size_t n)
+{
+    store_release(&(fifo->tail), load_relaxed(&(fifo->tail)) + n);
+    wake_other(fifo, &(fifo->popWaiting), &(fifo->pushSeq));
+}
+
+int fifo_peek(struct fifo_t *fifo, struct iovec *iov)
+{
+    size_t head;
+
+    head = load_relaxed(&(fifo->head));
+    if(fifo->tailCache == head) {
+        WAIT_UNTIL((fifo->tailCache = load_acquire(&(fifo->tail))) != head
+                   || load_acquire(&(fifo->eof)), pushSeq, popWaiting);
+        /* eof is set after the last commit, so tail is final now */
+        if(fifo->tailCache == head && (fifo->tailCache = load_acquire(&(fifo->tail))) == head)
+            return 0;
+    }
+    return ring_spans(fifo, head, fifo->tailCache - head, iov);
+}
+
+void fifo_release(struct fifo_t *fifo, size_t n)
+{
+    store_release(&(fifo->head), load_relaxed(&(fifo->head)) + n);
+    wake_other(fifo, &(fifo->pushWaiting), &(fifo->popSeq));
+}
+
+void fifo_set_eof(struct fifo_t *fifo)
+{
+    store_release(&(fifo->eof), 1);
+    wake_other(fifo, &(fifo->popWaiting), &(fifo->pushSeq));
+}
+
 ssize_t fifo_push(struct fifo_t *fifo, char *buf, size_t n)
 {
-    size_t ret = 0, rem;
+    struct iovec iov[2];
 
-    if(n > (fifo->n - 1))
+    if(n > fifo->n)
         return -1;
 
-    WHILE_LOCKED(
-        while(1) {
-            if(fifo->tail < fifo->head) /* wrapped around */
-                rem = fifo->head - fifo->tail - 1;
-            else
-                rem = (fifo->head - fifo->buf - 1) + (fifo->bufend - fifo->tail);
-            if(rem < n)
-                cond_wait(&(fifo->pop), &(fifo->lock));
-            else
-                break;
-        }
-
-        if(fifo->tail < fifo->head) { /* wrapped around */
-            if(fifo->head - fifo->tail - 1 >= n) {
-                memcpy(fifo->tail, buf, n);
-                fifo->tail += n;
-                ret = n;
-            } else { /* not enough space */
-                ret = 0;
-            }
-        } else {
-            rem = fifo->bufend - fifo->tail;
-            if(rem > n) {
-                memcpy(fifo->tail, buf, n);
-                fifo->tail += n;
-                ret = n;
-            } else if(rem + (fifo->head - fifo->buf - 1) >= n) { /* need to wrap around */
-                memcpy(fifo->tail, buf, rem);
-                memcpy(fifo->buf, buf+rem, n-rem);
-                fifo->tail = fifo->buf + n-rem;
-                ret = n;
-            } else { /* not enough space */
-                ret = 0;
-            }
-        });
-    if(ret>0)
-        cond_signal(&(fifo->push));
-    return ret;
+    if(fifo_reserve(fifo, iov, n) == 1 || iov[0].iov_len >= n) {
+        memcpy(iov[0].iov_base, buf, n);
+    } else {
+        memcpy(iov[0].iov_base, buf, iov[0].iov_len);
+        memcpy(iov[1].iov_base, buf + iov[0].iov_len, n - iov[0].iov_len);
+    }
+    fifo_commit(fifo, n);
+    return n;
 }
 
 size_t fifo_pop(struct fifo_t *fifo, char *buf, size_t n)
 {
-    size_t ret = 0, toCopy, rem;
-    WHILE_LOCKED(
-        while(1) {
-            if(fifo->tail < fifo->head) /* wrapped around */
-                rem = (fifo->bufend - fifo->head) + (fifo->tail - fifo->buf);
-            else
-                rem = fifo->tail - fifo->head;
-            if(rem < 1) /* wait while fifo is empty */
-                cond_wait(&(fifo->push), &(fifo->lock));
-            else
-                break;
-        }
+    struct iovec iov[2];
+    size_t ret;
+    int nSpans;
 
-        if(fifo->tail < fifo->head) { /* wrapped around */
-            toCopy = min(fifo->bufend - fifo->head, n);
-            memcpy(buf, fifo->head, toCopy);
-            ret += toCopy;
-            fifo->head += toCopy;
-            if(fifo->head >= fifo->bufend)
-                fifo->head = fifo->buf;
-            if(ret < n) {
-                toCopy = min(n - ret, fifo->tail - fifo->head);
-                memcpy(buf + ret, fifo->head, toCopy);
-                ret += toCopy;
-                fifo->head += toCopy;
-            }
-        } else {
-            toCopy = min(fifo->tail - fifo->head, n);
-            memcpy(buf, fifo->head, toCopy);
-            ret += toCopy;
-            fifo->head += toCopy;
-        });
-    if(ret>0)
-        cond_signal(&(fifo->pop));
+    if((nSpans = fifo_peek(fifo, iov)) == 0)
+        return 0;
+    if(nSpans == 1 || iov[0].iov_len >= n) {
+        ret = min(n, iov[0].iov_len);
+        memcpy(buf, iov[0].iov_base, ret);
+    } else {
+        memcpy(buf, iov[0].iov_base, iov[0].iov_len);
+        ret = iov[0].iov_len + min(n - iov[0].iov_len, iov[1].iov_len);
+        memcpy(buf + iov[0].iov_len, iov[1].iov_base, ret - iov[0].iov_len);
+    }
+    fifo_release(fifo, ret);
     return ret;
 }
 
 size_t fifo_nelements_in(struct fifo_t *fifo)
 {
-    WHILE_LOCKED(
-        if(fifo->tail < fifo->head) { /* wrapped around */
-            return (fifo->tail - fifo->buf) + (fifo->bufend - fifo->head);
-        } else {
-            return fifo->tail - fifo->head;
-        });
+    return load_acquire(&(fifo->tail)) - load_acquire(&(fifo->head));
 }
 
 #ifdef FIFO_DEBUG_ENABLEMAIN
@@ -1,34 +1,71 @@
 #ifndef __FIFO_H__
 #define __FIFO_H__
 
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+#define FIFO_CACHE_LINE 64
+
+/* Single-producer/single-consumer byte ring.  Exactly one thread may
+ * push and exactly one other thread may pop.  head and tail are free
+ * running byte counters, each written by one side only and kept on its
+ * own cache line; tail - head is the number of bytes stored.  A side
+ * only sleeps (futex on linux) when the ring is empty resp. full. */
 struct fifo_t
 {
-    pthread_mutex_t lock;
-    pthread_cond_t push;
-    pthread_cond_t pop;
+    /* producer side */
+    _Alignas(FIFO_CACHE_LINE) _Atomic size_t tail;
+    size_t headCache; /* producer's last view of head */
+    _Atomic uint32_t popSeq; /* bumped by the consumer to wake the producer */
+    _Atomic int pushWaiting;
+    _Atomic int eof; /* the producer will not commit any more */
+
+    /* consumer side */
+    _Alignas(FIFO_CACHE_LINE) _Atomic size_t head;
+    size_t tailCache; /* consumer's last view of tail */
+    _Atomic uint32_t pushSeq; /* bumped by the producer to wake the consumer */
+    _Atomic int popWaiting;
 
-    size_t n;
-    /* *head is the first element, *(tail-1) is the last element.
-     * *(bufend-1) is the last element in the buf.  head == tail
-     * means the buffer is empty.  When wrapped around, tail is
-     * allowed only up to (head-1).  Highest value for tail is (bufend-1).  
-     * One space is wasted.*/
-    char *head, *tail, *bufend;
+    _Alignas(FIFO_CACHE_LINE) size_t n; /* capacity, a power of 2 */
+    size_t mask;
     char *buf;
+#ifndef __linux
+    pthread_mutex_t lock; /* only used to sleep */
+    pthread_cond_t wake;
+#endif
 };
 
-/* create a fifo with buffer size n bytes */
+/* create a fifo with buffer size of at least n bytes, rounded up to a
+ * power of 2 */
 struct fifo_t *fifo_init(size_t n);
 int fifo_close(struct fifo_t *fifo);
 /* returns number of bytes successfully pushed.  If not all n bytes
  * can be pushed, this function will block until enough space is made.
- * If n is greater than the fifo capacity (fifo->n - 1), this function
+ * If n is greater than the fifo capacity (fifo->n), this function
  * returns -1. */
 ssize_t fifo_push(struct fifo_t *fifo, char *buf, size_t n);
 /* return number of bytes successfully popped. n is the requested
  * size.  If there is nothing in the fifo, this function blocks until
  * at least one element is in the fifo. */
 size_t fifo_pop(struct fifo_t *fifo, char *buf, size_t n);
+/* Zero-copy access.  fifo_reserve blocks until at least nMin bytes
+ * are free and describes all free space in iov[0..1] (the second span
+ * is used when the free space wraps around), returning the number of
+ * spans.  The producer fills a prefix of that and publishes it with
+ * fifo_commit.  Likewise fifo_peek blocks until the fifo is not empty
+ * and describes the stored bytes, fifo_release hands n of them back.
+ * Once the producer has called fifo_set_eof and the fifo is drained,
+ * fifo_peek returns 0 instead of blocking, and fifo_pop returns 0.
+ * nMin must not exceed fifo->n. */
+int fifo_reserve(struct fifo_t *fifo, struct iovec *iov, size_t nMin);
+void fifo_commit(struct fifo_t *fifo, size_t n);
+int fifo_peek(struct fifo_t *fifo, struct iovec *iov);
+void fifo_release(struct fifo_t *fifo, size_t n);
+/* called by the producer after its last commit */
+void fifo_set_eof(struct fifo_t *fifo);
 /* number of elements (bytes) stored in the fifo. */
 size_t fifo_nelements_in(struct fifo_t *fifo);
 
@@ -1,8 +1,148 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
 #include <hdf5.h>
+#include <zlib.h>
 #include "common.h"
 #include "hdf5io.h"
+#include "tpool.h"
+#include "deltacodec.h"
+
+/* One HDF5 chunk, i.e. one channel of one event, being compressed */
+struct zchunk
+{
+    struct tpool_job job;
+    const char *src;
+    size_t srcLen;
+    char *dst;
+    size_t dstCap, dstLen;
+    int filter, level;
+    unsigned filterMask; /* bit n set: stored without the filter at index n */
+    size_t sampleWidth;
+    char *shuffled; /* sampleWidth > 1: the bytes regrouped as the shuffle filter does */
+};
+
+struct zslot
+{
+    size_t eventId;
+    char *wavBuf; /* private copy of the event */
+    struct zchunk *chunks; /* nChunks of them, in the order of wavBuf */
+};
+
+struct HDF5IO(zpipe)
+{
+    struct tpool_t *pool;
+    size_t nThreads;
+    size_t nChunks; /* HDF5 chunks per event */
+    size_t nSlots;
+    size_t head, count; /* ring of events in flight, oldest at head */
+    struct zslot *slots; /* allocated at the first event */
+};
+
+/* One HDF5 chunk read as stored by a reader, being decompressed into
+ * its place in the event */
+struct ichunk
+{
+    struct tpool_job job;
+    const struct HDF5IO(reader) *rd;
+    char *src; /* as stored */
+    size_t srcLen, srcCap;
+    char *tmp; /* between two filters */
+    char *dst;
+    unsigned filterMask; /* bit n set: filter n was skipped when writing */
+    int queued; /* job went to the pool; chunks that are not written
+                 * or fail to read are dealt with on the spot */
+    int bad;
+};
+
+/* read-ahead state, see open_reader.  Events are read into the ring
+ * in order; nRead - nReleased of them are in use, nTaken of those
+ * have been handed out. */
+struct HDF5IO(reader)
+{
+    struct HDF5IO(waveform_file) *wavFile;
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;   /* an event was read, or the thread stopped */
+    pthread_cond_t released; /* a buffer came back, or quit was set */
+    size_t firstEvent, nEvents;
+    size_t *eventIds; /* open_reader_list: the events to read, else NULL */
+    size_t nBufs;
+    struct HDF5IO(waveform_event) *events; /* the ring, buffers recycled */
+    char *wavBuf;
+    size_t nRead, nTaken, nReleased; /* free running counts */
+    int full; /* the thread waits for buffers */
+    int stopped, quit, failed;
+    /* set_decompress_threads: the thread only reads chunks as stored
+     * and pool undoes the filters, else pool is NULL */
+    struct tpool_t *pool;
+    size_t nChunks, chunkBytes; /* per event */
+    int nFilters, filters[H5Z_MAX_NFILTERS]; /* in the order they ran when writing */
+    struct ichunk *chunks; /* nChunks per buffer */
+};
+
+static void zpipe_drain(struct HDF5IO(waveform_file) *wavFile, int all);
+static void zpipe_close(struct HDF5IO(waveform_file) *wavFile);
+static int write_event_set_extent(struct HDF5IO(waveform_file) *wavFile, size_t nExtent);
+static int index_flush(struct HDF5IO(waveform_file) *wavFile);
+static int feature_flush(struct HDF5IO(waveform_file) *wavFile);
+static int roi_flush(struct HDF5IO(waveform_file) *wavFile);
+
+static size_t delta_filter(unsigned int flags, size_t cdNelmts,
+                           const unsigned int cdValues[], size_t nBytes,
+                           size_t *bufSize, void **buf)
+{
+    char *out;
+    size_t n;
+
+    if(flags & H5Z_FLAG_REVERSE) {
+        n = deltacodec_decoded_size((char*)*buf, nBytes);
+        out = (char*)H5allocate_memory(n, 0);
+        if(out == NULL) return 0;
+        if(deltacodec_decode((char*)*buf, nBytes, out) < 0) {
+            H5free_memory(out);
+            return 0;
+        }
+    } else {
+        out = (char*)H5allocate_memory(deltacodec_bound(nBytes), 0);
+        if(out == NULL) return 0;
+        n = deltacodec_encode((char*)*buf, nBytes, out);
+        if(n >= nBytes) { /* the filter is optional, HDF5 stores the chunk as is */
+            H5free_memory(out);
+            return 0;
+        }
+    }
+    H5free_memory(*buf);
+    *buf = out;
+    *bufSize = n;
+    return n;
+}
+
+static void register_delta_filter(void)
+{
+    static int registered = 0;
+    H5Z_class2_t deltaClass = {
+        H5Z_CLASS_T_VERS, HDF5IO_FILTER_ID_DELTA, 1, 1,
+        "deltacodec", NULL, NULL, delta_filter
+    };
+
+    if(registered) return;
+    deltacodec_get_impl(); /* picks the kernels before any thread runs them */
+    if(H5Zregister(&deltaClass) >= 0) registered = 1;
+}
+
+static void roi_init(struct HDF5IO(waveform_file) *wavFile)
+{
+    wavFile->roiEventDid = wavFile->roiIndexDid = wavFile->roiSampleDid = -1;
+    wavFile->nRoiEvents = wavFile->nRoiRows = wavFile->nRoiSamples = 0;
+    wavFile->nRoiEventBuf = wavFile->nRoiRowBuf = wavFile->nRoiSampleBuf = 0;
+    wavFile->roiRowCap = wavFile->roiSampleCap = 0;
+    wavFile->roiEventBuf = NULL;
+    wavFile->roiRowBuf = NULL;
+    wavFile->roiSampleBuf = NULL;
+}
 
 struct HDF5IO(waveform_file) *HDF5IO(open_file)(const char *fname,
                                                 size_t nWfmPerChunk,
@@ -12,6 +152,7 @@ struct HDF5IO(waveform_file) *HDF5IO(open_file)(const char *fname,
     herr_t ret;
 
     struct HDF5IO(waveform_file) *wavFile;
+    register_delta_filter();
     wavFile = (struct HDF5IO(waveform_file) *)
         malloc(sizeof(struct HDF5IO(waveform_file)));
     wavFile->waveFid = H5Fcreate(fname, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
@@ -42,15 +183,55 @@ struct HDF5IO(waveform_file) *HDF5IO(open_file)(const char *fname,
     H5Gclose(rootGid);
 
     wavFile->nPt = SCOPE_MEM_LENGTH_MAX;
+    wavFile->sampleWidth = 1;
+    wavFile->nFrames = 1;
+    wavFile->chDid = -1;
+    wavFile->chunkCacheBytes = 0;
+    wavFile->chunkCacheSlots = 0;
+    wavFile->zpipe = NULL;
+    wavFile->nDecompressThreads = 0;
+    wavFile->nPtPerH5Chunk = 0;
+    wavFile->filter = HDF5IO_FILTER_DEFLATE;
+    wavFile->filterLevel = HDF5IO_DEFLATE_LEVEL;
+    wavFile->layout = HDF5IO_LAYOUT_CHUNKGROUPS;
+    wavFile->nExtent = 0;
+    wavFile->eventIdEnd = 0;
+    wavFile->indexDid = -1;
+    wavFile->nIndexRows = 0;
+    wavFile->nIndexBuf = 0;
+    wavFile->indexBuf = NULL;
+    roi_init(wavFile);
+    wavFile->featureDid = -1;
+    wavFile->nFeatureRows = 0;
+    wavFile->nFeatureBuf = 0;
+    wavFile->featureBuf = NULL;
     return wavFile;
 }
 
+/* the extent of a 1D dataset, if it is there */
+static hid_t open_rows(hid_t fid, const char *name, size_t *nRows)
+{
+    hid_t did, sid;
+    hsize_t dims[1];
+
+    *nRows = 0;
+    if(H5Lexists(fid, name, H5P_DEFAULT) <= 0) return -1;
+    did = H5Dopen(fid, name, H5P_DEFAULT);
+    if(did < 0) return -1;
+    sid = H5Dget_space(did);
+    H5Sget_simple_extent_dims(sid, dims, NULL);
+    H5Sclose(sid);
+    *nRows = dims[0];
+    return did;
+}
+
 struct HDF5IO(waveform_file) *HDF5IO(open_file_for_read)(const char *fname)
 {
     hid_t attrAid;
     herr_t ret;
 
     struct HDF5IO(waveform_file) *wavFile;
+    register_delta_filter();
     wavFile = (struct HDF5IO(waveform_file) *)
         malloc(sizeof(struct HDF5IO(waveform_file)));
     wavFile->waveFid = H5Fopen(fname, H5F_ACC_RDONLY, H5P_DEFAULT);
@@ -67,15 +248,93 @@ struct HDF5IO(waveform_file) *HDF5IO(open_file_for_read)(const char *fname)
                               H5P_DEFAULT, H5P_DEFAULT);
     ret = H5Aread(attrAid, H5T_NATIVE_HSIZE, &(wavFile->nCh));
     H5Aclose(attrAid);
+    /* files from before set_filter existed are all deflate */
+    wavFile->filter = HDF5IO_FILTER_DEFLATE;
+    wavFile->filterLevel = HDF5IO_DEFLATE_LEVEL;
+    if(H5Aexists_by_name(wavFile->waveFid, "/", "filter", H5P_DEFAULT) > 0) {
+        attrAid = H5Aopen_by_name(wavFile->waveFid, "/", "filter",
+                                  H5P_DEFAULT, H5P_DEFAULT);
+        ret = H5Aread(attrAid, H5T_NATIVE_INT, &(wavFile->filter));
+        H5Aclose(attrAid);
+        attrAid = H5Aopen_by_name(wavFile->waveFid, "/", "filterLevel",
+                                  H5P_DEFAULT, H5P_DEFAULT);
+        ret = H5Aread(attrAid, H5T_NATIVE_INT, &(wavFile->filterLevel));
+        H5Aclose(attrAid);
+    }
+
+    if(H5Lexists(wavFile->waveFid, HDF5IO_WAVEFORM_DATASET, H5P_DEFAULT) > 0)
+        wavFile->layout = HDF5IO_LAYOUT_EXTENSIBLE;
+    else if(H5Lexists(wavFile->waveFid, HDF5IO_FRAME_DATASET, H5P_DEFAULT) > 0)
+        wavFile->layout = HDF5IO_LAYOUT_FRAMES;
+    else if(H5Lexists(wavFile->waveFid, HDF5IO_ROI_EVENT_DATASET, H5P_DEFAULT) > 0)
+        wavFile->layout = HDF5IO_LAYOUT_ROI;
+    else
+        wavFile->layout = HDF5IO_LAYOUT_CHUNKGROUPS;
 
     wavFile->nPt = SCOPE_MEM_LENGTH_MAX;
+    wavFile->sampleWidth = 1;
+    wavFile->nFrames = 1;
+    wavFile->chDid = -1;
+    wavFile->chunkCacheBytes = 0;
+    wavFile->chunkCacheSlots = 0;
+    wavFile->zpipe = NULL;
+    wavFile->nDecompressThreads = 0;
+    wavFile->nPtPerH5Chunk = 0;
+    wavFile->nExtent = 0;
+    wavFile->eventIdEnd = 0;
+
+    wavFile->indexDid = open_rows(wavFile->waveFid, HDF5IO_INDEX_DATASET,
+                                  &(wavFile->nIndexRows));
+    wavFile->nIndexBuf = 0;
+    wavFile->indexBuf = NULL;
+    roi_init(wavFile);
+    if(wavFile->layout == HDF5IO_LAYOUT_ROI) {
+        wavFile->roiEventDid = open_rows(wavFile->waveFid, HDF5IO_ROI_EVENT_DATASET,
+                                         &(wavFile->nRoiEvents));
+        wavFile->roiIndexDid = open_rows(wavFile->waveFid, HDF5IO_ROI_INDEX_DATASET,
+                                         &(wavFile->nRoiRows));
+        wavFile->roiSampleDid = open_rows(wavFile->waveFid, HDF5IO_ROI_SAMPLE_DATASET,
+                                          &(wavFile->nRoiSamples));
+    }
+    wavFile->featureDid = open_rows(wavFile->waveFid, HDF5IO_FEATURE_DATASET,
+                                    &(wavFile->nFeatureRows));
+    wavFile->nFeatureBuf = 0;
+    wavFile->featureBuf = NULL;
     return wavFile;
 }
 
+static void write_event_close_dataset(struct HDF5IO(waveform_file) *wavFile)
+{
+    if(wavFile->chDid < 0) return;
+    if(wavFile->layout != HDF5IO_LAYOUT_CHUNKGROUPS
+       && wavFile->eventIdEnd < wavFile->nExtent) { /* drop the unused room */
+        write_event_set_extent(wavFile, wavFile->eventIdEnd);
+    }
+    H5Sclose(wavFile->mSid);
+    H5Sclose(wavFile->chSid);
+    H5Dclose(wavFile->chDid);
+    wavFile->chDid = -1;
+}
+
 int HDF5IO(close_file)(struct HDF5IO(waveform_file) *wavFile)
 {
     herr_t ret;
 
+    zpipe_close(wavFile);
+    write_event_close_dataset(wavFile);
+    index_flush(wavFile);
+    roi_flush(wavFile);
+    feature_flush(wavFile);
+    if(wavFile->indexDid >= 0) H5Dclose(wavFile->indexDid);
+    if(wavFile->featureDid >= 0) H5Dclose(wavFile->featureDid);
+    if(wavFile->roiEventDid >= 0) H5Dclose(wavFile->roiEventDid);
+    if(wavFile->roiIndexDid >= 0) H5Dclose(wavFile->roiIndexDid);
+    if(wavFile->roiSampleDid >= 0) H5Dclose(wavFile->roiSampleDid);
+    free(wavFile->indexBuf);
+    free(wavFile->roiEventBuf);
+    free(wavFile->roiRowBuf);
+    free(wavFile->roiSampleBuf);
+    free(wavFile->featureBuf);
     ret = H5Fclose(wavFile->waveFid);
     free(wavFile);
     return (int)ret;
@@ -86,6 +345,11 @@ int HDF5IO(flush_file)(struct HDF5IO(waveform_file) *wavFile)
     hid_t attrAid;
     herr_t ret;
 
+    zpipe_drain(wavFile, 1);
+    write_event_close_dataset(wavFile);
+    index_flush(wavFile);
+    roi_flush(wavFile);
+    feature_flush(wavFile);
     attrAid = H5Aopen_by_name(wavFile->waveFid, "/", "nEvents",
                               H5P_DEFAULT, H5P_DEFAULT);
     ret = H5Awrite(attrAid, H5T_NATIVE_HSIZE, &(wavFile->nEvents));
@@ -95,18 +359,13 @@ int HDF5IO(flush_file)(struct HDF5IO(waveform_file) *wavFile)
     return (int)ret;
 }
 
-int HDF5IO(write_waveform_attribute_in_file_header)(
-    struct HDF5IO(waveform_file) *wavFile,
-    struct waveform_attribute *wavAttr)
+/* the compound type of the "Waveform Attributes" attribute.  Members
+ * are matched by name when reading, so older files without some of
+ * them can still be read. */
+static hid_t waveform_attribute_type(hid_t doubleArrayTid)
 {
-    herr_t ret;
-    
-    hid_t wavAttrTid, wavAttrSid, wavAttrAid, doubleArrayTid, rootGid;
-    const hsize_t doubleArrayDims[1]={SCOPE_NCH};
-    const unsigned doubleArrayRank = 1;
+    hid_t wavAttrTid;
 
-    doubleArrayTid = H5Tarray_create(H5T_NATIVE_DOUBLE, doubleArrayRank, doubleArrayDims);
-    
     wavAttrTid = H5Tcreate(H5T_COMPOUND, sizeof(struct waveform_attribute));
 
     H5Tinsert(wavAttrTid, "wavAttr.chMask", HOFFSET(struct waveform_attribute, chMask),
@@ -115,6 +374,8 @@ int HDF5IO(write_waveform_attribute_in_file_header)(
               H5T_NATIVE_HSIZE);
     H5Tinsert(wavAttrTid, "wavAttr.nFrames", HOFFSET(struct waveform_attribute, nFrames),
               H5T_NATIVE_HSIZE);
+    H5Tinsert(wavAttrTid, "wavAttr.sampleWidth",
+              HOFFSET(struct waveform_attribute, sampleWidth), H5T_NATIVE_HSIZE);
     H5Tinsert(wavAttrTid, "wavAttr.dt", HOFFSET(struct waveform_attribute, dt), H5T_NATIVE_DOUBLE);
     H5Tinsert(wavAttrTid, "wavAttr.t0", HOFFSET(struct waveform_attribute, t0), H5T_NATIVE_DOUBLE);
     H5Tinsert(wavAttrTid, "wavAttr.ymult",
@@ -123,7 +384,37 @@ int HDF5IO(write_waveform_attribute_in_file_header)(
               HOFFSET(struct waveform_attribute, yoff), doubleArrayTid);
     H5Tinsert(wavAttrTid, "wavAttr.yzero",
               HOFFSET(struct waveform_attribute, yzero), doubleArrayTid);
+    return wavAttrTid;
+}
+
+/* frames per event as stored, 1 unless nFrames divides nPt */
+static size_t frames_per_event(struct waveform_attribute *wavAttr)
+{
+    if(wavAttr->nFrames == 0 || wavAttr->nPt % wavAttr->nFrames) return 1;
+    return wavAttr->nFrames;
+}
 
+/* the HDF5 type of the samples, in memory and in the file */
+static hid_t sample_type(struct HDF5IO(waveform_file) *wavFile)
+{
+    return wavFile->sampleWidth == 2 ? H5T_NATIVE_SHORT : H5T_NATIVE_CHAR;
+}
+
+int HDF5IO(write_waveform_attribute_in_file_header)(
+    struct HDF5IO(waveform_file) *wavFile,
+    struct waveform_attribute *wavAttr)
+{
+    herr_t ret;
+    
+    hid_t wavAttrTid, wavAttrSid, wavAttrAid, doubleArrayTid, rootGid;
+    const hsize_t doubleArrayDims[1]={SCOPE_NCH};
+    const unsigned doubleArrayRank = 1;
+
+    doubleArrayTid = H5Tarray_create(H5T_NATIVE_DOUBLE, doubleArrayRank, doubleArrayDims);
+    
+    wavAttrTid = waveform_attribute_type(doubleArrayTid);
+
+    if(wavAttr->sampleWidth != 2) wavAttr->sampleWidth = 1;
     wavAttrSid = H5Screate(H5S_SCALAR);
 
     rootGid = H5Gopen(wavFile->waveFid, "/", H5P_DEFAULT);
@@ -140,6 +431,8 @@ int HDF5IO(write_waveform_attribute_in_file_header)(
     H5Gclose(rootGid);
 
     wavFile->nPt = wavAttr->nPt;
+    wavFile->sampleWidth = wavAttr->sampleWidth;
+    wavFile->nFrames = frames_per_event(wavAttr);
     return (int)ret;
 }
 
@@ -155,22 +448,7 @@ int HDF5IO(read_waveform_attribute_in_file_header)(
 
     doubleArrayTid = H5Tarray_create(H5T_NATIVE_DOUBLE, doubleArrayRank, doubleArrayDims);
     
-    wavAttrTid = H5Tcreate(H5T_COMPOUND, sizeof(struct waveform_attribute));
-
-    H5Tinsert(wavAttrTid, "wavAttr.chMask", HOFFSET(struct waveform_attribute, chMask),
-              H5T_NATIVE_UINT);
-    H5Tinsert(wavAttrTid, "wavAttr.nPt", HOFFSET(struct waveform_attribute, nPt),
-              H5T_NATIVE_HSIZE);
-    H5Tinsert(wavAttrTid, "wavAttr.nFrames", HOFFSET(struct waveform_attribute, nFrames),
-              H5T_NATIVE_HSIZE);
-    H5Tinsert(wavAttrTid, "wavAttr.dt", HOFFSET(struct waveform_attribute, dt), H5T_NATIVE_DOUBLE);
-    H5Tinsert(wavAttrTid, "wavAttr.t0", HOFFSET(struct waveform_attribute, t0), H5T_NATIVE_DOUBLE);
-    H5Tinsert(wavAttrTid, "wavAttr.ymult",
-              HOFFSET(struct waveform_attribute, ymult), doubleArrayTid);
-    H5Tinsert(wavAttrTid, "wavAttr.yoff",
-              HOFFSET(struct waveform_attribute, yoff), doubleArrayTid);
-    H5Tinsert(wavAttrTid, "wavAttr.yzero",
-              HOFFSET(struct waveform_attribute, yzero), doubleArrayTid);
+    wavAttrTid = waveform_attribute_type(doubleArrayTid);
 
     wavAttrAid = H5Aopen_by_name(wavFile->waveFid, "/", "Waveform Attributes",
                                  H5P_DEFAULT, H5P_DEFAULT);
@@ -180,121 +458,1536 @@ int HDF5IO(read_waveform_attribute_in_file_header)(
     H5Tclose(wavAttrTid);
     H5Tclose(doubleArrayTid);
 
+    if(wavAttr->sampleWidth != 2) wavAttr->sampleWidth = 1; /* absent in older files */
+
+    write_event_close_dataset(wavFile); /* its memory dataspace may have the old nPt */
     wavFile->nPt = wavAttr->nPt;
+    wavFile->sampleWidth = wavAttr->sampleWidth;
+    wavFile->nFrames = frames_per_event(wavAttr);
     return (int)ret;
 }
 
-int HDF5IO(write_event)(struct HDF5IO(waveform_file) *wavFile,
-                        struct HDF5IO(waveform_event) *wavEvent)
+int HDF5IO(set_layout)(struct HDF5IO(waveform_file) *wavFile, int layout)
 {
-    char buf[NAME_BUF_SIZE];
+    if(layout != HDF5IO_LAYOUT_CHUNKGROUPS && layout != HDF5IO_LAYOUT_EXTENSIBLE
+       && layout != HDF5IO_LAYOUT_FRAMES && layout != HDF5IO_LAYOUT_ROI)
+        return -1;
+    wavFile->layout = layout;
+    return 0;
+}
+
+/* samples per HDF5 chunk: a frame in the frames layout, otherwise
+ * nPtPerH5Chunk, or a bit less so that it divides nPt, which lets
+ * every event start at a chunk boundary and the compression threads
+ * and the reader work on whole chunks.  When no divisor is at least
+ * half of nPtPerH5Chunk (a prime nPt, say) the waveforms stay whole
+ * rather than being cut into tiny chunks. */
+static size_t h5chunk_length(struct HDF5IO(waveform_file) *wavFile)
+{
+    size_t nPieces, nPt = wavFile->nPt, minLen = wavFile->nPtPerH5Chunk / 2;
+
+    if(wavFile->layout == HDF5IO_LAYOUT_FRAMES)
+        return nPt / wavFile->nFrames;
+    if(wavFile->nPtPerH5Chunk == 0 || wavFile->nPtPerH5Chunk >= nPt)
+        return nPt;
+    for(nPieces = (nPt + wavFile->nPtPerH5Chunk - 1) / wavFile->nPtPerH5Chunk;
+        nPt % nPieces && nPt / nPieces >= minLen; nPieces++) ;
+    if(nPt % nPieces || nPt / nPieces < minLen)
+        return nPt;
+    return nPt / nPieces;
+}
+
+int HDF5IO(set_chunk_samples)(struct HDF5IO(waveform_file) *wavFile, size_t nPtPerH5Chunk)
+{
+    wavFile->nPtPerH5Chunk = nPtPerH5Chunk;
+    if(wavFile->layout != HDF5IO_LAYOUT_FRAMES && nPtPerH5Chunk > 0
+       && nPtPerH5Chunk < wavFile->nPt && h5chunk_length(wavFile) == wavFile->nPt) {
+        fprintf(stderr, "hdf5io: no chunk length near %zd divides %zd samples,"
+                " keeping waveforms whole\n", nPtPerH5Chunk, wavFile->nPt);
+        return -1;
+    }
+    return 0;
+}
+
+int HDF5IO(set_chunk_cache)(struct HDF5IO(waveform_file) *wavFile,
+                            size_t nBytes, size_t nSlots)
+{
+    wavFile->chunkCacheBytes = nBytes;
+    wavFile->chunkCacheSlots = nSlots;
+    return 0;
+}
+
+const char *HDF5IO(filter_name)(int filter)
+{
+    static const char *names[HDF5IO_FILTER_N] = {"none", "deflate", "lz4", "zstd", "delta"};
+
+    if(filter < 0 || filter >= HDF5IO_FILTER_N) return NULL;
+    return names[filter];
+}
+
+static int write_int_attribute(hid_t fid, const char *name, int val)
+{
+    hid_t attrSid, attrAid;
     herr_t ret;
+
+    if(H5Aexists_by_name(fid, "/", name, H5P_DEFAULT) > 0)
+        H5Adelete_by_name(fid, "/", name, H5P_DEFAULT);
+    attrSid = H5Screate(H5S_SCALAR);
+    attrAid = H5Acreate_by_name(fid, "/", name, H5T_NATIVE_INT, attrSid,
+                                H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    ret = H5Awrite(attrAid, H5T_NATIVE_INT, &val);
+    H5Sclose(attrSid);
+    H5Aclose(attrAid);
+    return (int)ret;
+}
+
+int HDF5IO(set_filter)(struct HDF5IO(waveform_file) *wavFile, int filter, int level)
+{
+    switch(filter) {
+    case HDF5IO_FILTER_NONE:
+        level = 0;
+        break;
+    case HDF5IO_FILTER_DEFLATE:
+        if(level <= 0) level = HDF5IO_DEFLATE_LEVEL;
+        if(level > 9) level = 9;
+        break;
+    case HDF5IO_FILTER_LZ4:
+        level = 0;
+        if(H5Zfilter_avail(HDF5IO_FILTER_ID_LZ4) <= 0) return -1;
+        break;
+    case HDF5IO_FILTER_ZSTD:
+        if(level <= 0) level = 3; /* zstd's own default */
+        if(level > 22) level = 22;
+        if(H5Zfilter_avail(HDF5IO_FILTER_ID_ZSTD) <= 0) return -1;
+        break;
+    case HDF5IO_FILTER_DELTA:
+        level = 0;
+        break;
+    default:
+        return -1;
+    }
+    wavFile->filter = filter;
+    wavFile->filterLevel = level;
+    write_int_attribute(wavFile->waveFid, "filter", filter);
+    write_int_attribute(wavFile->waveFid, "filterLevel", level);
+    return 0;
+}
+
+/* adds the filter pipeline of set_filter to a dataset creation plist */
+static void write_event_set_filter(struct HDF5IO(waveform_file) *wavFile, hid_t chPid)
+{
+    unsigned int cdValues[1];
+
+    /* both compress better with the low and high bytes of 2-byte
+     * samples apart */
+    if(wavFile->sampleWidth > 1 && (wavFile->filter == HDF5IO_FILTER_DEFLATE
+                                    || wavFile->filter == HDF5IO_FILTER_DELTA))
+        H5Pset_shuffle(chPid);
+    switch(wavFile->filter) {
+    case HDF5IO_FILTER_DEFLATE:
+        H5Pset_deflate(chPid, wavFile->filterLevel);
+        break;
+    case HDF5IO_FILTER_LZ4:
+        /* a no-op for 1-byte samples, groups the bytes of wider ones */
+        H5Pset_shuffle(chPid);
+        cdValues[0] = 0; /* the plugin's default block size */
+        H5Pset_filter(chPid, HDF5IO_FILTER_ID_LZ4, H5Z_FLAG_MANDATORY, 1, cdValues);
+        break;
+    case HDF5IO_FILTER_ZSTD:
+        cdValues[0] = wavFile->filterLevel;
+        H5Pset_filter(chPid, HDF5IO_FILTER_ID_ZSTD, H5Z_FLAG_MANDATORY, 1, cdValues);
+        break;
+    case HDF5IO_FILTER_DELTA:
+        /* optional: a chunk that would grow is stored uncompressed */
+        H5Pset_filter(chPid, HDF5IO_FILTER_ID_DELTA, H5Z_FLAG_OPTIONAL, 0, NULL);
+        break;
+    default:
+        break;
+    }
+}
+
+static size_t next_prime(size_t n)
+{
+    size_t d;
+
+    for(;; n++) {
+        for(d=2; d*d<=n; d++)
+            if(n % d == 0) break;
+        if(d*d > n) return n;
+    }
+}
+
+static hid_t write_event_dataset_access(struct HDF5IO(waveform_file) *wavFile)
+{
+    hid_t dapl;
+    size_t nBytes, nSlots;
+
+    nBytes = wavFile->chunkCacheBytes ? wavFile->chunkCacheBytes
+        : wavFile->nCh * wavFile->nPt * wavFile->sampleWidth;
+    /* HDF5 suggests ~100 hash slots per chunk that fits in the cache */
+    nSlots = wavFile->chunkCacheSlots ? wavFile->chunkCacheSlots
+        : next_prime(100 * (nBytes / (h5chunk_length(wavFile) * wavFile->sampleWidth) + 1));
+
+    dapl = H5Pcreate(H5P_DATASET_ACCESS);
+    /* w0 = 1: chunks written in full are evicted first */
+    H5Pset_chunk_cache(dapl, nSlots, nBytes, 1.0);
+    return dapl;
+}
+
+/* rows of the extensible or frames dataset one event takes */
+static size_t rows_per_event(struct HDF5IO(waveform_file) *wavFile)
+{
+    return wavFile->layout == HDF5IO_LAYOUT_FRAMES ? wavFile->nFrames : 1;
+}
+
+/* the dataset holding chunkId, or the one dataset of the other layouts */
+static void dataset_name(struct HDF5IO(waveform_file) *wavFile, size_t chunkId, char *buf)
+{
+    if(wavFile->layout == HDF5IO_LAYOUT_EXTENSIBLE)
+        snprintf(buf, NAME_BUF_SIZE, "%s", HDF5IO_WAVEFORM_DATASET);
+    else if(wavFile->layout == HDF5IO_LAYOUT_FRAMES)
+        snprintf(buf, NAME_BUF_SIZE, "%s", HDF5IO_FRAME_DATASET);
+    else
+        snprintf(buf, NAME_BUF_SIZE, "C%zd", chunkId);
+}
+
+/* A chunk is created when its first event arrives, which is the usual
+ * in-order case, otherwise it may exist already.  The extensible and
+ * frames datasets are created empty. */
+static int write_event_open_dataset(struct HDF5IO(waveform_file) *wavFile, size_t chunkId,
+                                    int isNew)
+{
+    char buf[NAME_BUF_SIZE];
+    hid_t chPid, chTid, dapl;
+    hsize_t dims[3], maxDims[3], h5chunkDims[3];
+    int rank;
+
+    dataset_name(wavFile, chunkId, buf);
+    dapl = write_event_dataset_access(wavFile);
+
+    if(!isNew && H5Lexists(wavFile->waveFid, buf, H5P_DEFAULT) > 0) {
+        wavFile->chDid = H5Dopen(wavFile->waveFid, buf, dapl);
+        wavFile->chSid = H5Dget_space(wavFile->chDid);
+        if(wavFile->layout != HDF5IO_LAYOUT_CHUNKGROUPS) {
+            H5Sget_simple_extent_dims(wavFile->chSid, dims, NULL);
+            wavFile->nExtent = dims[0] / rows_per_event(wavFile);
+        }
+    } else { /* need to create a new chunk */
+        if(wavFile->layout != HDF5IO_LAYOUT_CHUNKGROUPS) {
+            rank = 3;
+            dims[0] = 0;
+            maxDims[0] = H5S_UNLIMITED;
+            dims[1] = maxDims[1] = wavFile->nCh;
+            dims[2] = maxDims[2] = wavFile->layout == HDF5IO_LAYOUT_FRAMES
+                ? wavFile->nPt / wavFile->nFrames : wavFile->nPt;
+            h5chunkDims[0] = 1;
+            h5chunkDims[1] = 1;
+            h5chunkDims[2] = h5chunk_length(wavFile);
+            wavFile->nExtent = 0;
+        } else {
+            rank = 2;
+            dims[0] = maxDims[0] = wavFile->nCh;
+            dims[1] = maxDims[1] = wavFile->nPt * wavFile->nWfmPerChunk;
+            h5chunkDims[0] = 1;
+            h5chunkDims[1] = h5chunk_length(wavFile);
+        }
+
+        wavFile->chSid = H5Screate_simple(rank, dims, maxDims);
+        chPid = H5Pcreate(H5P_DATASET_CREATE);
+        H5Pset_chunk(chPid, rank, h5chunkDims);
+        write_event_set_filter(wavFile, chPid);
+
+        chTid = H5Tcopy(sample_type(wavFile));
+        wavFile->chDid = H5Dcreate(wavFile->waveFid, buf, chTid, wavFile->chSid,
+                                   H5P_DEFAULT, chPid, dapl);
+        H5Tclose(chTid);
+        H5Pclose(chPid);
+    }
+    H5Pclose(dapl);
+    if(wavFile->chDid < 0) {
+        H5Sclose(wavFile->chSid);
+        return -1;
+    }
+
+    dims[0] = wavFile->nCh;
+    dims[1] = wavFile->nPt;
+    wavFile->mSid = H5Screate_simple(2, dims, NULL);
+    wavFile->chunkId = chunkId;
+    return 0;
+}
+
+static int write_event_set_extent(struct HDF5IO(waveform_file) *wavFile, size_t nExtent)
+{
+    hsize_t dims[3];
+
+    dims[1] = wavFile->nCh;
+    if(wavFile->layout == HDF5IO_LAYOUT_FRAMES) { /* nExtent counts events, not rows */
+        dims[0] = nExtent * wavFile->nFrames;
+        dims[2] = wavFile->nPt / wavFile->nFrames;
+    } else {
+        dims[0] = nExtent;
+        dims[2] = wavFile->nPt;
+    }
+    if(H5Dset_extent(wavFile->chDid, dims) < 0) return -1;
+    H5Sclose(wavFile->chSid);
+    wavFile->chSid = H5Dget_space(wavFile->chDid);
+    wavFile->nExtent = nExtent;
+    return 0;
+}
+
+/* makes the dataset holding eventId the open one, growing the
+ * extensible or frames one if needed */
+static int write_event_select_dataset(struct HDF5IO(waveform_file) *wavFile,
+                                      size_t eventId)
+{
     size_t chunkId, inChunkId;
-    hid_t rootGid, chSid, chPid, chTid, chDid;
+
+    if(wavFile->layout != HDF5IO_LAYOUT_CHUNKGROUPS) {
+        if(wavFile->chDid < 0 && write_event_open_dataset(wavFile, 0, 0) < 0)
+            return -1;
+        if(eventId >= wavFile->nExtent
+           && write_event_set_extent(wavFile, (eventId / wavFile->nWfmPerChunk + 1)
+                                     * wavFile->nWfmPerChunk) < 0)
+            return -1;
+        if(eventId >= wavFile->eventIdEnd) wavFile->eventIdEnd = eventId + 1;
+        return 0;
+    }
+    chunkId = eventId / wavFile->nWfmPerChunk;
+    inChunkId = eventId % wavFile->nWfmPerChunk;
+    if(wavFile->chDid < 0 || chunkId != wavFile->chunkId) {
+        write_event_close_dataset(wavFile);
+        if(write_event_open_dataset(wavFile, chunkId, inChunkId == 0) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static void write_event_done(struct HDF5IO(waveform_file) *wavFile, size_t eventId)
+{
+    if(wavFile->layout != HDF5IO_LAYOUT_CHUNKGROUPS) return;
+    if(eventId % wavFile->nWfmPerChunk == wavFile->nWfmPerChunk - 1) /* this one is full */
+        write_event_close_dataset(wavFile);
+}
+
+/* selects eventId in the file dataspace of its dataset */
+static void select_event(struct HDF5IO(waveform_file) *wavFile, size_t eventId, hid_t sid)
+{
+    hsize_t slabOff[3], slabDims[3];
+
+    if(wavFile->layout == HDF5IO_LAYOUT_EXTENSIBLE) {
+        slabOff[0] = eventId;
+        slabOff[1] = 0;
+        slabOff[2] = 0;
+        slabDims[0] = 1;
+        slabDims[1] = wavFile->nCh;
+        slabDims[2] = wavFile->nPt;
+    } else {
+        slabOff[0] = 0;
+        slabOff[1] = (eventId % wavFile->nWfmPerChunk) * wavFile->nPt;
+        slabDims[0] = wavFile->nCh;
+        slabDims[1] = wavFile->nPt;
+    }
+    H5Sselect_hyperslab(sid, H5S_SELECT_SET, slabOff, NULL, slabDims, NULL);
+}
+
+/* Moves samples iPt..iPt+nPt-1 of the channels in chSel of eventId
+ * between buf, a row of nPt samples per selected channel, and the
+ * frames dataset.  The row of a channel is spread over consecutive
+ * frames there, which is up to three slabs: the end of the first
+ * frame, the whole frames and the start of the last one.  HDF5 pairs
+ * up the elements in row-major order, so the file selection can not
+ * span channels, and each channel is a transfer of its own. */
+static herr_t frames_io(struct HDF5IO(waveform_file) *wavFile, size_t eventId,
+                        unsigned int chSel, size_t iPt, size_t nPt, char *buf, int write)
+{
+    size_t frameSize = wavFile->nPt / wavFile->nFrames, row0 = eventId * wavFile->nFrames;
+    size_t iCh, f0, f1, nSel = 0;
+    hsize_t slabOff[3], slabDims[3], dims[1];
     hid_t mSid;
-    hsize_t dims[2], h5chunkDims[2], slabOff[2], mOff[2], slabDims[2];
-    
-    chunkId = wavEvent->eventId / wavFile->nWfmPerChunk;
-    inChunkId = wavEvent->eventId % wavFile->nWfmPerChunk;
+    herr_t ret = 0;
 
-    snprintf(buf, NAME_BUF_SIZE, "C%zd", chunkId);
-    rootGid = H5Gopen(wavFile->waveFid, "/", H5P_DEFAULT);
+    f0 = iPt / frameSize;
+    f1 = (iPt + nPt - 1) / frameSize;
+    dims[0] = nPt;
+    mSid = H5Screate_simple(1, dims, NULL);
+    for(iCh=0; iCh<wavFile->nCh && ret >= 0; iCh++) {
+        if(!(chSel & (1u << iCh))) continue;
+        slabOff[1] = iCh;
+        slabDims[1] = 1;
+        slabOff[0] = row0 + f0;
+        slabOff[2] = iPt - f0 * frameSize;
+        slabDims[0] = 1;
+        slabDims[2] = (f0 == f1 ? iPt + nPt : (f0 + 1) * frameSize) - iPt;
+        H5Sselect_hyperslab(wavFile->chSid, H5S_SELECT_SET, slabOff, NULL, slabDims, NULL);
+        if(f1 > f0 + 1) {
+            slabOff[0] = row0 + f0 + 1;
+            slabOff[2] = 0;
+            slabDims[0] = f1 - f0 - 1;
+            slabDims[2] = frameSize;
+            H5Sselect_hyperslab(wavFile->chSid, H5S_SELECT_OR, slabOff, NULL, slabDims, NULL);
+        }
+        if(f1 > f0) {
+            slabOff[0] = row0 + f1;
+            slabOff[2] = 0;
+            slabDims[0] = 1;
+            slabDims[2] = iPt + nPt - f1 * frameSize;
+            H5Sselect_hyperslab(wavFile->chSid, H5S_SELECT_OR, slabOff, NULL, slabDims, NULL);
+        }
+        if(write)
+            ret = H5Dwrite(wavFile->chDid, sample_type(wavFile), mSid, wavFile->chSid,
+                           H5P_DEFAULT, buf + nSel * nPt * wavFile->sampleWidth);
+        else
+            ret = H5Dread(wavFile->chDid, sample_type(wavFile), mSid, wavFile->chSid,
+                          H5P_DEFAULT, buf + nSel * nPt * wavFile->sampleWidth);
+        nSel++;
+    }
+    H5Sclose(mSid);
+    return ret;
+}
+
+/* logical offset of the k-th HDF5 chunk of eventId, counting along
+ * the time axis of channel 0 first */
+static void chunk_offset(struct HDF5IO(waveform_file) *wavFile, size_t eventId, size_t k,
+                         hsize_t *offset)
+{
+    size_t chunkLen = h5chunk_length(wavFile), nPieces = wavFile->nPt / chunkLen;
+    size_t iCh = k / nPieces, iPt = (k % nPieces) * chunkLen;
 
-#define write_event_create_dataset                   \
-    do {                                                    \
-        dims[0] = wavFile->nCh;                             \
-        dims[1] = wavFile->nPt * wavFile->nWfmPerChunk;     \
-        h5chunkDims[0] = 1;                                 \
-        h5chunkDims[1] = wavFile->nPt;                      \
-                                                            \
-        chSid = H5Screate_simple(2, dims, NULL);            \
-        chPid = H5Pcreate(H5P_DATASET_CREATE);              \
-        H5Pset_chunk(chPid, 2, h5chunkDims);                \
-        H5Pset_deflate(chPid, 6);                           \
-                                                            \
-        chTid = H5Tcopy(H5T_NATIVE_CHAR);                   \
-        chDid = H5Dcreate(rootGid, buf, chTid, chSid,       \
-                          H5P_DEFAULT, chPid, H5P_DEFAULT); \
-                                                            \
-        H5Tclose(chTid);                                    \
-        H5Pclose(chPid);                                    \
-    } while(0)
-
-    if(inChunkId == 0) { /* need to create a new chunk */
-        write_event_create_dataset;
+    if(wavFile->layout == HDF5IO_LAYOUT_FRAMES) { /* a chunk is a frame */
+        offset[0] = eventId * wavFile->nFrames + k % nPieces;
+        offset[1] = iCh;
+        offset[2] = 0;
+    } else if(wavFile->layout == HDF5IO_LAYOUT_EXTENSIBLE) {
+        offset[0] = eventId;
+        offset[1] = iCh;
+        offset[2] = iPt;
     } else {
-        chDid = H5Dopen(rootGid, buf, H5P_DEFAULT);
-        if(chDid < 0) { /* need to create a new chunk */
-            /* This is not a neat way to do it.  One may check out
-             * H5Lexists() and try to utilize that function.  Its
-             * efficiency is not verified though. */
-            write_event_create_dataset;
-        } else {
-            chSid = H5Dget_space(chDid);
+        offset[0] = iCh;
+        offset[1] = (eventId % wavFile->nWfmPerChunk) * wavFile->nPt + iPt;
+    }
+}
+
+/* what the HDF5 shuffle filter makes of n bytes of w-byte elements:
+ * byte 0 of every element, then byte 1, ... */
+static void shuffle_bytes(const char *src, size_t n, size_t w, char *dst)
+{
+    size_t i, b, nElem = n / w;
+
+    for(b=0; b<w; b++)
+        for(i=0; i<nElem; i++)
+            dst[b * nElem + i] = src[i * w + b];
+}
+
+/* made once, lookups read single rows and would spend much of their
+ * time building it */
+static hid_t event_index_type(void)
+{
+    static hid_t tid = -1;
+
+    if(tid >= 0) return tid;
+    tid = H5Tcreate(H5T_COMPOUND, sizeof(struct HDF5IO(event_index)));
+    H5Tinsert(tid, "eventId", HOFFSET(struct HDF5IO(event_index), eventId), H5T_NATIVE_HSIZE);
+    H5Tinsert(tid, "chunkId", HOFFSET(struct HDF5IO(event_index), chunkId), H5T_NATIVE_HSIZE);
+    H5Tinsert(tid, "inChunkId", HOFFSET(struct HDF5IO(event_index), inChunkId),
+              H5T_NATIVE_HSIZE);
+    H5Tinsert(tid, "hostTime", HOFFSET(struct HDF5IO(event_index), hostTime),
+              H5T_NATIVE_DOUBLE);
+    H5Tinsert(tid, "triggerTime", HOFFSET(struct HDF5IO(event_index), triggerTime),
+              H5T_NATIVE_DOUBLE);
+    return tid;
+}
+
+/* appends n rows from buf to the 1D dataset *did that has nRows of
+ * them, creating it first if needed, named name, in HDF5 chunks of
+ * chunkLen rows and compressed as set_filter says if compress is set */
+static int append_rows(struct HDF5IO(waveform_file) *wavFile, hid_t *did, const char *name,
+                       hid_t tid, size_t nRows, const void *buf, size_t n, size_t chunkLen,
+                       int compress)
+{
+    hid_t sid, mSid, pid;
+    hsize_t dims[1], maxDims[1], off[1];
+    herr_t ret;
+
+    if(*did < 0) {
+        dims[0] = 0;
+        maxDims[0] = H5S_UNLIMITED;
+        sid = H5Screate_simple(1, dims, maxDims);
+        pid = H5Pcreate(H5P_DATASET_CREATE);
+        dims[0] = chunkLen;
+        H5Pset_chunk(pid, 1, dims);
+        if(compress) write_event_set_filter(wavFile, pid);
+        *did = H5Dcreate(wavFile->waveFid, name, tid, sid, H5P_DEFAULT, pid, H5P_DEFAULT);
+        H5Pclose(pid);
+        H5Sclose(sid);
+        if(*did < 0) return -1;
+    }
+    dims[0] = nRows + n;
+    H5Dset_extent(*did, dims);
+    sid = H5Dget_space(*did);
+    off[0] = nRows;
+    dims[0] = n;
+    H5Sselect_hyperslab(sid, H5S_SELECT_SET, off, NULL, dims, NULL);
+    mSid = H5Screate_simple(1, dims, NULL);
+    ret = H5Dwrite(*did, tid, mSid, sid, H5P_DEFAULT, buf);
+    H5Sclose(mSid);
+    H5Sclose(sid);
+    return (int)ret;
+}
+
+/* reads rows iRow..iRow+n-1 of the 1D dataset did */
+static int read_rows(hid_t did, hid_t tid, size_t iRow, size_t n, void *buf)
+{
+    hid_t sid, mSid;
+    hsize_t off[1], dims[1];
+    herr_t ret;
+
+    sid = H5Dget_space(did);
+    off[0] = iRow;
+    dims[0] = n;
+    H5Sselect_hyperslab(sid, H5S_SELECT_SET, off, NULL, dims, NULL);
+    mSid = H5Screate_simple(1, dims, NULL);
+    ret = H5Dread(did, tid, mSid, sid, H5P_DEFAULT, buf);
+    H5Sclose(mSid);
+    H5Sclose(sid);
+    return ret < 0 ? -1 : 0;
+}
+
+/* appends the buffered rows to the index dataset, creating it first if
+ * needed */
+static int index_flush(struct HDF5IO(waveform_file) *wavFile)
+{
+    int ret;
+
+    if(wavFile->nIndexBuf == 0) return 0;
+    ret = append_rows(wavFile, &(wavFile->indexDid), HDF5IO_INDEX_DATASET, event_index_type(),
+                      wavFile->nIndexRows, wavFile->indexBuf, wavFile->nIndexBuf,
+                      HDF5IO_INDEX_BATCH, 0);
+    if(wavFile->indexDid < 0) return -1;
+
+    wavFile->nIndexRows += wavFile->nIndexBuf;
+    wavFile->nIndexBuf = 0;
+    return ret;
+}
+
+static void index_append(struct HDF5IO(waveform_file) *wavFile,
+                         struct HDF5IO(waveform_event) *wavEvent)
+{
+    struct HDF5IO(event_index) *row;
+
+    if(wavFile->indexBuf == NULL)
+        wavFile->indexBuf = (struct HDF5IO(event_index)*)
+            malloc(HDF5IO_INDEX_BATCH * sizeof(struct HDF5IO(event_index)));
+    row = &(wavFile->indexBuf[wavFile->nIndexBuf++]);
+    row->eventId = wavEvent->eventId;
+    if(wavFile->layout != HDF5IO_LAYOUT_CHUNKGROUPS) {
+        row->chunkId = 0;
+        row->inChunkId = wavEvent->eventId;
+    } else {
+        row->chunkId = wavEvent->eventId / wavFile->nWfmPerChunk;
+        row->inChunkId = wavEvent->eventId % wavFile->nWfmPerChunk;
+    }
+    row->hostTime = wavEvent->hostTime;
+    row->triggerTime = wavEvent->triggerTime;
+    if(wavFile->nIndexBuf == HDF5IO_INDEX_BATCH)
+        index_flush(wavFile);
+}
+
+/* the float[SCOPE_NCH] members of the feature row type */
+static hid_t feature_array_type(void)
+{
+    static hid_t tid = -1;
+    const hsize_t dims[1] = {SCOPE_NCH};
+
+    if(tid < 0) tid = H5Tarray_create(H5T_NATIVE_FLOAT, 1, dims);
+    return tid;
+}
+
+static hid_t features_type(void)
+{
+    static hid_t tid = -1;
+
+    if(tid >= 0) return tid;
+    tid = H5Tcreate(H5T_COMPOUND, sizeof(struct HDF5IO(features)));
+    H5Tinsert(tid, "eventId", HOFFSET(struct HDF5IO(features), eventId), H5T_NATIVE_HSIZE);
+    H5Tinsert(tid, "baseline", HOFFSET(struct HDF5IO(features), baseline),
+              feature_array_type());
+    H5Tinsert(tid, "rms", HOFFSET(struct HDF5IO(features), rms), feature_array_type());
+    H5Tinsert(tid, "amplitude", HOFFSET(struct HDF5IO(features), amplitude),
+              feature_array_type());
+    H5Tinsert(tid, "peakTime", HOFFSET(struct HDF5IO(features), peakTime),
+              feature_array_type());
+    H5Tinsert(tid, "integral", HOFFSET(struct HDF5IO(features), integral),
+              feature_array_type());
+    return tid;
+}
+
+static int feature_flush(struct HDF5IO(waveform_file) *wavFile)
+{
+    int ret;
+
+    if(wavFile->nFeatureBuf == 0) return 0;
+    ret = append_rows(wavFile, &(wavFile->featureDid), HDF5IO_FEATURE_DATASET, features_type(),
+                      wavFile->nFeatureRows, wavFile->featureBuf, wavFile->nFeatureBuf,
+                      HDF5IO_INDEX_BATCH, 0);
+    if(wavFile->featureDid < 0) return -1;
+
+    wavFile->nFeatureRows += wavFile->nFeatureBuf;
+    wavFile->nFeatureBuf = 0;
+    return ret;
+}
+
+int HDF5IO(write_features)(struct HDF5IO(waveform_file) *wavFile,
+                           const struct HDF5IO(features) *row)
+{
+    if(wavFile->featureBuf == NULL)
+        wavFile->featureBuf = (struct HDF5IO(features)*)
+            malloc(HDF5IO_INDEX_BATCH * sizeof(struct HDF5IO(features)));
+    if(wavFile->featureBuf == NULL) return -1;
+    wavFile->featureBuf[wavFile->nFeatureBuf++] = *row;
+    if(wavFile->nFeatureBuf == HDF5IO_INDEX_BATCH)
+        return feature_flush(wavFile);
+    return 0;
+}
+
+size_t HDF5IO(get_number_of_features)(struct HDF5IO(waveform_file) *wavFile)
+{
+    return wavFile->nFeatureRows + wavFile->nFeatureBuf;
+}
+
+int HDF5IO(read_features)(struct HDF5IO(waveform_file) *wavFile, size_t iRow, size_t nRows,
+                          struct HDF5IO(features) *rows)
+{
+    size_t n = 0;
+
+    if(iRow + nRows > wavFile->nFeatureRows + wavFile->nFeatureBuf) return -1;
+    if(iRow < wavFile->nFeatureRows) { /* the part in the file */
+        n = wavFile->nFeatureRows - iRow < nRows ? wavFile->nFeatureRows - iRow : nRows;
+        if(read_rows(wavFile->featureDid, features_type(), iRow, n, rows) < 0) return -1;
+    }
+    if(n < nRows) /* and the part not written yet */
+        memcpy(rows + n, wavFile->featureBuf + (iRow + n - wavFile->nFeatureRows),
+               (nRows - n) * sizeof(*rows));
+    return 0;
+}
+
+/* the offset of member name in struct features, -1 if there is none */
+static int feature_member_offset(const char *name)
+{
+    static const struct {
+        const char *name;
+        size_t off;
+    } members[] = {
+        {"baseline", HOFFSET(struct HDF5IO(features), baseline)},
+        {"rms", HOFFSET(struct HDF5IO(features), rms)},
+        {"amplitude", HOFFSET(struct HDF5IO(features), amplitude)},
+        {"peakTime", HOFFSET(struct HDF5IO(features), peakTime)},
+        {"integral", HOFFSET(struct HDF5IO(features), integral)}
+    };
+    size_t i;
+
+    for(i=0; i<sizeof(members)/sizeof(members[0]); i++)
+        if(strcmp(name, members[i].name) == 0) return (int)members[i].off;
+    return -1;
+}
+
+/* Whole rows HDF5IO_INDEX_BATCH at a time and a copy of the member
+ * beat an H5Dread with a compound type of just that member, which
+ * HDF5 converts row by row at half the speed. */
+int HDF5IO(read_feature_column)(struct HDF5IO(waveform_file) *wavFile, const char *name,
+                                size_t iRow, size_t nRows, float *col)
+{
+    struct HDF5IO(features) *rows;
+    int off = feature_member_offset(name);
+    size_t i, k, n;
+
+    if(off < 0 || iRow + nRows > wavFile->nFeatureRows + wavFile->nFeatureBuf) return -1;
+    rows = (struct HDF5IO(features)*)malloc(HDF5IO_INDEX_BATCH * sizeof(*rows));
+    if(rows == NULL) return -1;
+    for(i=0; i<nRows; i+=n) {
+        n = nRows - i < HDF5IO_INDEX_BATCH ? nRows - i : HDF5IO_INDEX_BATCH;
+        if(HDF5IO(read_features)(wavFile, iRow + i, n, rows) < 0) {
+            free(rows);
+            return -1;
         }
+        for(k=0; k<n; k++)
+            memcpy(col + (i + k) * SCOPE_NCH, (const char*)(rows + k) + off,
+                   SCOPE_NCH * sizeof(float));
     }
-#undef write_event_create_dataset
+    free(rows);
+    return 0;
+}
 
-    slabOff[0] = 0;
-    slabOff[1] = inChunkId * wavFile->nPt;
-    slabDims[0] = wavFile->nCh;
-    slabDims[1] = wavFile->nPt;
-    H5Sselect_hyperslab(chSid, H5S_SELECT_SET, slabOff, NULL, slabDims, NULL);
+static hid_t roi_type(void)
+{
+    static hid_t tid = -1;
 
-    mSid = H5Screate_simple(2, slabDims, NULL);
-    mOff[0] = 0;
-    mOff[1] = 0;
-    H5Sselect_hyperslab(mSid, H5S_SELECT_SET, mOff, NULL, slabDims, NULL);
-    
-    ret = H5Dwrite(chDid, H5T_NATIVE_CHAR, mSid, chSid, H5P_DEFAULT,
-                   wavEvent->wavBuf);
+    if(tid >= 0) return tid;
+    tid = H5Tcreate(H5T_COMPOUND, sizeof(struct HDF5IO(roi)));
+    H5Tinsert(tid, "ch", HOFFSET(struct HDF5IO(roi), ch), H5T_NATIVE_UINT32);
+    H5Tinsert(tid, "iPt", HOFFSET(struct HDF5IO(roi), iPt), H5T_NATIVE_UINT32);
+    H5Tinsert(tid, "nPt", HOFFSET(struct HDF5IO(roi), nPt), H5T_NATIVE_UINT32);
+    return tid;
+}
+
+static hid_t roi_event_type(void)
+{
+    static hid_t tid = -1;
+    const hsize_t dims[1] = {SCOPE_NCH};
+    hid_t intArrayTid;
+
+    if(tid >= 0) return tid;
+    intArrayTid = H5Tarray_create(H5T_NATIVE_INT, 1, dims);
+    tid = H5Tcreate(H5T_COMPOUND, sizeof(struct HDF5IO(roi_event)));
+    H5Tinsert(tid, "triggerId", HOFFSET(struct HDF5IO(roi_event), triggerId),
+              H5T_NATIVE_HSIZE);
+    H5Tinsert(tid, "iRoi", HOFFSET(struct HDF5IO(roi_event), iRoi), H5T_NATIVE_HSIZE);
+    H5Tinsert(tid, "nRoi", HOFFSET(struct HDF5IO(roi_event), nRoi), H5T_NATIVE_HSIZE);
+    H5Tinsert(tid, "offset", HOFFSET(struct HDF5IO(roi_event), offset), H5T_NATIVE_HSIZE);
+    H5Tinsert(tid, "baseline", HOFFSET(struct HDF5IO(roi_event), baseline), intArrayTid);
+    H5Tclose(intArrayTid);
+    return tid;
+}
+
+/* appends the buffered samples, regions and events, in that order, so
+ * that the rows in the file never point past the samples */
+static int roi_flush(struct HDF5IO(waveform_file) *wavFile)
+{
+    int ret = 0;
+
+    if(wavFile->nRoiSampleBuf > 0) {
+        ret |= append_rows(wavFile, &(wavFile->roiSampleDid), HDF5IO_ROI_SAMPLE_DATASET,
+                           sample_type(wavFile), wavFile->nRoiSamples, wavFile->roiSampleBuf,
+                           wavFile->nRoiSampleBuf, HDF5IO_ROI_CHUNK, 1);
+        wavFile->nRoiSamples += wavFile->nRoiSampleBuf;
+        wavFile->nRoiSampleBuf = 0;
+    }
+    if(wavFile->nRoiRowBuf > 0) {
+        ret |= append_rows(wavFile, &(wavFile->roiIndexDid), HDF5IO_ROI_INDEX_DATASET,
+                           roi_type(), wavFile->nRoiRows, wavFile->roiRowBuf,
+                           wavFile->nRoiRowBuf, HDF5IO_INDEX_BATCH, 0);
+        wavFile->nRoiRows += wavFile->nRoiRowBuf;
+        wavFile->nRoiRowBuf = 0;
+    }
+    if(wavFile->nRoiEventBuf > 0) {
+        ret |= append_rows(wavFile, &(wavFile->roiEventDid), HDF5IO_ROI_EVENT_DATASET,
+                           roi_event_type(), wavFile->nRoiEvents, wavFile->roiEventBuf,
+                           wavFile->nRoiEventBuf, HDF5IO_INDEX_BATCH, 0);
+        wavFile->nRoiEvents += wavFile->nRoiEventBuf;
+        wavFile->nRoiEventBuf = 0;
+    }
+    return ret < 0 ? -1 : 0;
+}
+
+int HDF5IO(write_event_rois)(struct HDF5IO(waveform_file) *wavFile,
+                             struct HDF5IO(waveform_event) *wavEvent,
+                             struct HDF5IO(roi_event) *roiEvent, struct HDF5IO(roi) *rois)
+{
+    size_t i, n = 0, w = wavFile->sampleWidth;
+    const struct HDF5IO(roi) *roi;
+
+    if(wavFile->layout != HDF5IO_LAYOUT_ROI
+       || wavEvent->eventId != wavFile->nRoiEvents + wavFile->nRoiEventBuf)
+        return -1;
+    for(i=0; i<roiEvent->nRoi; i++) {
+        if(rois[i].ch >= wavFile->nCh || rois[i].iPt + rois[i].nPt > wavFile->nPt)
+            return -1;
+        n += rois[i].nPt;
+    }
+
+    if(wavFile->roiEventBuf == NULL)
+        wavFile->roiEventBuf = (struct HDF5IO(roi_event)*)
+            malloc(HDF5IO_INDEX_BATCH * sizeof(struct HDF5IO(roi_event)));
+    if(wavFile->nRoiRowBuf + roiEvent->nRoi > wavFile->roiRowCap) {
+        wavFile->roiRowCap = wavFile->nRoiRowBuf + roiEvent->nRoi + HDF5IO_INDEX_BATCH;
+        wavFile->roiRowBuf = (struct HDF5IO(roi)*)
+            realloc(wavFile->roiRowBuf, wavFile->roiRowCap * sizeof(struct HDF5IO(roi)));
+    }
+    if(wavFile->nRoiSampleBuf + n > wavFile->roiSampleCap) {
+        wavFile->roiSampleCap = wavFile->nRoiSampleBuf + n + HDF5IO_ROI_CHUNK;
+        wavFile->roiSampleBuf = (char*)realloc(wavFile->roiSampleBuf, wavFile->roiSampleCap * w);
+    }
+
+    roiEvent->iRoi = wavFile->nRoiRows + wavFile->nRoiRowBuf;
+    roiEvent->offset = wavFile->nRoiSamples + wavFile->nRoiSampleBuf;
+    for(i=0; i<roiEvent->nRoi; i++) {
+        roi = &(rois[i]);
+        memcpy(wavFile->roiSampleBuf + wavFile->nRoiSampleBuf * w,
+               wavEvent->wavBuf + (roi->ch * wavFile->nPt + roi->iPt) * w, roi->nPt * w);
+        wavFile->nRoiSampleBuf += roi->nPt;
+        wavFile->roiRowBuf[wavFile->nRoiRowBuf++] = *roi;
+    }
+    wavFile->roiEventBuf[wavFile->nRoiEventBuf++] = *roiEvent;
 
     wavFile->nEvents++;
+    index_append(wavFile, wavEvent);
+    if(wavFile->nRoiEventBuf == HDF5IO_INDEX_BATCH || wavFile->nRoiRowBuf >= HDF5IO_INDEX_BATCH
+       || wavFile->nRoiSampleBuf >= HDF5IO_ROI_CHUNK)
+        return roi_flush(wavFile);
+    return 0;
+}
 
-    H5Sclose(mSid);
-    H5Sclose(chSid);
-    H5Dclose(chDid);
-    H5Gclose(rootGid);
+/* write_event in HDF5IO_LAYOUT_ROI: each waveform is one region */
+static int roi_write_event(struct HDF5IO(waveform_file) *wavFile,
+                           struct HDF5IO(waveform_event) *wavEvent)
+{
+    struct HDF5IO(roi_event) roiEvent;
+    struct HDF5IO(roi) rois[SCOPE_NCH];
+    size_t iCh;
+
+    memset(&roiEvent, 0, sizeof(roiEvent));
+    roiEvent.triggerId = wavEvent->eventId;
+    roiEvent.nRoi = wavFile->nCh;
+    for(iCh=0; iCh<wavFile->nCh; iCh++) {
+        rois[iCh].ch = iCh;
+        rois[iCh].iPt = 0;
+        rois[iCh].nPt = wavFile->nPt;
+    }
+    return HDF5IO(write_event_rois)(wavFile, wavEvent, &roiEvent, rois);
+}
+
+int HDF5IO(read_roi_event)(struct HDF5IO(waveform_file) *wavFile, size_t eventId,
+                           struct HDF5IO(roi_event) *roiEvent)
+{
+    if(wavFile->layout != HDF5IO_LAYOUT_ROI || roi_flush(wavFile) < 0
+       || eventId >= wavFile->nRoiEvents)
+        return -1;
+    return read_rows(wavFile->roiEventDid, roi_event_type(), eventId, 1, roiEvent);
+}
+
+int HDF5IO(read_rois)(struct HDF5IO(waveform_file) *wavFile,
+                      const struct HDF5IO(roi_event) *roiEvent, struct HDF5IO(roi) *rois)
+{
+    if(roiEvent->nRoi == 0) return 0;
+    if(roiEvent->iRoi + roiEvent->nRoi > wavFile->nRoiRows) return -1;
+    return read_rows(wavFile->roiIndexDid, roi_type(), roiEvent->iRoi, roiEvent->nRoi, rois);
+}
+
+/* the samples of the regions of an event */
+static size_t roi_samples(const struct HDF5IO(roi_event) *roiEvent,
+                          const struct HDF5IO(roi) *rois)
+{
+    size_t k, n = 0;
+
+    for(k=0; k<roiEvent->nRoi; k++) n += rois[k].nPt;
+    return n;
+}
+
+int HDF5IO(read_roi_samples)(struct HDF5IO(waveform_file) *wavFile,
+                             const struct HDF5IO(roi_event) *roiEvent,
+                             const struct HDF5IO(roi) *rois, char *buf)
+{
+    size_t n = roi_samples(roiEvent, rois);
+
+    if(roiEvent->offset + n > wavFile->nRoiSamples) return -1;
+    if(n == 0) return 0;
+    return read_rows(wavFile->roiSampleDid, sample_type(wavFile), roiEvent->offset, n, buf);
+}
+
+/* read_event_window in HDF5IO_LAYOUT_ROI: the baseline, with the parts
+ * of the regions that fall into the window copied over it */
+static int roi_read_window(struct HDF5IO(waveform_file) *wavFile, size_t eventId,
+                           unsigned int chSel, size_t iPt, size_t nPt, char *buf)
+{
+    struct HDF5IO(roi_event) roiEvent;
+    struct HDF5IO(roi) *rois = NULL;
+    char *samples = NULL, *row;
+    size_t iCh, k, a, b, i, off, nSel = 0, w = wavFile->sampleWidth;
+    int ret = -1;
+
+    if(HDF5IO(read_roi_event)(wavFile, eventId, &roiEvent) < 0)
+        return -1;
+    if(roiEvent.nRoi > 0) {
+        rois = (struct HDF5IO(roi)*)malloc(roiEvent.nRoi * sizeof(struct HDF5IO(roi)));
+        if(HDF5IO(read_rois)(wavFile, &roiEvent, rois) < 0)
+            goto end;
+        samples = (char*)malloc(roi_samples(&roiEvent, rois) * w + 1);
+        if(HDF5IO(read_roi_samples)(wavFile, &roiEvent, rois, samples) < 0)
+            goto end;
+    }
+    for(iCh=0; iCh<wavFile->nCh; iCh++) {
+        if(!(chSel & (1u << iCh))) continue;
+        row = buf + nSel * nPt * w;
+        if(w == 2)
+            for(i=0; i<nPt; i++) ((int16_t*)row)[i] = (int16_t)roiEvent.baseline[iCh];
+        else
+            memset(row, (char)roiEvent.baseline[iCh], nPt);
+        for(k=0, off=0; k<roiEvent.nRoi; off+=rois[k++].nPt) {
+            if(rois[k].ch != iCh) continue;
+            a = rois[k].iPt > iPt ? rois[k].iPt : iPt;
+            b = rois[k].iPt + rois[k].nPt < iPt + nPt ? rois[k].iPt + rois[k].nPt : iPt + nPt;
+            if(a < b)
+                memcpy(row + (a - iPt) * w, samples + (off + a - rois[k].iPt) * w, (b - a) * w);
+        }
+        nSel++;
+    }
+    ret = 0;
+end:
+    free(samples);
+    free(rois);
+    return ret;
+}
+
+static void zpipe_compress(void *arg)
+{
+    struct zchunk *zc = (struct zchunk*)arg;
+    uLongf len = zc->dstCap;
+    const char *src = zc->src;
+    unsigned iFilter = 0; /* index of the compressor in the pipeline */
+
+    if(zc->filter == HDF5IO_FILTER_NONE) {
+        len = zc->srcLen;
+    } else if(zc->sampleWidth > 1) { /* set_filter put shuffle first */
+        shuffle_bytes(zc->src, zc->srcLen, zc->sampleWidth, zc->shuffled);
+        src = zc->shuffled;
+        iFilter = 1;
+    }
+    if(zc->filter == HDF5IO_FILTER_DEFLATE) {
+        /* same zlib stream the HDF5 deflate filter produces */
+        if(compress2((Bytef*)zc->dst, &len, (const Bytef*)src, zc->srcLen,
+                     zc->level) != Z_OK)
+            len = zc->srcLen;
+    } else if(zc->filter == HDF5IO_FILTER_DELTA) {
+        len = deltacodec_encode(src, zc->srcLen, zc->dst);
+    }
+    if(len < zc->srcLen) {
+        zc->dstLen = len;
+        zc->filterMask = 0;
+    } else { /* both filters are optional, so they may be skipped */
+        memcpy(zc->dst, src, zc->srcLen);
+        zc->dstLen = zc->srcLen;
+        zc->filterMask = zc->filter == HDF5IO_FILTER_NONE ? 0 : 1u << iFilter;
+    }
+}
+
+int HDF5IO(set_decompress_threads)(struct HDF5IO(waveform_file) *wavFile,
+                                   size_t nThreads)
+{
+    wavFile->nDecompressThreads = nThreads;
+    return 0;
+}
+
+int HDF5IO(set_compress_threads)(struct HDF5IO(waveform_file) *wavFile,
+                                 size_t nThreads)
+{
+    struct HDF5IO(zpipe) *zp;
+
+    zpipe_close(wavFile);
+    if(nThreads == 0) return 0;
+
+    zp = (struct HDF5IO(zpipe)*)calloc(1, sizeof(struct HDF5IO(zpipe)));
+    zp->pool = tpool_init(nThreads);
+    zp->nThreads = nThreads;
+    wavFile->zpipe = zp;
+    return 0;
+}
+
+static void zpipe_alloc(struct HDF5IO(waveform_file) *wavFile)
+{
+    struct HDF5IO(zpipe) *zp = wavFile->zpipe;
+    size_t i, iCh, n; /* bytes per chunk */
+
+    n = h5chunk_length(wavFile) * wavFile->sampleWidth;
+    zp->nChunks = wavFile->nCh * (wavFile->nPt / h5chunk_length(wavFile));
+    /* enough events in flight to keep every worker busy, plus the one
+     * being committed */
+    zp->nSlots = zp->nThreads / zp->nChunks + 2;
+    zp->slots = (struct zslot*)calloc(zp->nSlots, sizeof(struct zslot));
+    for(i=0; i<zp->nSlots; i++) {
+        zp->slots[i].wavBuf = (char*)malloc(zp->nChunks * n);
+        zp->slots[i].chunks = (struct zchunk*)calloc(zp->nChunks, sizeof(struct zchunk));
+        for(iCh=0; iCh<zp->nChunks; iCh++) {
+            zp->slots[i].chunks[iCh].src = zp->slots[i].wavBuf + iCh * n;
+            zp->slots[i].chunks[iCh].srcLen = n;
+            zp->slots[i].chunks[iCh].sampleWidth = wavFile->sampleWidth;
+            if(wavFile->sampleWidth > 1)
+                zp->slots[i].chunks[iCh].shuffled = (char*)malloc(n);
+            zp->slots[i].chunks[iCh].dstCap = compressBound(n);
+            if(zp->slots[i].chunks[iCh].dstCap < deltacodec_bound(n))
+                zp->slots[i].chunks[iCh].dstCap = deltacodec_bound(n);
+            zp->slots[i].chunks[iCh].dst = (char*)malloc(zp->slots[i].chunks[iCh].dstCap);
+            zp->slots[i].chunks[iCh].job.fn = zpipe_compress;
+            zp->slots[i].chunks[iCh].job.arg = &(zp->slots[i].chunks[iCh]);
+        }
+    }
+}
+
+/* commits finished events in order: the oldest one only when all is 0
+ * and it is ready, every event in flight when all is 1 */
+static void zpipe_drain(struct HDF5IO(waveform_file) *wavFile, int all)
+{
+    struct HDF5IO(zpipe) *zp = wavFile->zpipe;
+    struct zslot *slot;
+    size_t iCh;
+    hsize_t offset[3];
+
+    if(zp == NULL) return;
+    while(zp->count > 0) {
+        slot = &(zp->slots[zp->head]);
+        for(iCh=0; iCh<zp->nChunks; iCh++) {
+            if(all) tpool_wait(zp->pool, &(slot->chunks[iCh].job));
+            else if(!tpool_done(zp->pool, &(slot->chunks[iCh].job))) return;
+        }
+        if(write_event_select_dataset(wavFile, slot->eventId) == 0) {
+            for(iCh=0; iCh<zp->nChunks; iCh++) {
+                chunk_offset(wavFile, slot->eventId, iCh, offset);
+                H5Dwrite_chunk(wavFile->chDid, H5P_DEFAULT, slot->chunks[iCh].filterMask,
+                               offset, slot->chunks[iCh].dstLen, slot->chunks[iCh].dst);
+            }
+            write_event_done(wavFile, slot->eventId);
+        }
+        zp->head = (zp->head + 1) % zp->nSlots;
+        zp->count--;
+    }
+}
+
+static void zpipe_close(struct HDF5IO(waveform_file) *wavFile)
+{
+    struct HDF5IO(zpipe) *zp = wavFile->zpipe;
+    size_t i, iCh;
+
+    if(zp == NULL) return;
+    zpipe_drain(wavFile, 1);
+    tpool_close(zp->pool);
+    if(zp->slots) {
+        for(i=0; i<zp->nSlots; i++) {
+            for(iCh=0; iCh<zp->nChunks; iCh++) {
+                free(zp->slots[i].chunks[iCh].dst);
+                free(zp->slots[i].chunks[iCh].shuffled);
+            }
+            free(zp->slots[i].chunks);
+            free(zp->slots[i].wavBuf);
+        }
+        free(zp->slots);
+    }
+    free(zp);
+    wavFile->zpipe = NULL;
+}
+
+static int zpipe_write_event(struct HDF5IO(waveform_file) *wavFile,
+                             struct HDF5IO(waveform_event) *wavEvent)
+{
+    struct HDF5IO(zpipe) *zp = wavFile->zpipe;
+    struct zslot *slot;
+    size_t iCh;
+
+    if(wavFile->filter == HDF5IO_FILTER_LZ4 || wavFile->filter == HDF5IO_FILTER_ZSTD) {
+        fprintf(stderr, "hdf5io: no compression threads for the %s filter,"
+                " compressing in H5Dwrite\n", HDF5IO(filter_name)(wavFile->filter));
+        zpipe_close(wavFile);
+        return HDF5IO(write_event)(wavFile, wavEvent);
+    }
+    if(zp->slots == NULL) zpipe_alloc(wavFile);
+    zpipe_drain(wavFile, 0);
+    if(zp->count == zp->nSlots) { /* wait for the oldest one */
+        slot = &(zp->slots[zp->head]);
+        for(iCh=0; iCh<zp->nChunks; iCh++)
+            tpool_wait(zp->pool, &(slot->chunks[iCh].job));
+        zpipe_drain(wavFile, 0);
+    }
+
+    slot = &(zp->slots[(zp->head + zp->count) % zp->nSlots]);
+    slot->eventId = wavEvent->eventId;
+    memcpy(slot->wavBuf, wavEvent->wavBuf, wavFile->nCh * wavFile->nPt * wavFile->sampleWidth);
+    for(iCh=0; iCh<zp->nChunks; iCh++) {
+        slot->chunks[iCh].filter = wavFile->filter;
+        slot->chunks[iCh].level = wavFile->filterLevel;
+        tpool_submit(zp->pool, &(slot->chunks[iCh].job));
+    }
+    zp->count++;
+
+    wavFile->nEvents++;
+    index_append(wavFile, wavEvent);
+    return 0;
+}
+
+int HDF5IO(write_event)(struct HDF5IO(waveform_file) *wavFile,
+                        struct HDF5IO(waveform_event) *wavEvent)
+{
+    herr_t ret;
+
+    if(wavFile->layout == HDF5IO_LAYOUT_ROI)
+        return roi_write_event(wavFile, wavEvent);
+    if(wavFile->zpipe)
+        return zpipe_write_event(wavFile, wavEvent);
+
+    if(write_event_select_dataset(wavFile, wavEvent->eventId) < 0)
+        return -1;
+
+    if(wavFile->layout == HDF5IO_LAYOUT_FRAMES) {
+        ret = frames_io(wavFile, wavEvent->eventId, (1u << wavFile->nCh) - 1, 0, wavFile->nPt,
+                        wavEvent->wavBuf, 1);
+    } else {
+        select_event(wavFile, wavEvent->eventId, wavFile->chSid);
+        ret = H5Dwrite(wavFile->chDid, sample_type(wavFile), wavFile->mSid, wavFile->chSid,
+                       H5P_DEFAULT, wavEvent->wavBuf);
+    }
+
+    wavFile->nEvents++;
+    index_append(wavFile, wavEvent);
+
+    write_event_done(wavFile, wavEvent->eventId);
     return (int)ret;
 }
 
+/* opens the dataset holding eventId, unless it is open already */
+static int read_event_select_dataset(struct HDF5IO(waveform_file) *wavFile,
+                                     size_t eventId)
+{
+    char buf[NAME_BUF_SIZE];
+    size_t chunkId;
+    hsize_t dims[3];
+    hid_t dcpl;
+    int rank;
+
+    chunkId = wavFile->layout == HDF5IO_LAYOUT_CHUNKGROUPS ? eventId / wavFile->nWfmPerChunk : 0;
+    dataset_name(wavFile, chunkId, buf);
+    if(wavFile->chDid >= 0 && chunkId == wavFile->chunkId)
+        return 0;
+
+    write_event_close_dataset(wavFile);
+    wavFile->chDid = H5Dopen(wavFile->waveFid, buf, H5P_DEFAULT);
+    if(wavFile->chDid < 0) return -1;
+    wavFile->chSid = H5Dget_space(wavFile->chDid);
+    /* the chunk length the file was written with, for chunk_offset */
+    dcpl = H5Dget_create_plist(wavFile->chDid);
+    rank = H5Pget_chunk(dcpl, 3, dims);
+    wavFile->nPtPerH5Chunk = rank > 0 ? dims[rank - 1] : 0;
+    H5Pclose(dcpl);
+    if(wavFile->layout != HDF5IO_LAYOUT_CHUNKGROUPS) {
+        H5Sget_simple_extent_dims(wavFile->chSid, dims, NULL);
+        /* equal, so closing it does not try to trim it */
+        wavFile->nExtent = wavFile->eventIdEnd = dims[0] / rows_per_event(wavFile);
+    }
+    dims[0] = wavFile->nCh;
+    dims[1] = wavFile->nPt;
+    wavFile->mSid = H5Screate_simple(2, dims, NULL);
+    wavFile->chunkId = chunkId;
+    return 0;
+}
+
 int HDF5IO(read_event)(struct HDF5IO(waveform_file) *wavFile,
                        struct HDF5IO(waveform_event) *wavEvent)
 {
-    char buf[NAME_BUF_SIZE];
     herr_t ret;
-    size_t chunkId, inChunkId;
-    hid_t chSid, chDid;
+
+    if(wavFile->layout == HDF5IO_LAYOUT_ROI)
+        return roi_read_window(wavFile, wavEvent->eventId, (1u << wavFile->nCh) - 1, 0,
+                               wavFile->nPt, wavEvent->wavBuf);
+    if(read_event_select_dataset(wavFile, wavEvent->eventId) < 0)
+        return -1;
+    if(wavFile->layout != HDF5IO_LAYOUT_CHUNKGROUPS && wavEvent->eventId >= wavFile->nExtent)
+        return -1;
+
+    if(wavFile->layout == HDF5IO_LAYOUT_FRAMES)
+        return (int)frames_io(wavFile, wavEvent->eventId, (1u << wavFile->nCh) - 1, 0,
+                              wavFile->nPt, wavEvent->wavBuf, 0);
+    select_event(wavFile, wavEvent->eventId, wavFile->chSid);
+    ret = H5Dread(wavFile->chDid, sample_type(wavFile), wavFile->mSid, wavFile->chSid,
+                  H5P_DEFAULT, wavEvent->wavBuf);
+    return (int)ret;
+}
+
+int HDF5IO(read_event_window)(struct HDF5IO(waveform_file) *wavFile,
+                              struct HDF5IO(waveform_event) *wavEvent,
+                              unsigned int chSel, size_t iPt, size_t nPt)
+{
+    hsize_t slabOff[3], slabDims[3], dims[2];
+    size_t iCh, nSel = 0;
     hid_t mSid;
-    hsize_t slabOff[2], mOff[2], slabDims[2];
-    
-    chunkId = wavEvent->eventId / wavFile->nWfmPerChunk;
-    inChunkId = wavEvent->eventId % wavFile->nWfmPerChunk;
+    herr_t ret;
 
-    snprintf(buf, NAME_BUF_SIZE, "/C%zd", chunkId);
-    chDid = H5Dopen(wavFile->waveFid, buf, H5P_DEFAULT);
-    chSid = H5Dget_space(chDid);
+    if(nPt == 0 || iPt + nPt > wavFile->nPt || (chSel & ((1u << wavFile->nCh) - 1)) == 0)
+        return -1;
+    if(wavFile->layout == HDF5IO_LAYOUT_ROI)
+        return roi_read_window(wavFile, wavEvent->eventId, chSel, iPt, nPt, wavEvent->wavBuf);
+    if(read_event_select_dataset(wavFile, wavEvent->eventId) < 0)
+        return -1;
+    if(wavFile->layout != HDF5IO_LAYOUT_CHUNKGROUPS && wavEvent->eventId >= wavFile->nExtent)
+        return -1;
+    if(wavFile->layout == HDF5IO_LAYOUT_FRAMES)
+        return (int)frames_io(wavFile, wavEvent->eventId, chSel, iPt, nPt, wavEvent->wavBuf, 0);
 
-    slabOff[0] = 0;
-    slabOff[1] = inChunkId * wavFile->nPt;
-    slabDims[0] = wavFile->nCh;
-    slabDims[1] = wavFile->nPt;
-    H5Sselect_hyperslab(chSid, H5S_SELECT_SET, slabOff, NULL, slabDims, NULL);
+    /* one [1, nPt] slab per selected channel, so that HDF5 only reads
+     * (and decompresses) the chunks these touch */
+    H5Sselect_none(wavFile->chSid);
+    for(iCh=0; iCh<wavFile->nCh; iCh++) {
+        if(!(chSel & (1u << iCh))) continue;
+        if(wavFile->layout == HDF5IO_LAYOUT_EXTENSIBLE) {
+            slabOff[0] = wavEvent->eventId;
+            slabOff[1] = iCh;
+            slabOff[2] = iPt;
+            slabDims[0] = 1;
+            slabDims[1] = 1;
+            slabDims[2] = nPt;
+        } else {
+            slabOff[0] = iCh;
+            slabOff[1] = (wavEvent->eventId % wavFile->nWfmPerChunk) * wavFile->nPt + iPt;
+            slabDims[0] = 1;
+            slabDims[1] = nPt;
+        }
+        H5Sselect_hyperslab(wavFile->chSid, H5S_SELECT_OR, slabOff, NULL, slabDims, NULL);
+        nSel++;
+    }
 
-    mSid = H5Screate_simple(2, slabDims, NULL);
-    mOff[0] = 0;
-    mOff[1] = 0;
-    H5Sselect_hyperslab(mSid, H5S_SELECT_SET, mOff, NULL, slabDims, NULL);
+    dims[0] = nSel;
+    dims[1] = nPt;
+    mSid = H5Screate_simple(2, dims, NULL);
+    ret = H5Dread(wavFile->chDid, sample_type(wavFile), mSid, wavFile->chSid,
+                  H5P_DEFAULT, wavEvent->wavBuf);
+    H5Sclose(mSid);
+    return (int)ret;
+}
 
-    ret = H5Dread(chDid, H5T_NATIVE_CHAR, mSid, chSid, H5P_DEFAULT,
-                  wavEvent->wavBuf);
+int HDF5IO(read_frames)(struct HDF5IO(waveform_file) *wavFile, size_t iFrame, size_t nFrames,
+                        unsigned int chSel, char *buf)
+{
+    struct HDF5IO(waveform_event) wavEvent;
+    size_t frameSize = wavFile->nPt / wavFile->nFrames, iCh, nSel = 0, i;
+    hsize_t slabOff[3], slabDims[3], dims[3];
+    hid_t mSid;
+    herr_t ret;
+
+    for(iCh=0; iCh<wavFile->nCh; iCh++)
+        if(chSel & (1u << iCh)) nSel++;
+    if(nSel == 0 || nFrames == 0)
+        return -1;
+
+    if(wavFile->layout != HDF5IO_LAYOUT_FRAMES) {
+        memset(&wavEvent, 0, sizeof(wavEvent));
+        for(i=iFrame; i<iFrame+nFrames; i++) {
+            wavEvent.eventId = i / wavFile->nFrames;
+            wavEvent.wavBuf = buf + (i - iFrame) * nSel * frameSize * wavFile->sampleWidth;
+            if(HDF5IO(read_event_window)(wavFile, &wavEvent, chSel,
+                                         (i % wavFile->nFrames) * frameSize, frameSize) < 0)
+                return -1;
+        }
+        return 0;
+    }
 
+    if(read_event_select_dataset(wavFile, 0) < 0)
+        return -1;
+    if(iFrame + nFrames > wavFile->nExtent * wavFile->nFrames)
+        return -1;
+    /* the rows come out in the file's [frame, ch, sample] order */
+    H5Sselect_none(wavFile->chSid);
+    for(iCh=0; iCh<wavFile->nCh; iCh++) {
+        if(!(chSel & (1u << iCh))) continue;
+        slabOff[0] = iFrame;
+        slabOff[1] = iCh;
+        slabOff[2] = 0;
+        slabDims[0] = nFrames;
+        slabDims[1] = 1;
+        slabDims[2] = frameSize;
+        H5Sselect_hyperslab(wavFile->chSid, H5S_SELECT_OR, slabOff, NULL, slabDims, NULL);
+    }
+    dims[0] = nFrames;
+    dims[1] = nSel;
+    dims[2] = frameSize;
+    mSid = H5Screate_simple(3, dims, NULL);
+    ret = H5Dread(wavFile->chDid, sample_type(wavFile), mSid, wavFile->chSid,
+                  H5P_DEFAULT, buf);
     H5Sclose(mSid);
-    H5Sclose(chSid);
-    H5Dclose(chDid);
     return (int)ret;
 }
 
+static void unshuffle_bytes(const char *src, size_t n, size_t w, char *dst)
+{
+    size_t i, b, nElem = n / w;
+
+    for(b=0; b<w; b++)
+        for(i=0; i<nElem; i++)
+            dst[i * w + b] = src[b * nElem + i];
+}
+
+/* undoes the filters of one chunk on a pool worker, the last one
+ * writing straight into the event */
+static void reader_inflate(void *arg)
+{
+    struct ichunk *ic = (struct ichunk*)arg;
+    const struct HDF5IO(reader) *rd = ic->rd;
+    size_t n = rd->chunkBytes, inLen = ic->srcLen;
+    const char *in = ic->src;
+    char *out;
+    uLongf len;
+    int i, nLeft = 0;
+
+    ic->bad = 0;
+    for(i=0; i<rd->nFilters; i++)
+        if(!(ic->filterMask & (1u << i))) nLeft++;
+    if(nLeft == 0) {
+        if(inLen == n) memcpy(ic->dst, in, n);
+        else ic->bad = 1;
+        return;
+    }
+    for(i=rd->nFilters-1; i>=0 && !ic->bad; i--) {
+        if(ic->filterMask & (1u << i)) continue;
+        out = --nLeft % 2 ? ic->tmp : ic->dst;
+        switch(rd->filters[i]) {
+        case H5Z_FILTER_DEFLATE:
+            len = n;
+            if(uncompress((Bytef*)out, &len, (const Bytef*)in, inLen) != Z_OK || len != n)
+                ic->bad = 1;
+            break;
+        case HDF5IO_FILTER_ID_DELTA:
+            if(deltacodec_decoded_size(in, inLen) != n || deltacodec_decode(in, inLen, out) < 0)
+                ic->bad = 1;
+            break;
+        case H5Z_FILTER_SHUFFLE:
+            if(inLen == n) unshuffle_bytes(in, n, rd->wavFile->sampleWidth, out);
+            else ic->bad = 1;
+            break;
+        }
+        in = out;
+        inLen = n;
+    }
+}
+
+/* reads the chunks of wavEvent as stored and queues them to be
+ * decompressed into its wavBuf.  Returns -1, with nothing queued, if
+ * the event is not in the file; a chunk that fails later is marked
+ * bad. */
+static int reader_fetch(struct HDF5IO(reader) *rd, struct HDF5IO(waveform_event) *wavEvent,
+                        struct ichunk *chunks)
+{
+    struct HDF5IO(waveform_file) *wavFile = rd->wavFile;
+    struct ichunk *ic;
+    hsize_t offset[3], nBytes;
+    herr_t ret;
+    size_t k;
+
+    if(read_event_select_dataset(wavFile, wavEvent->eventId) < 0)
+        return -1;
+    if(wavFile->layout != HDF5IO_LAYOUT_CHUNKGROUPS && wavEvent->eventId >= wavFile->nExtent)
+        return -1;
+    for(k=0; k<rd->nChunks; k++) {
+        ic = &(chunks[k]);
+        ic->dst = wavEvent->wavBuf + k * rd->chunkBytes;
+        chunk_offset(wavFile, wavEvent->eventId, k, offset);
+        H5E_BEGIN_TRY {
+            ret = H5Dget_chunk_storage_size(wavFile->chDid, offset, &nBytes);
+        } H5E_END_TRY;
+        if(ret < 0 || nBytes == 0) { /* never written, H5Dread gives the fill value */
+            memset(ic->dst, 0, rd->chunkBytes);
+            ic->bad = 0;
+            ic->queued = 0;
+            continue;
+        }
+        if(nBytes > ic->srcCap) {
+            free(ic->src);
+            ic->srcCap = nBytes;
+            ic->src = (char*)malloc(ic->srcCap);
+        }
+        ic->srcLen = nBytes;
+        if(H5Dread_chunk(wavFile->chDid, H5P_DEFAULT, offset, &(ic->filterMask), ic->src) < 0) {
+            ic->bad = 1;
+            ic->queued = 0;
+            continue;
+        }
+        ic->queued = 1;
+        tpool_submit(rd->pool, &(ic->job));
+    }
+    return 0;
+}
+
+/* sets up the pool if the file's filters are ones reader_inflate
+ * knows, and if there is something to read */
+static void reader_init_pool(struct HDF5IO(reader) *rd, size_t nThreads)
+{
+    struct HDF5IO(waveform_file) *wavFile = rd->wavFile;
+    size_t i, chunkLen;
+    unsigned int flags, cdValues[8];
+    size_t nCdValues;
+    hid_t dcpl;
+    int k, id;
+
+    if(nThreads == 0 || rd->nEvents == 0 || wavFile->layout == HDF5IO_LAYOUT_ROI
+       || read_event_select_dataset(wavFile, rd->eventIds ? rd->eventIds[0]
+                                    : rd->firstEvent) < 0)
+        return;
+    dcpl = H5Dget_create_plist(wavFile->chDid);
+    rd->nFilters = H5Pget_nfilters(dcpl);
+    for(k=0; k<rd->nFilters; k++) {
+        nCdValues = sizeof(cdValues) / sizeof(cdValues[0]);
+        id = H5Pget_filter2(dcpl, k, &flags, &nCdValues, cdValues, 0, NULL, NULL);
+        if(id != H5Z_FILTER_DEFLATE && id != H5Z_FILTER_SHUFFLE && id != HDF5IO_FILTER_ID_DELTA)
+            break; /* e.g. a plugin, H5Dread runs it */
+        rd->filters[k] = id;
+    }
+    H5Pclose(dcpl);
+    if(rd->nFilters < 0 || k < rd->nFilters)
+        return;
+
+    chunkLen = h5chunk_length(wavFile);
+    rd->chunkBytes = chunkLen * wavFile->sampleWidth;
+    rd->nChunks = wavFile->nCh * (wavFile->nPt / chunkLen);
+    /* enough events in flight to keep every worker busy */
+    if(rd->nBufs < nThreads / rd->nChunks + 2)
+        rd->nBufs = nThreads / rd->nChunks + 2;
+    rd->chunks = (struct ichunk*)calloc(rd->nBufs * rd->nChunks, sizeof(struct ichunk));
+    for(i=0; i<rd->nBufs * rd->nChunks; i++) {
+        rd->chunks[i].rd = rd;
+        rd->chunks[i].tmp = rd->nFilters > 1 ? (char*)malloc(rd->chunkBytes) : NULL;
+        rd->chunks[i].job.fn = reader_inflate;
+        rd->chunks[i].job.arg = &(rd->chunks[i]);
+    }
+    rd->pool = tpool_init(nThreads);
+}
+
+static void *reader_thread(void *arg)
+{
+    struct HDF5IO(reader) *rd = (struct HDF5IO(reader)*)arg;
+    struct HDF5IO(waveform_event) *wavEvent;
+    size_t i;
+    int ret;
+
+    pthread_mutex_lock(&(rd->lock));
+    for(i=0; i<rd->nEvents; i++) {
+        while(rd->nRead - rd->nReleased == rd->nBufs && !rd->quit) {
+            rd->full = 1;
+            pthread_cond_wait(&(rd->released), &(rd->lock));
+        }
+        if(rd->quit) break;
+        wavEvent = &(rd->events[i % rd->nBufs]);
+        pthread_mutex_unlock(&(rd->lock));
+
+        wavEvent->eventId = rd->eventIds ? rd->eventIds[i] : rd->firstEvent + i;
+        if(rd->pool)
+            ret = reader_fetch(rd, wavEvent, rd->chunks + (i % rd->nBufs) * rd->nChunks);
+        else
+            ret = HDF5IO(read_event)(rd->wavFile, wavEvent);
+
+        pthread_mutex_lock(&(rd->lock));
+        if(ret < 0) break;
+        rd->nRead++;
+        pthread_cond_signal(&(rd->filled));
+    }
+    rd->stopped = 1;
+    pthread_cond_signal(&(rd->filled));
+    pthread_mutex_unlock(&(rd->lock));
+    return NULL;
+}
+
+static struct HDF5IO(reader) *reader_open(struct HDF5IO(waveform_file) *wavFile,
+                                          size_t firstEvent, const size_t *eventIds,
+                                          size_t nEvents, size_t nBufs)
+{
+    struct HDF5IO(reader) *rd;
+    size_t i, n = wavFile->nCh * wavFile->nPt * wavFile->sampleWidth;
+
+    rd = (struct HDF5IO(reader)*)calloc(1, sizeof(struct HDF5IO(reader)));
+    rd->wavFile = wavFile;
+    rd->firstEvent = firstEvent;
+    rd->nEvents = nEvents;
+    if(eventIds && nEvents > 0) {
+        rd->eventIds = (size_t*)malloc(nEvents * sizeof(size_t));
+        memcpy(rd->eventIds, eventIds, nEvents * sizeof(size_t));
+    }
+    rd->nBufs = nBufs < 2 ? 2 : nBufs;
+    reader_init_pool(rd, wavFile->nDecompressThreads);
+    rd->events = (struct HDF5IO(waveform_event)*)
+        calloc(rd->nBufs, sizeof(struct HDF5IO(waveform_event)));
+    rd->wavBuf = (char*)malloc(rd->nBufs * n);
+    for(i=0; i<rd->nBufs; i++)
+        rd->events[i].wavBuf = rd->wavBuf + i * n;
+    pthread_mutex_init(&(rd->lock), NULL);
+    pthread_cond_init(&(rd->filled), NULL);
+    pthread_cond_init(&(rd->released), NULL);
+    pthread_create(&(rd->tid), NULL, reader_thread, rd);
+    return rd;
+}
+
+struct HDF5IO(reader) *HDF5IO(open_reader)(struct HDF5IO(waveform_file) *wavFile,
+                                           size_t firstEvent, size_t nEvents, size_t nBufs)
+{
+    return reader_open(wavFile, firstEvent, NULL, nEvents, nBufs);
+}
+
+struct HDF5IO(reader) *HDF5IO(open_reader_list)(struct HDF5IO(waveform_file) *wavFile,
+                                                const size_t *eventIds, size_t nEvents,
+                                                size_t nBufs)
+{
+    return reader_open(wavFile, 0, eventIds, nEvents, nBufs);
+}
+
+struct HDF5IO(waveform_event) *HDF5IO(reader_next)(struct HDF5IO(reader) *rd)
+{
+    struct HDF5IO(waveform_event) *wavEvent = NULL;
+    struct ichunk *chunks;
+    size_t iBuf = 0, k;
+
+    if(rd->failed) return NULL;
+    pthread_mutex_lock(&(rd->lock));
+    while(rd->nTaken == rd->nRead && !rd->stopped) {
+        /* a caller that holds more than half the ring would wait for
+         * ever for reader_release to wake the thread */
+        if(rd->full) {
+            rd->full = 0;
+            pthread_cond_signal(&(rd->released));
+        }
+        pthread_cond_wait(&(rd->filled), &(rd->lock));
+    }
+    if(rd->nTaken < rd->nRead) {
+        iBuf = rd->nTaken++ % rd->nBufs;
+        wavEvent = &(rd->events[iBuf]);
+    }
+    pthread_mutex_unlock(&(rd->lock));
+
+    if(wavEvent && rd->pool) { /* its chunks may still be decompressing */
+        chunks = rd->chunks + iBuf * rd->nChunks;
+        for(k=0; k<rd->nChunks; k++) {
+            if(chunks[k].queued) tpool_wait(rd->pool, &(chunks[k].job));
+            if(chunks[k].bad) rd->failed = 1;
+        }
+        if(rd->failed) wavEvent = NULL;
+    }
+    return wavEvent;
+}
+
+void HDF5IO(reader_release)(struct HDF5IO(reader) *rd)
+{
+    pthread_mutex_lock(&(rd->lock));
+    if(rd->nReleased < rd->nTaken) {
+        rd->nReleased++;
+        /* wake the thread once half the ring is free rather than for
+         * every buffer, which saves a switch per event when it and the
+         * caller share a cpu */
+        if(rd->full && rd->nRead - rd->nReleased <= rd->nBufs / 2) {
+            rd->full = 0;
+            pthread_cond_signal(&(rd->released));
+        }
+    }
+    pthread_mutex_unlock(&(rd->lock));
+}
+
+int HDF5IO(close_reader)(struct HDF5IO(reader) *rd)
+{
+    size_t i;
+
+    if(rd == NULL) return -1;
+    pthread_mutex_lock(&(rd->lock));
+    rd->quit = 1;
+    pthread_cond_signal(&(rd->released));
+    pthread_mutex_unlock(&(rd->lock));
+    pthread_join(rd->tid, NULL);
+    if(rd->pool) {
+        tpool_close(rd->pool); /* after the chunks still queued */
+        for(i=0; i<rd->nBufs * rd->nChunks; i++) {
+            free(rd->chunks[i].src);
+            free(rd->chunks[i].tmp);
+        }
+        free(rd->chunks);
+    }
+
+    pthread_mutex_destroy(&(rd->lock));
+    pthread_cond_destroy(&(rd->filled));
+    pthread_cond_destroy(&(rd->released));
+    free(rd->wavBuf);
+    free(rd->events);
+    free(rd->eventIds);
+    free(rd);
+    return 0;
+}
+
 size_t HDF5IO(get_number_of_events)(struct HDF5IO(waveform_file) *wavFile)
 {
     /*
@@ -313,6 +2006,76 @@ size_t HDF5IO(get_number_of_events)(struct HDF5IO(waveform_file) *wavFile)
     return wavFile->nEvents;
 }
 
+int HDF5IO(read_event_index)(struct HDF5IO(waveform_file) *wavFile, size_t iRow,
+                             size_t nRows, struct HDF5IO(event_index) *rows)
+{
+    size_t n = 0;
+
+    if(iRow + nRows > wavFile->nIndexRows + wavFile->nIndexBuf) return -1;
+    if(iRow < wavFile->nIndexRows) { /* the part in the file */
+        n = wavFile->nIndexRows - iRow < nRows ? wavFile->nIndexRows - iRow : nRows;
+        if(read_rows(wavFile->indexDid, event_index_type(), iRow, n, rows) < 0) return -1;
+    }
+    if(n < nRows) /* and the part not written yet */
+        memcpy(rows + n, wavFile->indexBuf + (iRow + n - wavFile->nIndexRows),
+               (nRows - n) * sizeof(struct HDF5IO(event_index)));
+    return 0;
+}
+
+int HDF5IO(find_event)(struct HDF5IO(waveform_file) *wavFile, size_t eventId,
+                       struct HDF5IO(event_index) *row)
+{
+    size_t lo = 0, hi, mid;
+
+    hi = wavFile->nIndexRows + wavFile->nIndexBuf;
+    if(hi == 0) { /* no index, where the event would be */
+        if(eventId >= wavFile->nEvents) return -1;
+        row->eventId = eventId;
+        row->chunkId = wavFile->layout != HDF5IO_LAYOUT_CHUNKGROUPS ? 0
+            : eventId / wavFile->nWfmPerChunk;
+        row->inChunkId = wavFile->layout != HDF5IO_LAYOUT_CHUNKGROUPS ? eventId
+            : eventId % wavFile->nWfmPerChunk;
+        row->hostTime = 0.0;
+        row->triggerTime = 0.0;
+        return 0;
+    }
+    while(lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if(HDF5IO(read_event_index)(wavFile, mid, 1, row) < 0) return -1;
+        if(row->eventId < eventId) lo = mid + 1;
+        else hi = mid;
+    }
+    if(HDF5IO(read_event_index)(wavFile, lo, 1, row) < 0 || row->eventId != eventId)
+        return -1;
+    return 0;
+}
+
+/* the first row with hostTime >= t */
+static size_t index_lower_bound_time(struct HDF5IO(waveform_file) *wavFile, double t)
+{
+    struct HDF5IO(event_index) row;
+    size_t lo = 0, hi, mid;
+
+    hi = wavFile->nIndexRows + wavFile->nIndexBuf;
+    while(lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if(HDF5IO(read_event_index)(wavFile, mid, 1, &row) < 0) break;
+        if(row.hostTime < t) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+size_t HDF5IO(find_time_range)(struct HDF5IO(waveform_file) *wavFile, double t0, double t1,
+                               size_t *iRow)
+{
+    size_t iEnd;
+
+    *iRow = index_lower_bound_time(wavFile, t0);
+    iEnd = index_lower_bound_time(wavFile, t1);
+    return iEnd > *iRow ? iEnd - *iRow : 0;
+}
+
 #ifdef HDF5IO_DEBUG_ENABLEMAIN
 int main(int argc, char **argv)
 {
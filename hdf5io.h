@@ -1,17 +1,141 @@
 #ifndef __HDF5IO_H__
 #define __HDF5IO_H__
 
+#include <stdint.h>
 #include <hdf5.h>
 
 #define NAME_BUF_SIZE 256
+#define HDF5IO_DEFLATE_LEVEL 6
+
+/* compression of the waveform datasets, see set_filter */
+enum {
+    HDF5IO_FILTER_NONE = 0,
+    HDF5IO_FILTER_DEFLATE,
+    HDF5IO_FILTER_LZ4,  /* byte shuffle + LZ4, HDF5 filter plugin 32004 */
+    HDF5IO_FILTER_ZSTD, /* HDF5 filter plugin 32015 */
+    HDF5IO_FILTER_DELTA, /* deltacodec, registered by hdf5io */
+    HDF5IO_FILTER_N
+};
+#define HDF5IO_FILTER_ID_LZ4 32004
+#define HDF5IO_FILTER_ID_ZSTD 32015
+#define HDF5IO_FILTER_ID_DELTA 32768 /* from the range for private use */
+
+/* how events are laid out in the file, see set_layout */
+enum {
+    HDF5IO_LAYOUT_CHUNKGROUPS = 0, /* 2D [nCh, nWfmPerChunk*nPt] datasets /C0, /C1, ... */
+    HDF5IO_LAYOUT_EXTENSIBLE,      /* one 3D [nEvents, nCh, nPt] dataset */
+    HDF5IO_LAYOUT_FRAMES,          /* one 3D [nEvents*nFrames, nCh, nPt/nFrames] dataset */
+    HDF5IO_LAYOUT_ROI              /* regions of interest only, see write_event_rois */
+};
+#define HDF5IO_WAVEFORM_DATASET "Waveforms" /* of HDF5IO_LAYOUT_EXTENSIBLE */
+#define HDF5IO_FRAME_DATASET "Frames" /* of HDF5IO_LAYOUT_FRAMES */
+#define HDF5IO_ROI_EVENT_DATASET "RoiEvents" /* of HDF5IO_LAYOUT_ROI, a row per event */
+#define HDF5IO_ROI_INDEX_DATASET "RoiIndex" /* a row per region */
+#define HDF5IO_ROI_SAMPLE_DATASET "RoiSamples" /* the samples of all regions, 1D */
+#define HDF5IO_ROI_CHUNK 65536 /* samples per HDF5 chunk of HDF5IO_ROI_SAMPLE_DATASET */
+#define HDF5IO_INDEX_DATASET "EventIndex"
+#define HDF5IO_INDEX_BATCH 1024 /* index rows buffered before they are written */
+#define HDF5IO_FEATURE_DATASET "EventFeatures" /* a row per event, see write_features */
+
+/* one row of the event index, see find_event */
+struct HDF5IO(event_index)
+{
+    size_t eventId;
+    size_t chunkId;   /* the event is in dataset C<chunkId>, 0 for the extensible layout */
+    size_t inChunkId; /* at this place in that dataset */
+    double hostTime;
+    double triggerTime;
+};
+
+/* HDF5IO_LAYOUT_ROI: a region of interest, samples iPt..iPt+nPt-1 of
+ * the stored channel ch (0..nCh-1), as a row of the region index.
+ * Rows are 12 bytes, as a noisy run can have several regions per
+ * event; where the samples are follows from the event's offset and
+ * the nPt of the regions before. */
+struct HDF5IO(roi)
+{
+    uint32_t ch;
+    uint32_t iPt, nPt;
+};
+
+/* HDF5IO_LAYOUT_ROI: row eventId of HDF5IO_ROI_EVENT_DATASET */
+struct HDF5IO(roi_event)
+{
+    size_t triggerId;  /* the event's number as acquired, see write_event_rois */
+    size_t iRoi, nRoi; /* its rows in HDF5IO_ROI_INDEX_DATASET */
+    /* of its first sample in HDF5IO_ROI_SAMPLE_DATASET, the samples of
+     * its regions following one after the other */
+    size_t offset;
+    /* per stored channel, what the samples outside the regions read
+     * back as */
+    int baseline[SCOPE_NCH];
+};
+
+/* a row of HDF5IO_FEATURE_DATASET: per stored channel, in volts and
+ * seconds, what event selection cuts on, computed by the writer while
+ * the event is at hand (evfeatures.c) */
+struct HDF5IO(features)
+{
+    size_t eventId;
+    float baseline[SCOPE_NCH];  /* mean of the baseline samples */
+    float rms[SCOPE_NCH];       /* of the baseline samples about it */
+    float amplitude[SCOPE_NCH]; /* the sample furthest from the baseline, minus it */
+    float peakTime[SCOPE_NCH];  /* of that sample, from the start of its frame */
+    float integral[SCOPE_NCH];  /* sum(v - baseline) * dt over the event, V s */
+};
+
+struct HDF5IO(zpipe); /* parallel compression state, private to hdf5io.c */
+struct HDF5IO(reader); /* read-ahead state, private to hdf5io.c */
 
 struct HDF5IO(waveform_file)
 {
     hid_t waveFid;
     size_t nPt;
     size_t nCh;
+    size_t sampleWidth; /* bytes per sample, from the waveform attribute */
+    size_t nFrames; /* FastFrame frames per event, 1 when not in FastFrame mode */
     size_t nWfmPerChunk;
     size_t nEvents;
+    int layout; /* HDF5IO_LAYOUT_* */
+
+    /* the dataset events are written to or read from, with its file and
+     * memory dataspaces.  A C<n> dataset is kept open until one with
+     * another chunkId is needed or, when writing, until it is full or
+     * the file is flushed or closed.  chDid < 0 means none is open. */
+    hid_t chDid, chSid, mSid;
+    size_t chunkId;
+    /* HDF5IO_LAYOUT_EXTENSIBLE: events the dataset has room for, and
+     * the highest eventId written + 1 */
+    size_t nExtent, eventIdEnd;
+    /* raw data chunk cache of the datasets written, see set_chunk_cache */
+    size_t chunkCacheBytes, chunkCacheSlots;
+    /* HDF5IO_FILTER_* and its level, see set_filter */
+    int filter, filterLevel;
+    /* non-NULL when chunks are compressed by a thread pool and written
+     * with H5Dwrite_chunk, see set_compress_threads */
+    struct HDF5IO(zpipe) *zpipe;
+    /* pool size of readers opened later, see set_decompress_threads */
+    size_t nDecompressThreads;
+    /* samples per HDF5 chunk asked for, 0 for whole waveforms, see
+     * set_chunk_samples */
+    size_t nPtPerH5Chunk;
+    /* the event index: rows in the file and rows still in indexBuf */
+    hid_t indexDid;
+    size_t nIndexRows, nIndexBuf;
+    struct HDF5IO(event_index) *indexBuf;
+    /* HDF5IO_LAYOUT_ROI: the datasets and the rows (samples) in them,
+     * then the rows and samples buffered to be appended in batches */
+    hid_t roiEventDid, roiIndexDid, roiSampleDid;
+    size_t nRoiEvents, nRoiRows, nRoiSamples;
+    size_t nRoiEventBuf, nRoiRowBuf, nRoiSampleBuf;
+    size_t roiRowCap, roiSampleCap;
+    struct HDF5IO(roi_event) *roiEventBuf;
+    struct HDF5IO(roi) *roiRowBuf;
+    char *roiSampleBuf;
+    /* the feature table: rows in the file and rows still in featureBuf */
+    hid_t featureDid;
+    size_t nFeatureRows, nFeatureBuf;
+    struct HDF5IO(features) *featureBuf;
 };
 
 struct HDF5IO(waveform_event)
@@ -19,8 +143,15 @@ struct HDF5IO(waveform_event)
     size_t eventId;
     /* wavBuf should point to a contiguous 2D array, mapped as
      * ch1..ch2..ch3..ch4 (row-major).  Omitting one or more ch? is
-     * allowed in accordance with chMask.*/
+     * allowed in accordance with chMask.  Samples are signed chars, or
+     * int16_t in the host's byte order when the file's sampleWidth is
+     * 2, so the buffer holds nCh * nPt * sampleWidth bytes. */
     char *wavBuf;
+    /* for the event index: when the host received the event
+     * (CLOCK_MONOTONIC, s) and the scope's trigger time stamp of it
+     * (its first frame in FastFrame mode), 0 when unknown */
+    double hostTime;
+    double triggerTime;
 };
 
 /* nWfmPerChunk: waveforms are stored in 2D arrays.  To optimize
@@ -35,6 +166,70 @@ int HDF5IO(close_file)(struct HDF5IO(waveform_file) *wavFile);
 /* flush also writes nEvents to the file */
 int HDF5IO(flush_file)(struct HDF5IO(waveform_file) *wavFile);
 
+/* Size of the HDF5 raw data chunk cache used for the datasets written
+ * to wavFile.  nBytes = 0 picks the default, which holds all HDF5
+ * chunks one event touches (nCh * nPt * sampleWidth bytes); nSlots = 0
+ * picks a hash table size to match.  Takes effect for datasets created
+ * or opened after the call. */
+int HDF5IO(set_chunk_cache)(struct HDF5IO(waveform_file) *wavFile,
+                            size_t nBytes, size_t nSlots);
+/* Splits every waveform into HDF5 chunks of about nPtPerH5Chunk
+ * samples along time, rounded down so that they divide nPt, so that
+ * read_event_window of a short time window only decompresses the
+ * chunks it overlaps.  Smaller chunks compress a little worse and cost
+ * more per chunk overhead when whole events are read.  0 (the default)
+ * makes each waveform one chunk, and so does a nPt that has no divisor
+ * between nPtPerH5Chunk / 2 and nPtPerH5Chunk, which returns -1 with a
+ * warning.  To be set after the waveform attribute and before the
+ * first write_event; readers need not know it. */
+int HDF5IO(set_chunk_samples)(struct HDF5IO(waveform_file) *wavFile, size_t nPtPerH5Chunk);
+/* HDF5IO_LAYOUT_CHUNKGROUPS (the default) starts a new root group
+ * dataset C<n> every nWfmPerChunk events, which makes files with many
+ * events slow to open.  HDF5IO_LAYOUT_EXTENSIBLE writes all events to
+ * the one dataset HDF5IO_WAVEFORM_DATASET, whose first dimension grows
+ * nWfmPerChunk events at a time.  Either way an HDF5 chunk holds (part
+ * of, see set_chunk_samples) one waveform.  HDF5IO_LAYOUT_FRAMES is
+ * for FastFrame runs: the one dataset HDF5IO_FRAME_DATASET has a row
+ * per frame, event e holding rows e*nFrames..(e+1)*nFrames-1, and an
+ * HDF5 chunk holds one frame of one channel, so read_frames of a few
+ * frames decompresses only those.  Events still go in and come out of
+ * write_event/read_event as nCh rows of nPt samples, frames
+ * concatenated.  nFrames is taken from the waveform attribute; without
+ * FastFrame this layout is the extensible one with 1 frame.
+ * HDF5IO_LAYOUT_ROI is for zero-suppressed runs, see write_event_rois.
+ * To be set before the first write_event; open_file_for_read finds
+ * out the layout by itself. */
+int HDF5IO(set_layout)(struct HDF5IO(waveform_file) *wavFile, int layout);
+/* Compression of the waveform datasets, to be set before the first
+ * write_event: one of
+ * HDF5IO_FILTER_*, level is the deflate (1..9) or zstd (1..22) level
+ * and is ignored otherwise, 0 picks the default.  The default filter
+ * is deflate at HDF5IO_DEFLATE_LEVEL.  LZ4 and zstd are HDF5 filter
+ * plugins, found through HDF5_PLUGIN_PATH; when the plugin can not be
+ * loaded -1 is returned and the filter is left as it was.  The choice
+ * is kept in the "filter" root attribute for information, readers need
+ * nothing but the plugin since HDF5 records the filter per dataset.
+ * The delta filter (see deltacodec.h) is built in; hdf5io registers it
+ * with HDF5 when a file is opened, so only programs linked with hdf5io
+ * can read it. */
+int HDF5IO(set_filter)(struct HDF5IO(waveform_file) *wavFile, int filter, int level);
+/* "none", "deflate", "lz4", "zstd", "delta"; NULL for an unknown filter */
+const char *HDF5IO(filter_name)(int filter);
+/* nThreads > 0: compress each HDF5 chunk (a waveform of one channel,
+ * or a piece of it) on a pool of nThreads workers and commit the
+ * compressed bytes with H5Dwrite_chunk, in event order, from the
+ * thread calling write_event.  write_event copies the event and
+ * returns once it is queued, so the caller may reuse wavBuf right
+ * away.  Up to nThreads / (HDF5 chunks per event) + 2 events are held
+ * in memory.  The file is the same as one written through H5Dwrite.
+ * nThreads = 0 (the default) compresses inside H5Dwrite on the calling
+ * thread, which is also what happens for the plugin filters, as the
+ * thread pool only does deflate and delta. */
+int HDF5IO(set_compress_threads)(struct HDF5IO(waveform_file) *wavFile,
+                                 size_t nThreads);
+/* The waveform attribute also sets the sample width of the datasets,
+ * wavAttr->sampleWidth 2 stores 16-bit samples, anything else 8-bit
+ * ones.  Files from before sampleWidth existed read back as 1. */
 int HDF5IO(write_waveform_attribute_in_file_header)(
     struct HDF5IO(waveform_file) *wavFile,
     struct waveform_attribute *wavAttr);
@@ -45,6 +240,122 @@ int HDF5IO(write_event)(struct HDF5IO(waveform_file) *wavFile,
                         struct HDF5IO(waveform_event) *wavEvent);
 int HDF5IO(read_event)(struct HDF5IO(waveform_file) *wavFile,
                        struct HDF5IO(waveform_event) *wavEvent);
+/* HDF5IO_LAYOUT_ROI keeps only regions of interest of the waveforms:
+ * their samples one after the other in HDF5IO_ROI_SAMPLE_DATASET
+ * (compressed as set_filter says, in HDF5 chunks of HDF5IO_ROI_CHUNK
+ * samples), a row per region in HDF5IO_ROI_INDEX_DATASET with where
+ * its samples are, and a row per event in HDF5IO_ROI_EVENT_DATASET
+ * with its regions and channel baselines.
+ * write_event_rois stores the roiEvent->nRoi regions rois[] of wavEvent
+ * (wavBuf as for write_event), filling in roiEvent->iRoi and
+ * roiEvent->offset.  Regions of a channel should not overlap.  Events
+ * have to come in order, eventId 0, 1, 2, ..., so a writer that drops
+ * events numbers the ones it keeps and can put its own count in
+ * roiEvent->triggerId.  write_event in this layout stores every
+ * waveform whole, as one region.  Compression threads are not used. */
+int HDF5IO(write_event_rois)(struct HDF5IO(waveform_file) *wavFile,
+                             struct HDF5IO(waveform_event) *wavEvent,
+                             struct HDF5IO(roi_event) *roiEvent, struct HDF5IO(roi) *rois);
+/* In HDF5IO_LAYOUT_ROI, read_event and read_event_window rebuild the
+ * waveforms from the regions, with the channel's baseline in between.
+ * read_roi_event reads row eventId of the event table, read_rois its
+ * roiEvent->nRoi regions into rois[], and read_roi_samples the samples
+ * of all those regions into buf, one after the other.  All return -1
+ * if the rows are not in the file. */
+int HDF5IO(read_roi_event)(struct HDF5IO(waveform_file) *wavFile, size_t eventId,
+                           struct HDF5IO(roi_event) *roiEvent);
+int HDF5IO(read_rois)(struct HDF5IO(waveform_file) *wavFile,
+                      const struct HDF5IO(roi_event) *roiEvent, struct HDF5IO(roi) *rois);
+int HDF5IO(read_roi_samples)(struct HDF5IO(waveform_file) *wavFile,
+                             const struct HDF5IO(roi_event) *roiEvent,
+                             const struct HDF5IO(roi) *rois, char *buf);
+/* Reads samples iPt..iPt+nPt-1 of the channels selected by chSel (bit
+ * i for the i-th channel stored, not the scope channel number) into
+ * wavBuf, row-major like read_event but with only the selected rows
+ * of nPt samples each.  Returns -1 for an empty selection or a window
+ * past the end of the waveform. */
+int HDF5IO(read_event_window)(struct HDF5IO(waveform_file) *wavFile,
+                              struct HDF5IO(waveform_event) *wavEvent,
+                              unsigned int chSel, size_t iPt, size_t nPt);
+/* Reads frames iFrame..iFrame+nFrames-1, counted over the whole file
+ * (frame f of event e is e*wavFile->nFrames + f), of the channels in
+ * chSel (as for read_event_window) into buf as [nFrames, nSel,
+ * nPt/wavFile->nFrames] samples.  One H5Dread in HDF5IO_LAYOUT_FRAMES,
+ * a read_event_window per frame otherwise.  Returns -1 for an empty
+ * selection or frames that are not in the file. */
+int HDF5IO(read_frames)(struct HDF5IO(waveform_file) *wavFile, size_t iFrame, size_t nFrames,
+                        unsigned int chSel, char *buf);
 size_t HDF5IO(get_number_of_events)(struct HDF5IO(waveform_file) *wavFile);
+/* Read-ahead for sequential scans.  open_reader starts a thread that
+ * reads events firstEvent..firstEvent+nEvents-1 with read_event into a
+ * ring of nBufs (at least 2) event buffers, allocated once, while the
+ * caller works on earlier ones.  reader_next returns the next event in
+ * order, blocking only if the thread has not read it yet, and NULL
+ * after the last one or at the first event that can not be read.  The
+ * event and its wavBuf stay valid until reader_release, which hands
+ * back the oldest event not yet released; up to nBufs - 1 events may
+ * be held while the thread keeps reading.  All HDF5 calls happen on
+ * the reader thread, so wavFile must not be used otherwise until
+ * close_reader, and the waveform attribute has to be read before
+ * open_reader. */
+struct HDF5IO(reader) *HDF5IO(open_reader)(struct HDF5IO(waveform_file) *wavFile,
+                                           size_t firstEvent, size_t nEvents, size_t nBufs);
+/* the same over nEvents events given by id (copied), for reading only
+ * the events a selection picked.  The ids should be in increasing
+ * order: every event then lies in the dataset of the previous one or
+ * a later one, so each C<n> dataset is opened once, and an HDF5 chunk
+ * holding several events (the ROI layout's samples) is read and
+ * decompressed once, into the chunk cache, for all of them.  In the
+ * other layouts an HDF5 chunk never spans two events. */
+struct HDF5IO(reader) *HDF5IO(open_reader_list)(struct HDF5IO(waveform_file) *wavFile,
+                                                const size_t *eventIds, size_t nEvents,
+                                                size_t nBufs);
+/* nThreads > 0: readers opened after the call fetch the chunks as
+ * stored with H5Dread_chunk and decompress them on a pool of nThreads
+ * workers, several events at a time (nBufs is raised to
+ * nThreads / (HDF5 chunks per event) + 2 if it is lower), instead of
+ * running the HDF5 filters inside H5Dread on the reader thread.
+ * Events still come out in order.  Deflate, delta and shuffle are
+ * undone by hdf5io itself; files with other filters (the lz4 and zstd
+ * plugins) are read with H5Dread as with nThreads = 0, the default. */
+int HDF5IO(set_decompress_threads)(struct HDF5IO(waveform_file) *wavFile,
+                                   size_t nThreads);
+struct HDF5IO(waveform_event) *HDF5IO(reader_next)(struct HDF5IO(reader) *rd);
+void HDF5IO(reader_release)(struct HDF5IO(reader) *rd);
+int HDF5IO(close_reader)(struct HDF5IO(reader) *rd);
+/* Every write_event adds a row to the HDF5IO_INDEX_DATASET table,
+ * HDF5IO_INDEX_BATCH rows at a time.  The lookups below are binary
+ * searches, so rows have to be in increasing eventId and hostTime
+ * order, which they are when events are written in the order they
+ * come in.
+ * find_event fills row for eventId and returns 0, or -1 if there is no
+ * such event.  Files without an index get a row computed from the
+ * layout, with the times 0. */
+int HDF5IO(find_event)(struct HDF5IO(waveform_file) *wavFile, size_t eventId,
+                       struct HDF5IO(event_index) *row);
+/* returns the number of rows with t0 <= hostTime < t1 and the first of
+ * them in *iRow */
+size_t HDF5IO(find_time_range)(struct HDF5IO(waveform_file) *wavFile, double t0, double t1,
+                               size_t *iRow);
+/* reads nRows index rows from iRow on, returns -1 if they do not exist */
+int HDF5IO(read_event_index)(struct HDF5IO(waveform_file) *wavFile, size_t iRow,
+                             size_t nRows, struct HDF5IO(event_index) *rows);
+/* The feature table, HDF5IO_FEATURE_DATASET, has a row per event that
+ * write_features was called for, appended HDF5IO_INDEX_BATCH rows at a
+ * time, in the order of the calls; dpo5054 -F writes one per event
+ * saved, so row i is event i.  It lets analysis select events without
+ * reading any waveform. */
+int HDF5IO(write_features)(struct HDF5IO(waveform_file) *wavFile,
+                           const struct HDF5IO(features) *row);
+size_t HDF5IO(get_number_of_features)(struct HDF5IO(waveform_file) *wavFile);
+/* reads nRows rows from iRow on, returns -1 if they do not exist */
+int HDF5IO(read_features)(struct HDF5IO(waveform_file) *wavFile, size_t iRow, size_t nRows,
+                          struct HDF5IO(features) *rows);
+/* copies only the member name ("baseline", "rms", "amplitude",
+ * "peakTime" or "integral") of nRows rows into col, SCOPE_NCH floats
+ * per row, for scans of a cut variable over the whole table a block
+ * of rows at a time */
+int HDF5IO(read_feature_column)(struct HDF5IO(waveform_file) *wavFile, const char *name,
+                                size_t iRow, size_t nRows, float *col);
 
 #endif /* __HDF5IO_H__ */
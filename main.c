@@ -58,14 +58,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <math.h>
 #include <string.h>
+#include <strings.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 #include <pthread.h>
 
 #include "common.h"
 #include "hdf5io.h"
 #include "fifo.h"
+#include "blockparser.h"
+#include "wavstat.h"
+#include "accum.h"
+#include "evfeatures.h"
+#include "timing.h"
 
 #ifdef DEBUG
   #define debug_printf(fmt, ...) do { fprintf(stderr, fmt, ##__VA_ARGS__); fflush(stderr); \
@@ -86,6 +94,31 @@
 static unsigned int chMask;
 static size_t nCh;
 static size_t nEvents;
+static size_t sampleWidth = 1; /* WFMOutpre:BYT_Nr */
+static int swapBytes; /* the scope sends 2-byte samples in the other byte order */
+static size_t pipelineDepth = 1; /* curve requests kept outstanding */
+static int streamMode; /* curvestream? instead of polling */
+
+/* zero suppression (-Z): thresholds in mV, then in raw counts, per
+ * stored channel, < 0 for negative pulses; samples kept around a pulse */
+static int zeroSuppress, dropEmpty;
+static size_t nZsThr;
+static double zsThr[SCOPE_NCH], zsCounts[SCOPE_NCH];
+static size_t zsPre = 16, zsPost = 32;
+static size_t nSaved, nRois, nRoiSamples; /* what it kept */
+static size_t nWhole; /* events kept whole, see save_rois */
+
+/* online reduction (-A, -P): only the average waveform and/or the
+ * persistence map are written, every accumPeriod seconds and at the
+ * end, a FastFrame frame counting as a trigger */
+static int accumAverage;
+static size_t accumTimeBins;
+static double accumPeriod = 10.0;
+static struct accum accum;
+
+/* the feature table (-F nBase): a row per event saved */
+static int saveFeatures;
+static size_t featureBase;
 
 static struct hdf5io_waveform_file *waveformFile;
 static struct hdf5io_waveform_event waveformEvent;
@@ -93,6 +126,9 @@ static struct waveform_attribute waveformAttr;
 
 #define FIFO_SIZE (512*1024*1024)
 static struct fifo_t *fifo;
+/* the receive time of each event, as doubles, for the event index */
+#define TIME_FIFO_SIZE (8*1024*1024)
+static struct fifo_t *timeFifo;
 
 #define MAXSLEEP 2
 static int connect_retry(int sockfd, const struct sockaddr *addr, socklen_t alen)
@@ -159,14 +195,20 @@ static int get_socket(char *host, char *port)
     return sockfd;
 }
 
+/* Sends queryStr and reads the response into respStr (BUFSIZ bytes,
+ * returned '\0'-terminated), until it is complete or tv has elapsed.
+ * A response is complete at a '\n' once nFields ';'-separated fields
+ * have come in; nFields = 0 takes the first '\n'.  Returns the number
+ * of bytes read, or -1. */
 static int query_response_with_timeout(int sockfd, char *queryStr, char *respStr,
-                                       struct timeval *tv)
+                                       size_t nFields, struct timeval *tv)
 {
-    int maxfd;
+    struct timespec now, deadline;
+    struct timeval left;
     fd_set rfd;
     int nsel;
     ssize_t nr, nw;
-    size_t ret;
+    size_t ret, i, nSep;
 
     nw = send(sockfd, queryStr, strnlen(queryStr, BUFSIZ), 0);
     if(nw<0) {
@@ -174,54 +216,96 @@ static int query_response_with_timeout(int sockfd, char *queryStr, char *respStr
         return (int)nw;
     }
 
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += tv->tv_sec;
+    deadline.tv_nsec += tv->tv_usec * 1000;
+    if(deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
     ret = 0;
+    nSep = 0;
     for(;;) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left.tv_sec = deadline.tv_sec - now.tv_sec;
+        left.tv_usec = (deadline.tv_nsec - now.tv_nsec) / 1000;
+        if(left.tv_usec < 0) {
+            left.tv_sec--;
+            left.tv_usec += 1000000;
+        }
+        if(left.tv_sec < 0) { /* timed out */
+            error_printf("query timed out: %s", queryStr);
+            break;
+        }
         FD_ZERO(&rfd);
         FD_SET(sockfd, &rfd);
-        maxfd = sockfd;
-        nsel = select(maxfd+1, &rfd, NULL, NULL, tv);
+        nsel = select(sockfd+1, &rfd, NULL, NULL, &left);
         if(nsel < 0 && errno != EINTR) { /* other errors */
             return nsel;
         }
-        if(nsel == 0) { /* timed out */
-            break;
-        }
+        if(nsel == 0) continue; /* the deadline check above ends it */
         if(nsel>0 && FD_ISSET(sockfd, &rfd)) {
-            nr = read(sockfd, respStr+ret, BUFSIZ-ret);
-            // debug_printf("nr = %zd\n", nr);
-            if(nr>0) {
-                ret += nr;
-            } else {
-                break;
-            }
+            nr = read(sockfd, respStr+ret, BUFSIZ-1-ret);
+            if(nr<=0) break;
+            for(i=ret; i<ret+nr; i++)
+                if(respStr[i] == ';' || respStr[i] == '\n') nSep++;
+            ret += nr;
+            if(respStr[ret-1] == '\n' && nSep >= nFields) break;
+            if(ret == BUFSIZ-1) break;
         }
     }
+    respStr[ret] = '\0';
     return (int)ret;
 }
 
-static int query_response(int sockfd, char *queryStr, char *respStr)
+static size_t nControlQueries;
+
+static int query_response(int sockfd, char *queryStr, char *respStr, size_t nFields)
 {
-    struct timeval tv = {
-        .tv_sec = 0,
-        .tv_usec = 500000,
+    struct timeval tv = { /* a limit only, complete responses return right away */
+        .tv_sec = 2,
+        .tv_usec = 0,
     };
-    return query_response_with_timeout(sockfd, queryStr, respStr, &tv);
+    nControlQueries++;
+    return query_response_with_timeout(sockfd, queryStr, respStr, nFields, &tv);
+}
+
+/* Commands have no response, so *OPC? is appended to cmdStr (which
+ * ends with '\n') to learn when the scope has executed them. */
+static int send_command(int sockfd, const char *cmdStr)
+{
+    char buf[BUFSIZ];
+
+    snprintf(buf, sizeof(buf), "%.*s;*OPC?\n", (int)strcspn(cmdStr, "\n"), cmdStr);
+    return query_response(sockfd, buf, buf, 1);
+}
+
+static int host_is_little_endian(void)
+{
+    uint16_t v = 1;
+    return *(char*)&v;
 }
 
 static int prepare_scope(int sockfd, struct waveform_attribute *wavAttr)
 /* fills wavAttr as well */
 {
-    int ret, ich, isFastFrame;
-    char buf[BUFSIZ], buf1[BUFSIZ], buf2[BUFSIZ];
+    int ret, ich, k, isFastFrame;
+    char buf[BUFSIZ], buf1[BUFSIZ], buf2[BUFSIZ], *p;
+    const char *encdg;
     
     wavAttr->chMask = chMask;
+    wavAttr->sampleWidth = sampleWidth;
+    /* signed binary; 2-byte samples in the host's byte order (SRIbinary
+     * is LSB first) so they can be stored as they arrive */
+    if(sampleWidth == 1) encdg = "FAStest";
+    else encdg = host_is_little_endian() ? "SRIbinary" : "RIBinary";
 
     strlcpy(buf, "*IDN?\n", sizeof(buf));
-    ret = query_response(sockfd, buf, buf);
-    buf[ret] = '\0';
+    ret = query_response(sockfd, buf, buf, 1);
     printf("%s", buf);
 
-    strlcpy(buf, "DATa:ENCdg fastest;:", sizeof(buf));
+    snprintf(buf, sizeof(buf), "DATa:ENCdg %s;:", encdg);
     strlcpy(buf1, "data:source ", sizeof(buf1));
     for(ich=0; ich<SCOPE_NCH; ich++) {
         if((chMask >> ich) & 0x01) {
@@ -237,16 +321,14 @@ static int prepare_scope(int sockfd, struct waveform_attribute *wavAttr)
     buf1[strnlen(buf1, sizeof(buf1))-1] = '\n';
 
     /* turn on selected channels */
-    ret = query_response(sockfd, buf, buf);
+    ret = send_command(sockfd, buf);
 
-    strlcpy(buf, "HORizontal:ACQLENGTH?;:WFMOutpre:XINcr?;:WFMOutpre:PT_Off?\n", sizeof(buf));
-    ret = query_response(sockfd, buf, buf);
-    sscanf(buf, "%zd;%lf;%lf", &(wavAttr->nPt), &(wavAttr->dt), &(wavAttr->t0));
+    strlcpy(buf, "HORizontal:ACQLENGTH?;:WFMOutpre:XINcr?;:WFMOutpre:PT_Off?;"
+            ":HORizontal:FASTframe:STATE?;:HORizontal:FASTframe:COUNt?\n", sizeof(buf));
+    ret = query_response(sockfd, buf, buf, 5);
+    sscanf(buf, "%zd;%lf;%lf;%d;%zd", &(wavAttr->nPt), &(wavAttr->dt), &(wavAttr->t0),
+           &isFastFrame, &(wavAttr->nFrames));
     wavAttr->t0 *= wavAttr->dt;
-
-    strlcpy(buf, "HORizontal:FASTframe:STATE?;:HORizontal:FASTframe:COUNt?\n", sizeof(buf));
-    ret = query_response(sockfd, buf, buf);
-    sscanf(buf, "%d;%zd", &isFastFrame, &(wavAttr->nFrames));
     if(isFastFrame) {
         printf("FastFrame mode, %zd frames per event.\n", wavAttr->nFrames);
         wavAttr->nPt *= wavAttr->nFrames;
@@ -254,40 +336,57 @@ static int prepare_scope(int sockfd, struct waveform_attribute *wavAttr)
         wavAttr->nFrames = 0;
     }
 
+    /* the scaling of all channels in one round trip, and the byte
+     * order the scope settled on */
+    buf[0] = '\0';
     for(ich=0; ich<SCOPE_NCH; ich++) {
-        snprintf(buf, sizeof(buf), "data:source ch%d;%s\n", ich+1,
-                 ":data:encdg FAStest;:WFMOutpre:BYT_Nr 1;"
-                 ":WFMOutpre:YMUlt?;:WFMOutpre:YOFf?;:WFMOutpre:YZEro?");
-        ret = query_response(sockfd, buf, buf);
-        sscanf(buf, "%lf;%lf;%lf", &(wavAttr->ymult[ich]), &(wavAttr->yoff[ich]),
+        snprintf(buf2, sizeof(buf2), "%sdata:source ch%d;:data:encdg %s;:WFMOutpre:BYT_Nr %zd;"
+                 ":WFMOutpre:YMUlt?;:WFMOutpre:YOFf?;:WFMOutpre:YZEro?", ich ? ";:" : "",
+                 ich+1, encdg, sampleWidth);
+        strncat(buf, buf2, sizeof(buf)-strnlen(buf, sizeof(buf))-1);
+    }
+    strncat(buf, ";:WFMOutpre:BYT_Or?\n", sizeof(buf)-strnlen(buf, sizeof(buf))-1);
+    ret = query_response(sockfd, buf, buf, 3 * SCOPE_NCH + 1);
+    for(ich=0, p=buf; ich<SCOPE_NCH; ich++) {
+        sscanf(p, "%lf;%lf;%lf", &(wavAttr->ymult[ich]), &(wavAttr->yoff[ich]),
                &(wavAttr->yzero[ich]));
+        for(k=0; k<3 && (p = strchr(p, ';')) != NULL; k++) p++;
+        if(p == NULL) break;
+    }
+    if(sampleWidth > 1 && p != NULL) {
+        swapBytes = (strncasecmp(p, "LSB", 3) == 0) != host_is_little_endian();
+        if(swapBytes)
+            printf("The scope sends %.3s first, samples are byte swapped.\n", p);
     }
 
     printf("waveform_attribute:\n"
            "     chMask  = 0x%02x\n"
            "     nPt     = %zd\n"
            "     nFrames = %zd\n"
+           "     width   = %zd\n"
            "     dt      = %g\n"
            "     t0      = %g\n"
            "     ymult   = %g %g %g %g\n"
            "     yoff    = %g %g %g %g\n"
            "     yzero   = %g %g %g %g\n",
-           wavAttr->chMask, wavAttr->nPt, wavAttr->nFrames, wavAttr->dt, wavAttr->t0,
+           wavAttr->chMask, wavAttr->nPt, wavAttr->nFrames, wavAttr->sampleWidth,
+           wavAttr->dt, wavAttr->t0,
            wavAttr->ymult[0], wavAttr->ymult[1], wavAttr->ymult[2], wavAttr->ymult[3],
            wavAttr->yoff[0], wavAttr->yoff[1], wavAttr->yoff[2], wavAttr->yoff[3],
            wavAttr->yzero[0], wavAttr->yzero[1], wavAttr->yzero[2], wavAttr->yzero[3]);
 
-    /* data:source to selected channels */
-    ret = query_response(sockfd, buf1, buf);
-    /* set waveform range */
-    snprintf(buf, sizeof(buf), "data:start 1;:data:stop %zd\n", wavAttr->nPt);
-    ret = query_response(sockfd, buf, buf);
+    /* data:source to selected channels, and the waveform range */
+    buf1[strnlen(buf1, sizeof(buf1))-1] = '\0';
+    snprintf(buf, sizeof(buf), "%s;:data:start 1;:data:stop %zd\n", buf1, wavAttr->nPt);
+    ret = send_command(sockfd, buf);
 
     return ret;
 }
 
 static void atexit_flush_files(void)
 {
+    if(accumAverage || accumTimeBins)
+        accum_write(&accum, waveformFile->waveFid, &waveformAttr);
     hdf5io_flush_file(waveformFile);
     hdf5io_close_file(waveformFile);
 }
@@ -307,38 +406,61 @@ static size_t raw_event_size(struct hdf5io_waveform_file *wavFile)
     char buf[BUFSIZ];
     size_t chHeaderSize;
     
-    chHeaderSize = snprintf(buf, sizeof(buf), "#X%zd", wavFile->nPt);
-    return (chHeaderSize + wavFile->nPt) * wavFile->nCh + 1;
+    chHeaderSize = snprintf(buf, sizeof(buf), "#X%zd", wavFile->nPt * wavFile->sampleWidth);
+    return (chHeaderSize + wavFile->nPt * wavFile->sampleWidth) * wavFile->nCh + 1;
 }
 
-static void *receive_and_push(void *arg)
+/* stamps n events that have just come in completely */
+static void push_receive_times(size_t n)
+{
+    double t = now();
+
+    while(n-- > 0) fifo_push(timeFifo, (char*)&t, sizeof(t));
+}
+
+/* sends n curve requests in one write */
+static ssize_t request_curves(int sockfd, const char *req, size_t n)
+{
+    char buf[BUFSIZ];
+    size_t len = strlen(req), i;
+
+    if(n * len > sizeof(buf)) n = sizeof(buf) / len;
+    for(i=0; i<n; i++) memcpy(buf + i * len, req, len);
+    return write(sockfd, buf, n * len);
+}
+
+/* Polls with req, keeping up to pipelineDepth requests outstanding,
+ * until nEvents events have come in.  nReceived events were already
+ * received by other means. */
+static void receive_poll(int sockfd, const char *req, size_t nReceived)
 {
     struct timeval tv; /* tv should be re-initialized in the loop since select
                           may change it after each call */
-    int sockfd, maxfd, nsel;
+    int maxfd, nsel;
     fd_set rfd;
-    char ibuf[BUFSIZ];
-    size_t iEvent = 0;
+    struct iovec iov[2];
+    int nSpans;
+    size_t nRequested = nReceived, n, nDone;
     ssize_t nr, nw, rawEventSize, readTotal;
-/*
-    FILE *fp;
-    if((fp=fopen("log.txt", "w"))==NULL) {
-        perror("log.txt");
-        return (void*)NULL;
-    }
-*/
-    sockfd = *((int*)arg);
-    if(nEvents > 0)
-        strlcpy(ibuf, "CURVENext?\n", sizeof(ibuf));
-    else {
-        strlcpy(ibuf, "CURVe?\n", sizeof(ibuf));
-        nEvents = 1;
-    }
-    nw = write(sockfd, ibuf, strnlen(ibuf, sizeof(ibuf)));
 
     rawEventSize = raw_event_size(waveformFile);
     readTotal = 0;
     for(;;) {
+        /* keep up to pipelineDepth requests outstanding.  The replies
+         * come back in request order, so counting bytes tells which
+         * ones are complete. */
+        n = nEvents - nRequested;
+        if(n > pipelineDepth - (nRequested - nReceived))
+            n = pipelineDepth - (nRequested - nReceived);
+        if(n > 0) {
+            nw = request_curves(sockfd, req, n);
+            if(nw < 0) {
+                warn("write");
+                break;
+            }
+            nRequested += nw / strlen(req);
+        }
+
         tv.tv_sec = 10;
         tv.tv_usec = 0;
         FD_ZERO(&rfd);
@@ -353,135 +475,416 @@ static void *receive_and_push(void *arg)
             warn("timed out");
         }
         if(nsel>0 && FD_ISSET(sockfd, &rfd)) {
-            nr = read(sockfd, ibuf, sizeof(ibuf));
-            if(nr < 0) {
-                warn("read");
+            /* read straight into the fifo's free space */
+            nSpans = fifo_reserve(fifo, iov, 1);
+            nr = readv(sockfd, iov, nSpans);
+            if(nr <= 0) {
+                if(nr < 0) warn("read");
+                else error_printf("Connection closed by the scope.\n");
                 break;
             }
             readTotal += nr;
-//            write(fileno(fp), ibuf, nr);
-            fifo_push(fifo, ibuf, nr);
+            fifo_commit(fifo, nr);
         }
-        if(iEvent >= nEvents) {
-            goto end;
+        for(nDone=0; readTotal >= rawEventSize; nDone++) {
+            readTotal -= rawEventSize;
+            nReceived++;
         }
-        if(readTotal >= rawEventSize) {
-            readTotal = 0;
-            strlcpy(ibuf, "CURVENext?\n", sizeof(ibuf));
-            nw = write(sockfd, ibuf, strnlen(ibuf, sizeof(ibuf)));
-            iEvent++;
+        push_receive_times(nDone);
+        if(nReceived >= nEvents) {
+            break;
         }
     }
-end:
+}
 
-//    fclose(fp);
-    return (void*)NULL;
+#define STREAM_READ_MAX (1024*1024) /* bytes taken off the socket per read */
+#define STREAM_PAUSE_MAX 0.01 /* s, longest wait for a read to fill up */
+#define STREAM_STALL_FIRST 10.0 /* s without data before the fill rate is known */
+#define STREAM_STALL_MIN 1.0 /* s */
+#define STREAM_STALL_EVENTS 10 /* event intervals without data that make a stall */
+#define STREAM_DRAIN_QUIET 0.2 /* s of silence that ends a drain */
+
+static char iov_byte(struct iovec *iov, size_t off)
+{
+    if(off < iov[0].iov_len) return ((char*)iov[0].iov_base)[off];
+    return ((char*)iov[1].iov_base)[off - iov[0].iov_len];
 }
 
-static void *pop_and_save(void *arg)
+/* the part of iov[0..nSpans) from off on, at most n bytes, in sub */
+static int iov_slice(struct iovec *iov, int nSpans, size_t off, size_t n,
+                     struct iovec *sub)
 {
-    int fStartEvent, fEndEvent, fStartCh, fGetNDig, fGetRetChLen; /* flags of states */
-    size_t nDig=0, retChLen, iCh, iRetChLen=0, i, j, wavBufN;
-    char ibuf[4*BUFSIZ], retChLenBuf[BUFSIZ];
-    size_t nr;
-    size_t iEvent = 0;
-    char *wavBuf;
+    int i, k = 0;
+
+    for(i=0; i<nSpans && n>0; i++) {
+        if(off >= iov[i].iov_len) {
+            off -= iov[i].iov_len;
+            continue;
+        }
+        sub[k].iov_base = (char*)iov[i].iov_base + off;
+        sub[k].iov_len = iov[i].iov_len - off < n ? iov[i].iov_len - off : n;
+        n -= sub[k].iov_len;
+        off = 0;
+        k++;
+    }
+    return k;
+}
+
+/* Reads curvestream? data until nEvents events are in (returns 0), the
+ * stream stalls or loses its framing (1), or the socket fails (-1);
+ * *nReceived counts the events.  Only whole events are committed to
+ * the fifo, so a stalled stream leaves nothing half parsed behind.
+ * Reads are bounded, and when less than a read's worth is waiting the
+ * reader pauses for the time the scope needs to fill it at the rate
+ * seen so far, rather than draining the socket in small pieces faster
+ * than the scope's buffer fills (see KNOWN BUGS in README.txt). */
+static int receive_stream(int sockfd, size_t *nReceived)
+{
+    struct timeval tv;
+    struct timespec ts;
+    fd_set rfd;
+    struct iovec iov[2], sub[2];
+    int nSpans, nsel, avail;
+    size_t rawEventSize, want, pending = 0, evtEnd, done, nDone;
+    ssize_t nr;
+    double rate = 0.0, stall, pause, t, tLast;
+    const char *req = "CURVEStream?\n";
+
+    rawEventSize = raw_event_size(waveformFile);
+    want = rawEventSize < STREAM_READ_MAX ? rawEventSize : STREAM_READ_MAX;
+    evtEnd = rawEventSize - 1; /* where the current event's '\n' should be */
+    *nReceived = 0;
+    if(write(sockfd, req, strlen(req)) < 0) {
+        warn("write");
+        return -1;
+    }
+    tLast = now();
+    while(*nReceived < nEvents) {
+        stall = STREAM_STALL_FIRST;
+        if(rate > 0) {
+            stall = STREAM_STALL_EVENTS * rawEventSize / rate;
+            if(stall < STREAM_STALL_MIN) stall = STREAM_STALL_MIN;
+        }
+        tv.tv_sec = (time_t)stall;
+        tv.tv_usec = (stall - tv.tv_sec) * 1e6;
+        FD_ZERO(&rfd);
+        FD_SET(sockfd, &rfd);
+        nsel = select(sockfd+1, &rfd, NULL, NULL, &tv);
+        if(nsel < 0) {
+            if(errno == EINTR) continue;
+            warn("select");
+            return -1;
+        }
+        if(nsel == 0) return 1;
+
+        if(rate > 0 && ioctl(sockfd, FIONREAD, &avail) == 0 && (size_t)avail < want) {
+            pause = (want - avail) / rate;
+            if(pause > STREAM_PAUSE_MAX) pause = STREAM_PAUSE_MAX;
+            ts.tv_sec = 0;
+            ts.tv_nsec = pause * 1e9;
+            nanosleep(&ts, NULL);
+        }
+
+        /* the bytes of an incomplete event stay uncommitted in front */
+        nSpans = fifo_reserve(fifo, iov, pending + want);
+        nSpans = iov_slice(iov, nSpans, pending, STREAM_READ_MAX, sub);
+        nr = readv(sockfd, sub, nSpans);
+        if(nr <= 0) {
+            if(nr < 0) warn("read");
+            else error_printf("Connection closed by the scope.\n");
+            return -1;
+        }
+        t = now();
+        if(t > tLast)
+            rate = rate > 0 ? 0.8 * rate + 0.2 * nr / (t - tLast) : nr / (t - tLast);
+        tLast = t;
+        pending += nr;
+
+        /* an event is rawEventSize bytes, but may end in ";\n" */
+        done = nDone = 0;
+        while(evtEnd < pending && *nReceived < nEvents) {
+            switch(iov_byte(iov, evtEnd)) {
+            case '\n':
+                (*nReceived)++;
+                nDone++;
+                done = evtEnd + 1;
+                evtEnd = done + rawEventSize - 1;
+                break;
+            case ';':
+            case '\r':
+                evtEnd++;
+                break;
+            default:
+                error_printf("curvestream? lost its framing.\n");
+                return 1;
+            }
+        }
+        if(done > 0) {
+            fifo_commit(fifo, done);
+            push_receive_times(nDone);
+            pending -= done;
+            evtEnd -= done;
+        }
+    }
+    return 0;
+}
+
+/* ends curvestream? with a device clear, then throws away whatever
+ * the scope still sends */
+static void stop_stream(int sockfd)
+{
+    char buf[BUFSIZ];
+    struct timeval tv;
+    fd_set rfd;
+
+    if(write(sockfd, "!d\n", 3) < 0) warn("write");
+    for(;;) {
+        tv.tv_sec = 0;
+        tv.tv_usec = STREAM_DRAIN_QUIET * 1e6;
+        FD_ZERO(&rfd);
+        FD_SET(sockfd, &rfd);
+        if(select(sockfd+1, &rfd, NULL, NULL, &tv) <= 0) break;
+        if(read(sockfd, buf, sizeof(buf)) <= 0) break;
+    }
+}
+
+static void *receive_and_push(void *arg)
+{
+    int sockfd, ret;
+    const char *req;
+    size_t nReceived = 0;
 /*
     FILE *fp;
-    if((fp=fopen("log1.txt", "w"))==NULL) {
-        perror("log1.txt");
+    if((fp=fopen("log.txt", "w"))==NULL) {
+        perror("log.txt");
         return (void*)NULL;
     }
 */
-    wavBufN = waveformAttr.nPt * nCh;
-    wavBuf = (char*)malloc(wavBufN * sizeof(char));
+    sockfd = *((int*)arg);
+    if(nEvents > 0)
+        req = "CURVENext?\n";
+    else {
+        req = "CURVe?\n";
+        nEvents = 1;
+        streamMode = 0;
+    }
+
+    if(streamMode) {
+        ret = receive_stream(sockfd, &nReceived);
+        if(ret < 0) goto end;
+        if(ret > 0) {
+            error_printf("curvestream? stalled after %zd events, falling back to"
+                         " CURVENext? polling.\n", nReceived);
+            stop_stream(sockfd);
+        } else if(write(sockfd, "!d\n", 3) < 0) {
+            warn("write");
+        }
+    }
+    if(nReceived < nEvents)
+        receive_poll(sockfd, req, nReceived);
+end:
+    /* whatever ended the receiving, the writer must not wait for more */
+    fifo_set_eof(fifo);
+
+//    fclose(fp);
+    return (void*)NULL;
+}
+
+/* -Z mV[,mV...][:nPre:nPost], one threshold for all channels or one
+ * per stored channel */
+static int parse_zero_suppression(char *s)
+{
+    char *p = s, *end;
+
+    for(nZsThr=0; nZsThr<SCOPE_NCH; p=end+1) {
+        zsThr[nZsThr] = strtod(p, &end);
+        if(end == p || zsThr[nZsThr] == 0) return -1;
+        nZsThr++;
+        if(*end != ',') break;
+    }
+    if(*end == ':') return sscanf(end + 1, "%zu:%zu", &zsPre, &zsPost) == 2 ? 0 : -1;
+    return *end == '\0' ? 0 : -1;
+}
+
+/* Zero suppression: a pulse starts at the first sample further than the
+ * threshold from the baseline, the mean of the waveform, and ends where
+ * the waveform comes back; it is kept with zsPre samples before and
+ * zsPost after, and regions that overlap are merged.  The scans skip
+ * the quiet parts with wavstat.c.  Events without any region are kept
+ * empty, or dropped with -D.  An event whose regions and their rows
+ * would take more room than the waveforms, noise over the threshold,
+ * is kept as one region per channel. */
+static int save_rois(struct hdf5io_waveform_event *wavEvent, size_t iEvent)
+{
+    static struct hdf5io_roi *rois;
+    static size_t roiCap;
+    struct hdf5io_roi_event roiEvent;
+    size_t i, j, start, end, a, b, n = 0, nPt = waveformAttr.nPt, w = sampleWidth;
+    size_t nSamples = 0;
+    const char *x;
+    double base;
+    int level;
+
+    memset(&roiEvent, 0, sizeof(roiEvent));
+    for(j=0; j<nCh; j++) {
+        x = wavEvent->wavBuf + j * nPt * w;
+        base = (double)wavstat_sum(x, w, nPt) / nPt;
+        roiEvent.baseline[j] = (int)lround(base);
+        /* a pulse is past level, and over when a sample is back at level */
+        if(zsCounts[j] < 0) level = (int)ceil(base + zsCounts[j]);
+        else level = (int)floor(base + zsCounts[j]);
+        for(i=0; i<nPt; i=b) {
+            if(zsCounts[j] < 0) {
+                start = i + wavstat_find_below(x + i * w, w, nPt - i, level);
+                if(start >= nPt) break;
+                end = start + wavstat_find_above(x + start * w, w, nPt - start, level - 1);
+            } else {
+                start = i + wavstat_find_above(x + i * w, w, nPt - i, level);
+                if(start >= nPt) break;
+                end = start + wavstat_find_below(x + start * w, w, nPt - start, level + 1);
+            }
+            a = start > zsPre ? start - zsPre : 0;
+            b = end + zsPost < nPt ? end + zsPost : nPt;
+            if(n > 0 && rois[n - 1].ch == j && a <= rois[n - 1].iPt + rois[n - 1].nPt) {
+                rois[n - 1].nPt = b - rois[n - 1].iPt;
+                continue;
+            }
+            if(n == roiCap) {
+                roiCap = roiCap ? 2 * roiCap : 64;
+                rois = (struct hdf5io_roi*)realloc(rois, roiCap * sizeof(*rois));
+            }
+            rois[n].ch = j;
+            rois[n].iPt = a;
+            rois[n].nPt = b - a;
+            n++;
+        }
+    }
+    if(n == 0 && dropEmpty) return 0;
+
+    for(i=0; i<n; i++) nSamples += rois[i].nPt;
+    if(nSamples * w + n * sizeof(struct hdf5io_roi) > nCh * nPt * w) {
+        if(roiCap < nCh) {
+            roiCap = nCh;
+            rois = (struct hdf5io_roi*)realloc(rois, roiCap * sizeof(*rois));
+        }
+        for(j=0; j<nCh; j++) {
+            rois[j].ch = j;
+            rois[j].iPt = 0;
+            rois[j].nPt = nPt;
+        }
+        n = nCh;
+        nSamples = nCh * nPt;
+        nWhole++;
+    }
+    wavEvent->eventId = nSaved++;
+    roiEvent.triggerId = iEvent;
+    roiEvent.nRoi = n;
+    hdf5io_write_event_rois(waveformFile, wavEvent, &roiEvent, rois);
+    nRois += n;
+    nRoiSamples += nSamples;
+    return 1;
+}
+
+/* adds the frames of an event to the accumulators, and writes them out
+ * when accumPeriod has passed since the last time */
+static void accumulate(const char *wavBuf)
+{
+    static double lastWrite;
+    size_t f, nFrames = accum.nPt < waveformAttr.nPt ? waveformAttr.nPt / accum.nPt : 1;
+    double t;
+
+    for(f=0; f<nFrames; f++)
+        accum_add(&accum, wavBuf + f * accum.nPt * sampleWidth, waveformAttr.nPt);
+    t = now();
+    if(lastWrite == 0.0) lastWrite = t;
+    if(t - lastWrite >= accumPeriod) {
+        accum_write(&accum, waveformFile->waveFid, &waveformAttr);
+        hdf5io_flush_file(waveformFile);
+        lastWrite = t;
+    }
+}
+
+static void *pop_and_save(void *arg)
+{
+    struct iovec iov[2];
+    int nSpans, iSpan, evtDone, saved;
+    size_t i, nc;
+    size_t iEvent = 0, nLost = 0, nLostNow;
+    double hostTime;
+    char *wavBuf;
+    struct blockparser_t *parser;
+    struct hdf5io_features features;
+
+    wavBuf = (char*)malloc(waveformAttr.nPt * nCh * sampleWidth);
+    parser = blockparser_init(waveformAttr.nPt, nCh, wavBuf);
+    blockparser_set_sample_width(parser, sampleWidth, swapBytes);
 
-    iCh = 0; j = 0;
-    fStartEvent = 1; fEndEvent = 0; fStartCh = 0; fGetNDig = 0; fGetRetChLen = 0;
     for(;;) {
-        nr = fifo_pop(fifo, ibuf, sizeof(ibuf));
-//        printf("%zd popped.\n", nr);
-//        fflush(stdout);
-//        write(fileno(fp), ibuf, nr);
-
-        if(nr == 0) break; /* there will be nothing from the fifo any more */
-        for(i=0; i<nr; i++) {
-            if(fStartEvent) {
-                printf("iEvent = %zd, ", iEvent);
-                iCh = 0;
-                j = 0;
-                fStartEvent = 0;
-                fStartCh = 1;
-                i--; continue;
-            } else if(fEndEvent) {
-                if(ibuf[i] == ';') { /* ';' only appears in curvestream? mode */
-                    continue;
-                } else if(ibuf[i] == '\n') {
-                    // debug_printf("iEvent = %zd\n", iEvent);
-                    printf("\n");
-                    fflush(stdout);
-                    fEndEvent = 0;
-                    fStartEvent = 1;
-
-                    /* Will trigger next event query.  Requesting next
-                     * event before writing the current event to file
-                     * may boost data rate a bit */
-                    // iEventIncLocked();
+        /* parse in place, the payload is copied once, into wavBuf */
+        nSpans = fifo_peek(fifo, iov);
+        if(nSpans == 0) { /* the receiver gave up, the run is short */
+            error_printf("Input ended after %zd of %zd events.\n", iEvent, nEvents);
+            nEvents = iEvent;
+            goto end;
+        }
+        for(iSpan=0; iSpan<nSpans; iSpan++) {
+            for(i=0; i<iov[iSpan].iov_len; i+=nc) {
+                nc = blockparser_feed(parser, (char*)iov[iSpan].iov_base + i,
+                                      iov[iSpan].iov_len - i, &evtDone);
+                fifo_release(fifo, nc);
+                /* events lost to corrupt input still had their host
+                 * times stamped; once the parser is resynchronising
+                 * past the end of the run, the rest of it is lost */
+                nLostNow = parser->nDropped - nLost;
+                if(parser->inResync && parser->nBytes >= nEvents * parser->evtSize)
+                    nLostNow = nEvents - iEvent;
+                for(; nLostNow > 0 && iEvent < nEvents; nLostNow--) {
+                    error_printf("Corrupt input, event %zd dropped.\n", iEvent);
+                    fifo_pop(timeFifo, (char*)&hostTime, sizeof(hostTime));
+                    nLost++;
                     iEvent++;
+                }
+                if(iEvent >= nEvents) {
+                    printf("\n");
+                    goto end;
+                }
+                if(!evtDone) continue;
 
-                    waveformEvent.wavBuf = wavBuf;
-                    waveformEvent.eventId = iEvent-1;
+                printf("iEvent = %zd\n", iEvent);
+                waveformEvent.wavBuf = wavBuf;
+                waveformEvent.eventId = iEvent - nLost;
+                fifo_pop(timeFifo, (char*)&(waveformEvent.hostTime), sizeof(double));
+                waveformEvent.triggerTime = 0.0;
+                /* the features while the event is still in cache */
+                if(saveFeatures)
+                    evfeatures_event(&waveformAttr, nCh, featureBase, wavBuf, &features);
+                saved = 1;
+                if(accumAverage || accumTimeBins)
+                    accumulate(wavBuf);
+                else if(zeroSuppress)
+                    saved = save_rois(&waveformEvent, iEvent);
+                else
                     hdf5io_write_event(waveformFile, &waveformEvent);
-
-                    if(iEvent >= nEvents) {
-                        printf("\n");
-                        goto end;
-                    }
+                if(saveFeatures && saved) {
+                    features.eventId = waveformEvent.eventId;
+                    hdf5io_write_features(waveformFile, &features);
                 }
-            } else {
-                if(fStartCh) {
-                    if(ibuf[i] == '#') {
-                        fGetNDig = 1;
-                        continue;
-                    } else if(fGetNDig) {
-                        retChLenBuf[0] = ibuf[i];
-                        retChLenBuf[1] = '\0';
-                        nDig = atol(retChLenBuf);
-                        printf("nDig = %zd, ", nDig);
-                        
-                        iRetChLen = 0;
-                        fGetNDig = 0;
-                        continue;
-                    } else {
-                        retChLenBuf[iRetChLen] = ibuf[i];
-                        iRetChLen++;
-                        if(iRetChLen >= nDig) {
-                            retChLenBuf[iRetChLen] = '\0';
-                            retChLen = atol(retChLenBuf);
-                            printf("iRetChLen = %zd, retChLen = %zd, ",
-                                   iRetChLen, retChLen);
-                            fStartCh = 0;
-                            continue;
-                        }
-                    }
-                } else {
-                    wavBuf[j] = ibuf[i];
-                    j++;
-                    if((j % waveformAttr.nPt) == 0 && (j!=0)) {
-                        printf("iCh = %zd, ", iCh);
-                        iCh++;
-                        fStartCh = 1;
-                        if(iCh >= nCh) {
-                            fEndEvent = 1;
-                        }
-                    }
+                iEvent++;
+
+                if(iEvent >= nEvents) {
+                    printf("\n");
+                    goto end;
                 }
             }
         }
     }
 end:
+    fflush(stdout);
+    if(nLost > 0)
+        error_printf("Corrupt input at %zd places, %zd events dropped.\n",
+                     parser->nResync, nLost);
+    blockparser_close(parser);
     free(wavBuf);
-//    fclose(fp);
     return (void*)NULL;
 }
 
@@ -490,14 +893,114 @@ int main(int argc, char **argv)
     char *p, *outFileName, *scopeAddress, *scopePort;
     unsigned int v, c;
     time_t startTime, stopTime;
-    int sockfd;
+    struct timespec runStart, runStop;
+    double runTime;
+    char *progName = argv[0], *filterName = NULL;
+    int sockfd, opt, badOpt = 0, filter = HDF5IO_FILTER_DEFLATE, filterLevel = 0;
+    int layout = HDF5IO_LAYOUT_CHUNKGROUPS;
     pthread_t wTid;
-    size_t nWfmPerChunk = 100;
+    size_t nWfmPerChunk = 100, nCompressThreads = 0, nPtPerH5Chunk = 0, j, frameSize;
+    double rawBytes, savedBytes;
+
+    while((opt = getopt(argc, argv, "ADeF:fk:p:P:st:u:w:z:Z:")) != -1) {
+        switch(opt) {
+        case 'A':
+            accumAverage = 1;
+            break;
+        case 'D':
+            dropEmpty = 1;
+            break;
+        case 'e':
+            layout = HDF5IO_LAYOUT_EXTENSIBLE;
+            break;
+        case 'F':
+            saveFeatures = 1;
+            featureBase = atol(optarg);
+            break;
+        case 'f':
+            layout = HDF5IO_LAYOUT_FRAMES;
+            break;
+        case 'k':
+            nPtPerH5Chunk = atol(optarg);
+            break;
+        case 'p':
+            pipelineDepth = atol(optarg);
+            if(pipelineDepth < 1) badOpt = 1;
+            break;
+        case 'P':
+            accumTimeBins = atol(optarg);
+            if(accumTimeBins < 1) badOpt = 1;
+            break;
+        case 's':
+            streamMode = 1;
+            break;
+        case 't':
+            nCompressThreads = atol(optarg);
+            break;
+        case 'u':
+            accumPeriod = atof(optarg);
+            if(accumPeriod <= 0) badOpt = 1;
+            break;
+        case 'w':
+            sampleWidth = atol(optarg);
+            if(sampleWidth != 1 && sampleWidth != 2) badOpt = 1;
+            break;
+        case 'z': /* filter[:level] */
+            filterName = optarg;
+            if((p = strchr(optarg, ':')) != NULL) {
+                *p = '\0';
+                filterLevel = atoi(p + 1);
+            }
+            for(filter=0; filter<HDF5IO_FILTER_N; filter++)
+                if(strcmp(optarg, hdf5io_filter_name(filter)) == 0) break;
+            if(filter == HDF5IO_FILTER_N) badOpt = 1;
+            break;
+        case 'Z':
+            zeroSuppress = 1;
+            layout = HDF5IO_LAYOUT_ROI;
+            if(parse_zero_suppression(optarg) < 0) badOpt = 1;
+            break;
+        default:
+            badOpt = 1;
+        }
+    }
+    /* the positional arguments keep their old places in argv[] */
+    argv += optind - 1;
+    argc -= optind - 1;
 
-    if(argc<6) {
-        error_printf("%s scopeAdddress scopePort outFileName chMask(0x..) nEvents nWfmPerChunk\n",
-                     argv[0]);
+    if((zeroSuppress || saveFeatures) && (accumAverage || accumTimeBins)) badOpt = 1;
+    if(argc<6 || badOpt) {
+        error_printf("%s [-e|-f] [-F nBase] [-k nSamples] [-p depth] [-s] [-t nCompressThreads]"
+                     " [-w 1|2] [-z filter[:level]] [-Z mV[,mV...][:nPre:nPost] [-D] | [-A]"
+                     " [-P nTimeBins] [-u seconds]]"
+                     " scopeAdddress scopePort outFileName chMask(0x..) nEvents"
+                     " nWfmPerChunk\n", progName);
         error_printf("nEvents = 0 reads the already captured waveform on the scope.\n");
+        error_printf("-t n compresses on n threads besides the writer, 0 (default) compresses"
+                     " inline.\n");
+        error_printf("-p n keeps n CURVENext? requests outstanding, default 1.\n");
+        error_printf("-s reads with curvestream? and falls back to polling if the stream"
+                     " stalls.\n");
+        error_printf("-w 2 records 2-byte samples (hi-res acquisition), default 1.\n");
+        error_printf("-e writes one extensible dataset instead of a C<n> dataset per"
+                     " nWfmPerChunk events.\n");
+        error_printf("-f writes one dataset with a row per FastFrame frame, [frame, ch,"
+                     " frameSize].\n");
+        error_printf("-F n adds a row of features per event and channel (baseline and rms of"
+                     " the first n samples, 0 for 10%% of a frame, amplitude, peak time,"
+                     " integral) to the EventFeatures table.\n");
+        error_printf("-k n stores waveforms in HDF5 chunks of about n samples, so that"
+                     " time windows read fast; default whole waveforms.\n");
+        error_printf("-z none|deflate|lz4|zstd|delta, default deflate:%d.  lz4 and zstd need the"
+                     " HDF5 filter plugins.\n", HDF5IO_DEFLATE_LEVEL);
+        error_printf("-Z keeps only the pulses past the threshold from the baseline, < 0 for"
+                     " negative ones, one for all or one per channel, with nPre:nPost samples"
+                     " around them, default %zd:%zd; -D drops events without any.\n",
+                     zsPre, zsPost);
+        error_printf("-A and -P n write, instead of the events, the average waveform and its"
+                     " rms, and a persistence map of n time bins by %d codes, per channel and"
+                     " frame, every -u seconds (default %g) and at the end.\n", ACCUM_NCODES,
+                     accumPeriod);
         return EXIT_FAILURE;
     }
     scopeAddress = argv[1];
@@ -514,6 +1017,10 @@ int main(int argc, char **argv)
         error_printf("Invalid chMask input: %s\n", argv[4]);
         return EXIT_FAILURE;
     }
+    if(zeroSuppress && nZsThr != 1 && nZsThr != nCh) {
+        error_printf("-Z needs one threshold or %zd, one per channel.\n", nCh);
+        return EXIT_FAILURE;
+    }
     if(argc>=7)
         nWfmPerChunk = atol(argv[6]);
 
@@ -526,10 +1033,40 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
+    clock_gettime(CLOCK_MONOTONIC, &runStart);
     prepare_scope(sockfd, &waveformAttr);
+    for(j=0, c=0; zeroSuppress && c<SCOPE_NCH; c++) {
+        if(!((1u << c) & chMask)) continue;
+        zsCounts[j] = (nZsThr == 1 ? zsThr[0] : zsThr[j]) * 1e-3 / waveformAttr.ymult[c];
+        j++;
+    }
+    if(saveFeatures && featureBase == 0) {
+        frameSize = waveformAttr.nFrames > 0 ? waveformAttr.nPt / waveformAttr.nFrames
+            : waveformAttr.nPt;
+        featureBase = frameSize / 10 > 0 ? frameSize / 10 : 1;
+    }
+    if(accumAverage || accumTimeBins) {
+        frameSize = waveformAttr.nFrames > 0 && waveformAttr.nPt % waveformAttr.nFrames == 0
+            ? waveformAttr.nPt / waveformAttr.nFrames : waveformAttr.nPt;
+        if(accum_init(&accum, nCh, frameSize, sampleWidth, accumAverage, accumTimeBins) < 0) {
+            error_printf("Not enough memory for -A/-P.\n");
+            return EXIT_FAILURE;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &runStop);
+    printf("setup: %zd control queries in %.1f ms\n", nControlQueries,
+           (runStop.tv_sec - runStart.tv_sec) * 1e3 + (runStop.tv_nsec - runStart.tv_nsec) * 1e-6);
     fifo = fifo_init(FIFO_SIZE);
+    timeFifo = fifo_init(TIME_FIFO_SIZE);
     waveformFile = hdf5io_open_file(outFileName, nWfmPerChunk, nCh);
     hdf5io_write_waveform_attribute_in_file_header(waveformFile, &waveformAttr);
+    hdf5io_set_layout(waveformFile, layout);
+    hdf5io_set_chunk_samples(waveformFile, nPtPerH5Chunk);
+    if(filterName && hdf5io_set_filter(waveformFile, filter, filterLevel) < 0) {
+        error_printf("Filter %s is not available, check HDF5_PLUGIN_PATH.\n", filterName);
+        return EXIT_FAILURE;
+    }
+    hdf5io_set_compress_threads(waveformFile, nCompressThreads);
 
     signal(SIGKILL, signal_kill_handler);
     signal(SIGINT, signal_kill_handler);
@@ -537,6 +1074,7 @@ int main(int argc, char **argv)
     pthread_create(&wTid, NULL, pop_and_save, &sockfd);
 
     printf("start time = %zd\n", startTime = time(NULL));
+    clock_gettime(CLOCK_MONOTONIC, &runStart);
 
     receive_and_push(&sockfd);
 
@@ -552,19 +1090,39 @@ int main(int argc, char **argv)
 /*
     do {
         fgets(ibuf, sizeof(ibuf), stdin);
-        nw = query_response(sockfd, ibuf, ibuf);
+        nw = query_response(sockfd, ibuf, ibuf, 0);
         write(STDIN_FILENO, ibuf, nw);
     } while (nw>=0);
 */
 
     stopTime = time(NULL);
     pthread_join(wTid, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &runStop);
+    runTime = (runStop.tv_sec - runStart.tv_sec) + (runStop.tv_nsec - runStart.tv_nsec) * 1e-9;
 
     printf("\nstart time = %zd\n", startTime);
     printf("stop time  = %zd\n", stopTime);
+    printf("run summary: %zd events in %.3f s, %.2f MB/s, %.1f events/s\n",
+           nEvents, runTime, nEvents * raw_event_size(waveformFile) / runTime / 1e6,
+           nEvents / runTime);
+    if(zeroSuppress) {
+        rawBytes = (double)nEvents * nCh * waveformAttr.nPt * sampleWidth;
+        savedBytes = (double)nRoiSamples * sampleWidth + nRois * sizeof(struct hdf5io_roi)
+            + nSaved * sizeof(struct hdf5io_roi_event);
+        printf("zero suppression: %zd of %zd events kept (%zd whole), %zd regions,"
+               " %zd of %.0f samples, data reduced %.1fx before compression\n", nSaved,
+               nEvents, nWhole, nRois, nRoiSamples, rawBytes / sampleWidth,
+               savedBytes > 0 ? rawBytes / savedBytes : 0.0);
+    }
+    if(accumAverage || accumTimeBins)
+        printf("accumulated: %zd triggers, %s kernels%s%s\n", accum.nTriggers,
+               accum_impl_name(accum_get_impl()), accumAverage ? ", average" : "",
+               accumTimeBins ? ", persistence" : "");
 
     fifo_close(fifo);
+    fifo_close(timeFifo);
     close(sockfd);
     atexit_flush_files();
+    accum_free(&accum);
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,7 @@
+#ifndef __TIMING_H__
+#define __TIMING_H__
+
+/* seconds on the monotonic clock, for timing runs and benchmarks */
+double now(void);
+
+#endif /* __TIMING_H__ */
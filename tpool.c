@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "tpool.h"
+
+static void *worker(void *arg)
+{
+    struct tpool_t *pool = (struct tpool_t*)arg;
+    struct tpool_job *job;
+
+    pthread_mutex_lock(&(pool->lock));
+    for(;;) {
+        while(pool->head == NULL && !pool->quit)
+            pthread_cond_wait(&(pool->work), &(pool->lock));
+        if(pool->head == NULL) /* quit, and nothing left to do */
+            break;
+        job = pool->head;
+        pool->head = job->next;
+        if(pool->head == NULL) pool->tail = NULL;
+        pthread_mutex_unlock(&(pool->lock));
+
+        job->fn(job->arg);
+
+        pthread_mutex_lock(&(pool->lock));
+        job->done = 1;
+        pthread_cond_broadcast(&(pool->done));
+    }
+    pthread_mutex_unlock(&(pool->lock));
+    return NULL;
+}
+
+struct tpool_t *tpool_init(size_t nThreads)
+{
+    struct tpool_t *pool;
+    size_t i;
+
+    if(nThreads < 1) nThreads = 1;
+    pool = (struct tpool_t*)calloc(1, sizeof(struct tpool_t));
+    pthread_mutex_init(&(pool->lock), NULL);
+    pthread_cond_init(&(pool->work), NULL);
+    pthread_cond_init(&(pool->done), NULL);
+    pool->nThreads = nThreads;
+    pool->tids = (pthread_t*)malloc(nThreads * sizeof(pthread_t));
+    for(i=0; i<nThreads; i++)
+        pthread_create(&(pool->tids[i]), NULL, worker, pool);
+    return pool;
+}
+
+int tpool_close(struct tpool_t *pool)
+{
+    size_t i;
+
+    if(pool == NULL) return -1;
+    pthread_mutex_lock(&(pool->lock));
+    pool->quit = 1;
+    pthread_cond_broadcast(&(pool->work));
+    pthread_mutex_unlock(&(pool->lock));
+    for(i=0; i<pool->nThreads; i++)
+        pthread_join(pool->tids[i], NULL);
+
+    pthread_mutex_destroy(&(pool->lock));
+    pthread_cond_destroy(&(pool->work));
+    pthread_cond_destroy(&(pool->done));
+    free(pool->tids);
+    free(pool);
+    return 0;
+}
+
+void tpool_submit(struct tpool_t *pool, struct tpool_job *job)
+{
+    job->done = 0;
+    job->next = NULL;
+    pthread_mutex_lock(&(pool->lock));
+    if(pool->tail) pool->tail->next = job;
+    else pool->head = job;
+    pool->tail = job;
+    pthread_cond_signal(&(pool->work));
+    pthread_mutex_unlock(&(pool->lock));
+}
+
+void tpool_wait(struct tpool_t *pool, struct tpool_job *job)
+{
+    pthread_mutex_lock(&(pool->lock));
+    while(!job->done)
+        pthread_cond_wait(&(pool->done), &(pool->lock));
+    pthread_mutex_unlock(&(pool->lock));
+}
+
+int tpool_done(struct tpool_t *pool, struct tpool_job *job)
+{
+    int done;
+
+    pthread_mutex_lock(&(pool->lock));
+    done = job->done;
+    pthread_mutex_unlock(&(pool->lock));
+    return done;
+}
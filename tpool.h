@@ -0,0 +1,38 @@
+#ifndef __TPOOL_H__
+#define __TPOOL_H__
+
+#include <pthread.h>
+
+/* A job is owned by the caller and must stay valid until tpool_wait
+ * has returned for it (or the pool is closed). */
+struct tpool_job
+{
+    void (*fn)(void *arg);
+    void *arg;
+    int done;
+    struct tpool_job *next;
+};
+
+struct tpool_t
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work; /* a job was queued, or quit was set */
+    pthread_cond_t done; /* a job finished */
+    struct tpool_job *head, *tail;
+    size_t nThreads;
+    pthread_t *tids;
+    int quit;
+};
+
+/* create a pool of nThreads worker threads */
+struct tpool_t *tpool_init(size_t nThreads);
+/* runs all jobs still queued, then stops the workers */
+int tpool_close(struct tpool_t *pool);
+/* queue job; job->fn(job->arg) will run on one of the workers */
+void tpool_submit(struct tpool_t *pool, struct tpool_job *job);
+/* blocks until job has finished */
+void tpool_wait(struct tpool_t *pool, struct tpool_job *job);
+/* non-blocking check, returns 1 if job has finished */
+int tpool_done(struct tpool_t *pool, struct tpool_job *job);
+
+#endif /* __TPOOL_H__ */
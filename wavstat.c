@@ -0,0 +1,641 @@
+#include <stdint.h>
+#include <pthread.h>
+#include "wavstat.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WAVSTAT_X86
+#endif
+
+/* int16 blocks summed in int32 lanes before they are widened: at most
+ * 2 * 32768 per lane and vector, so 8192 vectors stay below 2^31 */
+#define SUM16_BLOCK 8192
+
+typedef long long (*sum_fn)(const void *raw, size_t n);
+typedef size_t (*find_fn)(const void *raw, size_t n, int thr);
+typedef void (*minmax_fn)(const void *raw, size_t n, int *min, int *max);
+
+static int impl = -1;
+static sum_fn sum[2];        /* by width - 1 */
+static sum_fn sumSquares[2];
+static minmax_fn minMax[2];
+static find_fn findBelow[2];
+static find_fn findAbove[2];
+
+/* scalar kernels, also used for the tails of the vector ones */
+
+static long long sum_i8_scalar(const void *raw, size_t n)
+{
+    const int8_t *x = (const int8_t*)raw;
+    long long s = 0;
+    size_t i;
+
+    for(i=0; i<n; i++) s += x[i];
+    return s;
+}
+
+static long long sum_i16_scalar(const void *raw, size_t n)
+{
+    const int16_t *x = (const int16_t*)raw;
+    long long s = 0;
+    size_t i;
+
+    for(i=0; i<n; i++) s += x[i];
+    return s;
+}
+
+static long long sum_squares_i8_scalar(const void *raw, size_t n)
+{
+    const int8_t *x = (const int8_t*)raw;
+    long long s = 0;
+    size_t i;
+
+    for(i=0; i<n; i++) s += x[i] * x[i];
+    return s;
+}
+
+static long long sum_squares_i16_scalar(const void *raw, size_t n)
+{
+    const int16_t *x = (const int16_t*)raw;
+    long long s = 0;
+    size_t i;
+
+    for(i=0; i<n; i++) s += x[i] * x[i];
+    return s;
+}
+
+/* min and max are where the vector kernels got to, updated with
+ * samples 0..n-1 */
+static void min_max_i8_tail(const int8_t *x, size_t n, int *min, int *max)
+{
+    size_t i;
+
+    for(i=0; i<n; i++) {
+        if(x[i] < *min) *min = x[i];
+        if(x[i] > *max) *max = x[i];
+    }
+}
+
+static void min_max_i16_tail(const int16_t *x, size_t n, int *min, int *max)
+{
+    size_t i;
+
+    for(i=0; i<n; i++) {
+        if(x[i] < *min) *min = x[i];
+        if(x[i] > *max) *max = x[i];
+    }
+}
+
+static void min_max_i8_scalar(const void *raw, size_t n, int *min, int *max)
+{
+    *min = INT8_MAX;
+    *max = INT8_MIN;
+    min_max_i8_tail((const int8_t*)raw, n, min, max);
+}
+
+static void min_max_i16_scalar(const void *raw, size_t n, int *min, int *max)
+{
+    *min = INT16_MAX;
+    *max = INT16_MIN;
+    min_max_i16_tail((const int16_t*)raw, n, min, max);
+}
+
+static size_t below_i8_scalar(const void *raw, size_t n, int thr)
+{
+    const int8_t *x = (const int8_t*)raw;
+    size_t i;
+
+    for(i=0; i<n; i++) if(x[i] < thr) break;
+    return i;
+}
+
+static size_t below_i16_scalar(const void *raw, size_t n, int thr)
+{
+    const int16_t *x = (const int16_t*)raw;
+    size_t i;
+
+    for(i=0; i<n; i++) if(x[i] < thr) break;
+    return i;
+}
+
+static size_t above_i8_scalar(const void *raw, size_t n, int thr)
+{
+    const int8_t *x = (const int8_t*)raw;
+    size_t i;
+
+    for(i=0; i<n; i++) if(x[i] > thr) break;
+    return i;
+}
+
+static size_t above_i16_scalar(const void *raw, size_t n, int thr)
+{
+    const int16_t *x = (const int16_t*)raw;
+    size_t i;
+
+    for(i=0; i<n; i++) if(x[i] > thr) break;
+    return i;
+}
+
+#ifdef WAVSTAT_X86
+
+static long long hsum_epi64(__m128i v)
+{
+    long long a[2];
+
+    _mm_storeu_si128((__m128i*)a, v);
+    return a[0] + a[1];
+}
+
+/* adds the four int32 of v to the two int64 lanes of acc */
+static __m128i add_widened(__m128i acc, __m128i v)
+{
+    __m128i sign = _mm_srai_epi32(v, 31);
+
+    acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, sign));
+    return _mm_add_epi64(acc, _mm_unpackhi_epi32(v, sign));
+}
+
+static long long sum_i8_sse2(const void *raw, size_t n)
+{
+    const int8_t *x = (const int8_t*)raw;
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    __m128i acc = _mm_setzero_si128();
+    size_t i;
+
+    /* samples + 128 as unsigned bytes, summed by psadbw */
+    for(i=0; i+16<=n; i+=16)
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_xor_si128(
+                                                  _mm_loadu_si128((const __m128i*)(x + i)), bias),
+                                              _mm_setzero_si128()));
+    return hsum_epi64(acc) - 128 * (long long)i + sum_i8_scalar(x + i, n - i);
+}
+
+static long long sum_i16_sse2(const void *raw, size_t n)
+{
+    const int16_t *x = (const int16_t*)raw;
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i acc = _mm_setzero_si128(), blk;
+    size_t i = 0, k;
+
+    while(i + 8 <= n) {
+        blk = _mm_setzero_si128();
+        for(k=0; k<SUM16_BLOCK && i+8<=n; k++, i+=8)
+            blk = _mm_add_epi32(blk, _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(x + i)),
+                                                    one));
+        acc = add_widened(acc, blk);
+    }
+    return hsum_epi64(acc) + sum_i16_scalar(x + i, n - i);
+}
+
+/* squares by pmaddwd: pairs of int8 squares stay below 2^15, so 8192
+ * vectors of them are summed in int32 lanes; pairs of int16 squares
+ * reach 2^31 and are widened, as unsigned, every vector */
+static long long sum_squares_i8_sse2(const void *raw, size_t n)
+{
+    const int8_t *x = (const int8_t*)raw;
+    __m128i acc = _mm_setzero_si128(), blk, v, lo, hi;
+    size_t i = 0, k;
+
+    while(i + 16 <= n) {
+        blk = _mm_setzero_si128();
+        for(k=0; k<SUM16_BLOCK && i+16<=n; k++, i+=16) {
+            v = _mm_loadu_si128((const __m128i*)(x + i));
+            lo = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+            hi = _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+            blk = _mm_add_epi32(blk, _mm_add_epi32(_mm_madd_epi16(lo, lo),
+                                                   _mm_madd_epi16(hi, hi)));
+        }
+        acc = add_widened(acc, blk);
+    }
+    return hsum_epi64(acc) + sum_squares_i8_scalar(x + i, n - i);
+}
+
+static long long sum_squares_i16_sse2(const void *raw, size_t n)
+{
+    const int16_t *x = (const int16_t*)raw;
+    __m128i acc = _mm_setzero_si128(), v, sq;
+    size_t i;
+
+    for(i=0; i+8<=n; i+=8) {
+        v = _mm_loadu_si128((const __m128i*)(x + i));
+        sq = _mm_madd_epi16(v, v);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, _mm_setzero_si128()));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, _mm_setzero_si128()));
+    }
+    return hsum_epi64(acc) + sum_squares_i16_scalar(x + i, n - i);
+}
+
+/* SSE2 has no signed byte min and max, the samples + 128 are compared
+ * as unsigned */
+static void min_max_i8_sse2(const void *raw, size_t n, int *min, int *max)
+{
+    const int8_t *x = (const int8_t*)raw;
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    __m128i lo = _mm_set1_epi8((char)0xff), hi = _mm_setzero_si128(), v;
+    uint8_t l[16], h[16];
+    size_t i, k;
+
+    for(i=0; i+16<=n; i+=16) {
+        v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(x + i)), bias);
+        lo = _mm_min_epu8(lo, v);
+        hi = _mm_max_epu8(hi, v);
+    }
+    _mm_storeu_si128((__m128i*)l, lo);
+    _mm_storeu_si128((__m128i*)h, hi);
+    *min = INT8_MAX;
+    *max = INT8_MIN;
+    for(k=0; k<16; k++) {
+        if(l[k] - 128 < *min) *min = l[k] - 128;
+        if(h[k] - 128 > *max) *max = h[k] - 128;
+    }
+    min_max_i8_tail(x + i, n - i, min, max);
+}
+
+static void min_max_i16_sse2(const void *raw, size_t n, int *min, int *max)
+{
+    const int16_t *x = (const int16_t*)raw;
+    __m128i lo = _mm_set1_epi16(INT16_MAX), hi = _mm_set1_epi16(INT16_MIN), v;
+    int16_t l[8], h[8];
+    size_t i, k;
+
+    for(i=0; i+8<=n; i+=8) {
+        v = _mm_loadu_si128((const __m128i*)(x + i));
+        lo = _mm_min_epi16(lo, v);
+        hi = _mm_max_epi16(hi, v);
+    }
+    _mm_storeu_si128((__m128i*)l, lo);
+    _mm_storeu_si128((__m128i*)h, hi);
+    *min = INT16_MAX;
+    *max = INT16_MIN;
+    for(k=0; k<8; k++) {
+        if(l[k] < *min) *min = l[k];
+        if(h[k] > *max) *max = h[k];
+    }
+    min_max_i16_tail(x + i, n - i, min, max);
+}
+
+static size_t below_i8_sse2(const void *raw, size_t n, int thr)
+{
+    const int8_t *x = (const int8_t*)raw;
+    __m128i t = _mm_set1_epi8((char)thr);
+    unsigned m;
+    size_t i;
+
+    for(i=0; i+16<=n; i+=16) {
+        m = _mm_movemask_epi8(_mm_cmpgt_epi8(t, _mm_loadu_si128((const __m128i*)(x + i))));
+        if(m) return i + __builtin_ctz(m);
+    }
+    return i + below_i8_scalar(x + i, n - i, thr);
+}
+
+static size_t below_i16_sse2(const void *raw, size_t n, int thr)
+{
+    const int16_t *x = (const int16_t*)raw;
+    __m128i t = _mm_set1_epi16((short)thr);
+    unsigned m;
+    size_t i;
+
+    for(i=0; i+8<=n; i+=8) {
+        m = _mm_movemask_epi8(_mm_cmpgt_epi16(t, _mm_loadu_si128((const __m128i*)(x + i))));
+        if(m) return i + __builtin_ctz(m) / 2;
+    }
+    return i + below_i16_scalar(x + i, n - i, thr);
+}
+
+static size_t above_i8_sse2(const void *raw, size_t n, int thr)
+{
+    const int8_t *x = (const int8_t*)raw;
+    __m128i t = _mm_set1_epi8((char)thr);
+    unsigned m;
+    size_t i;
+
+    for(i=0; i+16<=n; i+=16) {
+        m = _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_loadu_si128((const __m128i*)(x + i)), t));
+        if(m) return i + __builtin_ctz(m);
+    }
+    return i + above_i8_scalar(x + i, n - i, thr);
+}
+
+static size_t above_i16_sse2(const void *raw, size_t n, int thr)
+{
+    const int16_t *x = (const int16_t*)raw;
+    __m128i t = _mm_set1_epi16((short)thr);
+    unsigned m;
+    size_t i;
+
+    for(i=0; i+8<=n; i+=8) {
+        m = _mm_movemask_epi8(_mm_cmpgt_epi16(_mm_loadu_si128((const __m128i*)(x + i)), t));
+        if(m) return i + __builtin_ctz(m) / 2;
+    }
+    return i + above_i16_scalar(x + i, n - i, thr);
+}
+
+__attribute__((target("avx2")))
+static long long hsum256_epi64(__m256i v)
+{
+    return hsum_epi64(_mm_add_epi64(_mm256_castsi256_si128(v),
+                                    _mm256_extracti128_si256(v, 1)));
+}
+
+__attribute__((target("avx2")))
+static long long sum_i8_avx2(const void *raw, size_t n)
+{
+    const int8_t *x = (const int8_t*)raw;
+    const __m256i bias = _mm256_set1_epi8((char)0x80);
+    __m256i acc = _mm256_setzero_si256();
+    size_t i;
+
+    for(i=0; i+32<=n; i+=32)
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(
+                                   _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(x + i)),
+                                                    bias), _mm256_setzero_si256()));
+    return hsum256_epi64(acc) - 128 * (long long)i + sum_i8_scalar(x + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static long long sum_i16_avx2(const void *raw, size_t n)
+{
+    const int16_t *x = (const int16_t*)raw;
+    const __m256i one = _mm256_set1_epi16(1);
+    __m256i acc = _mm256_setzero_si256(), blk;
+    size_t i = 0, k;
+
+    while(i + 16 <= n) {
+        blk = _mm256_setzero_si256();
+        for(k=0; k<SUM16_BLOCK && i+16<=n; k++, i+=16)
+            blk = _mm256_add_epi32(blk, _mm256_madd_epi16(
+                                       _mm256_loadu_si256((const __m256i*)(x + i)), one));
+        acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(blk)));
+        acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(blk, 1)));
+    }
+    return hsum256_epi64(acc) + sum_i16_scalar(x + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static long long sum_squares_i8_avx2(const void *raw, size_t n)
+{
+    const int8_t *x = (const int8_t*)raw;
+    __m256i acc = _mm256_setzero_si256(), blk, v;
+    size_t i = 0, k;
+
+    while(i + 16 <= n) {
+        blk = _mm256_setzero_si256();
+        for(k=0; k<SUM16_BLOCK && i+16<=n; k++, i+=16) {
+            v = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(x + i)));
+            blk = _mm256_add_epi32(blk, _mm256_madd_epi16(v, v));
+        }
+        acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(blk)));
+        acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(blk, 1)));
+    }
+    return hsum256_epi64(acc) + sum_squares_i8_scalar(x + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static long long sum_squares_i16_avx2(const void *raw, size_t n)
+{
+    const int16_t *x = (const int16_t*)raw;
+    __m256i acc = _mm256_setzero_si256(), v, sq;
+    size_t i;
+
+    for(i=0; i+16<=n; i+=16) {
+        v = _mm256_loadu_si256((const __m256i*)(x + i));
+        sq = _mm256_madd_epi16(v, v);
+        acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(sq)));
+        acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(sq, 1)));
+    }
+    return hsum256_epi64(acc) + sum_squares_i16_scalar(x + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void min_max_i8_avx2(const void *raw, size_t n, int *min, int *max)
+{
+    const int8_t *x = (const int8_t*)raw;
+    __m256i lo = _mm256_set1_epi8(INT8_MAX), hi = _mm256_set1_epi8(INT8_MIN), v;
+    int8_t l[32], h[32];
+    size_t i, k;
+
+    for(i=0; i+32<=n; i+=32) {
+        v = _mm256_loadu_si256((const __m256i*)(x + i));
+        lo = _mm256_min_epi8(lo, v);
+        hi = _mm256_max_epi8(hi, v);
+    }
+    _mm256_storeu_si256((__m256i*)l, lo);
+    _mm256_storeu_si256((__m256i*)h, hi);
+    *min = INT8_MAX;
+    *max = INT8_MIN;
+    for(k=0; k<32; k++) {
+        if(l[k] < *min) *min = l[k];
+        if(h[k] > *max) *max = h[k];
+    }
+    min_max_i8_tail(x + i, n - i, min, max);
+}
+
+__attribute__((target("avx2")))
+static void min_max_i16_avx2(const void *raw, size_t n, int *min, int *max)
+{
+    const int16_t *x = (const int16_t*)raw;
+    __m256i lo = _mm256_set1_epi16(INT16_MAX), hi = _mm256_set1_epi16(INT16_MIN), v;
+    int16_t l[16], h[16];
+    size_t i, k;
+
+    for(i=0; i+16<=n; i+=16) {
+        v = _mm256_loadu_si256((const __m256i*)(x + i));
+        lo = _mm256_min_epi16(lo, v);
+        hi = _mm256_max_epi16(hi, v);
+    }
+    _mm256_storeu_si256((__m256i*)l, lo);
+    _mm256_storeu_si256((__m256i*)h, hi);
+    *min = INT16_MAX;
+    *max = INT16_MIN;
+    for(k=0; k<16; k++) {
+        if(l[k] < *min) *min = l[k];
+        if(h[k] > *max) *max = h[k];
+    }
+    min_max_i16_tail(x + i, n - i, min, max);
+}
+
+__attribute__((target("avx2")))
+static size_t below_i8_avx2(const void *raw, size_t n, int thr)
+{
+    const int8_t *x = (const int8_t*)raw;
+    __m256i t = _mm256_set1_epi8((char)thr);
+    unsigned m;
+    size_t i;
+
+    for(i=0; i+32<=n; i+=32) {
+        m = (unsigned)_mm256_movemask_epi8(
+            _mm256_cmpgt_epi8(t, _mm256_loadu_si256((const __m256i*)(x + i))));
+        if(m) return i + __builtin_ctz(m);
+    }
+    return i + below_i8_scalar(x + i, n - i, thr);
+}
+
+__attribute__((target("avx2")))
+static size_t below_i16_avx2(const void *raw, size_t n, int thr)
+{
+    const int16_t *x = (const int16_t*)raw;
+    __m256i t = _mm256_set1_epi16((short)thr);
+    unsigned m;
+    size_t i;
+
+    for(i=0; i+16<=n; i+=16) {
+        m = (unsigned)_mm256_movemask_epi8(
+            _mm256_cmpgt_epi16(t, _mm256_loadu_si256((const __m256i*)(x + i))));
+        if(m) return i + __builtin_ctz(m) / 2;
+    }
+    return i + below_i16_scalar(x + i, n - i, thr);
+}
+
+__attribute__((target("avx2")))
+static size_t above_i8_avx2(const void *raw, size_t n, int thr)
+{
+    const int8_t *x = (const int8_t*)raw;
+    __m256i t = _mm256_set1_epi8((char)thr);
+    unsigned m;
+    size_t i;
+
+    for(i=0; i+32<=n; i+=32) {
+        m = (unsigned)_mm256_movemask_epi8(
+            _mm256_cmpgt_epi8(_mm256_loadu_si256((const __m256i*)(x + i)), t));
+        if(m) return i + __builtin_ctz(m);
+    }
+    return i + above_i8_scalar(x + i, n - i, thr);
+}
+
+__attribute__((target("avx2")))
+static size_t above_i16_avx2(const void *raw, size_t n, int thr)
+{
+    const int16_t *x = (const int16_t*)raw;
+    __m256i t = _mm256_set1_epi16((short)thr);
+    unsigned m;
+    size_t i;
+
+    for(i=0; i+16<=n; i+=16) {
+        m = (unsigned)_mm256_movemask_epi8(
+            _mm256_cmpgt_epi16(_mm256_loadu_si256((const __m256i*)(x + i)), t));
+        if(m) return i + __builtin_ctz(m) / 2;
+    }
+    return i + above_i16_scalar(x + i, n - i, thr);
+}
+
+#endif /* WAVSTAT_X86 */
+
+static int use_impl(int newImpl)
+{
+    switch(newImpl) {
+    case WAVSTAT_SCALAR:
+        sum[0] = sum_i8_scalar;
+        sum[1] = sum_i16_scalar;
+        sumSquares[0] = sum_squares_i8_scalar;
+        sumSquares[1] = sum_squares_i16_scalar;
+        minMax[0] = min_max_i8_scalar;
+        minMax[1] = min_max_i16_scalar;
+        findBelow[0] = below_i8_scalar;
+        findBelow[1] = below_i16_scalar;
+        findAbove[0] = above_i8_scalar;
+        findAbove[1] = above_i16_scalar;
+        break;
+#ifdef WAVSTAT_X86
+    case WAVSTAT_SSE2:
+        sum[0] = sum_i8_sse2;
+        sum[1] = sum_i16_sse2;
+        sumSquares[0] = sum_squares_i8_sse2;
+        sumSquares[1] = sum_squares_i16_sse2;
+        minMax[0] = min_max_i8_sse2;
+        minMax[1] = min_max_i16_sse2;
+        findBelow[0] = below_i8_sse2;
+        findBelow[1] = below_i16_sse2;
+        findAbove[0] = above_i8_sse2;
+        findAbove[1] = above_i16_sse2;
+        break;
+    case WAVSTAT_AVX2:
+        if(!__builtin_cpu_supports("avx2")) return -1;
+        sum[0] = sum_i8_avx2;
+        sum[1] = sum_i16_avx2;
+        sumSquares[0] = sum_squares_i8_avx2;
+        sumSquares[1] = sum_squares_i16_avx2;
+        minMax[0] = min_max_i8_avx2;
+        minMax[1] = min_max_i16_avx2;
+        findBelow[0] = below_i8_avx2;
+        findBelow[1] = below_i16_avx2;
+        findAbove[0] = above_i8_avx2;
+        findAbove[1] = above_i16_avx2;
+        break;
+#endif
+    default:
+        return -1;
+    }
+    impl = newImpl;
+    return 0;
+}
+
+static void pick_impl(void)
+{
+    int i;
+
+    for(i=WAVSTAT_NIMPL-1; i>=0; i--)
+        if(use_impl(i) == 0) break;
+}
+
+/* the default is picked once, by whichever thread asks first */
+static pthread_once_t implOnce = PTHREAD_ONCE_INIT;
+
+int wavstat_set_impl(int newImpl)
+{
+    pthread_once(&implOnce, pick_impl);
+    return use_impl(newImpl);
+}
+
+int wavstat_get_impl(void)
+{
+    pthread_once(&implOnce, pick_impl);
+    return impl;
+}
+
+const char *wavstat_impl_name(int i)
+{
+    static const char *names[WAVSTAT_NIMPL] = {"scalar", "sse2", "avx2"};
+
+    if(i < 0 || i >= WAVSTAT_NIMPL) return NULL;
+    return names[i];
+}
+
+long long wavstat_sum(const char *raw, size_t width, size_t n)
+{
+    wavstat_get_impl();
+    return sum[width == 2](raw, n);
+}
+
+long long wavstat_sum_squares(const char *raw, size_t width, size_t n)
+{
+    wavstat_get_impl();
+    return sumSquares[width == 2](raw, n);
+}
+
+void wavstat_min_max(const char *raw, size_t width, size_t n, int *min, int *max)
+{
+    wavstat_get_impl();
+    minMax[width == 2](raw, n, min, max);
+}
+
+/* thresholds out of the sample range are answered here, the kernels
+ * only see ones they can broadcast */
+size_t wavstat_find_below(const char *raw, size_t width, size_t n, int thr)
+{
+    int lo = width == 2 ? INT16_MIN : INT8_MIN, hi = width == 2 ? INT16_MAX : INT8_MAX;
+
+    wavstat_get_impl();
+    if(thr <= lo) return n;
+    if(thr > hi) return 0;
+    return findBelow[width == 2](raw, n, thr);
+}
+
+size_t wavstat_find_above(const char *raw, size_t width, size_t n, int thr)
+{
+    int lo = width == 2 ? INT16_MIN : INT8_MIN, hi = width == 2 ? INT16_MAX : INT8_MAX;
+
+    wavstat_get_impl();
+    if(thr >= hi) return n;
+    if(thr < lo) return 0;
+    return findAbove[width == 2](raw, n, thr);
+}
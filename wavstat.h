@@ -0,0 +1,37 @@
+#ifndef __WAVSTAT_H__
+#define __WAVSTAT_H__
+
+#include <stddef.h>
+
+/* Kernels over raw samples (int8, or int16 when width is 2) for the
+ * analysis programs and the feature table: sums for baselines and
+ * charge integrals, sums of squares for the noise, extremes, and
+ * threshold scans that skip the quiet parts of a waveform 16 or 32
+ * samples at a time.  SSE2 and AVX2 with a scalar fallback, chosen as
+ * in deltacodec; all give the same results. */
+
+enum {
+    WAVSTAT_SCALAR = 0,
+    WAVSTAT_SSE2,
+    WAVSTAT_AVX2,
+    WAVSTAT_NIMPL
+};
+
+/* picks the kernels, returns -1 when the cpu can not run them.  The
+ * default is the best one available.  Call it before any thread uses
+ * the kernels. */
+int wavstat_set_impl(int impl);
+int wavstat_get_impl(void);
+const char *wavstat_impl_name(int impl);
+
+/* sum of samples 0..n-1 */
+long long wavstat_sum(const char *raw, size_t width, size_t n);
+/* sum of their squares */
+long long wavstat_sum_squares(const char *raw, size_t width, size_t n);
+/* the lowest and highest of samples 0..n-1, n > 0 */
+void wavstat_min_max(const char *raw, size_t width, size_t n, int *min, int *max);
+/* index of the first sample < thr (> thr), n if there is none */
+size_t wavstat_find_below(const char *raw, size_t width, size_t n, int thr);
+size_t wavstat_find_above(const char *raw, size_t width, size_t n, int thr);
+
+#endif /* __WAVSTAT_H__ */